@@ -23,248 +23,43 @@
 #include <stdexcept>
 #include <cctype>
 #include <cstdlib>
+#include <cstdio>
+#include <iterator>
+#include <fstream>
 
 #include "asap/memory.h"
 #include "asap/traits.h"
 #include "asap/data_set.h"
 #include "asap/word_count.h"
+#include "asap/record_parser.h"
 
 namespace asap {
 
-struct NZDelim {
-    bool operator () ( char c ) const { 
-	return ( c == ',' ) | ( c == '}' );
-    }
-};
-
-struct IsAlnum {
-    bool operator () ( char c ) const { 
-	return std::isalnum(c);
-    }
-};
-
-struct NewLine {
-    bool operator () ( char c ) const { 
-	return c == '\n';
-    }
-};
-
-struct NonBlank {
-    bool operator () ( char c ) const { 
-	return !std::isspace(c);
-    }
-};
+typedef parse::nz_delim<'}'> NZDelim;
 
 namespace arff {
 
-// Skip all white-space (blank lines) as well as lines with comments
-#if 1
-void skip_blank_lines( char * & p, char * end ) {
-    while( std::isspace(*p) )
-	++p;
-    while( *p == '%' ) {
-	++p;
-	while( *p != '\n' )
-	    if( *p++ == '\0' )
-		return;
-	while( std::isspace(*p) )
-	    ++p;
-    }
-}
-#else
-void skip_blank_lines( char * & p, char * end ) {
-    if( (p = std::find_if( p, end, NonBlank() )) == end )
-	return;
-    while( *p == '%' ) {
-	++p;
-	if( (p = std::find_if( p, end, NewLine() )) == end )
-	    return;
-	++p;
-	if( (p=std::find_if( p, end, NonBlank() )) == end )
-	    return;
-    }
-}
-#endif
-
-// Update dense_vector
-template<typename vector_type, typename = void>
-class record_value {
-    vector_type & vector;
-    typename vector_type::index_type nexti;
-public:
-    record_value( vector_type & vector_ ) : vector( vector_ ), nexti( 0 ) { }
-
-    void operator () ( typename vector_type::value_type v ) {
-	assert( nexti < vector.length() ); // throw
-	vector[nexti++] = v;
-    }
-    void operator () ( typename vector_type::index_type i,
-		       typename vector_type::value_type v ) {
-	assert( 0 <= i && i < vector.length() ); // throw
-	vector[i] = v;
-    }
-};
-
-// Update sparse_vector
-template<typename vector_type>
-class record_value<vector_type,
-		   typename std::enable_if<is_sparse_vector<vector_type>::value>::type> {
-    vector_type & vector;
-    typename vector_type::index_type pos;
-public:
-    record_value( vector_type & vector_ ) : vector( vector_ ), pos( 0 ) { }
-
-    void operator () ( typename vector_type::value_type v ) {
-	assert( pos < vector.length() ); // throw
-	vector.set( pos, v, pos );
-	++pos;
-    }
-    void operator () ( typename vector_type::index_type i,
-		       typename vector_type::value_type v ) {
-	assert( 0 <= i && i < vector.length() ); // throw
-	vector.set( pos++, v, i );
-    }
-};
+typedef parse::arff_syntax syntax;
 
+using parse::skip_blank_lines;
+using parse::read_relation;
+using parse::read_attribute;
 
 template<typename vector_type>
 bool
 read_dense_vector( char *& p, char * end, vector_type & vector ) {
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) { return false; } ++pp; } while( 0 )
-    assert( *p != '{' );
-    record_value<vector_type> recorder( vector );
-    do {
-	while( std::isspace( *p ) )
-	    ADVANCE( p );
-	if( *p == '?' )
-	    fatal( "missing data not supported" );
-	typename vector_type::value_type v = 0;
-#if REAL_IS_INT
-	v = std::strtoul( p, &p, 10 );
-#else
-	v = std::strtod( p, &p );
-#endif
-	recorder( v );
-	while( std::isspace( *p ) && *p != '\n' )
-	    ADVANCE( p );
-	if( *p == ',' )
-	    ADVANCE( p );
-    } while( *p != '\n' );
-    return true;
-#undef ADVANCE
+    return parse::read_dense_vector<syntax>( p, end, vector );
 }
 
 template<typename vector_type>
 bool
-read_sparse_vector( char *& pref, char * end, vector_type & vector ) {
-    // We will only be overwriting a few elements, so clear everything first
-    if( is_dense_vector<vector_type>::value )
-	vector.clear();
-
-    record_value<vector_type> recorder( vector );
-
-    char * p = pref;
-
-    assert( *p == '{' );
-    ++p;
-    while( std::isspace( *p ) )
-	++p;
-    do {
-	typename vector_type::index_type i = std::strtoul( p, &p, 10 );
-	while( std::isspace( *p ) || *p == ':' )
-	    ++p;
-	if( *p == '}' )
-	    break;
-	if( *p == '?' )
-	    fatal( "missing data not supported" );
-	typename vector_type::value_type vv = 0;
-#if REAL_IS_INT
-	vv = std::strtoul( p, &p, 10 );
-#else
-	vv = std::strtod( p, &p );
-#endif
-	// vector[i] = vv;
-	recorder( i, vv );
-
-	if( (p = std::find_if( p, end, NZDelim() )) == end ) {
-	    pref = p;
-	    return false;
-	}
-	if( *p == '}' )
-	    break;
-	++p;
-	while( std::isspace( *p ) )
-	    ++p;
-    } while( *p != '}' ); // && *p != '\n' );
-    ++p;
-    pref = p;
-    return true;
+read_sparse_vector( char *& p, char * end, vector_type & vector ) {
+    return parse::read_sparse_vector<syntax>( p, end, vector );
 }
 
 template<typename vector_type>
 bool read_vector( char *& p, char * end, vector_type & vector ) {
-    if( *p == '{' )
-	return read_sparse_vector( p, end, vector );
-    else
-	return read_dense_vector( p, end, vector );
-}
-
-template<typename WordBankTy>
-const char * read_relation( char *& p, WordBankTy & idx ) {
-    while( std::isspace(*p) && *p != '\n' )
-	++p;
-    char * relation = p;
-    if( *p == '\'' ) { // scan until closing quote
-	++p;
-	while( *p != '\'' ) {
-	    if( *p == '\\' ) // skip next character
-		++p;
-	    if( *p == '\0' )
-		return 0;
-	    ++p;
-	}
-	// Skip closing quote
-	++p;
-    } else { // scan until space
-	while( !std::isspace( *p ) ) {
-	    if( *p == '\0' )
-		return 0;
-	    ++p;
-	}
-    }
-    const char * stored
-	= idx.memorize( relation, p-relation ); // Store relation, not indexed
-    ++p; // delimiter replaced by '\0'
-    return stored;
-}
-
-template<typename WordBankTy>
-const char * read_attribute( char *& p, WordBankTy & idx ) {
-    // Isolate token
-    while( std::isspace( *p ) )
-	++p;
-    char * name = p;
-    while( !std::isspace( *p ) )
-	if( *p++ == '\0' )
-	    return 0;
-    const char * stored = idx.index( name, p-name ); // Store name in index
-    ++p; // space replaced by '\0'
-
-    // Isolate type
-    while( std::isspace( *p ) )
-	++p;
-    char * type = p;
-    while( !std::isspace( *p ) )
-	if( *p++ == '\0' )
-	    return 0;
-    // Delineate end of data type by overwriting space
-    *p++ = '\0';
-    if( strcmp( type, "numeric" ) ) {
-	std::cerr << "Warning: treating non-numeric attribute '"
-		  << stored << "' of type '" << type << "' as numeric\n";
-    }
-
-    return stored; // ignoring type as we only consider numeric types ...
+    return parse::read_vector<syntax>( p, end, vector );
 }
 
 }
@@ -280,19 +75,7 @@ size_t count_lines( const char * p ) {
 }
 
 size_t count_nonzeros( const char * p, const char * end ) {
-    size_t nvalues = 0;
-    ++p; // skip opening {
-    const char * prevp = p;
-    while( (p = std::find_if( p, end, NZDelim() )) != end ) {
-	if( *p == '}' )
-	    break;
-	++p;
-	++nvalues;
-	prevp = p;
-    }
-    if( std::find_if( prevp, p, IsAlnum() ) != p )
-	++nvalues;
-    return nvalues;
+    return parse::count_nonzeros<arff::syntax>( p, end );
 }
 
 std::pair<size_t,size_t> count_values( const char * p, const char * end ) {
@@ -317,33 +100,98 @@ std::pair<size_t,size_t> count_values( const char * p, const char * end ) {
 }
 
 template<typename VectorTy, typename Container>
-typename std::enable_if<is_dense_vector<VectorTy>::value>::type
-create_vector( Container & container, const char * p, const char * end,
-	       size_t ndim ) {
-    container.emplace_back( ndim );
+void create_vector( Container & container, const char * p, const char * end,
+		    size_t ndim ) {
+    parse::create_vector<arff::syntax, VectorTy>( container, p, end, ndim );
 }
 
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_sparse_vector<VectorTy>::value>::type
-create_vector( Container & container, const char * p, const char * end,
-	       size_t ndim ) {
-    container.emplace_back( ndim, count_nonzeros( p, end ) );
+namespace arff {
+
+// Parse the header of an ARFF file up to and including the @data
+// declaration. Returns a pointer to the data section, or 0 when the input
+// ends before @data.
+template<typename WordContainerTy>
+char * read_header( char * p, char * end, WordContainerTy & idx,
+		    const char *& relation, const std::string & filename ) {
+#define ADVANCE(pp) do { if( *(pp) == '\0' ) return 0; ++pp; } while( 0 )
+    do {
+	skip_blank_lines( p, end );
+	while( *p != '@' )
+	    ADVANCE( p );
+	ADVANCE( p );
+	if( !strncasecmp( p, "relation ", 9 ) ) {
+	    p += 9;
+	    if( !(relation = read_relation( p, idx )) )
+		fatal( "Incomplete relation specifier in input file '",
+		       filename, "'" );
+	} else if( !strncasecmp( p, "attribute ", 10 ) ) {
+	    p += 10;
+	    if( !read_attribute( p, idx ) )
+		fatal( "Incomplete attribute specifier in input file '",
+		       filename, "'" );
+	} else if( !strncasecmp( p, "data", 4 ) ) {
+	    // From now on everything is data
+	    return p + 4;
+	}
+    } while( 1 );
+#undef ADVANCE
 }
 
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_dense_vector<VectorTy>::value>::type
-init_vector( Container & container, const char * p, const char * end,
-	     size_t ndim ) {
+// Whether the input starts with a header. Parts of a data set written
+// in parallel typically carry only data.
+inline bool has_header( char * p, char * end ) {
+    skip_blank_lines( p, end );
+    return *p == '@';
+}
+
+// Parse the headers of all parts and split the data sections into chunks.
+// The first part with a header describes the data set; any further headers
+// must declare the same number of attributes. Parts without header are
+// pure data. Returns the index of the describing part, or parts.size()
+// when there is none. chunks is left empty when there is no data section.
+template<typename WordContainerTy>
+size_t read_part_headers( const parse::part_buffers<WordContainerTy> & parts,
+			  const std::vector<std::string> & names,
+			  std::vector<parse::chunk> & chunks,
+			  const char *& relation ) {
+    size_t nparts = parts.size();
+    std::vector<char *> data( nparts );
+    std::vector<const char *> rel( nparts, (const char *)0 );
+    std::vector<char> header( nparts );
+
+    cilk_for( size_t i=0; i < nparts; ++i ) {
+	char * p = parts.get_buffer( i );
+	char * end = parts.get_buffer_end( i );
+	header[i] = has_header( p, end );
+	data[i] = header[i]
+	    ? read_header( p, end, *parts.get_index( i ), rel[i], names[i] )
+	    : p;
+    }
+
+    size_t hdr = std::find( header.begin(), header.end(), 1 )
+	- header.begin();
+    if( hdr == nparts )
+	return nparts;
+    if( rel[hdr] )
+	relation = rel[hdr];
+    if( !data[hdr] )
+	return hdr;
+
+    size_t ndim = parts.get_index( hdr )->size();
+    for( size_t i=0; i < nparts; ++i ) {
+	if( header[i] && parts.get_index( i )->size() != ndim )
+	    fatal( "Attributes in input file '", names[i],
+		   "' do not match those in '", names[hdr], "'" );
+	if( data[i] )
+	    parse::split_lines( data[i], parts.get_buffer_end( i ), chunks );
+    }
+    return hdr;
 }
 
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_sparse_vector<VectorTy>::value>::type
-init_vector( Container & container, const char * p, const char * end,
-	     size_t ndim ) {
-    container.emplace_back( ndim, count_nonzeros( p, end ) );
 }
 
-// Basic implementation where vectors are individually allocated
+// Basic implementation where vectors are individually allocated.
+// The input may be a single file or a directory of part files.
 template<typename DataSetTy>
 typename std::enable_if<
     std::is_same<typename DataSetTy::vector_type::memory_mgmt_type, mm_ownership_policy>::value,
@@ -352,61 +200,29 @@ arff_read( const std::string & filename, bool &is_stored_sparse ) {
     typedef DataSetTy data_set_type;
     typedef typename data_set_type::vector_type vector_type;
     typedef typename data_set_type::index_list_type index_list_type;
-    typedef typename vector_type::index_type index_type;
-    typedef typename vector_type::value_type value_type;
 
-    std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
-    word_container_file_builder<index_list_type> idx_builder( filename, *idx );
+    std::vector<std::string> names = get_part_listing( filename );
+    parse::part_buffers<index_list_type> parts( names );
 
     std::shared_ptr<std::vector<vector_type>> vec_ptr
 	= std::make_shared<std::vector<vector_type>>();
-    std::vector<vector_type> & vec = *vec_ptr;
 
     const char * relation = "undefined";
     bool is_sparse = false;
 
-    // Now parse the data
-    char * p = idx_builder.get_buffer();
-    char * end = idx_builder.get_buffer_end();
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) goto END_OF_FILE; ++pp; } while( 0 )
-    do {
-	arff::skip_blank_lines( p, end );
-	while( *p != '@' )
-	    ADVANCE( p );
-	ADVANCE( p );
-	if( !strncasecmp( p, "relation ", 9 ) ) {
-	    p += 9;
-	    if( !(relation = arff::read_relation( p, idx_builder.get_word_list() )) )
-		fatal( "Incomplete relation specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "attribute ", 10 ) ) {
-	    p += 10;
-	    if( !arff::read_attribute( p, idx_builder.get_word_list() ) )
-		fatal( "Incomplete attribute specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "data", 4 ) ) {
-	    // From now on everything is data
-	    int ndim = idx_builder.size();
-	    p += 4;
-
-	    arff::skip_blank_lines( p, end );
-
-	    do {
-		is_sparse |= *p == '{';
-		// Create vector speculatively...
-		create_vector<vector_type>( vec, p, end, ndim );
-		if( !arff::read_vector( p, end, vec.back() ) ) {
-		    // Oops, no vector after all...
-		    // This should happen at most once per file
-		    vec.pop_back();
-		}
-		arff::skip_blank_lines( p, end );
-	    } while( *p != '\0' );
-	}
-    } while( 1 );
-#undef ADVANCE
+    std::vector<parse::chunk> chunks;
+    size_t hdr = arff::read_part_headers( parts, names, chunks, relation );
+    std::shared_ptr<index_list_type> idx
+	= hdr < parts.size() ? parts.get_index( hdr )
+	: std::make_shared<index_list_type>();
+    if( chunks.empty() ) {
+	is_stored_sparse = is_sparse;
+	return data_set_type( relation, idx, vec_ptr );
+    }
 
-END_OF_FILE:
+    // Now parse the data
+    parse::read_records<arff::syntax>( chunks, idx->size(), *vec_ptr,
+				       is_sparse );
 
     is_stored_sparse = is_sparse;
     return data_set_type( relation, idx, vec_ptr );
@@ -420,91 +236,34 @@ typename std::enable_if<
     DataSetTy>::type
 arff_read( const std::string & filename, bool &is_stored_sparse ) {
     typedef DataSetTy data_set_type;
-    typedef typename data_set_type::vector_type vector_type;
     typedef typename data_set_type::index_list_type index_list_type;
-    typedef typename vector_type::index_type index_type;
-    typedef typename vector_type::value_type value_type;
     typedef typename data_set_type::vector_list_type vector_set_type;
 
-    std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
-    word_container_file_builder<index_list_type> idx_builder( filename, *idx );
+    std::vector<std::string> names = get_part_listing( filename );
+    parse::part_buffers<index_list_type> parts( names );
 
     const char * relation = "undefined";
     bool is_sparse = false;
 
-    // Now parse the data
-    char * p = idx_builder.get_buffer();
-    char * end = idx_builder.get_buffer_end();
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) goto END_OF_FILE; ++pp; } while( 0 )
-    size_t num_points;
-    do {
-	arff::skip_blank_lines( p, end );
-	while( *p != '@' )
-	    ADVANCE( p );
-	ADVANCE( p );
-	if( !strncasecmp( p, "relation ", 9 ) ) {
-	    p += 9;
-	    if( !(relation = arff::read_relation( p, idx_builder.get_word_list() )) )
-		fatal( "Incomplete relation specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "attribute ", 10 ) ) {
-	    p += 10;
-	    if( !arff::read_attribute( p, idx_builder.get_word_list() ) )
-		fatal( "Incomplete attribute specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "data", 4 ) ) {
-	    // From now on everything is data
-	    int ndim = idx_builder.size();
-	    p += 4;
-
-	    arff::skip_blank_lines( p, end );
-
-	    return [&]() -> data_set_type {
-		// Estimate upper bound on space needed to store all vectors.
-		// Assumptions:
-		//   + At most one vector per line
-		//   + Dense vectors, so fixed vector size
-		std::pair<size_t,size_t> info = count_values(p, end);
-		// size_t max_points = count_lines(p);
-		size_t max_points = info.first;
-		size_t max_values = info.second;
-		std::shared_ptr<vector_set_type> dvs_ptr
-		    = std::make_shared<vector_set_type>(
-			max_points, is_sparse_vector<vector_type>::value ?
-			max_values : ndim );
-		vector_set_type & dvs = *dvs_ptr;
-		dvs.clear(); // zero-init
-
-		if( !max_points )
-		    goto END_OF_FILE;
-
-		num_points = 0;
-
-		do {
-		    is_sparse |= *p == '{';
-
-		    assert( num_points < max_points );
-		    init_vector<vector_type>( dvs, p, end, ndim );
-		    if( !arff::read_vector( p, end, dvs[num_points++] ) ) {
-			// Oops, no vector after all...
-			// This should happen at most once per file.
-			--num_points;
-		    }
-		    arff::skip_blank_lines( p, end );
-		} while( *p != '\0' );
-	    END_OF_FILE:
-		dvs.trim_number( num_points );
-		is_stored_sparse = is_sparse;
-		return data_set_type( relation, idx, dvs_ptr );
-	    }();
-	}
-    } while( 1 );
-#undef ADVANCE
+    std::vector<parse::chunk> chunks;
+    size_t hdr = arff::read_part_headers( parts, names, chunks, relation );
+    std::shared_ptr<index_list_type> idx
+	= hdr < parts.size() ? parts.get_index( hdr )
+	: std::make_shared<index_list_type>();
+    if( chunks.empty() ) {
+	is_stored_sparse = is_sparse;
+	return data_set_type(
+	    relation, idx,
+	    parse::internal::make_vector_set<vector_set_type>( 0, 0, 0 ) );
+    }
 
-END_OF_FILE:
+    // Now parse the data
+    std::shared_ptr<vector_set_type> dvs_ptr
+	= parse::read_record_set<arff::syntax, vector_set_type>(
+	    chunks, idx->size(), is_sparse );
 
     is_stored_sparse = is_sparse;
-    return data_set_type( relation, idx, std::make_shared<vector_set_type>( 0, 0 ) );
+    return data_set_type( relation, idx, dvs_ptr );
 }
 
 namespace arff {
@@ -548,26 +307,123 @@ operator << ( std::ostream & os,
 }
 
 
-template<typename VectorIter, typename ColNameIter, typename RowNameIter>
-void arff_write( std::ostream & of,
-		 const char * const relation_name,
-		 VectorIter vI, VectorIter vE,
-		 ColNameIter cI, ColNameIter cE,
-		 RowNameIter rI, RowNameIter rE ) {
+// Words pruned from the vocabulary have no id and are not columns
+template<typename Type>
+bool is_column( const Type & val ) {
+    return true;
+}
+
+template<typename Type1, typename Type, typename IndexType>
+bool is_column( const std::pair<Type1,appear_count<Type,IndexType>> & val ) {
+    return internal::has_id( val.second.second );
+}
+
+template<typename ColNameIter>
+void arff_write_header( std::ostream & of,
+			const char * const relation_name,
+			ColNameIter cI, ColNameIter cE ) {
     of << "@relation " << relation_name;
 
     for( auto I=cI; I != cE; ++I )
-	of << "\n\t@attribute " << *I
-	   << " numeric % value=" << get_value(*I);
+	if( is_column( *I ) )
+	    of << "\n\t@attribute " << *I
+	       << " numeric % value=" << get_value(*I);
 
     of << "\n\n@data";
+}
 
+template<typename VectorIter, typename RowNameIter>
+void arff_write_data( std::ostream & of,
+		      VectorIter vI, VectorIter vE, RowNameIter rI ) {
     for( auto I=vI; I != vE; ++I, ++rI )
 	of << "\n\t" << *I << " % " << *rI;
+}
 
+template<typename VectorIter, typename ColNameIter, typename RowNameIter>
+void arff_write( std::ostream & of,
+		 const char * const relation_name,
+		 VectorIter vI, VectorIter vE,
+		 ColNameIter cI, ColNameIter cE,
+		 RowNameIter rI, RowNameIter rE ) {
+    arff_write_header( of, relation_name, cI, cE );
+    arff_write_data( of, vI, vE, rI );
     of << std::endl;
 }
 
+// Prepare an existing directory for nparts part files: remove the part
+// files of an earlier run beyond nparts, which would otherwise be read back
+// as data, and the mark of completion. Other files that get_part_listing
+// would return are an error.
+inline void clear_parts( const std::string & dirname, size_t nparts ) {
+    std::string success = dirname + "/_SUCCESS";
+    if( unlink( success.c_str() ) < 0 && errno != ENOENT )
+	fatale( "unlink", success );
+
+    DIR * dp = opendir( dirname.c_str() );
+    if( !dp )
+	fatale( "opendir", dirname );
+    while( struct dirent * dirp = readdir( dp ) ) {
+	const char * name = dirp->d_name;
+	if( name[0] == '.' || name[0] == '_' )
+	    continue;
+	bool is_part = !strncmp( name, "part-", 5 ) && isdigit( name[5] );
+	char * end = nullptr;
+	unsigned long i = is_part ? strtoul( name+5, &end, 10 ) : 0;
+	if( !is_part || *end )
+	    fatal( "arff_write_parts: directory holds other files: ",
+		   dirname, "/", name );
+	if( i >= nparts ) {
+	    std::string file = dirname + "/" + name;
+	    if( unlink( file.c_str() ) < 0 )
+		fatale( "unlink", file );
+	}
+    }
+    closedir( dp );
+}
+
+// Write the vectors as a directory of nparts part files, in parallel.
+// Only the first part carries the header. The directory can be read back
+// by arff_read. Part files of an earlier run in the directory are
+// replaced.
+template<typename VectorIter, typename ColNameIter, typename RowNameIter>
+void arff_write_parts( const std::string & dirname, size_t nparts,
+		       const char * const relation_name,
+		       VectorIter vI, VectorIter vE,
+		       ColNameIter cI, ColNameIter cE,
+		       RowNameIter rI, RowNameIter rE ) {
+    if( nparts == 0 )
+	nparts = 1;
+
+    if( mkdir( dirname.c_str(), 0777 ) < 0 ) {
+	if( errno != EEXIST )
+	    fatale( "mkdir", dirname );
+	clear_parts( dirname, nparts );
+    }
+    size_t nvec = std::distance( vI, vE );
+    cilk_for( size_t i=0; i < nparts; ++i ) {
+	size_t from = i * nvec / nparts;
+	size_t to = ( i + 1 ) * nvec / nparts;
+
+	char name[32];
+	snprintf( name, sizeof(name), "/part-%05lu", (unsigned long)i );
+	std::string filename = dirname + name;
+	std::ofstream of( filename, std::ios_base::out );
+	if( !of )
+	    fatale( "open", filename );
+
+	if( i == 0 )
+	    arff_write_header( of, relation_name, cI, cE );
+	arff_write_data( of, std::next( vI, from ), std::next( vI, to ),
+			 std::next( rI, from ) );
+	of << std::endl;
+	of.close();
+    }
+
+    // Mark the output complete
+    std::ofstream of( dirname + "/_SUCCESS", std::ios_base::out );
+    of.close();
+}
+
 };
 
 template<typename DataSetTy>
@@ -598,6 +454,22 @@ void arff_write( const std::string & filename,
     }
 }
 
+template<typename DataSetTy>
+void arff_write_parts( const std::string & dirname,
+		       const DataSetTy & data_set, size_t nparts ) {
+    if( data_set.transpose() ) {
+	arff::arff_write_parts( dirname, nparts, data_set.get_relation(),
+				data_set.vector_cbegin(), data_set.vector_cend(),
+				data_set.index2_cbegin(), data_set.index2_cend(),
+				data_set.index_cbegin(), data_set.index_cend() );
+    } else {
+	arff::arff_write_parts( dirname, nparts, data_set.get_relation(),
+				data_set.vector_cbegin(), data_set.vector_cend(),
+				data_set.index_cbegin(), data_set.index_cend(),
+				data_set.index2_cbegin(), data_set.index2_cend() );
+    }
+}
+
 }
 
 #endif // INCLUDED_ASAP_ARFF_H
@@ -0,0 +1,276 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_ARFF_STREAM_H
+#define INCLUDED_ASAP_ARFF_STREAM_H
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <vector>
+#include <memory>
+
+#include <cilk/cilk.h>
+
+#include "asap/utils.h"
+#include "asap/compressed_io.h"
+#include "asap/arff.h"
+
+namespace asap {
+
+namespace internal {
+
+// Sequential reader over a plain or compressed file.
+class byte_source {
+    int					m_fd;
+    std::string				m_fname;
+    off_t				m_off;
+    std::unique_ptr<decompress_stream>	m_ds;
+
+public:
+    byte_source( const std::string & filename )
+	: m_fname( filename ), m_off( 0 ) {
+	if( (m_fd = open( filename.c_str(), O_RDONLY )) < 0 )
+	    fatale( "open", filename );
+	compression_format fmt = detect_compression( m_fd );
+	if( fmt != cf_none )
+	    m_ds.reset( new decompress_stream( m_fd, filename.c_str(), fmt ) );
+    }
+    ~byte_source() {
+	m_ds.reset();
+	close( m_fd );
+    }
+
+    // Read up to len bytes. Returns less than len only at end of file.
+    size_t read( char * buf, size_t len ) {
+	if( m_ds )
+	    return m_ds->read( buf, len );
+	size_t r = 0;
+	while( r < len ) {
+	    ssize_t n = pread( m_fd, &buf[r], len - r, m_off );
+	    if( n < 0 )
+		fatale( "pread", m_fname );
+	    if( n == 0 )
+		break;
+	    m_off += n;
+	    r += n;
+	}
+	return r;
+    }
+};
+
+} // namespace internal
+
+// Cursor over an ARFF file that returns the data in batches of vectors,
+// without holding the whole file in memory. The file is consumed through
+// two alternating windows: while vectors are parsed from one window, the
+// next window is read by a spawned task. Records are never split; a partial
+// line at the end of a window is carried over into the next one.
+//
+// Only vectors that own their storage can be returned in batches.
+// Attribute names are copied out of the window, hence the word container
+// must be self-managed.
+template<typename VectorTy,
+	 typename WordContTy
+	 = word_list<std::vector<const char *>, word_bank_managed>>
+class arff_cursor {
+public:
+    typedef VectorTy				vector_type;
+    typedef WordContTy				index_list_type;
+    typedef std::vector<vector_type>		batch_type;
+
+    static_assert( std::is_same<typename vector_type::memory_mgmt_type,
+				mm_ownership_policy>::value,
+		   "arff_cursor requires vectors with ownership" );
+    static_assert( index_list_type::is_managed,
+		   "arff_cursor attribute list must be self-managed" );
+
+private:
+    internal::byte_source		m_src;
+    std::string				m_fname;
+    std::shared_ptr<index_list_type>	m_idx;
+    const char			      * m_relation;
+    size_t				m_ndim;
+    bool				m_is_sparse;
+    size_t				m_batch;
+    size_t				m_window;
+
+    // Double-buffered window. m_buf[m_cur] is being parsed, the other one
+    // is filled at m_dst by the read-ahead.
+    std::vector<char>			m_buf[2];
+    int					m_cur;
+    size_t				m_len;		// valid bytes in m_buf[m_cur]
+    size_t				m_carry;	// start of partial line
+    char				m_saved;	// overwritten by '\0'
+    char			      * m_p;
+    char			      * m_end;
+    char			      * m_dst;
+    size_t				m_ahead;	// bytes read ahead
+    bool				m_ahead_done;
+    bool				m_last;		// m_buf[m_cur] is final
+
+public:
+    arff_cursor( const std::string & filename, size_t batch = 4096,
+		 size_t window = size_t(1)<<22 )
+	: m_src( filename ), m_fname( filename ),
+	  m_idx( std::make_shared<index_list_type>() ),
+	  m_relation( "undefined" ), m_ndim( 0 ), m_is_sparse( false ),
+	  m_batch( batch ), m_window( window ), m_cur( 0 ), m_len( 0 ),
+	  m_carry( 0 ), m_saved( '\0' ), m_p( 0 ), m_end( 0 ), m_dst( 0 ),
+	  m_ahead( 0 ), m_ahead_done( false ), m_last( false ) {
+	m_buf[0].resize( m_window+2 );
+	m_len = m_src.read( &m_buf[0][0], m_window );
+	install( m_len < m_window );
+	read_header();
+    }
+    arff_cursor( const arff_cursor & ) = delete;
+    arff_cursor & operator = ( const arff_cursor & ) = delete;
+
+    const char * get_relation() const { return m_relation; }
+    size_t get_dimensions() const { return m_ndim; }
+    const std::shared_ptr<index_list_type> & get_index() const {
+	return m_idx;
+    }
+    // Whether any vector returned so far was stored sparsely
+    bool is_stored_sparse() const { return m_is_sparse; }
+
+    // Parse up to batch vectors. Returns the number of vectors in batch,
+    // which is zero at end of file. The contents of batch are replaced.
+    size_t next( batch_type & batch ) {
+	batch.clear();
+	while( batch.size() < m_batch ) {
+	    // Read the next window while parsing this one. The read is
+	    // spawned here, as it must complete before next() returns.
+	    if( !m_last && !m_ahead_done ) {
+		m_ahead_done = true;
+		m_ahead = cilk_spawn m_src.read( m_dst, m_window );
+	    }
+
+	    arff::skip_blank_lines( m_p, m_end );
+	    if( *m_p == '\0' ) {
+		cilk_sync;
+		if( !advance() )
+		    break;
+		continue;
+	    }
+
+	    m_is_sparse |= *m_p == '{';
+	    create_vector<vector_type>( batch, m_p, m_end, m_ndim );
+	    if( !arff::read_vector( m_p, m_end, batch.back() ) )
+		batch.pop_back();
+	}
+	cilk_sync;
+	return batch.size();
+    }
+
+    // Interface towards arff::read_relation and arff::read_attribute
+    const char * memorize( char * p, size_t len ) {
+	return m_idx->memorize( p, len );
+    }
+    const char * index( char * p, size_t len ) {
+	return m_idx->index( p, len );
+    }
+
+private:
+    void read_header() {
+	do {
+	    arff::skip_blank_lines( m_p, m_end );
+	    while( *m_p != '@' && *m_p != '\0' )
+		++m_p;
+	    if( *m_p == '\0' ) {
+		if( !advance() )
+		    return;
+		continue;
+	    }
+	    ++m_p;
+	    if( !strncasecmp( m_p, "relation ", 9 ) ) {
+		m_p += 9;
+		if( !(m_relation = arff::read_relation( m_p, *this )) )
+		    fatal( "Incomplete relation specifier in input file '",
+			   m_fname, "'" );
+	    } else if( !strncasecmp( m_p, "attribute ", 10 ) ) {
+		m_p += 10;
+		if( !arff::read_attribute( m_p, *this ) )
+		    fatal( "Incomplete attribute specifier in input file '",
+			   m_fname, "'" );
+	    } else if( !strncasecmp( m_p, "data", 4 ) ) {
+		// From now on everything is data
+		m_p += 4;
+		m_ndim = m_idx->size();
+		return;
+	    }
+	} while( 1 );
+    }
+
+    // Make m_buf[m_cur] the window to parse and start reading the next one.
+    void install( bool eof ) {
+	std::vector<char> & buf = m_buf[m_cur];
+	m_last = eof;
+
+	if( m_last ) {
+	    // Terminate the final record
+	    buf[m_len++] = '\n';
+	    m_carry = m_len;
+	} else {
+	    m_carry = m_len;
+	    while( m_carry > 0 && buf[m_carry-1] != '\n' )
+		--m_carry;
+	}
+
+	m_saved = buf[m_carry];
+	buf[m_carry] = '\0';
+	m_p = &buf[0];
+	m_end = &buf[m_carry];
+
+	if( !m_last ) {
+	    // The next window is read behind the carried-over partial line
+	    size_t carry_len = m_len - m_carry;
+	    std::vector<char> & nxt = m_buf[1-m_cur];
+	    if( nxt.size() < carry_len + m_window + 2 )
+		nxt.resize( carry_len + m_window + 2 );
+	    m_dst = &nxt[carry_len];
+	    m_ahead_done = false;
+	}
+    }
+
+    // Move on to the next window. Returns false at end of file.
+    bool advance() {
+	if( m_last )
+	    return false;
+
+	// The header is parsed without reading ahead
+	size_t r = m_ahead_done ? m_ahead : m_src.read( m_dst, m_window );
+
+	std::vector<char> & buf = m_buf[m_cur];
+	std::vector<char> & nxt = m_buf[1-m_cur];
+	size_t carry_len = m_len - m_carry;
+	buf[m_carry] = m_saved;
+	if( carry_len > 0 )
+	    memcpy( &nxt[0], &buf[m_carry], carry_len );
+
+	m_cur = 1 - m_cur;
+	m_len = carry_len + r;
+	install( r < m_window );
+	return true;
+    }
+};
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_ARFF_STREAM_H
@@ -0,0 +1,262 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_COMPRESSED_IO_H
+#define INCLUDED_ASAP_COMPRESSED_IO_H
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if ASAP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if ASAP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "asap/utils.h"
+
+namespace asap {
+
+// Compressed input formats, recognised by their magic number rather than
+// by file name extension.
+enum compression_format {
+    cf_none = 0,
+    cf_gzip,	// 1f 8b
+    cf_zstd	// 28 b5 2f fd
+};
+
+inline compression_format detect_compression( int fd ) {
+    unsigned char magic[4];
+    ssize_t n = pread( fd, magic, sizeof(magic), 0 );
+    if( n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b )
+	return cf_gzip;
+    if( n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5
+	&& magic[2] == 0x2f && magic[3] == 0xfd )
+	return cf_zstd;
+    return cf_none;
+}
+
+inline compression_format detect_compression( const char * fname ) {
+    int fd;
+    if( (fd = open( fname, O_RDONLY )) < 0 )
+	fatale( "open", fname );
+    compression_format fmt = detect_compression( fd );
+    close( fd );
+    return fmt;
+}
+
+// Estimate of the decompressed size, used to size the output buffer.
+// gzip stores the size (mod 2^32) of the last member in its trailer; zstd
+// optionally records the content size in the frame header.
+inline size_t uncompressed_size_hint( int fd, size_t file_size,
+				      compression_format fmt ) {
+    size_t hint = 0;
+    if( fmt == cf_gzip && file_size >= 18 ) {
+	unsigned char isize[4];
+	if( pread( fd, isize, sizeof(isize), file_size-4 ) == 4 )
+	    hint = size_t(isize[0]) | (size_t(isize[1]) << 8)
+		| (size_t(isize[2]) << 16) | (size_t(isize[3]) << 24);
+    }
+#if ASAP_HAVE_ZSTD
+    else if( fmt == cf_zstd ) {
+	char hdr[18];	// maximum frame header size
+	ssize_t n = pread( fd, hdr, sizeof(hdr), 0 );
+	if( n > 0 ) {
+	    unsigned long long c = ZSTD_getFrameContentSize( hdr, n );
+	    if( c != ZSTD_CONTENTSIZE_UNKNOWN && c != ZSTD_CONTENTSIZE_ERROR )
+		hint = c;
+	}
+    }
+#endif
+    // Never trust a hint smaller than the compressed data.
+    return hint < file_size ? 4 * file_size : hint;
+}
+
+// Decompresses a file incrementally into buffers supplied by the caller.
+// Decompression runs in the calling strand; callers overlap it with the
+// processing of earlier data by spawning the latter, which keeps all work
+// under the Cilk scheduler.
+class decompress_stream {
+    int				m_fd;
+    std::string			m_fname;
+    compression_format		m_fmt;
+    size_t			m_seg_size;
+    off_t			m_in_off;
+    bool			m_done;		// all output produced
+
+    // Compressed input staging area
+    std::vector<char>		m_in;
+    size_t			m_in_pos, m_in_len;
+    bool			m_in_eof;
+
+#if ASAP_HAVE_ZLIB
+    z_stream			m_zs;
+#endif
+#if ASAP_HAVE_ZSTD
+    ZSTD_DStream	      * m_zds;
+#endif
+
+public:
+    decompress_stream( int fd, const char * fname, compression_format fmt,
+		       size_t seg_size = size_t(1)<<20 )
+	: m_fd( fd ), m_fname( fname ), m_fmt( fmt ), m_seg_size( seg_size ),
+	  m_in_off( 0 ), m_done( false ), m_in( size_t(1)<<18 ),
+	  m_in_pos( 0 ), m_in_len( 0 ), m_in_eof( false ) {
+	if( fmt == cf_none )
+	    fatal( "decompress_stream on uncompressed file: ", fname );
+#if !ASAP_HAVE_ZLIB
+	if( fmt == cf_gzip )
+	    fatal( "gzip input not supported (build with ASAP_HAVE_ZLIB): ",
+		   fname );
+#else
+	if( fmt == cf_gzip ) {
+	    memset( &m_zs, 0, sizeof(m_zs) );
+	    // 15 window bits + 32: accept gzip or zlib headers
+	    if( inflateInit2( &m_zs, 15+32 ) != Z_OK )
+		fatal( "inflateInit2 failed: ", m_fname );
+	}
+#endif
+#if !ASAP_HAVE_ZSTD
+	if( fmt == cf_zstd )
+	    fatal( "zstd input not supported (build with ASAP_HAVE_ZSTD): ",
+		   fname );
+#else
+	m_zds = 0;
+	if( fmt == cf_zstd ) {
+	    m_zds = ZSTD_createDStream();
+	    ZSTD_initDStream( m_zds );
+	}
+#endif
+    }
+    ~decompress_stream() {
+#if ASAP_HAVE_ZLIB
+	if( m_fmt == cf_gzip )
+	    inflateEnd( &m_zs );
+#endif
+#if ASAP_HAVE_ZSTD
+	if( m_fmt == cf_zstd )
+	    ZSTD_freeDStream( m_zds );
+#endif
+    }
+
+    decompress_stream( const decompress_stream & ) = delete;
+    decompress_stream & operator = ( const decompress_stream & ) = delete;
+
+    // Suggested amount of data to request per call to read()
+    size_t segment_size() const { return m_seg_size; }
+    bool done() const { return m_done; }
+
+    // Decompress up to cap bytes into buf. Returns the number of bytes
+    // produced, which is less than cap only at the end of the input.
+    size_t read( char * buf, size_t cap ) {
+	size_t len = 0;
+	if( m_done )
+	    return 0;
+#if ASAP_HAVE_ZLIB
+	if( m_fmt == cf_gzip )
+	    m_done = fill_gzip( buf, cap, len );
+#endif
+#if ASAP_HAVE_ZSTD
+	if( m_fmt == cf_zstd )
+	    m_done = fill_zstd( buf, cap, len );
+#endif
+	return len;
+    }
+
+private:
+    // Top up the compressed input buffer. Returns false at end of file.
+    bool read_input() {
+	if( m_in_pos < m_in_len )
+	    return true;
+	if( m_in_eof )
+	    return false;
+	ssize_t n = pread( m_fd, &m_in[0], m_in.size(), m_in_off );
+	if( n < 0 )
+	    fatale( "pread", m_fname );
+	m_in_off += n;
+	m_in_pos = 0;
+	m_in_len = n;
+	m_in_eof = n == 0;
+	return n > 0;
+    }
+
+#if ASAP_HAVE_ZLIB
+    // Returns true when the whole input has been decompressed.
+    bool fill_gzip( char * buf, size_t cap, size_t & len ) {
+	z_stream & zs = m_zs;
+	while( len < cap ) {
+	    // Even without further input, inflate may hold pending output.
+	    bool more = read_input();
+	    zs.next_in = (Bytef *)m_in.data() + m_in_pos;
+	    zs.avail_in = m_in_len - m_in_pos;
+	    zs.next_out = (Bytef *)&buf[len];
+	    zs.avail_out = cap - len;
+
+	    int ret = inflate( &zs, Z_NO_FLUSH );
+	    m_in_pos = m_in_len - zs.avail_in;
+	    len = cap - zs.avail_out;
+
+	    if( ret == Z_STREAM_END ) {
+		// Concatenated members (e.g. from pigz or cat) follow on.
+		if( !read_input() )
+		    return true;
+		inflateReset( &zs );
+	    } else if( ret == Z_BUF_ERROR && !more )
+		fatal( "inflate: unexpected end of file: ", m_fname );
+	    else if( ret != Z_OK && ret != Z_BUF_ERROR )
+		fatal( "inflate: ", zs.msg ? zs.msg : "corrupt input", ": ",
+		       m_fname );
+	}
+	return false;
+    }
+#endif
+
+#if ASAP_HAVE_ZSTD
+    bool fill_zstd( char * buf, size_t cap, size_t & len ) {
+	ZSTD_DStream * zds = m_zds;
+	while( len < cap ) {
+	    bool more = read_input();
+	    ZSTD_inBuffer in = { m_in.data(), m_in_len, m_in_pos };
+	    ZSTD_outBuffer out = { buf, cap, len };
+	    size_t ret = ZSTD_decompressStream( zds, &out, &in );
+	    if( ZSTD_isError( ret ) )
+		fatal( "ZSTD_decompressStream: ", ZSTD_getErrorName( ret ),
+		       ": ", m_fname );
+	    m_in_pos = in.pos;
+	    if( !more && out.pos == len ) {
+		// ret == 0 when the last frame is complete and flushed
+		if( ret != 0 )
+		    fatal( "zstd: unexpected end of file: ", m_fname );
+		return true;
+	    }
+	    len = out.pos;
+	}
+	return false;
+    }
+#endif
+};
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_COMPRESSED_IO_H
@@ -139,9 +139,12 @@ public:
     /** Data set destructor */
     ~data_set() { }
 
-    /** Return the number of primary labels in the data set */
+    /** Return the number of dimensions of the vectors in the data set.
+     *  This is the number of primary labels, unless labels have been
+     *  pruned (see asap::prune_vocabulary) */
     size_t get_dimensions() const {
-	return m_idx_names->size();
+	return m_vectors->size() ? m_vectors->cbegin()->length()
+	    : m_idx_names->size();
     }
     /** Return the number of vectors in the data set */
     size_t get_num_points() const {
@@ -224,7 +227,9 @@ private:
 		     && m_idx_names2->size() == m_vectors->length() ) 
 		|| ( !m_transpose
 		     && m_idx_names2->size() == m_vectors->number() ) );
-	assert( ( !m_transpose && m_idx_names->size() == m_vectors->length() )
+	// Labels pruned from the vocabulary remain in the index without a
+	// column, see asap::prune_vocabulary
+	assert( ( !m_transpose && m_idx_names->size() >= m_vectors->length() )
 		|| ( m_transpose && m_idx_names->size() == m_vectors->number() ) );
     }
 public:
@@ -0,0 +1,304 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_DF_STORE_H
+#define INCLUDED_ASAP_DF_STORE_H
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <climits>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "asap/utils.h"
+#include "asap/term_dict.h"
+
+namespace asap {
+
+// Persistent document frequency state of a corpus: the vocabulary, the
+// id and document frequency of each term, the number of documents and the
+// names of the input files counted. Incremental TF/IDF loads the state,
+// counts new documents only, and writes the merged state back. Term ids
+// are stable across updates: new terms are appended. Inputs are named by
+// their canonical path (see input_name()), such that a file that is listed
+// again is not counted twice.
+//
+// The file is used in place through mmap. It consists of a header followed
+// by 8-byte aligned sections:
+//   uint64_t df[num_terms]	  document frequency by id
+//   uint64_t offset[num_terms]	  start of each term in text
+//   uint32_t table[table_size]	  id+1 of the term hashing to each slot,
+//				  linear probing, 0 if empty
+//   char text[text_size]	  NUL-terminated terms
+//   char inputs[inputs_size]	  NUL-terminated names of num_inputs inputs
+// Integers are stored in native byte order.
+class df_store {
+public:
+    typedef uint32_t			id_type;
+    typedef term_dictionary::df_type	df_type;
+    static const id_type		npos = ~id_type(0);
+
+private:
+    struct header {
+	char		magic[8];
+	uint64_t	num_docs;
+	uint64_t	num_terms;
+	uint64_t	table_size;
+	uint64_t	text_size;
+	uint64_t	num_inputs;
+	uint64_t	inputs_size;
+    };
+
+    static const char * magic() { return "ASAPDFS2"; }
+
+    void		* m_map;
+    size_t		  m_map_size;
+    const header	* m_hdr;
+    const df_type	* m_df;
+    const uint64_t	* m_offset;
+    const uint32_t	* m_table;
+    const char		* m_text;
+    const char		* m_inputs;
+    std::unordered_set<const char *, text::charp_hash, text::charp_eql>
+			  m_input_set;
+
+public:
+    df_store() : m_map( nullptr ), m_map_size( 0 ), m_hdr( nullptr ) { }
+    ~df_store() { close(); }
+
+    df_store( const df_store & ) = delete;
+    df_store & operator = ( const df_store & ) = delete;
+
+    // Map the store in the file. Returns false if the file does not exist.
+    bool open( const std::string & filename ) {
+	close();
+
+	int fd = ::open( filename.c_str(), O_RDONLY );
+	if( fd < 0 ) {
+	    if( errno == ENOENT )
+		return false;
+	    fatale( "open", filename );
+	}
+	struct stat finfo;
+	if( fstat( fd, &finfo ) < 0 )
+	    fatale( "fstat", filename );
+	if( size_t(finfo.st_size) < sizeof(header) )
+	    fatal( "not a document frequency store: ", filename );
+
+	m_map_size = finfo.st_size;
+	m_map = mmap( 0, m_map_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if( m_map == MAP_FAILED )
+	    fatale( "mmap", filename );
+	::close( fd );
+
+	m_hdr = reinterpret_cast<const header *>( m_map );
+	if( memcmp( m_hdr->magic, magic(), sizeof(m_hdr->magic) )
+	    || m_map_size != file_size( m_hdr->num_terms, m_hdr->table_size,
+					m_hdr->text_size,
+					m_hdr->inputs_size ) )
+	    fatal( "not a document frequency store: ", filename );
+
+	const char * p = reinterpret_cast<const char *>( m_map ) + sizeof(header);
+	m_df = reinterpret_cast<const df_type *>( p );
+	p += m_hdr->num_terms * sizeof(df_type);
+	m_offset = reinterpret_cast<const uint64_t *>( p );
+	p += m_hdr->num_terms * sizeof(uint64_t);
+	m_table = reinterpret_cast<const uint32_t *>( p );
+	p += align( m_hdr->table_size * sizeof(uint32_t) );
+	m_text = p;
+	p += m_hdr->text_size;
+	m_inputs = p;
+
+	m_input_set.reserve( m_hdr->num_inputs );
+	for( size_t i=0; i < m_hdr->num_inputs; ++i ) {
+	    m_input_set.insert( p );
+	    p += strlen( p ) + 1;
+	}
+	return true;
+    }
+
+    void close() {
+	if( m_map )
+	    munmap( m_map, m_map_size );
+	m_map = nullptr;
+	m_hdr = nullptr;
+	m_input_set.clear();
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return m_hdr ? m_hdr->num_terms : 0; }
+    size_t num_docs() const { return m_hdr ? m_hdr->num_docs : 0; }
+    df_type df( id_type id ) const { return m_df[id]; }
+    const char * term( id_type id ) const { return &m_text[m_offset[id]]; }
+
+    // The inputs counted, by name as returned by input_name()
+    size_t num_inputs() const { return m_hdr ? m_hdr->num_inputs : 0; }
+    bool counted( const std::string & name ) const {
+	return m_input_set.find( name.c_str() ) != m_input_set.end();
+    }
+    std::vector<std::string> inputs() const {
+	std::vector<std::string> names;
+	names.reserve( num_inputs() );
+	const char * p = m_inputs;
+	for( size_t i=0; i < num_inputs(); ++i ) {
+	    names.push_back( p );
+	    p += names.back().size() + 1;
+	}
+	return names;
+    }
+
+    // The name under which an input file is recorded: its canonical path
+    static std::string input_name( const std::string & filename ) {
+	char path[PATH_MAX];
+	if( !realpath( filename.c_str(), path ) )
+	    fatale( "realpath", filename );
+	return path;
+    }
+
+    // The id of the term, or npos if absent
+    id_type find( const char * w ) const {
+	if( empty() )
+	    return npos;
+	size_t len;
+	uint64_t h = term_dictionary::hash( w, len );
+	size_t mask = m_hdr->table_size - 1;
+	for( size_t i = h & mask; m_table[i]; i = ( i + 1 ) & mask )
+	    if( !strcmp( term( m_table[i]-1 ), w ) )
+		return m_table[i]-1;
+	return npos;
+    }
+
+    // Write a store with num_docs documents and the terms in [I,E), where
+    // the n-th term has id n, e.g., a frozen term_dictionary, recording the
+    // names of the inputs counted so far. The file is replaced atomically:
+    // the new contents are synced to disk before the old file is replaced.
+    template<typename Iterator>
+    static void write( const std::string & filename, size_t num_docs,
+		       Iterator I, Iterator E,
+		       const std::vector<std::string> & inputs
+		       = std::vector<std::string>() ) {
+	size_t num_terms = std::distance( I, E );
+	if( num_terms >= size_t(npos) )
+	    fatal( "df_store: more than 2^32-1 terms" );
+
+	std::vector<df_type> df( num_terms );
+	std::vector<uint64_t> offset( num_terms );
+	std::vector<char> text;
+	size_t table_size = 16;
+	while( table_size < 2 * num_terms )
+	    table_size *= 2;
+	std::vector<uint32_t> table( table_size, 0 );
+
+	size_t n = 0;
+	for( Iterator TI=I; TI != E; ++TI, ++n ) {
+	    const char * w = TI->first;
+	    df[n] = TI->second.first;
+	    offset[n] = text.size();
+	    size_t len;
+	    uint64_t h = term_dictionary::hash( w, len );
+	    text.insert( text.end(), w, w+len+1 );
+
+	    size_t i = h & ( table_size - 1 );
+	    while( table[i] )
+		i = ( i + 1 ) & ( table_size - 1 );
+	    table[i] = n+1;
+	}
+	text.resize( align( text.size() ), '\0' );
+
+	std::vector<char> names;
+	for( const std::string & name : inputs )
+	    names.insert( names.end(), name.c_str(),
+			  name.c_str() + name.size() + 1 );
+	names.resize( align( names.size() ), '\0' );
+
+	header hdr;
+	memcpy( hdr.magic, magic(), sizeof(hdr.magic) );
+	hdr.num_docs = num_docs;
+	hdr.num_terms = num_terms;
+	hdr.table_size = table_size;
+	hdr.text_size = text.size();
+	hdr.num_inputs = inputs.size();
+	hdr.inputs_size = names.size();
+	std::vector<char> pad( align( table_size * sizeof(uint32_t) )
+			       - table_size * sizeof(uint32_t), '\0' );
+
+	std::string tmpname = filename + ".tmp";
+	FILE * fp = fopen( tmpname.c_str(), "wb" );
+	if( !fp )
+	    fatale( "fopen", tmpname );
+	auto put = [&]( const void * p, size_t n ) {
+	    if( n > 0 && fwrite( p, 1, n, fp ) != n )
+		fatale( "fwrite", tmpname );
+	};
+	put( &hdr, sizeof(hdr) );
+	put( df.data(), num_terms * sizeof(df_type) );
+	put( offset.data(), num_terms * sizeof(uint64_t) );
+	put( table.data(), table_size * sizeof(uint32_t) );
+	put( pad.data(), pad.size() );
+	put( text.data(), text.size() );
+	put( names.data(), names.size() );
+	if( fflush( fp ) != 0 )
+	    fatale( "fflush", tmpname );
+	if( fsync( fileno( fp ) ) < 0 )
+	    fatale( "fsync", tmpname );
+	if( fclose( fp ) != 0 )
+	    fatale( "fclose", tmpname );
+	if( rename( tmpname.c_str(), filename.c_str() ) < 0 )
+	    fatale( "rename", tmpname );
+    }
+
+private:
+    static size_t align( size_t n ) { return ( n + 7 ) & ~size_t(7); }
+
+    static size_t file_size( size_t num_terms, size_t table_size,
+			     size_t text_size, size_t inputs_size ) {
+	return sizeof(header) + num_terms * sizeof(df_type)
+	    + num_terms * sizeof(uint64_t)
+	    + align( table_size * sizeof(uint32_t) ) + text_size + inputs_size;
+    }
+};
+
+// Prime the dictionary with the terms of the store, such that every term
+// obtains the same id as in the store. The dictionary must be empty.
+inline void load_dictionary( term_dictionary & dict, const df_store & store ) {
+    if( dict.size() != 0 )
+	fatal( "load_dictionary: dictionary is not empty" );
+    for( size_t i=0; i < store.size(); ++i )
+	dict.intern( store.term( i ) );
+}
+
+// Add the document frequencies in the store to df, which is indexed by
+// the ids of a dictionary loaded from the store.
+inline void merge_document_frequency( std::vector<df_store::df_type> & df,
+				      const df_store & store ) {
+    cilk_for( size_t i=0; i < store.size(); ++i )
+	df[i] += store.df( i );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_DF_STORE_H
@@ -0,0 +1,543 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_EXTERNAL_COUNT_H
+#define INCLUDED_ASAP_EXTERNAL_COUNT_H
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+#include "asap/utils.h"
+#include "asap/hashtable.h"
+#include "asap/short_word.h"
+#include "asap/tokenizer.h"
+#include "asap/word_bank.h"
+#include "asap/word_count.h"
+
+namespace asap {
+
+namespace internal {
+
+// A run: a file of (word, count) records in strictly increasing order of
+// the words. A record holds the 32-bit word length, the null-terminated
+// word and the 64-bit count. The file is unlinked as soon as it is created
+// and is accessed through its descriptor, such that the scratch space is
+// reclaimed however the process ends.
+class run_file {
+public:
+    // Every index_interval-th record is entered in a sparse index
+    static const size_t index_interval = 1024;
+
+    struct index_entry {
+	std::string word;
+	off_t	    offset;
+    };
+
+private:
+    int				m_fd;
+    off_t			m_size;
+    size_t			m_records;
+    std::vector<index_entry>	m_index;
+
+public:
+    run_file( const std::string & dir ) : m_size( 0 ), m_records( 0 ) {
+	std::string path = dir + "/asap-run-XXXXXX";
+	if( (m_fd = mkstemp( &path[0] )) < 0 )
+	    fatale( "mkstemp", path );
+	unlink( path.c_str() );
+    }
+    run_file( const run_file & ) = delete;
+    run_file & operator = ( const run_file & ) = delete;
+    ~run_file() { close( m_fd ); }
+
+    int fd() const { return m_fd; }
+    off_t size() const { return m_size; }
+    size_t records() const { return m_records; }
+    const std::vector<index_entry> & index() const { return m_index; }
+
+    // Write the words of [first,last), which are in increasing order, and
+    // their counts. Words are held by the keys of the elements.
+    template<typename Iterator>
+    void write( Iterator first, Iterator last, size_t buf_size ) {
+	std::vector<char> buf;
+	buf.reserve( buf_size );
+	for( Iterator I=first; I != last; ++I ) {
+	    const char * w = I->first.c_str();
+	    uint32_t len = I->first.size();
+	    uint64_t count = I->second;
+	    if( m_records % index_interval == 0 )
+		m_index.push_back( index_entry{ std::string( w, len ),
+			    m_size + off_t( buf.size() ) } );
+	    if( buf.size() + record_size( len ) > buf_size ) {
+		flush( buf );
+		buf.reserve( std::max( buf_size, record_size( len ) ) );
+	    }
+	    size_t at = buf.size();
+	    buf.resize( at + record_size( len ) );
+	    memcpy( &buf[at], &len, sizeof(len) );
+	    memcpy( &buf[at+sizeof(len)], w, len );
+	    buf[at+sizeof(len)+len] = '\0';
+	    memcpy( &buf[at+sizeof(len)+len+1], &count, sizeof(count) );
+	    ++m_records;
+	}
+	flush( buf );
+    }
+
+    // Offset of a record that is not beyond the first record with a word
+    // not less than w
+    off_t seek( const char * w ) const {
+	auto I = std::lower_bound(
+	    m_index.begin(), m_index.end(), w,
+	    []( const index_entry & e, const char * w ) {
+		return strcmp( e.word.c_str(), w ) < 0;
+	    } );
+	return I == m_index.begin() ? 0 : (I-1)->offset;
+    }
+
+    static size_t record_size( size_t len ) {
+	return sizeof(uint32_t) + len + 1 + sizeof(uint64_t);
+    }
+
+private:
+    void flush( std::vector<char> & buf ) {
+	size_t w = 0;
+	while( w < buf.size() ) {
+	    ssize_t ww = ::write( m_fd, &buf[w], buf.size() - w );
+	    if( ww < 0 )
+		fatale( "write", "run file" );
+	    w += ww;
+	}
+	m_size += buf.size();
+	buf.clear();
+    }
+};
+
+// Sequential reader of a run from a given offset, through a buffer of its
+// own such that readers of the same run are independent.
+class run_reader {
+    const run_file    & m_run;
+    std::vector<char>	m_buf;
+    off_t		m_off;		// file offset of m_buf[m_pos]
+    size_t		m_pos, m_len;	// current record, valid bytes
+    const char	      * m_word;
+    uint64_t		m_count;
+
+public:
+    run_reader( const run_file & run, off_t offset, size_t buf_size )
+	: m_run( run ), m_buf( buf_size ), m_off( offset ), m_pos( 0 ),
+	  m_len( 0 ), m_word( nullptr ), m_count( 0 ) { }
+
+    // Advance to the next record. Returns false at the end of the run.
+    bool next() {
+	if( m_word ) {
+	    size_t r = run_file::record_size( strlen( m_word ) );
+	    m_pos += r;
+	    m_off += r;
+	}
+	if( m_off == m_run.size() ) {
+	    m_word = nullptr;
+	    return false;
+	}
+	uint32_t len;
+	fill( sizeof(len) );
+	memcpy( &len, &m_buf[m_pos], sizeof(len) );
+	fill( run_file::record_size( len ) );
+	m_word = &m_buf[m_pos+sizeof(len)];
+	memcpy( &m_count, &m_buf[m_pos+sizeof(len)+len+1], sizeof(m_count) );
+	return true;
+    }
+
+    const char * word() const { return m_word; }
+    uint64_t count() const { return m_count; }
+
+private:
+    // Make sure the n bytes from m_pos are in the buffer
+    void fill( size_t n ) {
+	if( m_len - m_pos >= n )
+	    return;
+	memmove( &m_buf[0], &m_buf[m_pos], m_len - m_pos );
+	m_len -= m_pos;
+	m_pos = 0;
+	if( m_buf.size() < n )
+	    m_buf.resize( n );
+	while( m_len < n ) {
+	    size_t want = std::min( m_buf.size() - m_len,
+				    size_t( m_run.size() - m_off ) - m_len );
+	    ssize_t rr = pread( m_run.fd(), &m_buf[m_len], want,
+				m_off + m_len );
+	    if( rr < 0 )
+		fatale( "pread", "run file" );
+	    if( rr == 0 )
+		fatal( "unexpected end of run file" );
+	    m_len += rr;
+	}
+    }
+};
+
+// Merge the records of the runs with words in [lo,hi), where a null bound
+// is unbounded. Calls fn( word, len, count ) for every distinct word in
+// increasing order, with the sum of its counts.
+template<typename Fn>
+void merge_runs( const std::vector<std::unique_ptr<run_file>> & runs,
+		 const char * lo, const char * hi, size_t buf_size, Fn fn ) {
+    std::vector<std::unique_ptr<run_reader>> rd;
+    rd.reserve( runs.size() );
+    for( const std::unique_ptr<run_file> & run : runs ) {
+	std::unique_ptr<run_reader> r(
+	    new run_reader( *run, lo ? run->seek( lo ) : 0, buf_size ) );
+	bool more;
+	while( (more = r->next()) && lo && strcmp( r->word(), lo ) < 0 )
+	    ;
+	if( more && ( !hi || strcmp( r->word(), hi ) < 0 ) )
+	    rd.push_back( std::move( r ) );
+    }
+
+    // Min-heap of the readers by their current word
+    auto cmp = [&]( size_t a, size_t b ) {
+	return strcmp( rd[a]->word(), rd[b]->word() ) > 0;
+    };
+    std::vector<size_t> heap( rd.size() );
+    for( size_t i=0; i < rd.size(); ++i )
+	heap[i] = i;
+    std::make_heap( heap.begin(), heap.end(), cmp );
+
+    std::string cur;
+    uint64_t count = 0;
+    while( !heap.empty() ) {
+	std::pop_heap( heap.begin(), heap.end(), cmp );
+	run_reader & r = *rd[heap.back()];
+	if( count != 0 && cur == r.word() )
+	    count += r.count();
+	else {
+	    if( count != 0 )
+		fn( cur.c_str(), cur.size(), count );
+	    cur = r.word();
+	    count = r.count();
+	}
+	if( r.next() && ( !hi || strcmp( r.word(), hi ) < 0 ) )
+	    std::push_heap( heap.begin(), heap.end(), cmp );
+	else
+	    heap.pop_back();
+    }
+    if( count != 0 )
+	fn( cur.c_str(), cur.size(), count );
+}
+
+} // namespace internal
+
+// Exact word counting in bounded memory. Each worker counts into a hash
+// table of its own. When the table would outgrow the worker's share of the
+// memory budget, its words are sorted and written as a run to scratch
+// space, and the table starts over. finish() merges the runs into a word
+// list: the key space is partitioned by splitters taken from the indices
+// of the runs and the partitions are merged in parallel, each by a k-way
+// merge. When no run was written, the tables are merged in memory.
+class external_counter {
+public:
+    static const bool is_managed = true;
+    // Lower bound on the memory budget per worker
+    static const size_t min_budget = size_t(1)<<20;
+    static const size_t io_buffer = size_t(1)<<20;
+
+    typedef hash_table<text::short_word, size_t, text::short_word_hash,
+		       text::short_word_eql> table_type;
+    typedef table_type::value_type value_type;
+
+private:
+    // Occupied flag, stored hash and element per slot
+    static const size_t slot_bytes = sizeof(value_type) + sizeof(size_t) + 1;
+    static const size_t initial_capacity = 4096;
+
+    struct view {
+	table_type		table;
+	word_bank_managed	storage;	// long words
+	size_t			stored;		// bytes in storage
+
+	view() : table( initial_capacity ), storage( size_t(1)<<16 ),
+		 stored( 0 ) {
+	    table.set_growth( 1, 1 );
+	}
+    };
+
+    size_t					m_budget;	// per worker
+    std::string					m_dir;
+    std::vector<std::unique_ptr<view>>		m_views;	// by worker
+    std::vector<std::unique_ptr<internal::run_file>> m_runs;
+    std::mutex					m_runs_lock;
+    size_t					m_num_runs;
+    size_t					m_spilled;	// bytes
+
+public:
+    // Use at most memory bytes for the tables, shared by the workers, and
+    // write runs to directory dir
+    external_counter( size_t memory, const std::string & dir )
+	: m_budget( std::max( memory / __cilkrts_get_nworkers(),
+			      size_t( min_budget ) ) ),
+	  m_dir( dir ), m_views( __cilkrts_get_nworkers() ),
+	  m_num_runs( 0 ), m_spilled( 0 ) { }
+
+    external_counter( const external_counter & ) = delete;
+    external_counter & operator = ( const external_counter & ) = delete;
+
+    // Text buffers need not be retained
+    void enregister( const std::shared_ptr<char> & ) { }
+
+    // Count a null-terminated word of len characters
+    void add( const char * w, size_t len, uint64_t c = 1 ) {
+	view & v = local();
+	text::short_word k( w, len );
+	size_t h = k.hash();
+	table_type::iterator I = v.table.find( k, h );
+	if( I != v.table.end() ) {
+	    I->second += c;
+	    return;
+	}
+
+	// Spill when inserting the word would exceed the budget. Growing the
+	// table holds the old and the new slots.
+	size_t cap = v.table.capacity();
+	size_t slots = v.table.size()+1 >= cap>>1 ? 3 * cap : cap;
+	size_t extra = k.is_inline() ? 0 : len+1;
+	if( slots * slot_bytes + v.stored + extra > m_budget
+	    && v.table.size() != 0 )
+	    spill( v );
+
+	if( !k.is_inline() ) {
+	    k = text::short_word( v.storage.store( w, len ), len );
+	    v.stored += len+1;
+	}
+	v.table.insert( value_type( k, c ), h );
+    }
+
+    // Merge the counts into the word list out, which must be empty. The
+    // list is sorted by word if any run was written. The runs are released.
+    // Not thread-safe.
+    template<typename ListTy>
+    void finish( ListTy & out ) {
+	if( m_runs.empty() )
+	    finish_in_memory( out );
+	else {
+	    cilk_for( size_t i=0; i < m_views.size(); ++i ) {
+		if( m_views[i] && m_views[i]->table.size() != 0 )
+		    spill( *m_views[i] );
+		m_views[i].reset();
+	    }
+	    finish_runs( out );
+	}
+	m_runs.clear();
+    }
+
+    // Runs written, and their total size in bytes
+    size_t num_runs() const { return m_num_runs; }
+    size_t spilled_bytes() const { return m_spilled; }
+    size_t budget() const { return m_budget; }
+
+private:
+    view & local() {
+	std::unique_ptr<view> & v = m_views[__cilkrts_get_worker_number()];
+	if( !v )
+	    v.reset( new view() );
+	return *v;
+    }
+
+    // Write the table of v as a run and start over with an empty table of
+    // the same capacity. Sorts sequentially: spawning would allow another
+    // strand of this worker to select the view in the meantime.
+    void spill( view & v ) {
+	std::vector<value_type> words( v.table.cbegin(), v.table.cend() );
+	size_t cap = v.table.capacity();
+	{
+	    table_type empty( 1 );
+	    v.table.swap( empty );
+	}
+	std::sort( words.begin(), words.end(),
+		   []( const value_type & a, const value_type & b ) {
+		       return a.first < b.first;
+		   } );
+
+	std::unique_ptr<internal::run_file> run(
+	    new internal::run_file( m_dir ) );
+	run->write( words.cbegin(), words.cend(), io_buffer );
+	{
+	    std::lock_guard<std::mutex> g( m_runs_lock );
+	    ++m_num_runs;
+	    m_spilled += run->size();
+	    m_runs.push_back( std::move( run ) );
+	}
+
+	std::vector<value_type>().swap( words );
+	v.storage.clear();
+	v.stored = 0;
+	table_type fresh( cap );
+	v.table.swap( fresh );
+    }
+
+    template<typename ListTy>
+    void finish_in_memory( ListTy & out ) {
+	typedef typename ListTy::key_type key_type;
+	typedef typename ListTy::value_type out_value_type;
+
+	view * r = nullptr;
+	for( std::unique_ptr<view> & v : m_views ) {
+	    if( !v )
+		continue;
+	    if( !r )
+		r = v.get();
+	    else {
+		r->table.merge( v->table, []( size_t & a, const size_t & b ) {
+			a += b;
+		    } );
+		r->storage.copy( v->storage );
+	    }
+	}
+	if( r ) {
+	    out.resize( r->table.size() );
+	    auto O = out.begin();
+	    for( auto I=r->table.cbegin(), E=r->table.cend(); I != E; ++I, ++O )
+		*O = out_value_type( key_type( I->first.c_str() ), I->second );
+	    out.storage().copy( r->storage );
+	}
+	m_views.clear();
+    }
+
+    template<typename ListTy>
+    void finish_runs( ListTy & out ) {
+	typedef typename ListTy::key_type key_type;
+	typedef typename ListTy::value_type out_value_type;
+
+	// Splitters evenly spaced over the words in the indices of the runs
+	std::vector<const char *> sample;
+	size_t records = 0;
+	for( const std::unique_ptr<internal::run_file> & run : m_runs ) {
+	    for( const internal::run_file::index_entry & e : run->index() )
+		sample.push_back( e.word.c_str() );
+	    records += run->records();
+	}
+	std::sort( sample.begin(), sample.end(),
+		   []( const char * a, const char * b ) {
+		       return strcmp( a, b ) < 0;
+		   } );
+	sample.erase( std::unique( sample.begin(), sample.end(),
+				   []( const char * a, const char * b ) {
+				       return strcmp( a, b ) == 0;
+				   } ), sample.end() );
+	size_t nparts = std::min( 4 * size_t( __cilkrts_get_nworkers() ),
+				  records / internal::run_file::index_interval );
+	nparts = std::max( std::min( nparts, sample.size() ), size_t(1) );
+	std::vector<const char *> split( nparts+1, nullptr );
+	for( size_t p=1; p < nparts; ++p )
+	    split[p] = sample[p * sample.size() / nparts];
+
+	// Each worker merges one partition at a time, with a buffer per run
+	size_t buf_size = std::min( std::max( m_budget / m_runs.size(),
+					      size_t(4096) ),
+				   size_t( io_buffer ) );
+
+	struct part {
+	    std::vector<out_value_type>	words;
+	    word_bank_managed		storage;
+	    part() : storage( size_t(1)<<20 ) { }
+	};
+	std::vector<part> parts( nparts );
+	cilk_for( size_t p=0; p < nparts; ++p ) {
+	    part & pt = parts[p];
+	    internal::merge_runs(
+		m_runs, split[p], split[p+1], buf_size,
+		[&]( const char * w, size_t len, uint64_t count ) {
+		    if( !internal::inline_key<key_type>::fits( len ) )
+			w = pt.storage.store( w, len );
+		    pt.words.push_back(
+			out_value_type( key_type( w ), count ) );
+		} );
+	}
+
+	std::vector<size_t> start( nparts+1, 0 );
+	for( size_t p=0; p < nparts; ++p )
+	    start[p+1] = start[p] + parts[p].words.size();
+	out.resize( start[nparts] );
+	cilk_for( size_t p=0; p < nparts; ++p ) {
+	    std::copy( parts[p].words.begin(), parts[p].words.end(),
+		       out.begin() + start[p] );
+	    std::vector<out_value_type>().swap( parts[p].words );
+	}
+	for( size_t p=0; p < nparts; ++p )
+	    out.storage().copy( parts[p].storage );
+    }
+};
+
+namespace text {
+
+// Count the words in [data,data+data_size) in bounded memory. Chunks of
+// chunk_size bytes are counted in parallel.
+inline size_t external_catalog( char * data, size_t data_size,
+				external_counter & counter,
+				size_t chunk_size ) {
+    cilk::reducer< cilk::op_add<size_t> > reduce_num_words(0);
+    char * const data_end = &data[data_size];
+    char * split = data;
+
+    while( split != data_end ) {
+	char * end = split_chunk( split, data_end, chunk_size );
+
+	cilk_spawn [&] ( char * split, char * end ) {
+	    size_t nwords = 0;
+	    tokenize( split, end, [&]( char * w, size_t len ) {
+		    counter.add( w, len );
+		    ++nwords;
+		} );
+	    *reduce_num_words += nwords;
+	}( split, end );
+
+	split = end;
+    }
+    cilk_sync;
+
+    return reduce_num_words.get_value();
+}
+
+} // namespace text
+
+// Count the words of a file in bounded memory, decompressing on the fly if
+// needed. The counts are collected by counter.finish().
+inline size_t external_catalog( const std::string & filename,
+				external_counter & counter,
+				size_t chunk_size = size_t(1)<<20 ) {
+    return internal::catalog_file(
+	filename, counter, chunk_size,
+	[]( char * data, size_t data_size, external_counter & c,
+	    size_t chunk_size ) {
+	    return text::external_catalog( data, data_size, c, chunk_size );
+	} );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_EXTERNAL_COUNT_H
@@ -0,0 +1,353 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_FEATURE_HASH_H
+#define INCLUDED_ASAP_FEATURE_HASH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+
+#include "asap/utils.h"
+#include "asap/word_bank.h"
+#include "asap/word_count.h"
+#include "asap/tokenizer.h"
+#include "asap/data_set.h"
+#include "asap/sparse_vector.h"
+
+namespace asap {
+
+// Term counts of a document in a hashed feature space: pairs of a feature
+// index and a signed count, ordered by index. The text is not retained.
+class hashed_catalog
+    : public std::vector<std::pair<uint32_t, int32_t>> {
+public:
+    static const bool is_managed = true;
+
+    // Text buffers need not be retained
+    void enregister( const std::shared_ptr<char> & ) { }
+};
+
+// TF/IDF without a vocabulary ("hashing trick"). Words are mapped to one of
+// 2^bits features by a hash computed during tokenisation; a second bit of
+// the hash selects the sign with which the word is counted, such that
+// collisions cancel out in expectation. Document frequencies are counted
+// in a flat array of atomic counters. Memory use depends on bits only.
+//
+// Columns are named after their index ("h<index>"), such that data sets
+// produced from different inputs share the same attributes. Optionally, a
+// word is recorded for each feature, the first one seen, and may be listed
+// by write_samples() for interpretation of the features.
+//
+// After all documents are counted, freeze() builds the list of columns
+// annotated with their document frequency. The feature_hasher then serves
+// as the column index of a TF/IDF data set. The columns may be pruned by
+// document frequency, in which case the retained features are numbered
+// consecutively. Stop words are not counted at all.
+class feature_hasher {
+public:
+    typedef uint32_t					index_type;
+    typedef appear_count<size_t, size_t>		count_type;
+    typedef std::pair<const char *, count_type>		value_type;
+    typedef std::vector<value_type>::const_iterator	const_iterator;
+
+    static const unsigned max_bits = 31;
+
+private:
+    unsigned					m_bits;
+    std::unique_ptr<std::atomic<uint32_t>[]>	m_df;
+    std::unique_ptr<std::atomic<const char *>[]> m_sample;
+    std::mutex					m_mux;
+    word_bank_managed				m_bank;	// sampled words
+    std::vector<char>				m_names;
+    std::vector<value_type>			m_columns;	// see freeze()
+    size_t					m_num_columns;
+    const vocabulary_filter *			m_stop_words;
+
+public:
+    feature_hasher( unsigned bits, bool sample = false )
+	: m_bits( bits ), m_num_columns( 0 ), m_stop_words( nullptr ) {
+	if( bits == 0 || bits > max_bits )
+	    fatal( "feature_hasher: number of bits must be in 1..", max_bits );
+	size_t n = size();
+	m_df.reset( new std::atomic<uint32_t>[n] );
+	if( sample )
+	    m_sample.reset( new std::atomic<const char *>[n] );
+	cilk_for( size_t i=0; i < n; ++i ) {
+	    m_df[i].store( 0, std::memory_order_relaxed );
+	    if( sample )
+		m_sample[i].store( nullptr, std::memory_order_relaxed );
+	}
+    }
+
+    feature_hasher( const feature_hasher & ) = delete;
+    feature_hasher & operator = ( const feature_hasher & ) = delete;
+
+    size_t size() const { return size_t(1) << m_bits; }
+    unsigned bits() const { return m_bits; }
+
+    // Do not count the stop words of filter, which must remain valid
+    void set_stop_words( const vocabulary_filter & filter ) {
+	m_stop_words = filter.has_stop_words() ? &filter : nullptr;
+    }
+
+    // Count the words in [data,data+data_size) into catalog, adding to its
+    // current content. Chunks of chunk_size bytes are tokenised in parallel.
+    size_t catalog( char * data, size_t data_size,
+		    hashed_catalog & catalog, size_t chunk_size ) {
+	char * const data_end = &data[data_size];
+	std::vector<std::pair<char *, char *>> chunks;
+	char * split = data;
+	while( split != data_end ) {
+	    char * end = text::split_chunk( split, data_end, chunk_size );
+	    chunks.push_back( std::make_pair( split, end ) );
+	    split = end;
+	}
+
+	// Each chunk yields a list of features ordered by index
+	std::vector<hashed_catalog> parts( chunks.size() );
+	std::vector<size_t> nwords( chunks.size() );
+	cilk_for( size_t k=0; k < chunks.size(); ++k ) {
+	    std::vector<uint64_t> keys;
+	    text::tokenize( chunks[k].first, chunks[k].second,
+			    [&]( char * w, size_t len ) {
+				if( !m_stop_words
+				    || !m_stop_words->is_stop_word( w ) )
+				    keys.push_back( feature( w, len ) );
+			    } );
+	    nwords[k] = keys.size();
+	    std::sort( keys.begin(), keys.end() );
+	    hashed_catalog & part = parts[k];
+	    for( uint64_t key : keys ) {
+		index_type idx = key >> 1;
+		int32_t inc = ( key & 1 ) ? -1 : 1;
+		if( part.empty() || part.back().first != idx )
+		    part.push_back( std::make_pair( idx, inc ) );
+		else
+		    part.back().second += inc;
+	    }
+	}
+
+	size_t num_words = 0;
+	for( size_t k=0; k < parts.size(); ++k ) {
+	    merge( catalog, parts[k] );
+	    num_words += nwords[k];
+	}
+	return num_words;
+    }
+
+    // Count a file, decompressing on the fly if needed
+    size_t catalog( const std::string & filename, hashed_catalog & catalog,
+		    size_t chunk_size = size_t(1)<<20 ) {
+	return internal::catalog_file(
+	    filename, catalog, chunk_size,
+	    [this]( char * data, size_t data_size, hashed_catalog & c,
+		    size_t chunk_size ) {
+		return this->catalog( data, data_size, c, chunk_size );
+	    } );
+    }
+
+    // Add a document's features to the document frequencies. Features
+    // whose count cancelled out to zero count as present, and are then
+    // removed from the catalog. Thread-safe.
+    void count_presence( hashed_catalog & catalog ) {
+	for( auto & f : catalog )
+	    m_df[f.first].fetch_add( 1, std::memory_order_relaxed );
+	catalog.erase( std::remove_if( catalog.begin(), catalog.end(),
+				       []( const hashed_catalog::value_type & f ) {
+					   return f.second == 0;
+				       } ),
+		       catalog.end() );
+    }
+
+    uint32_t df( index_type idx ) const {
+	return m_df[idx].load( std::memory_order_relaxed );
+    }
+
+    // The sampled word for a feature, or nullptr
+    const char * sample( index_type idx ) const {
+	return m_sample ? m_sample[idx].load( std::memory_order_relaxed )
+	    : nullptr;
+    }
+
+    // List the sampled words, one "<index> <word>" line per feature
+    void write_samples( std::ostream & os ) const {
+	if( !m_sample )
+	    return;
+	for( size_t i=0; i < size(); ++i )
+	    if( const char * w = sample( i ) )
+		os << i << ' ' << w << '\n';
+    }
+
+    // Build the list of columns with their document frequencies.
+    // Not thread-safe.
+    void freeze() {
+	size_t n = size();
+	const size_t width = 12; // "h" plus up to 10 digits plus NUL
+	m_names.resize( n * width );
+	m_columns.resize( n );
+	cilk_for( size_t i=0; i < n; ++i ) {
+	    char * name = &m_names[i*width];
+	    snprintf( name, width, "h%u", index_type( i ) );
+	    m_columns[i].first = name;
+	    m_columns[i].second.first = df( i );
+	    m_columns[i].second.second = i;
+	}
+	m_num_columns = n;
+    }
+
+    // Drop the columns that do not pass the filter, given the number of
+    // documents counted. Returns the number of columns dropped.
+    // Not thread-safe.
+    size_t prune( vocabulary_filter & filter, size_t num_docs ) {
+	size_t n = prune_vocabulary( m_columns.begin(), m_columns.end(),
+				     filter, num_docs );
+	m_num_columns = size() - n;
+	return n;
+    }
+
+    // The number of columns retained, and the column of a feature, if any
+    size_t num_columns() const { return m_num_columns; }
+    size_t column( index_type idx ) const {
+	return m_columns[idx].second.second;
+    }
+
+    // Access to the frozen columns
+    const_iterator cbegin() const { return m_columns.cbegin(); }
+    const_iterator cend() const { return m_columns.cend(); }
+    const_iterator begin() const { return m_columns.cbegin(); }
+    const_iterator end() const { return m_columns.cend(); }
+    const char * operator[] ( size_t idx ) const { return m_columns[idx].first; }
+
+private:
+    // The feature index of a word, shifted left by one, and its sign bit
+    uint64_t feature( const char * w, size_t len ) {
+	uint64_t v = text::word_hash( w, len );
+
+	index_type idx = v >> ( 64 - m_bits );
+	if( m_sample && !m_sample[idx].load( std::memory_order_relaxed ) )
+	    record( idx, w, len );
+	return ( uint64_t(idx) << 1 ) | ( v & 1 );
+    }
+
+    void record( index_type idx, const char * w, size_t len ) {
+	std::lock_guard<std::mutex> lock( m_mux );
+	if( !m_sample[idx].load( std::memory_order_relaxed ) )
+	    m_sample[idx].store( m_bank.store( w, len ),
+				 std::memory_order_relaxed );
+    }
+
+    // Merge the ordered list from into the ordered list to
+    static void merge( hashed_catalog & to, const hashed_catalog & from ) {
+	if( to.empty() ) {
+	    to.assign( from.begin(), from.end() );
+	    return;
+	}
+	hashed_catalog m;
+	m.reserve( to.size() + from.size() );
+	auto I = to.cbegin(), E = to.cend();
+	auto FI = from.cbegin(), FE = from.cend();
+	while( I != E && FI != FE ) {
+	    if( I->first < FI->first )
+		m.push_back( *I++ );
+	    else if( FI->first < I->first )
+		m.push_back( *FI++ );
+	    else {
+		m.push_back( std::make_pair( I->first, I->second + FI->second ) );
+		++I;
+		++FI;
+	    }
+	}
+	m.insert( m.end(), I, E );
+	m.insert( m.end(), FI, FE );
+	to.swap( m );
+    }
+};
+
+// TF/IDF over hashed catalogs. The sign of a feature's count carries over
+// to its TF/IDF score; sublinear scaling applies to its magnitude.
+template<typename VectorTy, typename InputIterator, typename VectorNameTy>
+data_set<VectorTy, feature_hasher, VectorNameTy>
+tfidf( InputIterator I, InputIterator E,
+       std::shared_ptr<feature_hasher> & hasher_ptr,
+       std::shared_ptr<VectorNameTy> & vec_names_ptr,
+       const tfidf_weighting & weighting = tfidf_weighting() ) {
+    typedef data_set<VectorTy, feature_hasher, VectorNameTy> data_set_type;
+    typedef typename data_set_type::vector_list_type vector_list_type;
+    typedef typename vector_list_type::value_type value_type;
+    typedef typename vector_list_type::index_type index_type;
+
+    const feature_hasher & hasher = *hasher_ptr;
+    size_t num_points = std::distance( I, E );
+    size_t num_dimensions = hasher.num_columns();
+    size_t nonzeros = std::for_each( I, E, SizeCounter<decltype(*I)>() ).size;
+
+    static_assert( is_sparse_vector<VectorTy>::value, "must be sparse - constructor" );
+    std::shared_ptr<vector_list_type> vectors_ptr
+	= std::make_shared<vector_list_type>( num_points, num_dimensions, nonzeros );
+    vector_list_type & vectors = *vectors_ptr;
+
+    std::vector<size_t> vec_start( num_points );
+    size_t inc_nonzeros = 0;
+    size_t i=0;
+    for( auto II=I; II != E; ++II, ++i ) {
+	size_t fcount = II->size();
+	vec_start[i] = inc_nonzeros;
+	inc_nonzeros += fcount;
+	vectors.emplace_back( num_dimensions, fcount );
+    }
+
+    cilk_for( size_t i=0; i < num_points; ++i ) {
+	auto PI = std::next( I, i );
+	value_type *v = &vectors.get_alloc_v()[vec_start[i]];
+	index_type *c = &vectors.get_alloc_i()[vec_start[i]];
+	size_t f = 0;
+	for( auto MI=PI->cbegin(), ME=PI->cend(); MI != ME; ++MI ) {
+	    // Features pruned by document frequency have no column
+	    size_t col = hasher.column( MI->first );
+	    if( !internal::has_id( col ) )
+		continue;
+	    value_type idf = log10( value_type(num_points + 1)
+				    / value_type(hasher.df( MI->first ) + 1) );
+	    value_type tf = weighting.tf<value_type>( std::abs( MI->second ) );
+	    c[f] = col;
+	    v[f] = ( MI->second < 0 ? -tf : tf ) * idf;
+	    ++f;
+	}
+	internal::tfidf_finish( vectors[i], v, c, f, weighting );
+    }
+    vectors.shrink_to_fit();
+
+    const char * name = "tfidf";
+    return data_set_type( name, hasher_ptr, vec_names_ptr, vectors_ptr, false );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_FEATURE_HASH_H
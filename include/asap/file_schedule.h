@@ -0,0 +1,150 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_FILE_SCHEDULE_H
+#define INCLUDED_ASAP_FILE_SCHEDULE_H
+
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+namespace asap {
+
+// Assignment of the files of a directory listing to parallel tasks, based
+// on the file sizes collected by get_directory_listing. Consecutive small
+// files are batched into one task, such that the per-task overhead is
+// amortised over a reasonable amount of text. Large files form a task of
+// their own and are split into chunks that are tokenised in parallel. The
+// chunk size follows the cache size and is reduced such that a large file
+// yields a few chunks per worker.
+class file_schedule {
+public:
+    struct task {
+	size_t first, last;	// files [first,last) of the listing
+	size_t chunk_size;	// split files in chunks of this many bytes
+    };
+
+    static const size_t min_chunk = size_t(64)<<10;
+    static const size_t max_chunk = size_t(8)<<20;
+    static const size_t default_cache = size_t(1)<<20;
+    // Bound the number of files in a batch to bound the imbalance caused
+    // by empty files
+    static const size_t max_batch_files = 1024;
+
+private:
+    std::vector<task> m_tasks;
+    size_t m_num_files;
+    size_t m_chunk_size;
+    size_t m_batch_size;
+
+public:
+    file_schedule() : m_num_files( 0 ), m_chunk_size( default_cache ),
+		      m_batch_size( 0 ) { }
+    file_schedule( const std::vector<size_t> & sizes,
+		   size_t nworkers = __cilkrts_get_nworkers(),
+		   size_t cache = cache_size() ) {
+	build( sizes, nworkers, cache );
+    }
+
+    void build( const std::vector<size_t> & sizes, size_t nworkers,
+		size_t cache ) {
+	m_tasks.clear();
+	m_num_files = sizes.size();
+	if( nworkers == 0 )
+	    nworkers = 1;
+
+	size_t total = 0;
+	for( size_t s : sizes )
+	    total += s;
+
+	// Chunks fit in the cache. Batches hold at least one chunk's worth
+	// of text unless this results in fewer than 8 tasks per worker.
+	m_chunk_size = clamp( cache, min_chunk, max_chunk );
+	m_batch_size = clamp( total / ( 8 * nworkers ), 1, m_chunk_size );
+
+	size_t first = 0, batch = 0;
+	for( size_t i=0; i < m_num_files; ++i ) {
+	    if( sizes[i] >= m_batch_size ) {
+		if( first != i )
+		    m_tasks.push_back( task{ first, i, m_chunk_size } );
+		size_t chunk = clamp( sizes[i] / ( 4 * nworkers ),
+				      min_chunk, m_chunk_size );
+		m_tasks.push_back( task{ i, i+1, chunk } );
+		first = i+1;
+		batch = 0;
+	    } else {
+		batch += sizes[i];
+		if( batch >= m_batch_size || i+1-first >= max_batch_files ) {
+		    m_tasks.push_back( task{ first, i+1, m_chunk_size } );
+		    first = i+1;
+		    batch = 0;
+		}
+	    }
+	}
+	if( first != m_num_files )
+	    m_tasks.push_back( task{ first, m_num_files, m_chunk_size } );
+    }
+
+    size_t size() const { return m_tasks.size(); }
+    const task & operator [] ( size_t t ) const { return m_tasks[t]; }
+
+    size_t num_files() const { return m_num_files; }
+    size_t chunk_size() const { return m_chunk_size; }
+    size_t batch_size() const { return m_batch_size; }
+
+    // Size of the per-core cache, i.e., the L2 cache, if it can be found
+    static size_t cache_size() {
+	long sz = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	sz = sysconf( _SC_LEVEL2_CACHE_SIZE );
+#endif
+	return sz > 0 ? size_t(sz) : default_cache;
+    }
+
+private:
+    static size_t clamp( size_t v, size_t lo, size_t hi ) {
+	return std::min( std::max( v, lo ), hi );
+    }
+};
+
+// Call fn( i, chunk_size ) for every file i in tasks [first,last) of the
+// schedule. Tasks execute in parallel, the files within a batch in order.
+template<typename Fn>
+void for_each_file( const file_schedule & schedule, size_t first, size_t last,
+		    Fn fn ) {
+    cilk_for( size_t t=first; t < last; ++t ) {
+	const file_schedule::task & k = schedule[t];
+	for( size_t i=k.first; i < k.last; ++i )
+	    fn( i, k.chunk_size );
+    }
+}
+
+// Call fn( i, chunk_size ) for every file i in the schedule
+template<typename Fn>
+void for_each_file( const file_schedule & schedule, Fn fn ) {
+    for_each_file( schedule, 0, schedule.size(), fn );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_FILE_SCHEDULE_H
@@ -23,13 +23,21 @@
 
 #include <unordered_map>
 #include <vector>
-#include <deque>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <cassert>
 
 namespace asap {
 
+// Hash table that keeps its elements in insertion order in a dense array.
+// A separate index table maps keys to positions in the array. The index is
+// probed linearly with robin-hood displacement: an element being inserted
+// takes the slot of any element that lies closer to its home slot. This
+// keeps probe sequences short at high load, and an unsuccessful lookup stops
+// as soon as it meets an element closer to home than the probed key would be.
 template<typename Key, typename T, class Hash=std::hash<Key>, 
 	 class KeyEqual = std::equal_to<Key>,
 	 class Allocator = std::allocator<std::pair<Key,T>>>
@@ -54,36 +62,49 @@ public:
 private:
     typedef hash_index<Key, T, Hash, KeyEqual, Allocator> self_type;
 private:
-    typedef std::pair<size_t,value_type>	serial_type;
-    typedef size_t				index_type;
+    // Element in insertion order with the stored hash of its key. Probes
+    // compare hashes before keys, and rehashing does not need to hash keys
+    // again.
+    struct entry_type {
+	value_type	value;
+	size_type	hash;
+    };
+    // Slot in the index table: the low 32 bits of the hash, which locate
+    // the home slot and filter out most mismatches without touching the
+    // element, and the position of the element in the dense array.
+    struct slot_type {
+	uint32_t	hash;
+	uint32_t	pos;
+    };
 
 // Alternative to constexpr function (Intel compiler fails)
-#define unused_key (~size_t(0))
+#define unused_pos (~uint32_t(0))
 
     typedef typename
-    allocator_type::template rebind<serial_type>::other serial_allocator_type;
+    allocator_type::template rebind<entry_type>::other entry_allocator_type;
     typedef typename
-    allocator_type::template rebind<index_type>::other index_allocator_type;
+    allocator_type::template rebind<slot_type>::other slot_allocator_type;
 
-    typedef typename std::deque<serial_type, serial_allocator_type>::iterator
-    storage_iterator;
-    typedef typename std::deque<serial_type, serial_allocator_type>::const_iterator
-    const_storage_iterator;
+    typedef std::vector<entry_type, entry_allocator_type> storage_type;
+    typedef typename storage_type::iterator storage_iterator;
+    typedef typename storage_type::const_iterator const_storage_iterator;
 
-    std::deque<serial_type, serial_allocator_type>	storage;
-    std::vector<index_type, index_allocator_type>	table;
+    storage_type					storage;
+    std::vector<slot_type, slot_allocator_type>		table;
     hasher kh;
     key_equal keql;
     size_type msize;
-    size_type load;
+    size_type grow_at;
+    float max_load;
+
 public:
-    hash_index(size_type init_size = 256) : msize(0), load(0) {
+    hash_index(size_type init_size = 256, float max_load_ = 0.875f)
+	: msize(0), grow_at(0), max_load(max_load_) {
 	assert( (init_size & (init_size-size_type(1))) == 0 );
+	assert( max_load > 0.0f && max_load < 1.0f );
         rehash(init_size);
     }
     
-    ~hash_index() { } // unimplemented, assuming no destructor for Key, T
-
     hasher hash_function() const { return kh; }
     key_equal key_eq() const { return keql; }
 
@@ -91,66 +112,78 @@ public:
 	table.swap( h.table );
 	storage.swap( h.storage );
 	std::swap( kh, h.kh );
+	std::swap( keql, h.keql );
 	std::swap( msize, h.msize );
-	std::swap( load, h.load );
+	std::swap( grow_at, h.grow_at );
+	std::swap( max_load, h.max_load );
     }
 
     void clear() {
-	table.clear();
 	storage.clear();
-	msize = 0;
-	load = 0;
+	std::fill( table.begin(), table.end(), slot_type{ 0, unused_pos } );
     }
 
-    size_t size() const { return load; }
+    size_t size() const { return storage.size(); }
+    bool empty() const { return storage.empty(); }
     
+    // Resize the index table to newsize slots, or to the smallest power of
+    // two that holds all elements within the maximum load factor.
     void rehash(size_type newsize) {
 	assert( (newsize & (newsize-size_type(1))) == 0 );
+	newsize = std::max( newsize, size_type(min_size) );
+	while( size() > slots_to_load( newsize ) )
+	    newsize <<= 1;
+	assert( newsize <= size_type(unused_pos)+1 );
 
-	// New storage
-        decltype(table) newtable( newsize, unused_key );
-
-	// Move over contents
-	for( storage_iterator
-		 I=storage.begin(), E=storage.end(); I != E; ++I ) {
-	    const Key & key = I->second.first;
-	    size_type index = kh( key ) & (newsize-1);
-	    while( newtable[index] != unused_key )
-		index = (index+1) & (newsize-1);
-	    I->first = index;
-	    newtable[index] = I - storage.begin();
-        }
-        newtable.swap(table);
+        decltype(table) newtable( newsize, slot_type{ 0, unused_pos } );
+	newtable.swap( table );
         msize = newsize;
+	grow_at = slots_to_load( newsize );
+
+	for( size_type pos=0; pos < storage.size(); ++pos )
+	    place( slot_type{ uint32_t(storage[pos].hash), uint32_t(pos) },
+		   storage[pos].hash & (msize-1), 0 );
+    }
+
+    // Grow such that n elements fit without rehashing
+    void reserve( size_type n ) {
+	storage.reserve( n );
+	if( n > grow_at ) {
+	    size_type newsize = msize;
+	    while( n > slots_to_load( newsize ) )
+		newsize <<= 1;
+	    rehash( newsize );
+	}
+    }
+
+    // Shrink the element array and the index table to the smallest size
+    // that holds the current elements. Intended for when aggregation is
+    // complete; the table remains usable and grows again on insertion.
+    void freeze() {
+	storage_type( std::make_move_iterator( storage.begin() ),
+		      std::make_move_iterator( storage.end() ),
+		      storage.get_allocator() ).swap( storage );
+	rehash( min_size );
+	table.shrink_to_fit();
     }
 
     size_t capacity() const { return msize; }
 
+    float max_load_factor() const { return max_load; }
+    void max_load_factor( float ml ) {
+	assert( ml > 0.0f && ml < 1.0f );
+	max_load = ml;
+	rehash( msize );
+    }
+
     mapped_type& operator[] (Key const& key) 
     {
-        size_type index = kh(key) & (msize-1);
-        while( table[index] != unused_key
-	      && !keql( storage[table[index]].second.first, key ) ) {
-            index = (index+1) & (msize-1);
-        }
-
-        if( table[index] != unused_key ) {
-            return storage[table[index]].second.second;
-	} else {
-            load++;
-            if(load >= msize>>1) {
-                rehash(msize<<1);
-                index = kh(key) & (msize-1);
-                while( table[index] != unused_key
-		       && !keql( storage[table[index]].second.first, key ) ) {
-                    index = (index+1) & (msize-1);
-                }
-            }
-	    table[index] = storage.size();
-	    storage.push_back(
-		std::make_pair( index, std::make_pair( key, mapped_type() ) ) );
-            return storage.back().second.second;
-        }
+	size_type h = kh(key);
+	size_type index, dist;
+	if( probe( key, h, index, dist ) )
+	    return storage[table[index].pos].value.second;
+	return emplace( value_type( key, mapped_type() ), h, index, dist )
+	    .value.second;
     }
 
     class const_iterator
@@ -159,6 +192,8 @@ public:
 	const_storage_iterator I;
 	    
     public:
+	typedef Hash hasher;
+
         const_iterator( const_storage_iterator _I ) : I( _I ) { }
 
         bool operator == (const_iterator const& other) const {
@@ -171,14 +206,18 @@ public:
 	    ++I;
             return *this;
         }
-        const_reference operator*() { return I->second; }
-	value_type const* operator->() { return &I->second; }
+        const_reference operator*() { return I->value; }
+	value_type const* operator->() { return &I->value; }
+	// The stored hash of the key
+	size_type hash() const { return I->hash; }
     };
 
     class iterator
 	: public std::iterator<std::random_access_iterator_tag, value_type> {
 	storage_iterator I;
     public:
+	typedef Hash hasher;
+
         iterator( storage_iterator _I ) : I( _I ) { }
 
 	operator const_iterator () const {
@@ -192,54 +231,30 @@ public:
 	    return I == other.I;
 	}
         iterator& operator++() { ++I; return *this; }
-        value_type & operator*() { return I->second; }
-	value_type * operator->() { return &I->second; }
-        value_type & operator*() const { return I->second; }
-	value_type * operator->() const { return &I->second; }
+        value_type & operator*() { return I->value; }
+	value_type * operator->() { return &I->value; }
+        value_type & operator*() const { return I->value; }
+	value_type * operator->() const { return &I->value; }
+	size_type hash() const { return I->hash; }
     };
 
 
     std::pair<iterator,bool> insert( const value_type & kv ) {
-	const key_type & key = kv.first;
-        size_type index = kh(key) & (msize-1);
-        while( table[index] != unused_key
-	       && !keql(storage[table[index]].second.first, key ) ) {
-            index = (index+1) & (msize-1);
-        }
+	return insert( kv, kh(kv.first) );
+    }
 
-        if( table[index] != unused_key )
-            return std::make_pair( iterator( storage.begin()+table[index] ),
-				   false );
-        else {
-            load++;
-            if(load >= msize>>1) {
-                rehash(msize<<1);
-                index = kh(key) & (msize-1);
-                while( table[index] != unused_key
-		       && !keql( storage[table[index]].second.first, key ) ) {
-                    index = (index+1) & (msize-1);
-                }
-            }
-            table[index] = storage.size();
-	    storage.push_back( std::make_pair( index, kv ) );
-            return std::make_pair( iterator( storage.begin()+table[index] ),
-				   true );
-        }
+    // Insert with a known hash h, which must equal hash_function()(kv.first)
+    std::pair<iterator,bool> insert( const value_type & kv, size_type h ) {
+	size_type index, dist;
+	if( probe( kv.first, h, index, dist ) )
+            return std::make_pair(
+		iterator( storage.begin()+table[index].pos ), false );
+	emplace( kv, h, index, dist );
+	return std::make_pair( iterator( storage.end()-1 ), true );
     }
 
     template<typename Iterator>
     void insert( Iterator from, Iterator to ) {
-/*
-	// If it is cheap to calculate the number of elements that will be
-	// inserted, do so and estimate that half of them are new.
-	if( std::is_same<typename std::iterator_traits<Iterator>::iterator_tag,
-	    std::random_access_iterator_tag>::value ) {
-	    size_t n = std::distance( from, to ); // O(1)
-	    if( load + n/2 >= msize>>1 )
-		rehash(msize<<1);
-	}
-*/
-
 	while( from != to ) {
 	    insert( *from );
 	    ++from;
@@ -247,27 +262,26 @@ public:
     }
 
     const_iterator find( const key_type &key ) const {
-        size_type index = kh(key) & (msize-1);
-        while( table[index] != unused_key
-	       && !keql( storage[table[index]].second.first, key ) ) {
-            index = (index+1) & (msize-1);
-        }
+	return find( key, kh(key) );
+    }
 
-        if( table[index] != unused_key )
-            return const_iterator( storage.cbegin() + table[index] );
+    iterator find( const key_type &key ) {
+	return find( key, kh(key) );
+    }
+
+    // Lookup with a known hash h, which must equal hash_function()(key)
+    const_iterator find( const key_type &key, size_type h ) const {
+	size_type index, dist;
+	if( probe( key, h, index, dist ) )
+            return const_iterator( storage.cbegin() + table[index].pos );
         else
 	    return cend();
     }
 
-    iterator find( const key_type &key ) {
-        size_type index = kh(key) & (msize-1);
-        while( table[index] != unused_key
-	       && !keql( storage[table[index]].second.first, key ) ) {
-            index = (index+1) & (msize-1);
-        }
-
-        if( table[index] != unused_key )
-            return iterator( storage.begin() + table[index] );
+    iterator find( const key_type &key, size_type h ) {
+	size_type index, dist;
+	if( probe( key, h, index, dist ) )
+            return iterator( storage.begin() + table[index].pos );
         else
 	    return end();
     }
@@ -280,9 +294,69 @@ public:
 
     const_iterator cbegin() const { return const_iterator( storage.cbegin() ); }
     const_iterator cend() const { return const_iterator( storage.cend() ); }
+
+private:
+    static const size_type min_size = 8;
+
+    size_type slots_to_load( size_type slots ) const {
+	return size_type( float(slots) * max_load );
+    }
+
+    // Distance of the element in slot index from its home slot
+    size_type distance( size_type index ) const {
+	return ( index - table[index].hash ) & (msize-1);
+    }
+
+    // Look up key. Returns true if found, with index set to its slot.
+    // Otherwise, index and dist are the slot where key should be placed
+    // and its distance from the home slot.
+    bool probe( const key_type & key, size_type h,
+		size_type & index, size_type & dist ) const {
+	uint32_t h32 = uint32_t(h);
+        index = h & (msize-1);
+	dist = 0;
+	while( table[index].pos != unused_pos && dist <= distance( index ) ) {
+	    if( table[index].hash == h32 ) {
+		const entry_type & e = storage[table[index].pos];
+		if( e.hash == h && keql( e.value.first, key ) )
+		    return true;
+	    }
+            index = (index+1) & (msize-1);
+	    ++dist;
+        }
+	return false;
+    }
+
+    // Append a new element, which is known not to be present
+    entry_type & emplace( const value_type & kv, size_type h,
+			  size_type index, size_type dist ) {
+	assert( storage.size() < size_type(unused_pos) );
+	storage.push_back( entry_type{ kv, h } );
+	slot_type s{ uint32_t(h), uint32_t(storage.size()-1) };
+	if( storage.size() > grow_at )
+	    rehash( msize<<1 );
+	else
+	    place( s, index, dist );
+	return storage.back();
+    }
+
+    // Robin-hood placement of s starting at slot index, at distance dist
+    // from its home slot.
+    void place( slot_type s, size_type index, size_type dist ) {
+	while( table[index].pos != unused_pos ) {
+	    size_type d = distance( index );
+	    if( d < dist ) {
+		std::swap( s, table[index] );
+		dist = d;
+	    }
+            index = (index+1) & (msize-1);
+	    ++dist;
+	}
+	table[index] = s;
+    }
 };
 
-#undef unused_key
+#undef unused_pos
 
 } // namespace asap
 
@@ -55,6 +55,8 @@
 #include <memory>
 #include <cassert>
 
+#include <cilk/cilk.h>
+
 namespace asap {
 
 // storage for flexible cardinality keys
@@ -80,11 +82,18 @@ public:
     // typedef const_iterator;
 
 private:
+    static const size_type merge_partition_size = 4096;
+    static const size_type merge_max_partitions = 256;
+
     typedef typename allocator_type::template rebind<bool>::other bool_allocator_type;
+    typedef typename allocator_type::template rebind<size_type>::other size_allocator_type;
     typedef hash_table<Key, T, Hash, KeyEqual, Allocator> self_type;
 private:
     std::vector<value_type, allocator_type> table;
     std::vector<bool, bool_allocator_type> occupied;
+    // The hash of every key is stored such that probes compare hashes
+    // before keys, and rehashing does not need to hash keys again.
+    std::vector<size_type, size_allocator_type> hashes;
     hasher kh;
     key_equal keql;
     size_type msize;
@@ -113,6 +122,7 @@ public:
     void swap( self_type & h ) {
 	table.swap( h.table );
 	occupied.swap( h.occupied );
+	hashes.swap( h.hashes );
 	std::swap( kh, h.kh );
 	std::swap( msize, h.msize );
 	std::swap( load, h.load );
@@ -121,6 +131,7 @@ public:
     void clear() {
 	table.clear();
 	occupied.clear();
+	hashes.clear();
 	msize = 0;
 	load = 0;
     }
@@ -133,20 +144,23 @@ public:
 	// New storage
         decltype(table) newtable(newsize);
         decltype(occupied) newoccupied(newsize, false);
+        decltype(hashes) newhashes(newsize);
 
 	// Move over contents
         for(size_type i = 0; i < msize; i++) {
             if(occupied[i]) {
-                size_type index = kh(table[i].first) & (newsize-1);
+                size_type index = hashes[i] & (newsize-1);
                 while(newoccupied[index])
                     index = (index+1) & (newsize-1);
 		// std::swap( newtable[index], table[i] );
 		newtable[index] = table[i];
                 newoccupied[index] = true;
+                newhashes[index] = hashes[i];
             }
         }
         newtable.swap(table);
         newoccupied.swap(occupied);
+        newhashes.swap(hashes);
         msize = newsize;
     }
 
@@ -154,10 +168,8 @@ public:
 
     mapped_type& operator[] (Key const& key) 
     {
-        size_type index = kh(key) & (msize-1);
-        while(occupied[index] && !keql(table[index].first, key)) {
-            index = (index+1) & (msize-1);
-        }
+        size_type h = kh(key);
+        size_type index = probe(key, h);
 
         if(occupied[index])
             return table[index].second;
@@ -165,13 +177,11 @@ public:
             load++;
             if(load >= msize>>log_grow) {
                 rehash(msize<<log_grow_by);
-                index = kh(key) & (msize-1);
-                while(occupied[index] && !keql(table[index].first, key)) {
-                    index = (index+1) & (msize-1);
-                }
+                index = probe(key, h);
             }
             table[index].first = key;
             occupied[index] = true;
+            hashes[index] = h;
             return table[index].second;
         }
     }
@@ -183,6 +193,8 @@ public:
         hash_table const* a;
         size_type index;
     public:
+        typedef Hash hasher;
+
         const_iterator(hash_table const& a, int index)
         {
             this->a = &a;
@@ -210,12 +222,16 @@ public:
             }
             return *this;
         }
-        const_reference operator*() {
+        const_reference operator*() const {
             return a->table[index];
         }
-	value_type const* operator->() {
+	value_type const* operator->() const {
             return &a->table[index];
 	}
+        // The stored hash of the key
+        size_type hash() const {
+            return a->hashes[index];
+        }
     };
 
     class iterator : public std::iterator<
@@ -224,6 +240,8 @@ public:
         hash_table * a;
         size_type index;
     public:
+        typedef Hash hasher;
+
         iterator(hash_table & a, int index)
         {
             this->a = &a;
@@ -265,19 +283,24 @@ public:
 	value_type * operator->() const { // key in entry should be const
             return &a->table[index];
 	}
+        size_type hash() const {
+            return a->hashes[index];
+        }
 
 	bool operator == ( const iterator & I ) const {
-	    return &a == &I.a && index == I.index;
+	    return a == I.a && index == I.index;
 	}
     };
 
 
     std::pair<iterator,bool> insert( const value_type & kv ) {
+        return insert( kv, kh(kv.first) );
+    }
+
+    // Insert with a known hash h, which must equal hash_function()(kv.first)
+    std::pair<iterator,bool> insert( const value_type & kv, size_type h ) {
 	const key_type & key = kv.first;
-        size_type index = kh(key) & (msize-1);
-        while(occupied[index] && !keql(table[index].first, key)) {
-            index = (index+1) & (msize-1);
-        }
+        size_type index = probe(key, h);
 
         if(occupied[index])
             return std::make_pair( iterator( *this, index ), false );
@@ -285,13 +308,11 @@ public:
             load++;
             if(load >= msize>>log_grow) {
                 rehash(msize<<log_grow_by);
-                index = kh(key) & (msize-1);
-                while(occupied[index] && !keql(table[index].first, key)) {
-                    index = (index+1) & (msize-1);
-                }
+                index = probe(key, h);
             }
             table[index] = kv;
             occupied[index] = true;
+            hashes[index] = h;
             return std::make_pair( iterator( *this, index ), true );
         }
     }
@@ -315,23 +336,118 @@ public:
 	}
     }
 
-    const_iterator find( const key_type &key ) const {
-        size_type index = kh(key) & (msize-1);
-        while(occupied[index] && !keql(table[index].first, key)) {
-            index = (index+1) & (msize-1);
+    // Combine all elements of rhs into *this. An element whose key is new
+    // is inserted with value fn( mapped_type(0), rhs value ), otherwise
+    // fn( value, rhs value ) is applied in place.
+    // The table is grown once to hold both tables. The slots are then split
+    // into partitions by the top bits of the home slot, which are processed
+    // in parallel. Each partition inserts the elements of rhs whose home slot
+    // lies within it. Probe sequences that run into the next partition are
+    // deferred and completed sequentially.
+    template<typename Reducer>
+    void merge( const hash_table & rhs, Reducer fn ) {
+        size_type need = load + rhs.load;
+        size_type newsize = msize;
+        while(need >= newsize>>log_grow)
+            newsize <<= log_grow_by;
+        if(newsize != msize)
+            rehash(newsize);
+
+        // Partitions cover whole words of the occupied bitmap
+        size_type nparts = std::min( msize / merge_partition_size,
+                                     size_type(merge_max_partitions) );
+        if(nparts < 2 || rhs.load < merge_partition_size) {
+            for(size_type i = 0; i < rhs.msize; i++)
+                if(rhs.occupied[i])
+                    merge_one( rhs.table[i], rhs.hashes[i], fn );
+            return;
         }
 
+        size_type shift = 0;
+        while((nparts << shift) < msize)
+            shift++;
+        size_type nchunks = std::min( nparts, rhs.msize );
+        size_type chunk = rhs.msize / nchunks;
+
+        // Bucket the elements of rhs by partition (counting sort)
+        std::vector<size_type> home(rhs.msize);
+        std::vector<size_type> start(nparts*nchunks+1, 0);
+        cilk_for(size_type c = 0; c < nchunks; c++) {
+            for(size_type i = c*chunk; i < (c+1)*chunk; i++) {
+                if(rhs.occupied[i]) {
+                    home[i] = rhs.hashes[i] & (msize-1);
+                    start[(home[i]>>shift)*nchunks+c+1]++;
+                }
+            }
+        }
+        for(size_type k = 0; k < nparts*nchunks; k++)
+            start[k+1] += start[k];
+
+        std::vector<size_type> order(rhs.load);
+        cilk_for(size_type c = 0; c < nchunks; c++) {
+            for(size_type i = c*chunk; i < (c+1)*chunk; i++) {
+                if(rhs.occupied[i])
+                    order[start[(home[i]>>shift)*nchunks+c]++] = i;
+            }
+        }
+        // start[p*nchunks+c] now holds the end of bucket (p,c)
+
+        std::vector<size_type> added(nparts, 0);
+        std::vector<std::vector<size_type>> deferred(nparts);
+        cilk_for(size_type p = 0; p < nparts; p++) {
+            size_type hi = (p+1) << shift;
+            size_type k = p == 0 ? 0 : start[p*nchunks-1];
+            size_type e = start[(p+1)*nchunks-1];
+            for(; k < e; k++) {
+                size_type i = order[k];
+                const value_type & kv = rhs.table[i];
+                size_type index = home[i];
+                size_type h = rhs.hashes[i];
+                while(index < hi && occupied[index]
+                      && !(hashes[index] == h
+                           && keql(table[index].first, kv.first)))
+                    index++;
+                if(index == hi) {
+                    deferred[p].push_back(i);
+                } else if(occupied[index]) {
+                    fn( table[index].second, kv.second );
+                } else {
+                    table[index] = value_type( kv.first, mapped_type(0) );
+                    fn( table[index].second, kv.second );
+                    occupied[index] = true;
+                    hashes[index] = h;
+                    added[p]++;
+                }
+            }
+        }
+
+        for(size_type p = 0; p < nparts; p++)
+            load += added[p];
+        for(size_type p = 0; p < nparts; p++)
+            for(size_type i : deferred[p])
+                merge_one( rhs.table[i], rhs.hashes[i], fn );
+    }
+
+    const_iterator find( const key_type &key ) const {
+        return find( key, kh(key) );
+    }
+
+    iterator find( const key_type &key ) {
+        return find( key, kh(key) );
+    }
+
+    // Lookup with a known hash h, which must equal hash_function()(key)
+    const_iterator find( const key_type &key, size_type h ) const {
+        size_type index = probe(key, h);
+
         if(occupied[index])
             return const_iterator( *this, index );
         else
 	    return cend();
     }
 
-    iterator find( const key_type &key ) {
-        size_type index = kh(key) & (msize-1);
-        while(occupied[index] && !keql(table[index].first, key)) {
-            index = (index+1) & (msize-1);
-        }
+    iterator find( const key_type &key, size_type h ) {
+        size_type index = probe(key, h);
 
         if(occupied[index])
             return iterator( *this, index );
@@ -362,6 +478,23 @@ public:
     const_iterator cend() const {
         return const_iterator(*this, msize); 
     }
+
+private:
+    template<typename Reducer>
+    void merge_one( const value_type & kv, size_type h, Reducer & fn ) {
+        std::pair<iterator,bool> ret
+            = insert( value_type( kv.first, mapped_type(0) ), h );
+        fn( ret.first->second, kv.second );
+    }
+
+    size_type probe( const key_type & key, size_type h ) const {
+        size_type index = h & (msize-1);
+        while(occupied[index]
+              && !(hashes[index] == h && keql(table[index].first, key))) {
+            index = (index+1) & (msize-1);
+        }
+        return index;
+    }
 };
 
 } // namespace asap
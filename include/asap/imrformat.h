@@ -17,379 +17,110 @@
 */
 
 
-#ifndef INCLUDED_ASAP_ARFF_H
-#define INCLUDED_ASAP_ARFF_H
+#ifndef INCLUDED_ASAP_IMRFORMAT_H
+#define INCLUDED_ASAP_IMRFORMAT_H
 
 #include <stdexcept>
 #include <cctype>
 #include <cstdlib>
-#include <array>
+#include <cstdio>
 
 #include "asap/memory.h"
 #include "asap/traits.h"
 #include "asap/data_set.h"
 #include "asap/word_count.h"
+#include "asap/record_parser.h"
 
 namespace asap {
 
-struct NZDelim {
-    bool operator () ( char c ) const { 
-	return ( c == ',' ) | ( c == ')' );
-    }
-};
-
-struct IsAlnum {
-    bool operator () ( char c ) const { 
-	return std::isalnum(c);
-    }
-};
-
-struct NewLine {
-    bool operator () ( char c ) const { 
-	return c == '\n';
-    }
-};
-
-struct NonBlank {
-    bool operator () ( char c ) const { 
-	return !std::isspace(c);
-    }
-};
-
 namespace array {
 
-// Skip all white-space (blank lines) as well as lines with comments
-#if 1
-void skip_blank_lines( char * & p, char * end ) {
-    while( std::isspace(*p) )
-	++p;
-    while( *p == '%' ) {
-	++p;
-	while( *p != '\n' )
-	    if( *p++ == '\0' )
-		return;
-	while( std::isspace(*p) )
-	    ++p;
-    }
-}
-#else
-void skip_blank_lines( char * & p, char * end ) {
-    if( (p = std::find_if( p, end, NonBlank() )) == end )
-	return;
-    while( *p == '%' ) {
-	++p;
-	if( (p = std::find_if( p, end, NewLine() )) == end )
-	    return;
-	++p;
-	if( (p=std::find_if( p, end, NonBlank() )) == end )
-	    return;
-    }
-}
-#endif
-
-// Update dense_vector
-template<typename vector_type, typename = void>
-class record_value {
-    vector_type & vector;
-    typename vector_type::index_type nexti;
-public:
-    record_value( vector_type & vector_ ) : vector( vector_ ), nexti( 0 ) { }
-
-    void operator () ( typename vector_type::value_type v ) {
-	assert( nexti < vector.length() ); // throw
-	vector[nexti++] = v;
-    }
-    void operator () ( typename vector_type::index_type i,
-		       typename vector_type::value_type v ) {
-	assert( 0 <= i && i < vector.length() ); // throw
-	vector[i] = v;
-    }
-};
-
-// Update sparse_vector
-template<typename vector_type>
-class record_value<vector_type,
-		   typename std::enable_if<is_sparse_vector<vector_type>::value>::type> {
-    vector_type & vector;
-    typename vector_type::index_type pos, idx;
-public:
-    record_value( vector_type & vector_ ) : vector( vector_ ), pos( 0 ), idx( 0 ) { }
-
-    void operator () ( typename vector_type::value_type v ) {
-	assert( pos < vector.length() ); // throw
-	if( v > 0 )
-	    vector.set( pos++, v, idx );
-	++idx;
-    }
-    void operator () ( typename vector_type::index_type i,
-		       typename vector_type::value_type v ) {
-	assert( 0 <= i && i < vector.length() ); // throw
-	if( v > 0 )
-	    vector.set( pos++, v, i );
-    }
-};
+typedef parse::imr_syntax syntax;
+typedef parse::nz_delim<')'> NZDelim;
 
+using parse::skip_blank_lines;
 
 template<typename vector_type>
-bool
-read_dense_vector( char *& p, char * end, vector_type & vector ) {
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) { return false; } ++pp; } while( 0 )
-    // assert( *p != '[' );
-    while( *p != '[' )
-        ADVANCE( p );
-    ADVANCE( p );
-    record_value<vector_type> recorder( vector );
-    do {
-	while( std::isspace( *p ) )
-	    ADVANCE( p );
-	if( *p == '?' )
-	    fatal( "missing data not supported" );
-	typename vector_type::value_type v = 0;
-#if REAL_IS_INT
-	v = std::strtoul( p, &p, 10 );
-#else
-	v = std::strtod( p, &p );
-#endif
-	recorder( v );
-	// while( std::isspace( *p ) && *p != '\n' )
-	while( ( std::isspace( *p ) || *p == ',' || *p == ']' || *p == ')' ) && (*p != '\n') )
-	    ADVANCE( p );
-	while( std::isspace( *p ) && *p != '\n' )
-	    ADVANCE( p );
-    } while( *p != '\n' );
-    return true;
-#undef ADVANCE
+bool read_vector( char *& p, char * end, vector_type & vector ) {
+    return parse::read_vector<syntax>( p, end, vector );
 }
 
-template<typename vector_type>
-bool
-read_sparse_vector( char *& pref, char * end, vector_type & vector ) {
-    // We will only be overwriting a few elements, so clear everything first
-    if( is_dense_vector<vector_type>::value )
-	vector.clear();
-
-    record_value<vector_type> recorder( vector );
-
-    char * p = pref;
-
-    while( *p != '[' )
-        ++p;
- 
-    assert( *p == '[' );
-    ++p;
-    while( std::isspace( *p ) )
+// Number of values in the first record, which determines the dimensions.
+inline size_t count_dimensions( char * p, char * end ) {
+    parse::skip_blank_lines( p, end );
+    size_t ndim = 0;
+    while( *p != syntax::dense_open && *p != '\n' && *p != '\0' )
 	++p;
+    if( *p != syntax::dense_open )
+	return 0;
+    ++p;
     do {
-	typename vector_type::index_type i = std::strtoul( p, &p, 10 );
-	while( std::isspace( *p ) || *p == ':' )
+	while( std::isspace( *p ) && *p != '\n' )
 	    ++p;
-	if( *p == ']' )
-	    break;
-	if( *p == '?' )
-	    fatal( "missing data not supported" );
-	typename vector_type::value_type vv = 0;
-#if REAL_IS_INT
-	vv = std::strtoul( p, &p, 10 );
-#else
-	vv = std::strtod( p, &p );
-#endif
-	// vector[i] = vv;
-	recorder( i, vv );
-
-	if( (p = std::find_if( p, end, NZDelim() )) == end ) {
-	    pref = p;
-	    return false;
-	}
-	if( *p == ')' )
+	char * s = p;
+	parse::scan_value<double>( p );
+	if( p == s )
 	    break;
-	++p;
-	while( std::isspace( *p ) )
-	    ++p;
-    } while( *p != ')' ); // && *p != '\n' );
-    ++p;
-    pref = p;
-    return true;
-}
-
-template<typename vector_type>
-bool read_vector( char *& p, char * end, vector_type & vector ) {
-    if( *p == '{' ) 
-	return read_sparse_vector( p, end, vector );
-    else
-	return read_dense_vector( p, end, vector );
-}
-
-template<typename WordBankTy>
-const char * read_relation( char *& p, WordBankTy & idx ) {
-    while( std::isspace(*p) && *p != '\n' )
-	++p;
-    char * relation = p;
-    if( *p == '\'' ) { // scan until closing quote
-	++p;
-	while( *p != '\'' ) {
-	    if( *p == '\\' ) // skip next character
-		++p;
-	    if( *p == '\0' )
-		return 0;
+	++ndim;
+	while( ( std::isspace( *p ) || syntax::is_value_sep( *p ) )
+	       && *p != '\n' )
 	    ++p;
-	}
-	// Skip closing quote
-	++p;
-    } else { // scan until space
-	while( !std::isspace( *p ) ) {
-	    if( *p == '\0' )
-		return 0;
-	    ++p;
-	}
-    }
-    const char * stored
-	= idx.memorize( relation, p-relation ); // Store relation, not indexed
-    ++p; // delimiter replaced by '\0'
-    return stored;
+    } while( *p != '\n' && *p != '\0' );
+    return ndim;
 }
 
-template<typename WordBankTy>
-const char * read_attribute( char *& p, WordBankTy & idx ) {
-    // Isolate token
-    while( std::isspace( *p ) )
-	++p;
-    char * name = p;
-    while( !std::isspace( *p ) )
-	if( *p++ == '\0' )
-	    return 0;
-    const char * stored = idx.index( name, p-name ); // Store name in index
-    ++p; // space replaced by '\0'
-
-    // Isolate type
-    while( std::isspace( *p ) )
-	++p;
-    char * type = p;
-    while( !std::isspace( *p ) )
-	if( *p++ == '\0' )
-	    return 0;
-    // Delineate end of data type by overwriting space
-    *p++ = '\0';
-    if( strcmp( type, "numeric" ) ) {
-	std::cerr << "Warning: treating non-numeric attribute '"
-		  << stored << "' of type '" << type << "' as numeric\n";
+// Record keys are not of interest to the ASAP workflow. Attributes are
+// named by their position, starting from 1.
+template<typename WordContainerTy>
+void index_attributes( WordContainerTy & idx, size_t ndim ) {
+    size_t len = 0;
+    for( size_t i=1; i <= ndim; ++i )
+	len += snprintf( nullptr, 0, "%lu", (unsigned long)i ) + 1;
+
+    char * buf = new char[len+1];
+    std::shared_ptr<char> sp( buf, std::default_delete<char[]>() );
+    if( !WordContainerTy::is_managed )
+	idx.enregister( sp );
+    char * p = buf;
+    for( size_t i=1; i <= ndim; ++i ) {
+	int n = sprintf( p, "%lu", (unsigned long)i );
+	idx.index( p, n );
+	p += n + 1;
     }
-
-    return stored; // ignoring type as we only consider numeric types ...
-}
-template<typename WordBankTy>
-const char * read_column_header( char *& p, WordBankTy & idx ) {
-    char * name = p;
-    const char * stored = idx.index( name, p-name ); // Store name in index
-    return stored; // ignoring type as we only consider numeric types ...
-}
-
 }
 
-size_t count_lines( const char * p ) {
-    size_t nlines = 0;
-    while( *p ) {
-	if( *p == '\n' )
-	    ++nlines;
-	++p;
-    }
-    return nlines;
-}
-
-size_t count_nonzeros( const char * p, const char * end ) {
-    size_t nvalues = 0;
-    ++p; // skip opening curly brace
-    const char * prevp = p;
-    while( (p = std::find_if( p, end, NZDelim() )) != end ) {
-	if( *p == ']' )
-	    break;
-	++p;
-	++nvalues;
-	prevp = p;
-    }
-    if( std::find_if( prevp, p, IsAlnum() ) != p )
-	++nvalues;
-    return nvalues;
-}
-
-size_t count_nonzeros_filtered( char * p, char * end ) {
-    size_t nvalues = 0;
-
-    while( *p != '[' )
-        ++p;
- 
-    assert( *p == '[' );
-    ++p;
-    while( std::isspace( *p ) )
-	++p;
-    do {
-	if( *p == ']' )
-	    break;
-#if REAL_IS_INT
-	if( std::strtoul( p, &p, 10 ) )
-	    ++nvalues;
-#else
-	if( std::strtod( p, &p ) )
-	    ++nvalues;
-#endif
-	if( *p == ')' )
-	    break;
-	++p;
-	while( std::isspace( *p ) )
-	    ++p;
-    } while( *p != ')' ); // && *p != '\n' );
-    return nvalues;
-}
-
-
-std::pair<size_t,size_t> count_values( const char * p, const char * end ) {
-    size_t npoints = 0;
-    size_t nvalues = 0;
-
-    const char * prevp = p;
-    while( (p=std::find_if( p, end, NZDelim() )) != end ) {
-	if( *p == ',' ) {
-	    ++nvalues;
+// Split the data in all parts into chunks. Returns the dimensions, which
+// must agree between the first records of all non-empty parts.
+template<typename WordContainerTy>
+size_t split_parts( const parse::part_buffers<WordContainerTy> & parts,
+		    const std::vector<std::string> & names,
+		    std::vector<parse::chunk> & chunks ) {
+    size_t nparts = parts.size();
+    std::vector<size_t> part_ndim( nparts );
+    cilk_for( size_t i=0; i < nparts; ++i )
+	part_ndim[i] = count_dimensions( parts.get_buffer( i ),
+					 parts.get_buffer_end( i ) );
+
+    size_t ndim = 0, first = 0;
+    for( size_t i=0; i < nparts; ++i ) {
+	if( part_ndim[i] != 0 ) {
+	    if( ndim == 0 ) {
+		ndim = part_ndim[i];
+		first = i;
+	    } else if( part_ndim[i] != ndim )
+		fatal( "Dimensions of input file '", names[i],
+		       "' do not match those of '", names[first], "'" );
 	}
-	else if( *p == ']' ) {
-	    ++npoints;
-	    if( std::find_if( prevp, p, IsAlnum() ) != p )
-		++nvalues;
-	}
-	++p;
-	prevp = p;
+	parse::split_lines( parts.get_buffer( i ), parts.get_buffer_end( i ),
+			    chunks );
     }
-
-    return std::make_pair( npoints, nvalues );
-}
-
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_dense_vector<VectorTy>::value>::type
-create_vector( Container & container, const char * p, const char * end,
-	       size_t ndim ) {
-    container.emplace_back( ndim );
-}
-
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_sparse_vector<VectorTy>::value>::type
-create_vector( Container & container, const char * p, const char * end,
-	       size_t ndim ) {
-    container.emplace_back( ndim, count_nonzeros_filtered( (char *)p, (char *)end ) );
-}
-
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_dense_vector<VectorTy>::value>::type
-init_vector( Container & container, const char * p, const char * end,
-	     size_t ndim ) {
+    return ndim;
 }
 
-template<typename VectorTy, typename Container>
-typename std::enable_if<is_sparse_vector<VectorTy>::value>::type
-init_vector( Container & container, const char * p, const char * end,
-	     size_t ndim ) {
-    container.emplace_back( ndim, count_nonzeros_filtered( (char *)p, (char *)end ) );
 }
 
-
+// IMR format: one record per line, (u'key', [v, w, ...]). The input may be
+// a single file or a directory of part files.
 // Basic implementation where vectors are individually allocated
 template<typename DataSetTy>
 typename std::enable_if<
@@ -399,79 +130,29 @@ array_read( const std::string & filename, bool &is_stored_sparse ) {
     typedef DataSetTy data_set_type;
     typedef typename data_set_type::vector_type vector_type;
     typedef typename data_set_type::index_list_type index_list_type;
-    typedef typename vector_type::index_type index_type;
-    typedef typename vector_type::value_type value_type;
-    typedef index_list_type word_container_type;
-
-    std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
 
-    word_container_type &                 m_container = *idx;
-
-
-    word_container_file_builder<index_list_type> idx_builder( filename, *idx );
+    std::vector<std::string> names = get_part_listing( filename );
+    parse::part_buffers<index_list_type> parts( names );
 
     std::shared_ptr<std::vector<vector_type>> vec_ptr
 	= std::make_shared<std::vector<vector_type>>();
-    std::vector<vector_type> & vec = *vec_ptr;
 
     const char * relation = "undefined";
     bool is_sparse = false;
 
-    // Now parse the data
-    char * p = idx_builder.get_buffer();
-    char * end = idx_builder.get_buffer_end();
-
-    // Fudge fake id's as we don't care about them for ASAP workflow
-    char labels[24][10];
-    for(int i = 0; i < 24; ++i)
-    {
-        sprintf(labels[i],"%d",i+1);
-    }
-    for(auto text : labels) {   // Range-for!
-       const char * stored = (*idx).index( text, strlen(text)+1 ); // Store name in index
-    }
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) goto END_OF_FILE; ++pp; } while( 0 )
-    do {
-        array::skip_blank_lines( p, end );
-        while( *p != '(' )
-            ADVANCE( p );
-        ADVANCE( p );
-
-#ifdef IMR
-            int ndim = 24;
-#else
-            int ndim = idx_builder.size();
-#endif
-            p += 4;
-
-	    array::skip_blank_lines( p, end );
-
-	    do {
-		is_sparse |= *p == '{';
-		// Create vector speculatively...
-		create_vector<vector_type>( vec, p, end, ndim );
-		if( !array::read_vector( p, end, vec.back() ) ) {
-		    // Oops, no vector after all...
-		    // This should happen at most once per file
-		    vec.pop_back();
-		}
-		array::skip_blank_lines( p, end );
-	    } while( *p != '\0' );
-    } while( 1 );
-#undef ADVANCE
-
-END_OF_FILE:
+    std::vector<parse::chunk> chunks;
+    size_t ndim = array::split_parts( parts, names, chunks );
 
-    is_stored_sparse = is_sparse;
-    return data_set_type( relation, idx, vec_ptr );
+    std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
+    array::index_attributes( *idx, ndim );
 
+    parse::read_records<array::syntax>( chunks, ndim, *vec_ptr, is_sparse );
 
     is_stored_sparse = is_sparse;
     return data_set_type( relation, idx, vec_ptr );
 }
 
-#ifndef IMR
-// Specialization for dense vectors without ownership. Ownership of the
+// Specialization for vectors without ownership. Ownership of the
 // vector contents are referred to the data_set for efficiency reasons.
 template<typename DataSetTy>
 typename std::enable_if<
@@ -479,175 +160,27 @@ typename std::enable_if<
     DataSetTy>::type
 array_read( const std::string & filename, bool &is_stored_sparse ) {
     typedef DataSetTy data_set_type;
-    typedef typename data_set_type::vector_type vector_type;
     typedef typename data_set_type::index_list_type index_list_type;
-    typedef typename vector_type::index_type index_type;
-    typedef typename vector_type::value_type value_type;
     typedef typename data_set_type::vector_list_type vector_set_type;
 
-    std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
-    word_container_file_builder<index_list_type> idx_builder( filename, *idx );
+    std::vector<std::string> names = get_part_listing( filename );
+    parse::part_buffers<index_list_type> parts( names );
 
     const char * relation = "undefined";
     bool is_sparse = false;
 
-    // Now parse the data
-    char * p = idx_builder.get_buffer();
-    char * end = idx_builder.get_buffer_end();
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) goto END_OF_FILE; ++pp; } while( 0 )
-    size_t num_points;
-    do {
-	array::skip_blank_lines( p, end );
-	while( *p != '@' )
-	    ADVANCE( p );
-	ADVANCE( p );
-	if( !strncasecmp( p, "relation ", 9 ) ) {
-	    p += 9;
-	    if( !(relation = array::read_relation( p, idx_builder.get_word_list() )) )
-		fatal( "Incomplete relation specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "attribute ", 10 ) ) {
-	    p += 10;
-	    if( !array::read_attribute( p, idx_builder.get_word_list() ) )
-		fatal( "Incomplete attribute specifier in input file '",
-		       filename, "'" );
-	} else if( !strncasecmp( p, "data", 4 ) ) {
-	    // From now on everything is data
-	    int ndim = idx_builder.size();
-	    p += 4;
-
-	    array::skip_blank_lines( p, end );
-
-	    return [&]() -> data_set_type {
-		// Estimate upper bound on space needed to store all vectors.
-		// Assumptions:
-		//   + At most one vector per line
-		//   + Dense vectors, so fixed vector size
-		std::pair<size_t,size_t> info = count_values(p, end);
-		// size_t max_points = count_lines(p);
-		size_t max_points = info.first;
-		size_t max_values = info.second;
-		std::shared_ptr<vector_set_type> dvs_ptr
-		    = std::make_shared<vector_set_type>(
-			max_points, is_sparse_vector<vector_type>::value ?
-			max_values : ndim );
-		vector_set_type & dvs = *dvs_ptr;
-		dvs.clear(); // zero-init
-
-		if( !max_points )
-		    goto END_OF_FILE;
-
-		num_points = 0;
-
-		do {
-		    is_sparse |= *p == '(';
-
-		    assert( num_points < max_points );
-		    init_vector<vector_type>( dvs, p, end, ndim );
-		    if( !array::read_vector( p, end, dvs[num_points++] ) ) {
-			// Oops, no vector after all...
-			// This should happen at most once per file.
-			--num_points;
-		    }
-		    array::skip_blank_lines( p, end );
-		} while( *p != '\0' );
-	    END_OF_FILE:
-		dvs.trim_number( num_points );
-		is_stored_sparse = is_sparse;
-		return data_set_type( relation, idx, dvs_ptr );
-	    }();
-	}
-    } while( 1 );
-#undef ADVANCE
-
-END_OF_FILE:
-
-    is_stored_sparse = is_sparse;
-    return data_set_type( relation, idx, std::make_shared<vector_set_type>( 0, 0 ) );
-}
-#endif
-
-// Version for IMR input format to k-means, basic array format
-// Specialization for dense vectors without ownership. Ownership of the
-// vector contents are referred to the data_set for efficiency reasons.
-template<typename DataSetTy>
-typename std::enable_if<
-    std::is_same<typename DataSetTy::vector_type::memory_mgmt_type, mm_no_ownership_policy>::value,
-    DataSetTy>::type
-array_read( std::string & filename, bool &is_stored_sparse ) {
-    typedef DataSetTy data_set_type;
-    typedef typename data_set_type::vector_type vector_type;
-    typedef typename data_set_type::index_list_type index_list_type;
-    typedef typename vector_type::index_type index_type;
-    typedef typename vector_type::value_type value_type;
-    typedef typename data_set_type::vector_list_type vector_set_type;
+    std::vector<parse::chunk> chunks;
+    size_t ndim = array::split_parts( parts, names, chunks );
 
     std::shared_ptr<index_list_type> idx = std::make_shared<index_list_type>();
-    word_container_file_builder<index_list_type> idx_builder( filename, *idx );
+    array::index_attributes( *idx, ndim );
 
-    const char * relation = "undefined";
-    bool is_sparse = false;
-
-    // Now parse the data
-    char * p = idx_builder.get_buffer();
-    char * end = idx_builder.get_buffer_end();
-#define ADVANCE(pp) do { if( *(pp) == '\0' ) goto END_OF_FILE; ++pp; } while( 0 )
-    size_t num_points;
-    do {
-	array::skip_blank_lines( p, end );
-	while( *p != '(' )
-	    ADVANCE( p );
-	ADVANCE( p );
-	    int ndim = idx_builder.size();
-	    p += 4;
-
-	    // array::skip_blank_lines( p, end );
-
-	    return [&]() -> data_set_type {
-		// Estimate upper bound on space needed to store all vectors.
-		// Assumptions:
-		//   + At most one vector per line
-		//   + Dense vectors, so fixed vector size
-		std::pair<size_t,size_t> info = count_values(p, end);
-		// size_t max_points = count_lines(p);
-		size_t max_points = info.first;
-		size_t max_values = info.second;
-		std::shared_ptr<vector_set_type> dvs_ptr
-		    = std::make_shared<vector_set_type>(
-			max_points, is_sparse_vector<vector_type>::value ?
-			max_values : ndim );
-		vector_set_type & dvs = *dvs_ptr;
-		dvs.clear(); // zero-init
-
-		if( !max_points )
-		    goto END_OF_FILE;
-
-		num_points = 0;
-
-		do {
-		    is_sparse |= *p == '(';
-
-		    assert( num_points < max_points );
-		    init_vector<vector_type>( dvs, p, end, ndim );
-		    if( !array::read_vector( p, end, dvs[num_points++] ) ) {
-			// Oops, no vector after all...
-			// This should happen at most once per file.
-			--num_points;
-		    }
-		    array::skip_blank_lines( p, end );
-		} while( *p != '\0' );
-	    END_OF_FILE:
-		dvs.trim_number( num_points );
-		is_stored_sparse = is_sparse;
-		return data_set_type( relation, idx, dvs_ptr );
-	    }();
-    } while( 1 );
-#undef ADVANCE
-
-END_OF_FILE:
+    std::shared_ptr<vector_set_type> dvs_ptr
+	= parse::read_record_set<array::syntax, vector_set_type>(
+	    chunks, ndim, is_sparse );
 
     is_stored_sparse = is_sparse;
-    return data_set_type( relation, idx, std::make_shared<vector_set_type>( 0, 0 ) );
+    return data_set_type( relation, idx, dvs_ptr );
 }
 
 namespace array {
@@ -743,4 +276,4 @@ void array_write( const std::string & filename,
 
 }
 
-#endif // INCLUDED_ASAP_ARFF_H
+#endif // INCLUDED_ASAP_IMRFORMAT_H
@@ -21,11 +21,18 @@
 #define INCLUDED_ASAP_IO_H
 
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
 
 #include <memory>
 #include <cerrno>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <cilk/cilk.h>
 
 #include "asap/word_bank.h"
 
@@ -33,69 +40,208 @@ namespace asap {
 
 namespace internal {
 
-template<typename ContainerTy>
-size_t getdir( const std::string & dirname, ContainerTy & files,
-	       bool recursive = true ) {
-    DIR *dp;
-    struct dirent *dirp;
-    if((dp  = opendir(dirname.c_str())) == NULL)
-	fatale( "opendir", dirname );
+// Entries of a directory, read in large batches with getdents64 where
+// available. Takes ownership of the descriptor.
+class dir_reader {
+    const char	      * m_path;		// for error messages
+#ifdef SYS_getdents64
+    int			m_fd;
+    std::vector<char>	m_buf;
+    size_t		m_pos, m_len;
+#else
+    DIR		      * m_dp;
+#endif
 
-    size_t total_size = 0;
+public:
+    static const size_t buffer_size = size_t(32)<<10;
 
-    while ((dirp = readdir(dp)) != NULL) {
-	const char * file = files.append( 0, dirname.c_str(), dirname.length() );
-	file = files.append( file, "/", 1 );
-	file = files.append( file, dirp->d_name, strlen(dirp->d_name) );
-
-        struct stat buf;
-        if( lstat( file, &buf ) < 0 )
-	    fatale( "lstat", file );
-
-        if (S_ISREG(buf.st_mode)) {
-            files.index_only(file);
-	    total_size += buf.st_size;
-	} else if( S_ISLNK(buf.st_mode) ) {
-	    char lnk[256];
-	    strncpy( lnk, file, sizeof(lnk) );
-	    size_t nbp = strlen( file )-1;
-	    while( lnk[nbp] != '/' && nbp > 0 )
-		--nbp;
-	    if( lnk[nbp] == '/' )
-		++nbp; // forward from '/'
-	    ssize_t nb = readlink(file, &lnk[nbp], sizeof(lnk)-nbp);
-	    if( nb < 0 )
-		fatale( "readlink", file );
-
-	    lnk[nbp+nb] = '\0';
-
-	    if( lstat( lnk, &buf ) < 0 )
-		fatale( "lstat symlink", lnk );
-	    if( S_ISREG(buf.st_mode) ) {
-		files.erase(file);
-		files.index(lnk, nbp+nb);
-		total_size += buf.st_size;
-	    }
-	} else if( S_ISDIR(buf.st_mode) && recursive ) {
-	    if( strcmp( dirp->d_name, "." ) && strcmp( dirp->d_name, ".." ) ) {
-		std::string subdir = file;
-		files.erase(file);
-		total_size += getdir( subdir, files, recursive );
-	    } else
-		files.erase(file);
-	} else
-	    files.erase(file);
+#ifdef SYS_getdents64
+    dir_reader( int fd, const char * path )
+	: m_path( path ), m_fd( fd ), m_buf( buffer_size ), m_pos( 0 ),
+	  m_len( 0 ) { }
+    ~dir_reader() { close( m_fd ); }
+#else
+    dir_reader( int fd, const char * path ) : m_path( path ) {
+	if( (m_dp = fdopendir( fd )) == NULL )
+	    fatale( "fdopendir", m_path );
     }
+    ~dir_reader() { closedir( m_dp ); }
+#endif
+    dir_reader( const dir_reader & ) = delete;
+    dir_reader & operator = ( const dir_reader & ) = delete;
 
-    closedir(dp);
+    int fd() const {
+#ifdef SYS_getdents64
+	return m_fd;
+#else
+	return dirfd( m_dp );
+#endif
+    }
+
+    // The next entry and its type (DT_*), which may be DT_UNKNOWN. Returns
+    // false at the end of the directory.
+    bool next( const char * & name, unsigned char & type ) {
+#ifdef SYS_getdents64
+	if( m_pos == m_len ) {
+	    long n = syscall( SYS_getdents64, m_fd, &m_buf[0], m_buf.size() );
+	    if( n < 0 )
+		fatale( "getdents64", m_path );
+	    if( n == 0 )
+		return false;
+	    m_pos = 0;
+	    m_len = n;
+	}
+	const struct dirent64 * d
+	    = reinterpret_cast<const struct dirent64 *>( &m_buf[m_pos] );
+	m_pos += d->d_reclen;
+	name = d->d_name;
+	type = d->d_type;
+	return true;
+#else
+	struct dirent * d = readdir( m_dp );
+	if( d == NULL )
+	    return false;
+	name = d->d_name;
+	type = d->d_type;
+	return true;
+#endif
+    }
+};
+
+// The files of a directory and its subdirectories, in the order read. The
+// paths of the files are held consecutively, null-terminated.
+struct dir_node {
+    static const size_t no_dir = ~size_t(0);
+
+    struct item {
+	size_t name;	// offset in paths
+	size_t len;
+	size_t size;
+	size_t dir;	// index in dirs, or no_dir for a file
+    };
+
+    std::string				path;
+    std::string				name;	// relative to the parent
+    std::string				paths;
+    std::vector<item>			items;
+    std::vector<std::unique_ptr<dir_node>> dirs;
+
+    dir_node( const std::string & path_, const std::string & name_ )
+	: path( path_ ), name( name_ ) { }
+
+    void add_file( const std::string & file, size_t size ) {
+	items.push_back( item{ paths.size(), file.size(), size, no_dir } );
+	paths += file;
+	paths += '\0';
+    }
+    void add_dir( const char * n ) {
+	items.push_back( item{ 0, 0, 0, dirs.size() } );
+	dirs.emplace_back( new dir_node( path + "/" + n, n ) );
+    }
+};
+
+inline std::string read_link( int at, const char * name,
+			      const std::string & file ) {
+    std::vector<char> buf( 256 );
+    while( true ) {
+	ssize_t nb = readlinkat( at, name, &buf[0], buf.size() );
+	if( nb < 0 )
+	    fatale( "readlink", file );
+	if( size_t(nb) < buf.size() )
+	    return std::string( &buf[0], nb );
+	buf.resize( 2 * buf.size() );
+    }
+}
+
+// List the directory name, relative to the directory open as at, into node.
+// Entries are looked up relative to the directory and stat calls are
+// avoided where the entry type is known. Subdirectories are listed in
+// parallel, one task each; the descriptor of the directory stays open for
+// them until they complete.
+inline void walk_dir( int at, dir_node & node, bool recursive ) {
+    int fd = openat( at, node.name.c_str(),
+		     O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if( fd < 0 )
+	fatale( "opendir", node.path );
+    dir_reader rd( fd, node.path.c_str() );
+
+    const char * n;
+    unsigned char type;
+    while( rd.next( n, type ) ) {
+	if( !strcmp( n, "." ) || !strcmp( n, ".." ) )
+	    continue;
+
+	struct stat buf;
+	bool have_stat = false;
+	if( type == DT_UNKNOWN ) {
+	    if( fstatat( fd, n, &buf, AT_SYMLINK_NOFOLLOW ) < 0 )
+		fatale( "lstat", node.path + "/" + n );
+	    type = IFTODT( buf.st_mode );
+	    have_stat = true;
+	}
 
+	if( type == DT_REG ) {
+	    std::string file = node.path + "/" + n;
+	    if( !have_stat && fstatat( fd, n, &buf, AT_SYMLINK_NOFOLLOW ) < 0 )
+		fatale( "lstat", file );
+	    node.add_file( file, buf.st_size );
+	} else if( type == DT_LNK ) {
+	    // Symbolic links to regular files are listed by the path of the
+	    // target
+	    std::string target = read_link( fd, n, node.path + "/" + n );
+	    std::string file = target[0] == '/' ? target
+		: node.path + "/" + target;
+	    if( fstatat( fd, target.c_str(), &buf, AT_SYMLINK_NOFOLLOW ) < 0 )
+		fatale( "lstat symlink", file );
+	    if( S_ISREG(buf.st_mode) )
+		node.add_file( file, buf.st_size );
+	} else if( type == DT_DIR && recursive )
+	    node.add_dir( n );
+    }
+
+    for( size_t i=0; i < node.dirs.size(); ++i )
+	cilk_spawn walk_dir( fd, *node.dirs[i], recursive );
+    cilk_sync;
+}
+
+// Append the files of node to the listing, depth-first, and release them
+template<typename ContainerTy>
+size_t flatten_dir( dir_node & node, ContainerTy & files,
+		    std::vector<size_t> * sizes ) {
+    size_t total_size = 0;
+    for( const dir_node::item & it : node.items ) {
+	if( it.dir != dir_node::no_dir ) {
+	    total_size += flatten_dir( *node.dirs[it.dir], files, sizes );
+	    node.dirs[it.dir].reset();
+	} else {
+	    files.index( &node.paths[it.name], it.len );
+	    total_size += it.size;
+	    if( sizes )
+		sizes->push_back( it.size );
+	}
+    }
     return total_size;
 }
 
+// List the regular files in dirname, and its subdirectories if recursive,
+// into files. The order is that of a sequential depth-first walk, in which
+// the files of a subdirectory take the place of its entry. Returns the
+// total size of the files.
+template<typename ContainerTy>
+size_t getdir( const std::string & dirname, ContainerTy & files,
+	       bool recursive = true, std::vector<size_t> * sizes = nullptr ) {
+    dir_node root( dirname, dirname );
+    walk_dir( AT_FDCWD, root, recursive );
+    return flatten_dir( root, files, sizes );
+}
+
 }
 
+// The sizes of the files are appended to sizes, if supplied, in the order
+// of the listing.
 template<typename WordListTy>
-size_t get_directory_listing( const std::string & dirname, WordListTy & wl ) {
+size_t get_directory_listing( const std::string & dirname, WordListTy & wl,
+			      std::vector<size_t> * sizes = nullptr ) {
     // Note: use asap::word_list defined in asap/word_bank.h
     // Note: WordListTy::word_bank_type must be managed
     typedef WordListTy word_list_type;
@@ -103,7 +249,44 @@ size_t get_directory_listing( const std::string & dirname, WordListTy & wl ) {
     static_assert( word_list_type::word_bank_type::is_managed,
 		   "Directory listing word_bank must be self-managed" );
 
-    return internal::getdir( dirname, wl );
+    return internal::getdir( dirname, wl, true, sizes );
+}
+
+// List the parts of a data set that may be stored as a single file or as a
+// directory of part files, as written by Hadoop or Spark. Parts are sorted
+// by name, which preserves record order for part-NNNNN naming. Hidden files
+// and bookkeeping files such as _SUCCESS and .part-00000.crc are skipped.
+inline std::vector<std::string>
+get_part_listing( const std::string & path ) {
+    std::vector<std::string> parts;
+
+    struct stat buf;
+    if( stat( path.c_str(), &buf ) < 0 )
+	fatale( "stat", path );
+    if( !S_ISDIR(buf.st_mode) ) {
+	parts.push_back( path );
+	return parts;
+    }
+
+    DIR *dp;
+    struct dirent *dirp;
+    if((dp  = opendir(path.c_str())) == NULL)
+	fatale( "opendir", path );
+
+    while ((dirp = readdir(dp)) != NULL) {
+	if( dirp->d_name[0] == '.' || dirp->d_name[0] == '_' )
+	    continue;
+	std::string file = path + "/" + dirp->d_name;
+	if( stat( file.c_str(), &buf ) < 0 )
+	    fatale( "stat", file );
+	if( S_ISREG(buf.st_mode) )
+	    parts.push_back( file );
+    }
+
+    closedir(dp);
+
+    std::sort( parts.begin(), parts.end() );
+    return parts;
 }
 
 }
@@ -388,6 +388,10 @@ public:
     const_iterator find( const key_type & w ) const {
 	return this->m_words.find( w );
     }
+    template<typename Iterator>
+    const_iterator find_entry( const Iterator & I ) const {
+	return internal::find_entry( this->m_words, I );
+    }
     // For reference and ease of substituting types in templates
     iterator binary_search( const key_type & w ) {
 	return find( w );
@@ -487,7 +491,8 @@ private:
 	    reducer_fn( keyval.second, I->second );
 
 	    // Lookup translated word and 
-	    std::pair<iterator,bool> ret = this->m_words.insert( keyval );
+	    std::pair<iterator,bool> ret
+		= internal::insert_entry( this->m_words, keyval, I );
 	    if( ret.second ) {
 		// Value was freshly inserted. Now remap the string.
 		// Unseen words need to be stored into container of LHS
@@ -0,0 +1,451 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_NGRAM_HASH_H
+#define INCLUDED_ASAP_NGRAM_HASH_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+
+#include "asap/utils.h"
+#include "asap/word_bank.h"
+#include "asap/word_count.h"
+#include "asap/tokenizer.h"
+#include "asap/hashtable.h"
+#include "asap/data_set.h"
+#include "asap/sparse_vector.h"
+
+namespace asap {
+
+namespace text {
+
+// Key of the last N words of a text: the word hashes h_1..h_N combined by
+// a polynomial rolling hash, h_1*P^(N-1) + ... + h_N modulo 2^64. Every
+// word is hashed once; sliding the window by one word takes a constant
+// number of multiplications, independent of N and of the word lengths.
+template<size_t N_>
+class rolling_ngram_key {
+public:
+    static const size_t N = N_;
+
+private:
+    static const uint64_t prime = 0x100000001b3ULL;
+
+    uint64_t	m_hash[N];	// ring of the last N word hashes
+    size_t	m_pos;
+    size_t	m_count;
+    uint64_t	m_key;
+    uint64_t	m_top;		// P^(N-1)
+
+public:
+    rolling_ngram_key() : m_pos( 0 ), m_count( 0 ), m_key( 0 ), m_top( 1 ) {
+	for( size_t i=1; i < N; ++i )
+	    m_top *= prime;
+    }
+
+    // Append a word. Returns true once N words have been seen.
+    bool push( const char * w, size_t len ) {
+	uint64_t h = word_hash( w, len );
+	if( m_count >= N )
+	    m_key -= m_hash[m_pos] * m_top;
+	m_key = m_key * prime + h;
+	m_hash[m_pos] = h;
+	m_pos = m_pos+1 == N ? 0 : m_pos+1;
+	return ++m_count >= N;
+    }
+
+    uint64_t key() const { return m_key; }
+
+    static uint64_t word_hash( const char * w, size_t len ) {
+	return text::word_hash( w, len );
+    }
+};
+
+// Keys are well-mixed hashes already
+struct ngram_key_hash {
+    size_t operator() ( uint64_t key ) const { return key; }
+};
+
+} // namespace text
+
+// Count of an n-gram in a document, with its words as first seen
+template<size_t N>
+struct hashed_ngram_count {
+    size_t		count;
+    text::ngram<N>	words;
+
+    hashed_ngram_count() : count( 0 ) { }
+    hashed_ngram_count( size_t c ) : count( c ) { }
+};
+
+// Per-document n-gram counts keyed by rolling_ngram_key. The n-grams are
+// hashed as a single integer. The words of an n-gram are recorded on its
+// first occurrence and compared on every later hit, and when counts are
+// merged. The TF/IDF columns are addressed by key alone, so distinct
+// n-grams sharing a key are not separated: their counts are merged and
+// the collision is reported by collisions().
+template<size_t N_, typename WordBankTy = word_bank_pre_alloc>
+class hashed_ngram_map {
+public:
+    static const size_t N = N_;
+    typedef WordBankTy					word_bank_type;
+    typedef hashed_ngram_count<N>			count_type;
+    typedef hash_table<uint64_t, count_type,
+		       text::ngram_key_hash>		table_type;
+    typedef typename table_type::value_type		value_type;
+    typedef typename table_type::const_iterator		const_iterator;
+    static const bool is_managed = word_bank_type::is_managed;
+
+private:
+    table_type		m_table;
+    word_bank_type	m_storage;
+    size_t		m_collisions;
+
+public:
+    hashed_ngram_map() : m_collisions( 0 ) { }
+
+    void set_growth( size_t w, size_t b ) { m_table.set_growth( w, b ); }
+
+    size_t size() const { return m_table.size(); }
+    bool empty() const { return m_table.size() == 0; }
+    // Number of keys found to be shared by distinct n-grams
+    size_t collisions() const { return m_collisions; }
+
+    const word_bank_type & storage() const { return m_storage; }
+
+    void enregister( std::shared_ptr<char> & buf ) {
+	m_storage.enregister( buf );
+    }
+
+    const char * store( char * p, size_t len ) {
+	return m_storage.store( p, len );
+    }
+
+    void index( uint64_t key, const text::ngram<N> & ng ) {
+	std::pair<typename table_type::iterator, bool> r
+	    = m_table.insert( value_type( key, count_type( 0 ) ), key );
+	if( r.second )
+	    r.first->second.words = ng;
+	else if( !text::ngram_eql()( r.first->second.words, ng ) )
+	    ++m_collisions;
+	++r.first->second.count;
+    }
+
+    // Add the counts of rhs, taking over its word storage
+    void merge( hashed_ngram_map & rhs ) {
+	for( auto I=rhs.m_table.cbegin(), E=rhs.m_table.cend(); I != E; ++I ) {
+	    std::pair<typename table_type::iterator, bool> r
+		= m_table.insert( value_type( I->first, count_type( 0 ) ),
+				  I->first );
+	    if( r.second )
+		r.first->second.words = I->second.words;
+	    else if( !text::ngram_eql()( r.first->second.words,
+					 I->second.words ) )
+		++m_collisions;
+	    r.first->second.count += I->second.count;
+	}
+	m_collisions += rhs.m_collisions;
+	m_storage.reduce( rhs.m_storage );
+	table_type().swap( rhs.m_table );
+    }
+
+    const_iterator cbegin() const { return m_table.cbegin(); }
+    const_iterator cend() const { return m_table.cend(); }
+    const_iterator begin() const { return m_table.cbegin(); }
+    const_iterator end() const { return m_table.cend(); }
+};
+
+namespace text {
+
+// Count the n-grams in [data,data+data_size) into catalog. Chunks of
+// chunk_size bytes are counted in parallel; as with ngram_catalog, n-grams
+// do not span chunks.
+template<size_t N, typename WordBankTy>
+size_t hashed_ngram_catalog( char * data, size_t data_size,
+			     hashed_ngram_map<N, WordBankTy> & catalog,
+			     size_t chunk_size ) {
+    char * const data_end = &data[data_size];
+    std::vector<std::pair<char *, char *>> chunks;
+    char * split = data;
+    while( split != data_end ) {
+	char * end = split_chunk( split, data_end, chunk_size );
+	chunks.push_back( std::make_pair( split, end ) );
+	split = end;
+    }
+
+    std::vector<hashed_ngram_map<N, WordBankTy>> parts( chunks.size() );
+    std::vector<size_t> nngrams( chunks.size(), 0 );
+    cilk_for( size_t k=0; k < chunks.size(); ++k ) {
+	hashed_ngram_map<N, WordBankTy> & part = parts[k];
+	part.set_growth( 1, 2 );
+	rolling_ngram_key<N> key;
+	ngram<N> ng;
+	tokenize( chunks[k].first, chunks[k].second,
+		  [&]( char * w, size_t len ) {
+		      ng.push_back( part.store( w, len ) );
+		      if( key.push( w, len ) ) {
+			  part.index( key.key(), ng );
+			  ++nngrams[k];
+		      }
+		  } );
+    }
+
+    size_t num_ngrams = 0;
+    for( size_t k=0; k < parts.size(); ++k ) {
+	catalog.merge( parts[k] );
+	num_ngrams += nngrams[k];
+    }
+    return num_ngrams;
+}
+
+} // namespace text
+
+namespace internal {
+
+template<typename MapTy>
+struct hashed_ngram_catalog_fn {
+    size_t operator () ( char * data, size_t data_size,
+			 MapTy & catalog, size_t chunk_size ) const {
+	return text::hashed_ngram_catalog( data, data_size, catalog,
+					   chunk_size );
+    }
+};
+
+} // namespace internal
+
+// Count the n-grams of a file, decompressing on the fly if needed
+template<size_t N, typename WordBankTy>
+size_t hashed_ngram_catalog( const std::string & filename,
+			     hashed_ngram_map<N, WordBankTy> & catalog,
+			     size_t chunk_size = size_t(1)<<20 ) {
+    return internal::catalog_file(
+	filename, catalog, chunk_size,
+	internal::hashed_ngram_catalog_fn<hashed_ngram_map<N, WordBankTy>>() );
+}
+
+// The n-grams of a corpus, keyed by rolling_ngram_key, with their document
+// frequency. After freeze(), n-grams are numbered in iteration order and the
+// dictionary serves as the column index of a TF/IDF data set; only then are
+// the n-grams resolved to their words. The dictionary shares the text of the
+// catalogs, such that these may be released after computing the TF/IDF.
+template<size_t N_>
+class hashed_ngram_dictionary {
+public:
+    static const size_t N = N_;
+    typedef appear_count<size_t, size_t>		count_type;
+    typedef std::pair<text::ngram<N>, count_type>	value_type;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+    struct entry {
+	size_t		df;
+	size_t		id;
+	text::ngram<N>	words;
+
+	entry() : df( 0 ), id( 0 ) { }
+	entry( size_t d ) : df( d ), id( 0 ) { }
+    };
+    typedef hash_table<uint64_t, entry, text::ngram_key_hash> table_type;
+
+    table_type			m_table;
+    size_t			m_collisions;
+    std::vector<value_type>	m_columns;	// see freeze()
+    word_bank_base		m_storage;
+
+    // Merges the document frequencies of two tables and checks the words
+    // of n-grams that occur in both
+    struct merge_fn {
+	size_t * collisions;
+
+	void operator () ( entry & lhs, const entry & rhs ) const {
+	    if( lhs.df == 0 )
+		lhs.words = rhs.words;
+	    else if( !text::ngram_eql()( lhs.words, rhs.words ) )
+		++*collisions;
+	    lhs.df += rhs.df;
+	}
+    };
+
+public:
+    hashed_ngram_dictionary() : m_collisions( 0 ) { }
+
+    hashed_ngram_dictionary( const hashed_ngram_dictionary & ) = delete;
+    hashed_ngram_dictionary & operator = ( const hashed_ngram_dictionary & )
+	= delete;
+
+    void swap( hashed_ngram_dictionary & d ) {
+	m_table.swap( d.m_table );
+	std::swap( m_collisions, d.m_collisions );
+	m_columns.swap( d.m_columns );
+	m_storage.swap( d.m_storage );
+    }
+
+    void set_growth( size_t w, size_t b ) { m_table.set_growth( w, b ); }
+
+    size_t size() const { return m_table.size(); }
+    // Number of keys found to be shared by distinct n-grams. Their
+    // counts are merged.
+    size_t collisions() const { return m_collisions; }
+
+    // Count the document towards the document frequencies
+    template<typename WordBankTy>
+    void count_presence( const hashed_ngram_map<N, WordBankTy> & catalog ) {
+	merge_fn fn{ &m_collisions };
+	for( auto I=catalog.cbegin(), E=catalog.cend(); I != E; ++I ) {
+	    entry e( 1 );
+	    e.words = I->second.words;
+	    std::pair<typename table_type::iterator, bool> r
+		= m_table.insert( typename table_type::value_type(
+				      I->first, entry( 0 ) ), I->first );
+	    fn( r.first->second, e );
+	}
+	m_collisions += catalog.collisions();
+	m_storage.copy( catalog.storage() );
+    }
+
+    void reduce( hashed_ngram_dictionary & rhs ) {
+	if( m_table.size() == 0 )
+	    m_table.swap( rhs.m_table );
+	else
+	    m_table.merge( rhs.m_table, merge_fn{ &m_collisions } );
+	m_collisions += rhs.m_collisions;
+	m_storage.reduce( rhs.m_storage );
+    }
+
+    // Number the n-grams and build the list of columns. Not thread-safe.
+    void freeze() {
+	m_columns.resize( m_table.size() );
+	size_t id = 0;
+	for( auto I=m_table.begin(), E=m_table.end(); I != E; ++I, ++id ) {
+	    I->second.id = id;
+	    m_columns[id].first = I->second.words;
+	    m_columns[id].second.first = I->second.df;
+	    m_columns[id].second.second = id;
+	}
+    }
+
+    // The id and document frequency of the n-gram with key, which must
+    // be present, after freeze()
+    const entry & lookup( uint64_t key ) const {
+	auto F = m_table.find( key, key );
+	assert( F != m_table.cend() );
+	return F->second;
+    }
+
+    // Access to the frozen columns
+    const_iterator cbegin() const { return m_columns.cbegin(); }
+    const_iterator cend() const { return m_columns.cend(); }
+    const_iterator begin() const { return m_columns.cbegin(); }
+    const_iterator end() const { return m_columns.cend(); }
+};
+
+template<size_t N>
+class hashed_ngram_dictionary_reducer {
+    typedef hashed_ngram_dictionary<N> type;
+
+    struct Monoid : cilk::monoid_base<type> {
+	static void reduce( type * left, type * right ) {
+	    left->reduce( *right );
+	}
+	static void identity( type * p ) {
+	    new (p) type();
+	    p->set_growth( 1, 2 );
+	}
+    };
+
+private:
+    cilk::reducer<Monoid> imp_;
+
+public:
+    hashed_ngram_dictionary_reducer() : imp_() { }
+
+    void swap( type & d ) { imp_.view().swap( d ); }
+
+    template<typename WordBankTy>
+    void count_presence( const hashed_ngram_map<N, WordBankTy> & catalog ) {
+	imp_.view().count_presence( catalog );
+    }
+
+    type & get_value() { return imp_.view(); }
+};
+
+// TF/IDF over hashed n-gram catalogs
+template<typename VectorTy, typename InputIterator, size_t N,
+	 typename VectorNameTy>
+data_set<VectorTy, hashed_ngram_dictionary<N>, VectorNameTy>
+tfidf( InputIterator I, InputIterator E,
+       std::shared_ptr<hashed_ngram_dictionary<N>> & dict_ptr,
+       std::shared_ptr<VectorNameTy> & vec_names_ptr,
+       const tfidf_weighting & weighting = tfidf_weighting() ) {
+    typedef data_set<VectorTy, hashed_ngram_dictionary<N>, VectorNameTy>
+	data_set_type;
+    typedef typename data_set_type::vector_list_type vector_list_type;
+    typedef typename vector_list_type::value_type value_type;
+    typedef typename vector_list_type::index_type index_type;
+
+    const hashed_ngram_dictionary<N> & dict = *dict_ptr;
+    size_t num_points = std::distance( I, E );
+    size_t num_dimensions = dict.size();
+    size_t nonzeros = std::for_each( I, E, SizeCounter<decltype(*I)>() ).size;
+
+    static_assert( is_sparse_vector<VectorTy>::value, "must be sparse - constructor" );
+    std::shared_ptr<vector_list_type> vectors_ptr
+	= std::make_shared<vector_list_type>( num_points, num_dimensions, nonzeros );
+    vector_list_type & vectors = *vectors_ptr;
+
+    std::vector<size_t> vec_start( num_points );
+    size_t inc_nonzeros = 0;
+    size_t i=0;
+    for( auto II=I; II != E; ++II, ++i ) {
+	size_t fcount = II->size();
+	vec_start[i] = inc_nonzeros;
+	inc_nonzeros += fcount;
+	vectors.emplace_back( num_dimensions, fcount );
+    }
+
+    cilk_for( size_t i=0; i < num_points; ++i ) {
+	auto PI = std::next( I, i );
+	value_type *v = &vectors.get_alloc_v()[vec_start[i]];
+	index_type *c = &vectors.get_alloc_i()[vec_start[i]];
+	size_t f = 0;
+	for( auto MI=PI->cbegin(), ME=PI->cend(); MI != ME; ++MI, ++f ) {
+	    const auto & e = dict.lookup( MI->first );
+	    value_type idf = log10( value_type(num_points + 1)
+				    / value_type(e.df + 1) );
+	    c[f] = e.id;
+	    v[f] = weighting.tf<value_type>( MI->second.count ) * idf;
+	}
+	vectors[i].sort_by_index();
+	internal::tfidf_finish( vectors[i], v, c, f, weighting );
+    }
+    vectors.shrink_to_fit();
+
+    const char * name = "tfidf";
+    return data_set_type( name, dict_ptr, vec_names_ptr, vectors_ptr, false );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_NGRAM_HASH_H
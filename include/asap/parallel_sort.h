@@ -0,0 +1,154 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_PARALLEL_SORT_H
+#define INCLUDED_ASAP_PARALLEL_SORT_H
+
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+namespace asap {
+
+namespace internal {
+
+// Ranges shorter than this are sorted sequentially
+static const size_t parallel_sort_cutoff = size_t(1)<<14;
+// Number of samples drawn per bucket of the sample sort
+static const size_t sample_sort_oversampling = 32;
+
+} // namespace internal
+
+// Sort [first,last) by cmp. Sample sort: splitters taken from a sorted
+// sample partition the range into buckets, elements are distributed over
+// the buckets in parallel blocks, and the buckets are sorted in parallel.
+// The sort is not stable. value_type must be default-constructible; the
+// buckets take a temporary copy of the range.
+template<typename RandomIt, typename Compare>
+void parallel_sort( RandomIt first, RandomIt last, Compare cmp ) {
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+
+    size_t n = std::distance( first, last );
+    size_t nworkers = __cilkrts_get_nworkers();
+    size_t nbuckets = std::min( 8 * nworkers,
+				n / internal::parallel_sort_cutoff );
+    if( nbuckets < 2 ) {
+	std::sort( first, last, cmp );
+	return;
+    }
+
+    // Splitters from an evenly spaced sample. Bucket b holds the elements
+    // x with splitter[b-1] <= x < splitter[b].
+    size_t nsamples = nbuckets * internal::sample_sort_oversampling;
+    std::vector<value_type> sample( nsamples );
+    for( size_t i=0; i < nsamples; ++i )
+	sample[i] = first[i * ( n / nsamples )];
+    std::sort( sample.begin(), sample.end(), cmp );
+    std::vector<value_type> splitter( nbuckets-1 );
+    for( size_t b=0; b+1 < nbuckets; ++b )
+	splitter[b] = sample[(b+1) * internal::sample_sort_oversampling];
+    std::vector<value_type>().swap( sample );
+
+    // Classify the elements and count them per block and bucket
+    size_t nblocks = nbuckets;
+    size_t block = ( n + nblocks - 1 ) / nblocks;
+    std::vector<uint32_t> bucket( n );
+    std::vector<size_t> count( nblocks * nbuckets, 0 );
+    cilk_for( size_t k=0; k < nblocks; ++k ) {
+	size_t * cnt = &count[k * nbuckets];
+	for( size_t i=k*block, e=std::min( n, (k+1)*block ); i < e; ++i ) {
+	    bucket[i] = std::upper_bound( splitter.begin(), splitter.end(),
+					  first[i], cmp ) - splitter.begin();
+	    ++cnt[bucket[i]];
+	}
+    }
+
+    // Offset of each block within each bucket
+    std::vector<size_t> start( nbuckets+1 );
+    size_t off = 0;
+    for( size_t b=0; b < nbuckets; ++b ) {
+	start[b] = off;
+	for( size_t k=0; k < nblocks; ++k ) {
+	    size_t c = count[k * nbuckets + b];
+	    count[k * nbuckets + b] = off;
+	    off += c;
+	}
+    }
+    start[nbuckets] = n;
+
+    std::vector<value_type> tmp( n );
+    cilk_for( size_t k=0; k < nblocks; ++k ) {
+	size_t * pos = &count[k * nbuckets];
+	for( size_t i=k*block, e=std::min( n, (k+1)*block ); i < e; ++i )
+	    tmp[pos[bucket[i]]++] = std::move( first[i] );
+    }
+
+    cilk_for( size_t b=0; b < nbuckets; ++b ) {
+	std::sort( tmp.begin() + start[b], tmp.begin() + start[b+1], cmp );
+	std::move( tmp.begin() + start[b], tmp.begin() + start[b+1],
+		   first + start[b] );
+    }
+}
+
+// Rearrange [first,last) such that [first,first+k) holds the first k
+// elements in the order cmp, sorted, and the other elements follow in
+// unspecified order. Each of a number of blocks selects its own first k
+// elements in parallel and moves them to the front; these candidates are
+// then sorted partially. Returns the end of the selected elements.
+template<typename RandomIt, typename Compare>
+RandomIt parallel_top_k( RandomIt first, RandomIt last, size_t k,
+			 Compare cmp ) {
+    size_t n = std::distance( first, last );
+    if( k >= n ) {
+	parallel_sort( first, last, cmp );
+	return last;
+    }
+    if( k == 0 )
+	return first;
+
+    // Blocks hold at least 2k elements, such that the candidates of block
+    // b, moved to [b*k,(b+1)*k), do not overlap those of blocks b and up
+    size_t nworkers = __cilkrts_get_nworkers();
+    size_t nblocks = std::min( 4 * nworkers, n / ( 2 * k ) );
+    if( nblocks < 2 || n < internal::parallel_sort_cutoff ) {
+	std::partial_sort( first, first + k, last, cmp );
+	return first + k;
+    }
+
+    size_t block = n / nblocks;
+    cilk_for( size_t b=0; b < nblocks; ++b ) {
+	RandomIt bf = first + b * block;
+	RandomIt be = b+1 == nblocks ? last : bf + block;
+	std::nth_element( bf, bf + k, be, cmp );
+    }
+    for( size_t b=1; b < nblocks; ++b )
+	std::swap_ranges( first + b * block, first + b * block + k,
+			  first + b * k );
+
+    std::partial_sort( first, first + k, first + nblocks * k, cmp );
+    return first + k;
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_PARALLEL_SORT_H
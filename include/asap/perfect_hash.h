@@ -0,0 +1,260 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_PERFECT_HASH_H
+#define INCLUDED_ASAP_PERFECT_HASH_H
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+
+#include <cilk/cilk.h>
+
+namespace asap {
+
+// Read-only map over a fixed set of keys, indexed by a minimal perfect hash
+// function. The set is built once from a range of distinct key-value pairs
+// and cannot be modified afterwards.
+//
+// The hash function follows BBHash: a cascade of bit arrays. Every key that
+// is not yet placed sets the bit at its hash position in the bit array of
+// the current level. Bits set by more than one key are cleared again, and
+// the keys that set them move on to the next level, which is proportionally
+// smaller. The index of a key is the rank of its bit across all levels.
+// A lookup takes one bit array access per level until a set bit is found,
+// which is at the first level for most keys, and then one access to the
+// value array. Keys are retained, so that absent keys are reported as such.
+// The index costs about 7 bits per key on top of the values.
+template<typename Key, typename T, class Hash = std::hash<Key>,
+	 class KeyEqual = std::equal_to<Key>>
+class perfect_hash_map {
+public:
+    typedef Key				key_type;
+    typedef T				mapped_type;
+    typedef std::pair<Key, T>		value_type;
+    typedef std::size_t 		size_type;
+    typedef Hash 			hasher;
+    typedef KeyEqual 			key_equal;
+    typedef const value_type&		const_reference;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    // Elements cannot be modified through iterators either
+    typedef const_iterator		iterator;
+
+private:
+    // Bits of a bit array and the number of set bits in all bit arrays
+    // preceding these.
+    struct word_type {
+	uint64_t	bits;
+	uint64_t	rank;
+    };
+    struct level_type {
+	size_type	offset;		// first word in m_words
+	size_type	nbits;
+    };
+
+    static const unsigned gamma = 2;		// bits per key in a level
+    static const unsigned max_levels = 32;
+
+    std::vector<value_type>		m_values;	// in index order
+    std::vector<word_type>		m_words;
+    std::vector<level_type>		m_levels;
+    // Keys that were not placed in any level, sorted by hash
+    std::vector<std::pair<size_type, size_type>> m_fallback;
+    hasher				kh;
+    key_equal				keql;
+
+public:
+    perfect_hash_map() { }
+
+    // Build the index over the distinct keys in [first,last)
+    template<typename Iterator>
+    perfect_hash_map( Iterator first, Iterator last ) {
+	build( first, last );
+    }
+
+    hasher hash_function() const { return kh; }
+    key_equal key_eq() const { return keql; }
+
+    size_type size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+
+    void clear() {
+	m_values.clear();
+	m_words.clear();
+	m_levels.clear();
+	m_fallback.clear();
+    }
+
+    void swap( perfect_hash_map & h ) {
+	m_values.swap( h.m_values );
+	m_words.swap( h.m_words );
+	m_levels.swap( h.m_levels );
+	m_fallback.swap( h.m_fallback );
+	std::swap( kh, h.kh );
+	std::swap( keql, h.keql );
+    }
+
+    // Replace the contents with the distinct keys in [first,last). The
+    // bit arrays of each level are filled in parallel.
+    template<typename Iterator>
+    void build( Iterator first, Iterator last ) {
+	clear();
+	m_values.assign( first, last );
+	size_type n = m_values.size();
+
+	std::vector<size_type> hashes( n );
+	cilk_for( size_type i=0; i < n; ++i )
+	    hashes[i] = kh( m_values[i].first );
+
+	std::vector<size_type> remaining( n );
+	cilk_for( size_type i=0; i < n; ++i )
+	    remaining[i] = i;
+
+	size_type rank = 0;
+	while( !remaining.empty() && m_levels.size() < max_levels ) {
+	    size_type r = remaining.size();
+	    size_type nwords = ( r * gamma + 63 ) / 64;
+	    level_type level{ m_words.size(), nwords * 64 };
+	    unsigned l = m_levels.size();
+
+	    std::unique_ptr<std::atomic<uint64_t>[]> seen(
+		new std::atomic<uint64_t>[nwords] );
+	    std::unique_ptr<std::atomic<uint64_t>[]> coll(
+		new std::atomic<uint64_t>[nwords] );
+	    cilk_for( size_type w=0; w < nwords; ++w ) {
+		seen[w].store( 0, std::memory_order_relaxed );
+		coll[w].store( 0, std::memory_order_relaxed );
+	    }
+
+	    cilk_for( size_type i=0; i < r; ++i ) {
+		size_type pos = position( hashes[remaining[i]], l, level.nbits );
+		uint64_t bit = uint64_t(1) << (pos % 64);
+		uint64_t prev = seen[pos/64].fetch_or(
+		    bit, std::memory_order_relaxed );
+		if( prev & bit )
+		    coll[pos/64].fetch_or( bit, std::memory_order_relaxed );
+	    }
+
+	    m_words.resize( level.offset + nwords );
+	    for( size_type w=0; w < nwords; ++w ) {
+		uint64_t bits = seen[w].load( std::memory_order_relaxed )
+		    & ~coll[w].load( std::memory_order_relaxed );
+		m_words[level.offset+w] = word_type{ bits, rank };
+		rank += __builtin_popcountll( bits );
+	    }
+	    m_levels.push_back( level );
+
+	    // Keys whose bit was cleared move on to the next level
+	    size_type k = 0;
+	    for( size_type i=0; i < r; ++i ) {
+		size_type pos = position( hashes[remaining[i]], l, level.nbits );
+		if( !( m_words[level.offset + pos/64].bits
+		       & ( uint64_t(1) << (pos % 64) ) ) )
+		    remaining[k++] = remaining[i];
+	    }
+	    remaining.resize( k );
+	}
+
+	// Keys with colliding hashes in every level
+	for( size_type i : remaining ) {
+	    m_fallback.push_back( std::make_pair( hashes[i], rank ) );
+	    ++rank;
+	}
+	assert( rank == n );
+
+	// Move the values into index order
+	std::vector<size_type> perm( n );
+	cilk_for( size_type i=0; i < n; ++i ) {
+	    size_type idx = index( hashes[i] );
+	    if( idx != n )
+		perm[idx] = i;
+	}
+	for( size_type j=0; j < m_fallback.size(); ++j )
+	    perm[m_fallback[j].second] = remaining[j];
+	std::vector<value_type> values;
+	values.reserve( n );
+	for( size_type idx=0; idx < n; ++idx )
+	    values.push_back( std::move( m_values[perm[idx]] ) );
+	m_values.swap( values );
+
+	std::sort( m_fallback.begin(), m_fallback.end() );
+    }
+
+    const_iterator find( const key_type & key ) const {
+	return find( key, kh( key ) );
+    }
+
+    // Lookup with a known hash h, which must equal hash_function()(key)
+    const_iterator find( const key_type & key, size_type h ) const {
+	size_type idx = index( h );
+	if( idx != size() ) {
+	    if( keql( m_values[idx].first, key ) )
+		return m_values.cbegin() + idx;
+	    return cend();
+	}
+
+	// Fall back to the unplaced keys
+	auto F = std::lower_bound( m_fallback.cbegin(), m_fallback.cend(),
+				   std::make_pair( h, size_type(0) ) );
+	for( ; F != m_fallback.cend() && F->first == h; ++F )
+	    if( keql( m_values[F->second].first, key ) )
+		return m_values.cbegin() + F->second;
+	return cend();
+    }
+
+    const_iterator begin() const { return m_values.cbegin(); }
+    const_iterator end() const { return m_values.cend(); }
+    const_iterator cbegin() const { return m_values.cbegin(); }
+    const_iterator cend() const { return m_values.cend(); }
+
+private:
+    // Position of the key with hash h in the bit array of level l
+    static size_type position( size_type h, unsigned l, size_type nbits ) {
+	uint64_t x = uint64_t(h) + uint64_t(l+1) * 0x9e3779b97f4a7c15ull;
+	x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+	x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return size_type( ( (unsigned __int128)x * nbits ) >> 64 );
+    }
+
+    // Index of the key with hash h, or size() if it is not placed in any
+    // level. A key that is not in the set may obtain the index of another
+    // key.
+    size_type index( size_type h ) const {
+	for( unsigned l=0; l < m_levels.size(); ++l ) {
+	    const level_type & level = m_levels[l];
+	    size_type pos = position( h, l, level.nbits );
+	    const word_type & w = m_words[level.offset + pos/64];
+	    uint64_t bit = uint64_t(1) << (pos % 64);
+	    if( w.bits & bit )
+		return w.rank + __builtin_popcountll( w.bits & (bit-1) );
+	}
+	return size();
+    }
+};
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_PERFECT_HASH_H
@@ -0,0 +1,689 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_RECORD_PARSER_H
+#define INCLUDED_ASAP_RECORD_PARSER_H
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+#include "asap/utils.h"
+#include "asap/traits.h"
+#include "asap/io.h"
+
+// Parsing core shared by the ARFF (arff.h) and IMR (imrformat.h) readers.
+// The formats differ only in their record syntax, which is captured by a
+// syntax policy class. Records are assumed to occupy a single line each,
+// which allows the data section to be split at line boundaries and parsed
+// in parallel.
+
+namespace asap {
+
+struct IsAlnum {
+    bool operator () ( char c ) const {
+	return std::isalnum(c);
+    }
+};
+
+struct NewLine {
+    bool operator () ( char c ) const {
+	return c == '\n';
+    }
+};
+
+struct NonBlank {
+    bool operator () ( char c ) const {
+	return !std::isspace(c);
+    }
+};
+
+namespace parse {
+
+// Delimiter of values in a sparse record
+template<char Close>
+struct nz_delim {
+    bool operator () ( char c ) const {
+	return ( c == ',' ) | ( c == Close );
+    }
+};
+
+// ARFF: dense records are comma-separated values, sparse records are
+// enclosed in curly braces: {i v, j w}
+struct arff_syntax {
+    typedef nz_delim<'}'> nz_delim_type;
+    static const char sparse_open = '{';
+    static const char sparse_close = '}';
+    static const char dense_open = '\0';	// values start the record
+    static const bool skip_zeros = false;
+    static bool is_value_sep( char c ) { return c == ','; }
+};
+
+// IMR: (u'key', [v, w, ...]). Only dense records; zeros are not stored
+// in sparse vectors.
+struct imr_syntax {
+    typedef nz_delim<')'> nz_delim_type;
+    static const char sparse_open = '\0';	// no sparse records
+    static const char sparse_close = ')';
+    static const char dense_open = '[';
+    static const bool skip_zeros = true;
+    static bool is_value_sep( char c ) {
+	return c == ',' || c == ']' || c == ')';
+    }
+};
+
+// Fast numeric scanning. Decimal numbers are converted exactly when the
+// significand fits in 53 bits and the decimal exponent is at most 22 in
+// magnitude, as both are then exactly representable and the result is
+// correctly rounded. Anything else is handed over to strtod/strtoul.
+inline unsigned long scan_ulong( char *& p ) {
+    char * s = p;
+    while( *s == ' ' || *s == '\t' )
+	++s;
+    if( !( *s >= '0' && *s <= '9' ) )
+	return std::strtoul( p, &p, 10 );
+    unsigned long v = 0;
+    char * b = s;
+    while( *s >= '0' && *s <= '9' )
+	v = v * 10 + ( *s++ - '0' );
+    if( s - b > 19 ) // may have overflowed
+	return std::strtoul( p, &p, 10 );
+    p = s;
+    return v;
+}
+
+inline double scan_double( char *& p ) {
+    static const double pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    char * s = p;
+    while( *s == ' ' || *s == '\t' )
+	++s;
+    bool neg = false;
+    if( *s == '-' || *s == '+' )
+	neg = *s++ == '-';
+
+    unsigned long long m = 0;
+    int ndigits = 0, exp = 0;
+    bool any = false;
+    while( *s >= '0' && *s <= '9' ) {
+	if( m || *s != '0' )
+	    ++ndigits;
+	m = m * 10 + ( *s++ - '0' );
+	any = true;
+    }
+    if( *s == '.' ) {
+	++s;
+	while( *s >= '0' && *s <= '9' ) {
+	    if( m || *s != '0' )
+		++ndigits;
+	    m = m * 10 + ( *s++ - '0' );
+	    --exp;
+	    any = true;
+	}
+    }
+    if( !any || ndigits > 19 || *s == 'x' || *s == 'X' )
+	return std::strtod( p, &p );
+    if( *s == 'e' || *s == 'E' ) {
+	char * e = s + 1;
+	bool eneg = false;
+	if( *e == '-' || *e == '+' )
+	    eneg = *e++ == '-';
+	if( !( *e >= '0' && *e <= '9' ) )
+	    return std::strtod( p, &p );
+	int x = 0;
+	while( *e >= '0' && *e <= '9' ) {
+	    if( x < 10000 )
+		x = x * 10 + ( *e - '0' );
+	    ++e;
+	}
+	exp += eneg ? -x : x;
+	s = e;
+    }
+    if( m >= (1ull << 53) || exp < -22 || exp > 22 )
+	return std::strtod( p, &p );
+
+    double v = double(m);
+    v = exp < 0 ? v / pow10[-exp] : v * pow10[exp];
+    p = s;
+    return neg ? -v : v;
+}
+
+template<typename ValueTy>
+ValueTy scan_value( char *& p ) {
+#if REAL_IS_INT
+    return scan_ulong( p );
+#else
+    return scan_double( p );
+#endif
+}
+
+// Skip all white-space (blank lines) as well as lines with comments
+inline void skip_blank_lines( char * & p, char * end ) {
+    while( std::isspace(*p) )
+	++p;
+    while( *p == '%' ) {
+	++p;
+	while( *p != '\n' )
+	    if( *p++ == '\0' )
+		return;
+	while( std::isspace(*p) )
+	    ++p;
+    }
+}
+
+// Update dense_vector
+template<typename vector_type, bool SkipZeros, typename = void>
+class record_value {
+    vector_type & vector;
+    typename vector_type::index_type nexti;
+public:
+    record_value( vector_type & vector_ ) : vector( vector_ ), nexti( 0 ) { }
+
+    void operator () ( typename vector_type::value_type v ) {
+	assert( nexti < vector.length() ); // throw
+	vector[nexti++] = v;
+    }
+    void operator () ( typename vector_type::index_type i,
+		       typename vector_type::value_type v ) {
+	assert( 0 <= i && i < vector.length() ); // throw
+	vector[i] = v;
+    }
+};
+
+// Update sparse_vector
+template<typename vector_type, bool SkipZeros>
+class record_value<vector_type, SkipZeros,
+		   typename std::enable_if<is_sparse_vector<vector_type>::value>::type> {
+    vector_type & vector;
+    typename vector_type::index_type pos, idx;
+public:
+    record_value( vector_type & vector_ ) : vector( vector_ ), pos( 0 ), idx( 0 ) { }
+
+    void operator () ( typename vector_type::value_type v ) {
+	assert( pos < vector.length() ); // throw
+	if( !SkipZeros || v > 0 )
+	    vector.set( pos++, v, idx );
+	++idx;
+    }
+    void operator () ( typename vector_type::index_type i,
+		       typename vector_type::value_type v ) {
+	assert( 0 <= i && i < vector.length() ); // throw
+	if( !SkipZeros || v > 0 )
+	    vector.set( pos++, v, i );
+    }
+};
+
+template<typename Syntax, typename vector_type>
+bool
+read_dense_vector( char *& p, char * end, vector_type & vector ) {
+#define ADVANCE(pp) do { if( *(pp) == '\0' ) { return false; } ++pp; } while( 0 )
+    if( Syntax::dense_open ) {
+	while( *p != Syntax::dense_open )
+	    ADVANCE( p );
+	ADVANCE( p );
+    }
+    record_value<vector_type, Syntax::skip_zeros> recorder( vector );
+    do {
+	while( std::isspace( *p ) )
+	    ADVANCE( p );
+	if( *p == '?' )
+	    fatal( "missing data not supported" );
+	typename vector_type::value_type v
+	    = scan_value<typename vector_type::value_type>( p );
+	recorder( v );
+	while( ( std::isspace( *p ) || Syntax::is_value_sep( *p ) )
+	       && *p != '\n' )
+	    ADVANCE( p );
+    } while( *p != '\n' && *p != '\0' ); // last line may lack a newline
+    return true;
+#undef ADVANCE
+}
+
+template<typename Syntax, typename vector_type>
+bool
+read_sparse_vector( char *& pref, char * end, vector_type & vector ) {
+    // We will only be overwriting a few elements, so clear everything first
+    if( is_dense_vector<vector_type>::value )
+	vector.clear();
+
+    record_value<vector_type, Syntax::skip_zeros> recorder( vector );
+
+    char * p = pref;
+
+    assert( *p == Syntax::sparse_open );
+    ++p;
+    while( std::isspace( *p ) )
+	++p;
+    do {
+	typename vector_type::index_type i = scan_ulong( p );
+	while( std::isspace( *p ) || *p == ':' )
+	    ++p;
+	if( *p == Syntax::sparse_close )
+	    break;
+	if( *p == '?' )
+	    fatal( "missing data not supported" );
+	typename vector_type::value_type vv
+	    = scan_value<typename vector_type::value_type>( p );
+	recorder( i, vv );
+
+	if( (p = std::find_if( p, end, typename Syntax::nz_delim_type() ))
+	    == end ) {
+	    pref = p;
+	    return false;
+	}
+	if( *p == Syntax::sparse_close )
+	    break;
+	++p;
+	while( std::isspace( *p ) )
+	    ++p;
+    } while( *p != Syntax::sparse_close );
+    ++p;
+    pref = p;
+    return true;
+}
+
+template<typename Syntax, typename vector_type>
+bool read_vector( char *& p, char * end, vector_type & vector ) {
+    if( Syntax::sparse_open && *p == Syntax::sparse_open )
+	return read_sparse_vector<Syntax>( p, end, vector );
+    else
+	return read_dense_vector<Syntax>( p, end, vector );
+}
+
+template<typename WordBankTy>
+const char * read_relation( char *& p, WordBankTy & idx ) {
+    while( std::isspace(*p) && *p != '\n' )
+	++p;
+    char * relation = p;
+    if( *p == '\'' ) { // scan until closing quote
+	++p;
+	while( *p != '\'' ) {
+	    if( *p == '\\' ) // skip next character
+		++p;
+	    if( *p == '\0' )
+		return 0;
+	    ++p;
+	}
+	// Skip closing quote
+	++p;
+    } else { // scan until space
+	while( !std::isspace( *p ) ) {
+	    if( *p == '\0' )
+		return 0;
+	    ++p;
+	}
+    }
+    const char * stored
+	= idx.memorize( relation, p-relation ); // Store relation, not indexed
+    ++p; // delimiter replaced by '\0'
+    return stored;
+}
+
+template<typename WordBankTy>
+const char * read_attribute( char *& p, WordBankTy & idx ) {
+    // Isolate token
+    while( std::isspace( *p ) )
+	++p;
+    char * name = p;
+    while( !std::isspace( *p ) )
+	if( *p++ == '\0' )
+	    return 0;
+    const char * stored = idx.index( name, p-name ); // Store name in index
+    ++p; // space replaced by '\0'
+
+    // Isolate type
+    while( std::isspace( *p ) )
+	++p;
+    char * type = p;
+    while( !std::isspace( *p ) )
+	if( *p++ == '\0' )
+	    return 0;
+    // Delineate end of data type by overwriting space
+    *p++ = '\0';
+    if( strcmp( type, "numeric" ) ) {
+	std::cerr << "Warning: treating non-numeric attribute '"
+		  << stored << "' of type '" << type << "' as numeric\n";
+    }
+
+    return stored; // ignoring type as we only consider numeric types ...
+}
+
+// Number of values stored by a record into a sparse vector
+template<typename Syntax>
+size_t count_nonzeros( const char * p, const char * end ) {
+    size_t nvalues = 0;
+    if( Syntax::sparse_open && *p == Syntax::sparse_open ) {
+	++p; // skip opening brace
+	const char * prevp = p;
+	while( (p = std::find_if( p, end, typename Syntax::nz_delim_type() ))
+	       != end ) {
+	    if( *p == Syntax::sparse_close )
+		break;
+	    ++p;
+	    ++nvalues;
+	    prevp = p;
+	}
+	if( std::find_if( prevp, p, IsAlnum() ) != p )
+	    ++nvalues;
+    } else {
+	char * q = const_cast<char *>( p );
+	if( Syntax::dense_open ) {
+	    while( *q != Syntax::dense_open && *q != '\n' && *q != '\0' )
+		++q;
+	    if( *q != Syntax::dense_open )
+		return 0;
+	    ++q;
+	}
+	while( *q != '\n' && *q != '\0' ) {
+	    while( std::isspace( *q ) && *q != '\n' )
+		++q;
+	    if( *q == '\n' || *q == '\0' )
+		break;
+	    char * s = q;
+	    double v = scan_value<double>( q );
+	    if( q == s ) // not a number
+		break;
+	    if( !Syntax::skip_zeros || v > 0 )
+		++nvalues;
+	    while( ( std::isspace( *q ) || Syntax::is_value_sep( *q ) )
+		   && *q != '\n' )
+		++q;
+	}
+    }
+    return nvalues;
+}
+
+template<typename Syntax, typename VectorTy, typename Container>
+typename std::enable_if<is_dense_vector<VectorTy>::value>::type
+create_vector( Container & container, const char * p, const char * end,
+	       size_t ndim ) {
+    container.emplace_back( ndim );
+}
+
+template<typename Syntax, typename VectorTy, typename Container>
+typename std::enable_if<is_sparse_vector<VectorTy>::value>::type
+create_vector( Container & container, const char * p, const char * end,
+	       size_t ndim ) {
+    container.emplace_back( ndim, count_nonzeros<Syntax>( p, end ) );
+}
+
+// A unit of parallel parsing: the records starting in [begin,cend) of a
+// buffer that extends up to end.
+struct chunk {
+    char * begin;
+    char * cend;
+    char * end;
+};
+
+// Split the data in [p,end) at line boundaries into chunks of roughly
+// equal size and append them to chunks.
+inline void split_lines( char * p, char * end, std::vector<chunk> & chunks,
+			 size_t min_chunk = size_t(1)<<16 ) {
+    size_t nchunks = 4 * __cilkrts_get_nworkers();
+    size_t len = end - p;
+    if( len / nchunks < min_chunk )
+	nchunks = len / min_chunk + 1;
+
+    char * prev = p;
+    for( size_t i=1; i < nchunks; ++i ) {
+	char * s = p + i * ( len / nchunks );
+	if( s <= prev )
+	    continue;
+	while( s != end && s[-1] != '\n' )
+	    ++s;
+	if( s != end && s > prev ) {
+	    chunks.push_back( chunk{ prev, s, end } );
+	    prev = s;
+	}
+    }
+    chunks.push_back( chunk{ prev, end, end } );
+}
+
+inline std::vector<chunk> split_lines( char * p, char * end ) {
+    std::vector<chunk> chunks;
+    split_lines( p, end, chunks );
+    return chunks;
+}
+
+// The contents of a data set stored as one or more part files (see
+// get_part_listing). All parts are read in parallel. Each part has its own
+// word container, which receives any header information in that part and,
+// for unmanaged word banks, keeps the part's buffer alive.
+template<typename WordContainerTy>
+class part_buffers {
+public:
+    typedef WordContainerTy			word_container_type;
+    typedef word_container_file_builder<word_container_type> builder_type;
+
+private:
+    std::vector<std::shared_ptr<word_container_type>>	m_idx;
+    std::vector<std::unique_ptr<builder_type>>		m_builder;
+
+public:
+    part_buffers( const std::vector<std::string> & parts )
+	: m_idx( parts.size() ), m_builder( parts.size() ) {
+	cilk_for( size_t i=0; i < parts.size(); ++i ) {
+	    m_idx[i] = std::make_shared<word_container_type>();
+	    m_builder[i].reset( new builder_type( parts[i], *m_idx[i] ) );
+	}
+    }
+
+    size_t size() const { return m_builder.size(); }
+    char * get_buffer( size_t i ) const {
+	return m_builder[i]->get_buffer();
+    }
+    char * get_buffer_end( size_t i ) const {
+	return m_builder[i]->get_buffer_end();
+    }
+    const std::shared_ptr<word_container_type> & get_index( size_t i ) const {
+	return m_idx[i];
+    }
+};
+
+// Apply fn to each record starting in [p,cend). fn must advance p past
+// the record and return false on an incomplete record.
+template<typename Fn>
+void for_each_record( char * p, char * cend, char * end, Fn fn ) {
+    skip_blank_lines( p, end );
+    while( p < cend && *p != '\0' ) {
+	if( !fn( p ) )
+	    break;
+	skip_blank_lines( p, end );
+    }
+}
+
+// Parse the data section into individually allocated vectors. Chunks are
+// parsed in parallel, then concatenated in file order. As with the serial
+// reader, the data ends at the first record that fails to parse.
+template<typename Syntax, typename VectorTy>
+size_t read_records( const std::vector<chunk> & chunks, size_t ndim,
+		     std::vector<VectorTy> & vec, bool & is_sparse ) {
+    typedef VectorTy vector_type;
+
+    size_t nchunks = chunks.size();
+    std::vector<std::vector<vector_type>> parts( nchunks );
+    std::vector<char> sparse( nchunks, 0 );
+    std::vector<char> failed( nchunks, 0 );
+
+    cilk_for( size_t c=0; c < nchunks; ++c ) {
+	std::vector<vector_type> & part = parts[c];
+	char * end = chunks[c].end;
+	for_each_record( chunks[c].begin, chunks[c].cend, end, [&]( char *& q ) {
+		sparse[c] |= Syntax::sparse_open && *q == Syntax::sparse_open;
+		// Create vector speculatively...
+		create_vector<Syntax, vector_type>( part, q, end, ndim );
+		if( !read_vector<Syntax>( q, end, part.back() ) ) {
+		    // Oops, no vector after all...
+		    // This should happen at most once per file
+		    part.pop_back();
+		    failed[c] = 1;
+		    return false;
+		}
+		return true;
+	    } );
+    }
+
+    // Drop the chunks following the first failed record
+    size_t last = 0;
+    while( last < nchunks && !failed[last] )
+	++last;
+    if( last < nchunks )
+	++last;
+
+    size_t total = vec.size();
+    for( size_t c=0; c < last; ++c ) {
+	total += parts[c].size();
+	is_sparse |= sparse[c] != 0;
+    }
+    vec.reserve( total );
+    for( size_t c=0; c < last; ++c ) {
+	std::move( parts[c].begin(), parts[c].end(),
+		   std::back_inserter( vec ) );
+	parts[c].clear();
+    }
+    return total;
+}
+
+template<typename Syntax, typename VectorTy>
+size_t read_records( char * p, char * end, size_t ndim,
+		     std::vector<VectorTy> & vec, bool & is_sparse ) {
+    return read_records<Syntax>( split_lines( p, end ), ndim, vec, is_sparse );
+}
+
+namespace internal {
+
+template<typename VectorSetTy>
+typename std::enable_if<is_dense_vector<typename VectorSetTy::vector_type>::value,
+			std::shared_ptr<VectorSetTy>>::type
+make_vector_set( size_t npoints, size_t ndim, size_t nnz ) {
+    return std::make_shared<VectorSetTy>( npoints, ndim );
+}
+
+template<typename VectorSetTy>
+typename std::enable_if<is_sparse_vector<typename VectorSetTy::vector_type>::value,
+			std::shared_ptr<VectorSetTy>>::type
+make_vector_set( size_t npoints, size_t ndim, size_t nnz ) {
+    return std::make_shared<VectorSetTy>( npoints, ndim, nnz );
+}
+
+template<typename VectorSetTy>
+typename std::enable_if<is_dense_vector<typename VectorSetTy::vector_type>::value>::type
+init_vector( VectorSetTy & set, size_t ndim, size_t nnz ) {
+}
+
+template<typename VectorSetTy>
+typename std::enable_if<is_sparse_vector<typename VectorSetTy::vector_type>::value>::type
+init_vector( VectorSetTy & set, size_t ndim, size_t nnz ) {
+    set.emplace_back( ndim, nnz );
+}
+
+} // namespace internal
+
+// Parse the data section into a pre-allocated vector set (vectors without
+// ownership). A parallel pass over the chunks counts the records and their
+// sizes, then the vectors are laid out and filled in parallel.
+template<typename Syntax, typename VectorSetTy>
+std::shared_ptr<VectorSetTy>
+read_record_set( const std::vector<chunk> & chunks, size_t ndim,
+		 bool & is_sparse ) {
+    typedef VectorSetTy vector_set_type;
+    typedef typename vector_set_type::vector_type vector_type;
+
+    size_t nchunks = chunks.size();
+    std::vector<std::vector<size_t>> nnz( nchunks );
+
+    cilk_for( size_t c=0; c < nchunks; ++c ) {
+	char * end = chunks[c].end;
+	for_each_record( chunks[c].begin, chunks[c].cend, end, [&]( char *& q ) {
+		nnz[c].push_back(
+		    is_sparse_vector<vector_type>::value
+		    ? count_nonzeros<Syntax>( q, end ) : ndim );
+		while( *q != '\n' && *q != '\0' )
+		    ++q;
+		return true;
+	    } );
+    }
+
+    std::vector<size_t> offset( nchunks+1, 0 );
+    size_t total_nnz = 0;
+    for( size_t c=0; c < nchunks; ++c ) {
+	offset[c+1] = offset[c] + nnz[c].size();
+	for( size_t n : nnz[c] )
+	    total_nnz += n;
+    }
+    size_t npoints = offset[nchunks];
+
+    std::shared_ptr<vector_set_type> dvs_ptr
+	= internal::make_vector_set<vector_set_type>( npoints, ndim, total_nnz );
+    vector_set_type & dvs = *dvs_ptr;
+    dvs.clear(); // zero-init
+    for( size_t c=0; c < nchunks; ++c )
+	for( size_t n : nnz[c] )
+	    internal::init_vector( dvs, ndim, n );
+
+    // failed[c] is the index of the first record in chunk c that could not
+    // be read, or npoints if all were read.
+    std::vector<char> sparse( nchunks, 0 );
+    std::vector<size_t> failed( nchunks, npoints );
+    cilk_for( size_t c=0; c < nchunks; ++c ) {
+	size_t i = offset[c];
+	char * end = chunks[c].end;
+	for_each_record( chunks[c].begin, chunks[c].cend, end, [&]( char *& q ) {
+		sparse[c] |= Syntax::sparse_open && *q == Syntax::sparse_open;
+		if( !read_vector<Syntax>( q, end, dvs[i] ) ) {
+		    // Incomplete record
+		    failed[c] = i;
+		    return false;
+		}
+		++i;
+		return true;
+	    } );
+    }
+
+    // The serial reader stops at the first incomplete record.
+    for( size_t c=0; c < nchunks; ++c ) {
+	is_sparse |= sparse[c] != 0;
+	if( failed[c] < npoints )
+	    npoints = failed[c];
+    }
+    dvs.trim_number( npoints );
+    return dvs_ptr;
+}
+
+template<typename Syntax, typename VectorSetTy>
+std::shared_ptr<VectorSetTy>
+read_record_set( char * p, char * end, size_t ndim, bool & is_sparse ) {
+    return read_record_set<Syntax, VectorSetTy>( split_lines( p, end ),
+						 ndim, is_sparse );
+}
+
+} // namespace parse
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_RECORD_PARSER_H
@@ -0,0 +1,140 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_SHORT_WORD_H
+#define INCLUDED_ASAP_SHORT_WORD_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "asap/tokenizer.h"
+
+namespace asap {
+
+namespace text {
+
+// A 16-byte key for word containers. Words of up to 15 characters are held
+// inline, zero-padded, such that comparing or hashing short words never
+// dereferences a pointer; equality takes two 64-bit compares. Longer words
+// are held as a pointer to the null-terminated copy in the word bank and
+// their length.
+//
+// The last byte tags the representation: for inline words it is 15 minus
+// the length, which doubles as the null terminator of a 15-character word;
+// for long words it is 0xff.
+class short_word {
+public:
+    static const size_t max_inline = 15;
+
+private:
+    uint64_t m_w[2];
+
+    static const unsigned char long_tag = 0xff;
+
+    unsigned char tag() const {
+	return reinterpret_cast<const unsigned char *>( m_w )[15];
+    }
+
+public:
+    short_word() { m_w[0] = m_w[1] = 0; set_tag( max_inline ); }
+    short_word( const char * p ) {
+	if( p )
+	    assign( p, strlen( p ) );
+	else {
+	    m_w[0] = m_w[1] = 0;
+	    set_tag( max_inline );
+	}
+    }
+    // Long words (len > max_inline) must be null-terminated and outlive
+    // the key, i.e., stored in a word bank.
+    short_word( const char * p, size_t len ) { assign( p, len ); }
+
+    bool is_inline() const { return tag() != long_tag; }
+
+    size_t size() const {
+	if( is_inline() )
+	    return max_inline - tag();
+	uint32_t len;
+	memcpy( &len, reinterpret_cast<const char *>( m_w ) + 8, sizeof(len) );
+	return len;
+    }
+
+    const char * c_str() const {
+	if( is_inline() )
+	    return reinterpret_cast<const char *>( m_w );
+	const char * p;
+	memcpy( &p, &m_w[0], sizeof(p) );
+	return p;
+    }
+    operator const char * () const { return c_str(); }
+
+    // FNV-1a, as charp_hash, such that iteration order of hash tables does
+    // not depend on the choice of key type
+    size_t hash() const { return word_fnv( c_str(), size() ); }
+
+    bool operator == ( const short_word & w ) const {
+	if( m_w[0] == w.m_w[0] && m_w[1] == w.m_w[1] )
+	    return true;
+	// A word is inline or not depending on its length only
+	if( is_inline() || w.is_inline() )
+	    return false;
+	size_t len = size();
+	return len == w.size() && memcmp( c_str(), w.c_str(), len ) == 0;
+    }
+    bool operator != ( const short_word & w ) const { return !( *this == w ); }
+    bool operator < ( const short_word & w ) const {
+	return strcmp( c_str(), w.c_str() ) < 0;
+    }
+
+private:
+    void set_tag( unsigned char t ) {
+	reinterpret_cast<unsigned char *>( m_w )[15] = t;
+    }
+    void assign( const char * p, size_t len ) {
+	m_w[0] = m_w[1] = 0;
+	if( len <= max_inline ) {
+	    memcpy( m_w, p, len );
+	    set_tag( max_inline - len );
+	} else {
+	    uint32_t len32 = len;
+	    memcpy( &m_w[0], &p, sizeof(p) );
+	    memcpy( reinterpret_cast<char *>( m_w ) + 8, &len32,
+		    sizeof(len32) );
+	    set_tag( long_tag );
+	}
+    }
+};
+
+struct short_word_hash {
+    size_t operator() ( const short_word & w ) const {
+	return w.hash();
+    }
+};
+
+struct short_word_eql {
+    bool operator () ( const short_word & lhs, const short_word & rhs ) const {
+	return lhs == rhs;
+    }
+};
+
+} // namespace text
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_SHORT_WORD_H
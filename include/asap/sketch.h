@@ -0,0 +1,502 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_SKETCH_H
+#define INCLUDED_ASAP_SKETCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
+
+#include "asap/utils.h"
+#include "asap/tokenizer.h"
+#include "asap/word_count.h"
+
+namespace asap {
+
+// Count-min sketch: depth rows of width counters. An item is counted in one
+// counter per row, selected by its 64-bit hash; its estimate is the least of
+// these counters. Estimates never fall short of the true count, and exceed
+// it by at most epsilon() times the total count with probability at least
+// 1 - delta(). Sketches of the same dimensions merge by adding counters.
+class count_min_sketch {
+    size_t		  m_width;	// power of two
+    size_t		  m_depth;
+    uint64_t		  m_total;
+    std::vector<uint64_t> m_count;	// row-major
+
+public:
+    count_min_sketch() : m_width( 0 ), m_depth( 0 ), m_total( 0 ) { }
+    count_min_sketch( size_t width, size_t depth ) {
+	resize( width, depth );
+    }
+
+    // The widest sketch of depth rows that fits in memory bytes
+    static size_t width_for( size_t memory, size_t depth ) {
+	size_t width = 1024;
+	while( 2 * width * depth * sizeof(uint64_t) <= memory )
+	    width *= 2;
+	return width;
+    }
+
+    void resize( size_t width, size_t depth ) {
+	if( width == 0 || ( width & ( width-1 ) ) != 0 || depth == 0 )
+	    fatal( "count_min_sketch: width must be a power of two" );
+	m_width = width;
+	m_depth = depth;
+	m_total = 0;
+	std::vector<uint64_t>( width * depth, 0 ).swap( m_count );
+    }
+
+    void swap( count_min_sketch & s ) {
+	std::swap( m_width, s.m_width );
+	std::swap( m_depth, s.m_depth );
+	std::swap( m_total, s.m_total );
+	m_count.swap( s.m_count );
+    }
+
+    size_t width() const { return m_width; }
+    size_t depth() const { return m_depth; }
+    size_t memory() const { return m_count.size() * sizeof(uint64_t); }
+    uint64_t total() const { return m_total; }
+
+    double epsilon() const { return M_E / double(m_width); }
+    double delta() const { return std::exp( -double(m_depth) ); }
+    // Additive error bound on estimates, holding with probability
+    // 1 - delta()
+    uint64_t error_bound() const {
+	return uint64_t( std::ceil( epsilon() * double(m_total) ) );
+    }
+
+    void add( uint64_t h, uint64_t c = 1 ) {
+	uint64_t step = mix( h );
+	for( size_t r=0; r < m_depth; ++r )
+	    m_count[r * m_width + slot( h, step, r )] += c;
+	m_total += c;
+    }
+
+    uint64_t estimate( uint64_t h ) const {
+	uint64_t step = mix( h );
+	uint64_t e = m_count[slot( h, step, 0 )];
+	for( size_t r=1; r < m_depth; ++r )
+	    e = std::min( e, m_count[r * m_width + slot( h, step, r )] );
+	return e;
+    }
+
+    void merge( const count_min_sketch & rhs ) {
+	if( rhs.m_width != m_width || rhs.m_depth != m_depth )
+	    fatal( "count_min_sketch: merging sketches of different size" );
+	uint64_t * c = m_count.data();
+	const uint64_t * rc = rhs.m_count.data();
+	cilk_for( size_t i=0; i < m_count.size(); ++i )
+	    c[i] += rc[i];
+	m_total += rhs.m_total;
+    }
+
+private:
+    // Rows use the hashes h + r * step (double hashing); step is odd
+    static uint64_t mix( uint64_t h ) {
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h | 1;
+    }
+    size_t slot( uint64_t h, uint64_t step, size_t r ) const {
+	return ( h + r * step ) & ( m_width - 1 );
+    }
+};
+
+// Space-saving summary of the most frequent items: at most capacity items
+// are monitored, with a count and the error by which that count may exceed
+// the true count. An unmonitored item takes over the item with the least
+// count, inheriting that count as its error. The true count of a monitored
+// item lies within [count-error,count]; an unmonitored item occurs at most
+// min_count() times. Items are identified by their 64-bit hash; the word
+// is kept for output.
+//
+// The items are kept in a binary min-heap on the count. An open-addressing
+// table with linear probing maps hashes to heap positions; each item knows
+// its slot in the table, such that moving it in the heap is cheap.
+class space_saving {
+public:
+    struct entry {
+	std::string	word;
+	uint64_t	hash;
+	uint64_t	count;
+	uint64_t	error;
+	size_t		slot;
+    };
+
+private:
+    size_t		  m_capacity;
+    std::vector<entry>	  m_heap;
+    std::vector<size_t>	  m_index;	// heap position + 1, 0 if empty
+
+public:
+    space_saving( size_t capacity = 0 ) : m_capacity( capacity ) {
+	size_t n = 16;
+	while( n < 2 * capacity )
+	    n *= 2;
+	m_index.resize( n, 0 );
+	m_heap.reserve( capacity );
+    }
+
+    void swap( space_saving & s ) {
+	std::swap( m_capacity, s.m_capacity );
+	m_heap.swap( s.m_heap );
+	m_index.swap( s.m_index );
+    }
+
+    size_t capacity() const { return m_capacity; }
+    size_t size() const { return m_heap.size(); }
+    bool full() const { return m_heap.size() >= m_capacity; }
+    uint64_t min_count() const {
+	return full() && !m_heap.empty() ? m_heap[0].count : 0;
+    }
+
+    void offer( uint64_t h, const char * w, size_t len, uint64_t c = 1 ) {
+	size_t i = probe( h );
+	if( m_index[i] ) {
+	    size_t p = m_index[i]-1;
+	    m_heap[p].count += c;
+	    sift_down( p );
+	} else if( !full() ) {
+	    m_heap.push_back( entry{ std::string( w, len ), h, c, 0, i } );
+	    m_index[i] = m_heap.size();
+	    sift_up( m_heap.size()-1 );
+	} else
+	    replace_min( h, w, len, min_count() + c, min_count() );
+    }
+
+    // Monitor the item with hash h in place of the item with the least
+    // count, when full
+    void replace_min( uint64_t h, const char * w, size_t len,
+		      uint64_t count, uint64_t error ) {
+	if( m_heap.empty() )
+	    return;
+	erase_slot( m_heap[0].slot );
+	size_t i = probe( h );
+	entry & e = m_heap[0];
+	e.word.assign( w, len );
+	e.hash = h;
+	e.count = count;
+	e.error = error;
+	e.slot = i;
+	m_index[i] = 1;
+	sift_down( 0 );
+    }
+
+    // Combine with rhs, such that the bounds hold for the union of the
+    // inputs: an item missing from one summary may have occurred up to
+    // that summary's min_count() times.
+    void merge( const space_saving & rhs ) {
+	uint64_t lmin = min_count(), rmin = rhs.min_count();
+	std::vector<entry> all;
+	all.reserve( m_heap.size() + rhs.m_heap.size() );
+	for( const entry & e : m_heap ) {
+	    const entry * r = rhs.find( e.hash );
+	    all.push_back( entry{ e.word, e.hash,
+			e.count + ( r ? r->count : rmin ),
+			e.error + ( r ? r->error : rmin ), 0 } );
+	}
+	for( const entry & e : rhs.m_heap )
+	    if( !find( e.hash ) )
+		all.push_back( entry{ e.word, e.hash, e.count + lmin,
+			    e.error + lmin, 0 } );
+
+	if( all.size() > m_capacity ) {
+	    std::nth_element( all.begin(), all.begin() + m_capacity, all.end(),
+			      []( const entry & a, const entry & b ) {
+				  return a.count > b.count;
+			      } );
+	    all.resize( m_capacity );
+	}
+	m_heap.swap( all );
+	std::fill( m_index.begin(), m_index.end(), 0 );
+	for( size_t p=0; p < m_heap.size(); ++p ) {
+	    size_t i = probe( m_heap[p].hash );
+	    m_heap[p].slot = i;
+	    m_index[i] = p+1;
+	}
+	for( size_t p=m_heap.size()/2; p > 0; --p )
+	    sift_down( p-1 );
+    }
+
+    // The monitored item with hash h, or nullptr
+    const entry * find( uint64_t h ) const {
+	size_t i = probe( h );
+	return m_index[i] ? &m_heap[m_index[i]-1] : nullptr;
+    }
+
+    // The monitored items, by decreasing count
+    std::vector<entry> top() const {
+	std::vector<entry> t( m_heap );
+	std::sort( t.begin(), t.end(),
+		   []( const entry & a, const entry & b ) {
+		       return a.count > b.count
+			   || ( a.count == b.count && a.word < b.word );
+		   } );
+	return t;
+    }
+
+private:
+    // The slot holding h, or the empty slot where it would go
+    size_t probe( uint64_t h ) const {
+	size_t mask = m_index.size() - 1;
+	size_t i = h & mask;
+	while( m_index[i] && m_heap[m_index[i]-1].hash != h )
+	    i = ( i + 1 ) & mask;
+	return i;
+    }
+
+    // Empty slot i, shifting back later slots of the same cluster
+    void erase_slot( size_t i ) {
+	size_t mask = m_index.size() - 1;
+	m_index[i] = 0;
+	for( size_t j = ( i + 1 ) & mask; m_index[j]; j = ( j + 1 ) & mask ) {
+	    entry & e = m_heap[m_index[j]-1];
+	    size_t home = e.hash & mask;
+	    // Move e to i unless its home lies cyclically in (i,j]
+	    if( ( j > i && ( home <= i || home > j ) )
+		|| ( j < i && ( home <= i && home > j ) ) ) {
+		m_index[i] = m_index[j];
+		m_index[j] = 0;
+		e.slot = i;
+		i = j;
+	    }
+	}
+    }
+
+    void place( size_t p, entry && e ) {
+	m_heap[p] = std::move( e );
+	m_index[m_heap[p].slot] = p+1;
+    }
+    void sift_up( size_t p ) {
+	entry e = std::move( m_heap[p] );
+	while( p > 0 && m_heap[(p-1)/2].count > e.count ) {
+	    place( p, std::move( m_heap[(p-1)/2] ) );
+	    p = (p-1)/2;
+	}
+	place( p, std::move( e ) );
+    }
+    void sift_down( size_t p ) {
+	size_t n = m_heap.size();
+	entry e = std::move( m_heap[p] );
+	while( true ) {
+	    size_t c = 2*p+1;
+	    if( c >= n )
+		break;
+	    if( c+1 < n && m_heap[c+1].count < m_heap[c].count )
+		++c;
+	    if( m_heap[c].count >= e.count )
+		break;
+	    place( p, std::move( m_heap[c] ) );
+	    p = c;
+	}
+	place( p, std::move( e ) );
+    }
+};
+
+// Approximate word counts in fixed memory: a count-min sketch estimates the
+// count of any word, a space-saving summary tracks the most frequent words.
+// A word enters a full summary only when its estimate exceeds the least
+// monitored count, which keeps rare words from churning the summary. The
+// bounds on counts then hold with the probability of the sketch's bound.
+// Each worker counts into a view of its own, which are merged by combine().
+// Views are selected by worker number; a view is only touched by strands
+// that do not spawn between selecting and updating it.
+class approximate_counter {
+public:
+    static const bool is_managed = true;
+    static const size_t default_depth = 4;
+
+    struct view {
+	count_min_sketch	sketch;
+	space_saving		top;
+
+	view( size_t width, size_t depth, size_t capacity )
+	    : sketch( width, depth ), top( capacity ) { }
+
+	void add( const char * w, size_t len, uint64_t c = 1 ) {
+	    uint64_t h = text::word_hash( w, len );
+	    sketch.add( h, c );
+	    if( !top.full() || top.find( h ) )
+		top.offer( h, w, len, c );
+	    else {
+		// Admit a word only if it may be more frequent than the least
+		// monitored one; its count is then taken from the sketch
+		uint64_t est = sketch.estimate( h );
+		if( est > top.min_count() )
+		    top.replace_min( h, w, len, est, est - c );
+	    }
+	}
+	void merge( const view & rhs ) {
+	    sketch.merge( rhs.sketch );
+	    top.merge( rhs.top );
+	}
+    };
+
+    // A heavy hitter with bounds on its count: the true count lies in
+    // [lower,upper] if the sketch stays within its error bound
+    struct estimate {
+	std::string	word;
+	uint64_t	upper;
+	uint64_t	lower;
+    };
+
+private:
+    size_t				m_width, m_depth, m_capacity;
+    std::vector<std::unique_ptr<view>>	m_views;	// by worker
+
+public:
+    // Use memory bytes per worker for the sketch, and monitor capacity
+    // words per worker
+    approximate_counter( size_t memory, size_t capacity,
+			 size_t depth = default_depth )
+	: m_width( count_min_sketch::width_for( memory, depth ) ),
+	  m_depth( depth ), m_capacity( capacity ),
+	  m_views( __cilkrts_get_nworkers() ) { }
+
+    approximate_counter( const approximate_counter & ) = delete;
+    approximate_counter & operator = ( const approximate_counter & ) = delete;
+
+    // Text buffers need not be retained
+    void enregister( const std::shared_ptr<char> & ) { }
+
+    // Count a word
+    void add( const char * w, size_t len, uint64_t c = 1 ) {
+	local().add( w, len, c );
+    }
+
+    // Count each word of a per-document word count once, i.e., count
+    // document frequencies
+    template<typename WordMapTy>
+    void count_presence( const WordMapTy & wc ) {
+	view & v = local();
+	for( auto I=wc.cbegin(), E=wc.cend(); I != E; ++I ) {
+	    const char * w = I->first;
+	    v.add( w, strlen( w ) );
+	}
+    }
+
+    // Merge all views into one and return it. Not thread-safe.
+    const view & combine() {
+	std::unique_ptr<view> & r = m_views[0];
+	for( size_t i=1; i < m_views.size(); ++i ) {
+	    if( !m_views[i] )
+		continue;
+	    if( !r )
+		r.swap( m_views[i] );
+	    else {
+		r->merge( *m_views[i] );
+		m_views[i].reset();
+	    }
+	}
+	if( !r )
+	    r.reset( new view( m_width, m_depth, m_capacity ) );
+	return *r;
+    }
+
+    // The k most frequent words, by decreasing count, after combine().
+    // Words are ranked by the tighter of the two upper bounds.
+    std::vector<estimate> heavy_hitters( size_t k ) const {
+	const view & v = *m_views[0];
+	std::vector<space_saving::entry> top = v.top.top();
+	std::vector<estimate> hh;
+	hh.reserve( top.size() );
+	for( const space_saving::entry & e : top )
+	    hh.push_back( estimate{ e.word,
+			std::min( e.count, v.sketch.estimate( e.hash ) ),
+			e.count - e.error } );
+	std::stable_sort( hh.begin(), hh.end(),
+			  []( const estimate & a, const estimate & b ) {
+			      return a.upper > b.upper;
+			  } );
+	if( hh.size() > k )
+	    hh.resize( k );
+	return hh;
+    }
+
+    // Memory used per worker by the sketch
+    size_t memory() const { return m_width * m_depth * sizeof(uint64_t); }
+
+private:
+    view & local() {
+	std::unique_ptr<view> & v = m_views[__cilkrts_get_worker_number()];
+	if( !v )
+	    v.reset( new view( m_width, m_depth, m_capacity ) );
+	return *v;
+    }
+};
+
+namespace text {
+
+// Count the words in [data,data+data_size) approximately. Chunks of
+// chunk_size bytes are counted in parallel.
+inline size_t approximate_catalog( char * data, size_t data_size,
+				   approximate_counter & counter,
+				   size_t chunk_size ) {
+    cilk::reducer< cilk::op_add<size_t> > reduce_num_words(0);
+    char * const data_end = &data[data_size];
+    char * split = data;
+
+    while( split != data_end ) {
+	char * end = split_chunk( split, data_end, chunk_size );
+
+	cilk_spawn [&] ( char * split, char * end ) {
+	    size_t nwords = 0;
+	    tokenize( split, end, [&]( char * w, size_t len ) {
+		    counter.add( w, len );
+		    ++nwords;
+		} );
+	    *reduce_num_words += nwords;
+	}( split, end );
+
+	split = end;
+    }
+    cilk_sync;
+
+    return reduce_num_words.get_value();
+}
+
+} // namespace text
+
+// Count the words of a file approximately, decompressing on the fly if
+// needed
+inline size_t approximate_catalog( const std::string & filename,
+				   approximate_counter & counter,
+				   size_t chunk_size = size_t(1)<<20 ) {
+    return internal::catalog_file(
+	filename, counter, chunk_size,
+	[]( char * data, size_t data_size, approximate_counter & c,
+	    size_t chunk_size ) {
+	    return text::approximate_catalog( data, data_size, c, chunk_size );
+	} );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_SKETCH_H
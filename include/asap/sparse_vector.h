@@ -24,6 +24,10 @@
 #include <memory>
 #include <type_traits>
 #include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <cilk/cilk.h>
 
 #include "asap/traits.h"
 #include "asap/vector_ops.h"
@@ -190,6 +194,25 @@ public:
 	c = m_coord[pos];
     }
 
+    // Retain only the first n non-zeros. The storage is not released,
+    // hence this is only supported if the vector does not own it.
+    void trim_nonzeros( index_type n ) {
+	static_assert( !memory_mgmt_type::deallocate,
+		       "vector must not own its storage" );
+	assert( n <= m_nonzeros );
+	m_nonzeros = n;
+    }
+
+    // Point the vector at a copy of its non-zeros held elsewhere, see
+    // sparse_vector_set::shrink_to_fit(). Only supported if the vector
+    // does not own its storage.
+    void relocate( value_type * value_, index_type * coord_ ) {
+	static_assert( !memory_mgmt_type::deallocate,
+		       "vector must not own its storage" );
+	m_value = value_;
+	m_coord = coord_;
+    }
+
     template<typename Fn>
     void map( Fn & fn ) {
 	for( index_type i=0; i < m_nonzeros; ++i )
@@ -318,13 +341,14 @@ public:
 	    size_t length = dvs.m_vectors[i].length();
 	    size_t nonzeros = dvs.m_vectors[i].nonzeros();
 	    dv_alloc.construct( &m_vectors[i], pv, pi, length, nonzeros );
+	    // Vectors need not be contiguous, see trim_nonzeros()
+	    std::copy( dvs.m_vectors[i].get_value(),
+		       dvs.m_vectors[i].get_value() + nonzeros, pv );
+	    std::copy( dvs.m_vectors[i].get_coord(),
+		       dvs.m_vectors[i].get_coord() + nonzeros, pi );
 	    pv += nonzeros;
 	    pi += nonzeros;
 	}
-	std::copy( &dvs.m_alloc_v[0], &dvs.m_alloc_v[m_total_length],
-		   &m_alloc_v[0] );
-	std::copy( &dvs.m_alloc_i[0], &dvs.m_alloc_i[m_total_length],
-		   &m_alloc_i[0] );
     }
     sparse_vector_set(sparse_vector_set && dvs)
 	: m_vectors(dvs.m_vectors),
@@ -391,8 +415,11 @@ public:
 	    pi = m_alloc_i;
 	} else {
 	    size_t prev_len = m_vectors[m_number-1].nonzeros();
-	    pv = m_vectors[m_number-1].m_value + prev_len;
-	    pi = m_vectors[m_number-1].m_coord + prev_len;
+	    // Vectors may extend sparse_vector (see attributes.h)
+	    pv = m_alloc_v + ( m_vectors[m_number-1].get_value() - m_alloc_v )
+		+ prev_len;
+	    pi = m_alloc_i + ( m_vectors[m_number-1].get_coord() - m_alloc_i )
+		+ prev_len;
 	    assert( pv - m_alloc_v <= m_total_length );
 	    assert( pi - m_alloc_i <= m_total_length );
 	}
@@ -413,6 +440,35 @@ public:
     value_type * get_alloc_v() { return m_alloc_v; }
     index_type * get_alloc_i() { return m_alloc_i; }
 
+    // Release the storage of non-zeros that vectors no longer hold, see
+    // sparse_vector::trim_nonzeros(). The vectors are copied to storage
+    // of exactly the required size, which temporarily holds both copies.
+    void shrink_to_fit() {
+	std::vector<size_t> start( m_number+1 );
+	start[0] = 0;
+	for( size_t i=0; i < m_number; ++i )
+	    start[i+1] = start[i] + m_vectors[i].nonzeros();
+	size_t total_length = start[m_number];
+	if( total_length == m_total_length )
+	    return;
+
+	value_type * pv = value_allocator_type().allocate( total_length );
+	index_type * pi = index_allocator_type().allocate( total_length );
+	cilk_for( size_t i=0; i < m_number; ++i ) {
+	    vector_type & v = m_vectors[i];
+	    std::copy( v.get_value(), v.get_value() + v.nonzeros(),
+		       pv + start[i] );
+	    std::copy( v.get_coord(), v.get_coord() + v.nonzeros(),
+		       pi + start[i] );
+	    v.relocate( pv + start[i], pi + start[i] );
+	}
+	value_allocator_type().deallocate( m_alloc_v, m_total_length );
+	index_allocator_type().deallocate( m_alloc_i, m_total_length );
+	m_alloc_v = pv;
+	m_alloc_i = pi;
+	m_total_length = total_length;
+    }
+
     // TODO: work out iterators
     iterator begin() { return &m_vectors[0]; }
     iterator end() { return &m_vectors[m_number]; }
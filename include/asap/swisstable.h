@@ -0,0 +1,462 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_SWISSTABLE_H
+#define INCLUDED_ASAP_SWISSTABLE_H
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <iterator>
+#include <functional>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace asap {
+
+namespace internal {
+
+// A group of consecutive control bytes, probed in one step. A control byte
+// is negative for an empty slot, or holds 7 bits of the hash of the key
+// stored in a full slot.
+struct ctrl_group {
+    static const size_t width = 16;
+    static const int8_t empty = -128;
+
+#if __SSE2__
+    __m128i ctrl;
+
+    explicit ctrl_group( const int8_t * p )
+	: ctrl( _mm_loadu_si128( (const __m128i *)p ) ) { }
+
+    // Bitmask of the slots with control byte h2
+    uint32_t match( int8_t h2 ) const {
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_set1_epi8( h2 ), ctrl ) );
+    }
+    // Bitmask of the empty slots
+    uint32_t match_empty() const {
+	return _mm_movemask_epi8( ctrl );
+    }
+#else
+    const int8_t * ctrl;
+
+    explicit ctrl_group( const int8_t * p ) : ctrl( p ) { }
+
+    uint32_t match( int8_t h2 ) const {
+	uint32_t m = 0;
+	for( size_t i=0; i < width; ++i )
+	    m |= uint32_t( ctrl[i] == h2 ) << i;
+	return m;
+    }
+    uint32_t match_empty() const {
+	uint32_t m = 0;
+	for( size_t i=0; i < width; ++i )
+	    m |= uint32_t( ctrl[i] < 0 ) << i;
+	return m;
+    }
+#endif
+};
+
+} // namespace internal
+
+// An open-addressing hash table with the interface of hash_table, in the
+// style of SwissTable. Slots are probed linearly, a group of 16 at a time:
+// the control bytes of the group are compared in one SIMD operation against
+// a 7-bit fingerprint of the hash, and only matching slots compare the
+// stored hash and the key. As in hash_table, the hash of every key is
+// retained for reuse.
+//
+// Erasing shifts later elements of the probe sequence back, such that no
+// tombstones are left behind. Keys and values are constructed and destroyed
+// properly, so need not be trivial.
+template<typename Key, typename T, class Hash=std::hash<Key>,
+	 class KeyEqual = std::equal_to<Key>,
+	 class Allocator = std::allocator<std::pair<Key,T>>>
+class swiss_table {
+public:
+    typedef Key				key_type;
+    typedef T				mapped_type;
+    typedef std::pair<Key, T>		value_type;
+    typedef std::size_t 		size_type;
+    typedef std::ptrdiff_t 		difference_type;
+    typedef Hash 			hasher;
+    typedef KeyEqual 			key_equal;
+    typedef Allocator 			allocator_type;
+    typedef value_type& 		reference;
+    typedef const value_type& 		const_reference;
+
+private:
+    typedef internal::ctrl_group		group;
+    typedef std::allocator_traits<allocator_type> alloc_traits;
+    typedef swiss_table<Key, T, Hash, KeyEqual, Allocator> self_type;
+
+    static const size_type min_capacity = group::width;
+
+    value_type		      * m_slots;
+    // One control byte per slot, followed by a copy of the first width-1
+    // control bytes such that a group may be loaded at any slot.
+    std::vector<int8_t>		m_ctrl;
+    std::vector<size_type>	m_hashes;
+    size_type			m_capacity;
+    size_type			m_size;
+    hasher			m_hash;
+    key_equal			m_eq;
+    allocator_type		m_alloc;
+
+public:
+    swiss_table( size_type init_size = 256 )
+	: m_slots( 0 ), m_capacity( 0 ), m_size( 0 ) {
+	assert( (init_size & (init_size-size_type(1))) == 0 );
+	allocate( std::max( init_size, size_type(min_capacity) ) );
+    }
+    swiss_table( const swiss_table & t )
+	: m_slots( 0 ), m_ctrl( t.m_ctrl ), m_hashes( t.m_hashes ),
+	  m_capacity( t.m_capacity ), m_size( t.m_size ),
+	  m_hash( t.m_hash ), m_eq( t.m_eq ), m_alloc( t.m_alloc ) {
+	m_slots = alloc_traits::allocate( m_alloc, m_capacity );
+	for( size_type i=0; i < m_capacity; ++i )
+	    if( is_full( i ) )
+		alloc_traits::construct( m_alloc, &m_slots[i], t.m_slots[i] );
+    }
+    swiss_table( swiss_table && t )
+	: m_slots( 0 ), m_capacity( 0 ), m_size( 0 ) {
+	allocate( min_capacity );
+	swap( t );
+    }
+    ~swiss_table() {
+	destroy_all();
+	alloc_traits::deallocate( m_alloc, m_slots, m_capacity );
+    }
+
+    swiss_table & operator = ( swiss_table t ) {
+	swap( t );
+	return *this;
+    }
+
+    hasher hash_function() const { return m_hash; }
+    key_equal key_eq() const { return m_eq; }
+
+    void swap( self_type & t ) {
+	std::swap( m_slots, t.m_slots );
+	m_ctrl.swap( t.m_ctrl );
+	m_hashes.swap( t.m_hashes );
+	std::swap( m_capacity, t.m_capacity );
+	std::swap( m_size, t.m_size );
+	std::swap( m_hash, t.m_hash );
+	std::swap( m_eq, t.m_eq );
+	std::swap( m_alloc, t.m_alloc );
+    }
+
+    // Remove all elements, retaining the capacity
+    void clear() {
+	destroy_all();
+	std::fill( m_ctrl.begin(), m_ctrl.end(), int8_t(group::empty) );
+	m_size = 0;
+    }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_type capacity() const { return m_capacity; }
+
+    // Resize to newsize slots, or the smallest larger power of two that
+    // holds all elements.
+    void rehash( size_type newsize ) {
+	assert( (newsize & (newsize-size_type(1))) == 0 );
+	newsize = std::max( newsize, size_type(min_capacity) );
+	while( !fits( m_size, newsize ) )
+	    newsize <<= 1;
+	if( newsize == m_capacity )
+	    return;
+
+	value_type * slots = m_slots;
+	std::vector<int8_t> ctrl;
+	std::vector<size_type> hashes;
+	ctrl.swap( m_ctrl );
+	hashes.swap( m_hashes );
+	size_type capacity = m_capacity;
+
+	allocate( newsize );
+	for( size_type i=0; i < capacity; ++i ) {
+	    if( ctrl[i] >= 0 ) {
+		size_type j = find_empty( hashes[i] );
+		alloc_traits::construct( m_alloc, &m_slots[j],
+					 std::move( slots[i] ) );
+		alloc_traits::destroy( m_alloc, &slots[i] );
+		set_ctrl( j, ctrl[i] );
+		m_hashes[j] = hashes[i];
+	    }
+	}
+	alloc_traits::deallocate( m_alloc, slots, capacity );
+    }
+
+    mapped_type & operator[] ( const key_type & key ) {
+	size_type h = m_hash( key );
+	std::pair<size_type,bool> r = probe( key, h );
+	if( !r.second )
+	    r.first = emplace_at( r.first, h, key, mapped_type() );
+	return m_slots[r.first].second;
+    }
+
+    class const_iterator
+	: public std::iterator<std::forward_iterator_tag, value_type> {
+	const swiss_table * a;
+	size_type index;
+    public:
+	typedef Hash hasher;
+
+	const_iterator( const swiss_table & a_, size_type index_ )
+	    : a( &a_ ), index( index_ ) {
+	    skip();
+	}
+
+	bool operator == ( const const_iterator & other ) const {
+	    return index == other.index;
+	}
+	bool operator != ( const const_iterator & other ) const {
+	    return index != other.index;
+	}
+	const_iterator & operator ++ () {
+	    ++index;
+	    skip();
+	    return *this;
+	}
+	const_reference operator * () const { return a->m_slots[index]; }
+	const value_type * operator -> () const { return &a->m_slots[index]; }
+	// The stored hash of the key
+	size_type hash() const { return a->m_hashes[index]; }
+
+    private:
+	void skip() {
+	    while( index < a->m_capacity && !a->is_full( index ) )
+		++index;
+	}
+	friend class swiss_table;
+    };
+
+    class iterator
+	: public std::iterator<std::forward_iterator_tag, value_type> {
+	swiss_table * a;
+	size_type index;
+    public:
+	typedef Hash hasher;
+
+	iterator( swiss_table & a_, size_type index_ )
+	    : a( &a_ ), index( index_ ) {
+	    skip();
+	}
+
+	operator const_iterator () const {
+	    return const_iterator( *a, index );
+	}
+
+	bool operator == ( const iterator & other ) const {
+	    return index == other.index;
+	}
+	bool operator != ( const iterator & other ) const {
+	    return index != other.index;
+	}
+	iterator & operator ++ () {
+	    ++index;
+	    skip();
+	    return *this;
+	}
+	value_type & operator * () const { return a->m_slots[index]; }
+	value_type * operator -> () const { return &a->m_slots[index]; }
+	size_type hash() const { return a->m_hashes[index]; }
+
+    private:
+	void skip() {
+	    while( index < a->m_capacity && !a->is_full( index ) )
+		++index;
+	}
+	friend class swiss_table;
+    };
+
+    std::pair<iterator,bool> insert( const value_type & kv ) {
+	return insert( kv, m_hash( kv.first ) );
+    }
+
+    // Insert with a known hash h, which must equal hash_function()(kv.first)
+    std::pair<iterator,bool> insert( const value_type & kv, size_type h ) {
+	std::pair<size_type,bool> r = probe( kv.first, h );
+	if( r.second )
+	    return std::make_pair( iterator( *this, r.first ), false );
+	r.first = emplace_at( r.first, h, kv.first, kv.second );
+	return std::make_pair( iterator( *this, r.first ), true );
+    }
+
+    template<typename Iterator>
+    void insert( Iterator from, Iterator to ) {
+	while( from != to ) {
+	    insert( *from );
+	    ++from;
+	}
+    }
+
+    const_iterator find( const key_type & key ) const {
+	return find( key, m_hash( key ) );
+    }
+    iterator find( const key_type & key ) {
+	return find( key, m_hash( key ) );
+    }
+
+    // Lookup with a known hash h, which must equal hash_function()(key)
+    const_iterator find( const key_type & key, size_type h ) const {
+	std::pair<size_type,bool> r = probe( key, h );
+	return r.second ? const_iterator( *this, r.first ) : cend();
+    }
+    iterator find( const key_type & key, size_type h ) {
+	std::pair<size_type,bool> r = probe( key, h );
+	return r.second ? iterator( *this, r.first ) : end();
+    }
+
+    size_type erase( const key_type & key ) {
+	std::pair<size_type,bool> r = probe( key, m_hash( key ) );
+	if( !r.second )
+	    return 0;
+	erase_at( r.first );
+	return 1;
+    }
+    // Note: invalidates all iterators, as elements may move
+    void erase( const_iterator I ) {
+	erase_at( I.index );
+    }
+
+    iterator begin() { return iterator( *this, 0 ); }
+    iterator end() { return iterator( *this, m_capacity ); }
+
+    const_iterator begin() const { return const_iterator( *this, 0 ); }
+    const_iterator end() const { return const_iterator( *this, m_capacity ); }
+
+    const_iterator cbegin() const { return const_iterator( *this, 0 ); }
+    const_iterator cend() const { return const_iterator( *this, m_capacity ); }
+
+private:
+    // Maximum load factor of 7/8
+    static bool fits( size_type n, size_type capacity ) {
+	return n <= capacity - capacity / 8;
+    }
+
+    static int8_t h2_of( size_type h ) {
+	return int8_t( h >> ( 8 * sizeof(size_type) - 7 ) );
+    }
+
+    bool is_full( size_type i ) const { return m_ctrl[i] >= 0; }
+
+    void set_ctrl( size_type i, int8_t c ) {
+	m_ctrl[i] = c;
+	if( i < group::width - 1 )
+	    m_ctrl[m_capacity + i] = c;
+    }
+
+    void allocate( size_type capacity ) {
+	m_slots = alloc_traits::allocate( m_alloc, capacity );
+	m_ctrl.assign( capacity + group::width - 1, int8_t(group::empty) );
+	m_hashes.assign( capacity, 0 );
+	m_capacity = capacity;
+    }
+
+    void destroy_all() {
+	for( size_type i=0; i < m_capacity; ++i )
+	    if( is_full( i ) )
+		alloc_traits::destroy( m_alloc, &m_slots[i] );
+    }
+
+    // Returns the slot holding key and true, or else the first empty slot
+    // in the probe sequence and false.
+    std::pair<size_type,bool> probe( const key_type & key, size_type h ) const {
+	size_type mask = m_capacity - 1;
+	int8_t h2 = h2_of( h );
+	size_type pos = h & mask;
+	while( true ) {
+	    group g( &m_ctrl[pos] );
+	    uint32_t e = g.match_empty();
+	    uint32_t m = g.match( h2 );
+	    // The key cannot be stored beyond an empty slot
+	    if( e )
+		m &= ( e & -e ) - 1;
+	    for( ; m; m &= m - 1 ) {
+		size_type i = ( pos + __builtin_ctz( m ) ) & mask;
+		if( m_hashes[i] == h && m_eq( m_slots[i].first, key ) )
+		    return std::make_pair( i, true );
+	    }
+	    if( e )
+		return std::make_pair( ( pos + __builtin_ctz( e ) ) & mask,
+				       false );
+	    pos = ( pos + group::width ) & mask;
+	}
+    }
+
+    size_type find_empty( size_type h ) const {
+	size_type mask = m_capacity - 1;
+	size_type pos = h & mask;
+	while( true ) {
+	    uint32_t e = group( &m_ctrl[pos] ).match_empty();
+	    if( e )
+		return ( pos + __builtin_ctz( e ) ) & mask;
+	    pos = ( pos + group::width ) & mask;
+	}
+    }
+
+    // Construct an element in empty slot i, which was returned by probe().
+    // Returns the slot where the element is stored.
+    template<typename V>
+    size_type emplace_at( size_type i, size_type h, const key_type & key,
+			  V && val ) {
+	if( !fits( m_size + 1, m_capacity ) ) {
+	    rehash( m_capacity << 1 );
+	    i = find_empty( h );
+	}
+	alloc_traits::construct( m_alloc, &m_slots[i], key,
+				 std::forward<V>( val ) );
+	set_ctrl( i, h2_of( h ) );
+	m_hashes[i] = h;
+	++m_size;
+	return i;
+    }
+
+    // Backward-shift deletion: move later elements of the cluster into
+    // the hole, unless doing so would place them before their home slot.
+    void erase_at( size_type i ) {
+	size_type mask = m_capacity - 1;
+	alloc_traits::destroy( m_alloc, &m_slots[i] );
+	for( size_type j=( i + 1 ) & mask; is_full( j ); j=( j + 1 ) & mask ) {
+	    size_type home = m_hashes[j] & mask;
+	    if( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) ) {
+		alloc_traits::construct( m_alloc, &m_slots[i],
+					 std::move( m_slots[j] ) );
+		alloc_traits::destroy( m_alloc, &m_slots[j] );
+		set_ctrl( i, m_ctrl[j] );
+		m_hashes[i] = m_hashes[j];
+		i = j;
+	    }
+	}
+	set_ctrl( i, group::empty );
+	--m_size;
+    }
+};
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_SWISSTABLE_H
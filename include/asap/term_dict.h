@@ -0,0 +1,391 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_TERM_DICT_H
+#define INCLUDED_ASAP_TERM_DICT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include <cilk/cilk.h>
+
+#include "asap/utils.h"
+#include "asap/word_bank.h"
+#include "asap/word_count.h"
+#include "asap/tokenizer.h"
+#include "asap/data_set.h"
+#include "asap/sparse_vector.h"
+#include "asap/parallel_sort.h"
+
+namespace asap {
+
+// A concurrent dictionary that assigns a dense 32-bit id to every distinct
+// term, in the order in which terms are first interned. Once all terms are
+// known, the rest of the TF/IDF pipeline operates on ids only.
+//
+// The table is lock-striped: the top bits of the hash select one of a
+// number of shards, each an open-addressing table protected by its own
+// lock. Hashes are stored alongside the terms, so probes compare hashes
+// before strings and growing a shard never rehashes a string. Terms are
+// copied into the shard's word bank.
+//
+// After the concurrent phase, freeze() builds the list of terms in id
+// order, annotated with their document frequency. The dictionary then
+// serves as the column index of a TF/IDF data set.
+class term_dictionary {
+public:
+    typedef uint32_t					id_type;
+    static const id_type				npos = ~id_type(0);
+    typedef uint64_t					df_type;
+    typedef appear_count<size_t, size_t>		count_type;
+    typedef std::pair<const char *, count_type>		value_type;
+    typedef std::vector<value_type>::const_iterator	const_iterator;
+
+private:
+    static const unsigned shard_bits = 8;
+
+    struct slot {
+	uint64_t	  hash;
+	const char	* word;
+	id_type		  id;
+	df_type		  df;	// see count_presence()
+    };
+
+    struct shard {
+	std::mutex		mux;
+	std::vector<slot>	table;
+	size_t			used;
+	word_bank_managed	bank;
+
+	shard() : table( 64, slot{ 0, nullptr, 0, 0 } ), used( 0 ) { }
+    };
+
+    std::unique_ptr<shard[]>	m_shards;
+    std::atomic<id_type>	m_next;
+    std::vector<const char *>	m_words;	// by id, see collect()
+    std::vector<value_type>	m_terms;	// by id, see freeze()
+
+public:
+    term_dictionary()
+	: m_shards( new shard[size_t(1)<<shard_bits] ), m_next( 0 ) { }
+
+    term_dictionary( const term_dictionary & ) = delete;
+    term_dictionary & operator = ( const term_dictionary & ) = delete;
+
+    size_t size() const { return m_next.load(); }
+
+    // Return the id of the NUL-terminated term w, assigning the next id
+    // if the term has not been seen before. Thread-safe.
+    id_type intern( const char * w ) {
+	return intern( w, 0 );
+    }
+
+    // The id of the NUL-terminated term w, or npos if absent. Must not run
+    // concurrently with intern().
+    id_type find( const char * w ) const {
+	size_t len;
+	uint64_t h = hash( w, len );
+	const shard & s = m_shards[h >> (64-shard_bits)];
+	size_t mask = s.table.size() - 1;
+	for( size_t i = h & mask; s.table[i].word; i = ( i + 1 ) & mask )
+	    if( s.table[i].hash == h && !strcmp( s.table[i].word, w ) )
+		return s.table[i].id;
+	return npos;
+    }
+
+    // Convert a per-document word count into a list of (id, count) pairs,
+    // ordered by id.
+    template<typename WordMapTy, typename IdCatalogTy>
+    void intern( const WordMapTy & wc, IdCatalogTy & catalog ) {
+	catalog.clear();
+	catalog.reserve( wc.size() );
+	for( auto I=wc.cbegin(), E=wc.cend(); I != E; ++I )
+	    catalog.emplace_back( intern( I->first ), I->second );
+	std::sort( catalog.begin(), catalog.end() );
+    }
+
+    // Intern the words of a per-document word count and count the document
+    // towards their document frequency, such that the word count can be
+    // discarded immediately. Thread-safe.
+    template<typename WordMapTy>
+    void count_presence( const WordMapTy & wc ) {
+	for( auto I=wc.cbegin(), E=wc.cend(); I != E; ++I )
+	    intern( I->first, 1 );
+    }
+
+    // The document frequencies counted by count_presence(), by id.
+    // Not thread-safe.
+    std::vector<df_type> document_frequency() const {
+	std::vector<df_type> df( size(), 0 );
+	cilk_for( size_t k=0; k < (size_t(1)<<shard_bits); ++k ) {
+	    for( const slot & e : m_shards[k].table )
+		if( e.word )
+		    df[e.id] = e.df;
+	}
+	return df;
+    }
+
+    // Renumber the ids from first onwards in lexicographic order of the
+    // terms; lower ids are retained. As ids are otherwise assigned in order
+    // of a parallel traversal, this makes them deterministic. Returns the
+    // mapping from old to new ids, which must be applied to all catalogs.
+    // Not thread-safe.
+    std::vector<id_type> sort_ids( id_type first = 0 ) {
+	collect();
+	size_t n = m_words.size();
+	std::vector<id_type> order( n );
+	for( size_t i=0; i < n; ++i )
+	    order[i] = i;
+	if( first < n )
+	    parallel_sort( order.begin() + first, order.end(),
+			   [&]( id_type a, id_type b ) {
+			       return strcmp( m_words[a], m_words[b] ) < 0;
+			   } );
+
+	std::vector<id_type> remap( n );
+	std::vector<const char *> words( n );
+	cilk_for( size_t i=0; i < n; ++i ) {
+	    remap[order[i]] = i;
+	    words[i] = m_words[order[i]];
+	}
+	m_words.swap( words );
+	return remap;
+    }
+
+    // Build the list of terms in id order, with document frequencies df.
+    // Not thread-safe.
+    template<typename CountTy>
+    void freeze( const std::vector<CountTy> & df ) {
+	collect();
+	size_t n = m_words.size();
+	m_terms.resize( n );
+	cilk_for( size_t i=0; i < n; ++i ) {
+	    m_terms[i].first = m_words[i];
+	    m_terms[i].second.first = df[i];
+	    m_terms[i].second.second = i;
+	}
+    }
+
+    // Drop the terms that do not pass the filter, given their document
+    // frequencies df over num_docs documents, as passed to freeze(). The
+    // other terms are numbered consecutively in id order, and df is
+    // renumbered alike. Returns the mapping from old to new ids, with npos
+    // for dropped terms, which must be applied to all catalogs. find()
+    // continues to return the old ids. Not thread-safe.
+    template<typename CountTy>
+    std::vector<id_type> prune( std::vector<CountTy> & df,
+				vocabulary_filter & filter, size_t num_docs ) {
+	size_t n = m_terms.size();
+	prune_vocabulary( m_terms.begin(), m_terms.end(), filter, num_docs );
+
+	std::vector<id_type> remap( n );
+	size_t k = 0;
+	for( size_t i=0; i < n; ++i ) {
+	    if( !internal::has_id( m_terms[i].second.second ) ) {
+		remap[i] = npos;
+		continue;
+	    }
+	    remap[i] = k;
+	    m_terms[k] = m_terms[i];
+	    df[k] = df[i];
+	    ++k;
+	}
+	m_terms.resize( k );
+	df.resize( k );
+	return remap;
+    }
+
+    // Access to the frozen dictionary
+    const_iterator cbegin() const { return m_terms.cbegin(); }
+    const_iterator cend() const { return m_terms.cend(); }
+    const_iterator begin() const { return m_terms.cbegin(); }
+    const_iterator end() const { return m_terms.cend(); }
+    const char * operator[] ( size_t id ) const { return m_terms[id].first; }
+
+    // Hash of the NUL-terminated term w; sets len to the length of w
+    static uint64_t hash( const char * w, size_t & len ) {
+	len = strlen( w );
+	return text::word_hash( w, len );
+    }
+
+private:
+    // Intern w and add inc to its document frequency
+    id_type intern( const char * w, df_type inc ) {
+	size_t len;
+	uint64_t h = hash( w, len );
+	shard & s = m_shards[h >> (64-shard_bits)];
+
+	std::lock_guard<std::mutex> lock( s.mux );
+	size_t mask = s.table.size() - 1;
+	size_t i = h & mask;
+	while( s.table[i].word ) {
+	    if( s.table[i].hash == h && !strcmp( s.table[i].word, w ) ) {
+		s.table[i].df += inc;
+		return s.table[i].id;
+	    }
+	    i = ( i + 1 ) & mask;
+	}
+
+	id_type id = m_next++;
+	if( id == npos )
+	    fatal( "term_dictionary: more than 2^32-1 terms" );
+	s.table[i] = slot{ h, s.bank.store( w, len ), id, inc };
+	if( 2 * ++s.used > s.table.size() )
+	    grow( s );
+	return id;
+    }
+
+    static void grow( shard & s ) {
+	std::vector<slot> table( 2 * s.table.size(), slot{ 0, nullptr, 0, 0 } );
+	size_t mask = table.size() - 1;
+	for( const slot & e : s.table ) {
+	    if( !e.word )
+		continue;
+	    size_t i = e.hash & mask;
+	    while( table[i].word )
+		i = ( i + 1 ) & mask;
+	    table[i] = e;
+	}
+	s.table.swap( table );
+    }
+
+    // Index the terms by id
+    void collect() {
+	size_t n = m_next.load();
+	if( m_words.size() == n )
+	    return;
+	m_words.resize( n );
+	cilk_for( size_t k=0; k < (size_t(1)<<shard_bits); ++k ) {
+	    for( const slot & e : m_shards[k].table )
+		if( e.word )
+		    m_words[e.id] = e.word;
+	}
+    }
+};
+
+// Document frequency of each term: the number of catalogs that contain it.
+// Catalogs are lists of (id, count) pairs. Only the catalogs at positions n
+// for which select(n) holds are counted.
+template<typename InputIterator, typename Predicate>
+std::vector<term_dictionary::df_type>
+document_frequency( InputIterator I, InputIterator E, size_t num_terms,
+		    Predicate select ) {
+    std::vector<term_dictionary::df_type> df( num_terms, 0 );
+    term_dictionary::df_type * h = df.data();
+    cilk_for( InputIterator CI=I; CI != E; ++CI ) {
+	if( !select( std::distance( I, CI ) ) )
+	    continue;
+	for( auto & t : *CI )
+	    __sync_fetch_and_add( &h[t.first], 1 );
+    }
+    return df;
+}
+
+template<typename InputIterator>
+std::vector<term_dictionary::df_type>
+document_frequency( InputIterator I, InputIterator E, size_t num_terms ) {
+    return document_frequency( I, E, num_terms,
+			       []( size_t ) { return true; } );
+}
+
+// Apply a renumbering of term ids, see term_dictionary::sort_ids() and
+// term_dictionary::prune(). Terms mapped to npos are removed.
+template<typename InputIterator, typename IdTy>
+void remap_ids( InputIterator I, InputIterator E,
+		const std::vector<IdTy> & remap ) {
+    cilk_for( InputIterator CI=I; CI != E; ++CI ) {
+	for( auto & t : *CI )
+	    t.first = remap[t.first];
+	std::sort( CI->begin(), CI->end() );
+	// npos sorts last
+	while( !CI->empty() && CI->back().first == term_dictionary::npos )
+	    CI->pop_back();
+    }
+}
+
+// TF/IDF over catalogs of (id, count) pairs ordered by id. Document
+// frequencies are looked up by id; no word is touched. The frequencies
+// are relative to num_docs documents, which defaults to the number of
+// catalogs, but may include documents counted previously (see df_store).
+template<typename VectorTy, typename InputIterator, typename CountTy,
+	 typename VectorNameTy>
+data_set<VectorTy, term_dictionary, VectorNameTy>
+tfidf( InputIterator I, InputIterator E,
+       std::shared_ptr<term_dictionary> & dict_ptr,
+       const std::vector<CountTy> & df,
+       std::shared_ptr<VectorNameTy> & vec_names_ptr,
+       size_t num_docs = 0,
+       const tfidf_weighting & weighting = tfidf_weighting() ) {
+    typedef data_set<VectorTy, term_dictionary, VectorNameTy> data_set_type;
+    typedef typename data_set_type::vector_list_type vector_list_type;
+    typedef typename vector_list_type::value_type value_type;
+    typedef typename vector_list_type::index_type index_type;
+
+    size_t num_points = std::distance( I, E );
+    size_t num_dimensions = std::distance( dict_ptr->cbegin(),
+					   dict_ptr->cend() );
+    size_t nonzeros = std::for_each( I, E, SizeCounter<decltype(*I)>() ).size;
+
+    static_assert( is_sparse_vector<VectorTy>::value, "must be sparse - constructor" );
+    std::shared_ptr<vector_list_type> vectors_ptr
+	= std::make_shared<vector_list_type>( num_points, num_dimensions, nonzeros );
+    vector_list_type & vectors = *vectors_ptr;
+
+    std::vector<size_t> vec_start( num_points );
+    size_t inc_nonzeros = 0;
+    size_t i=0;
+    for( auto II=I; II != E; ++II, ++i ) {
+	size_t fcount = II->size();
+	vec_start[i] = inc_nonzeros;
+	inc_nonzeros += fcount;
+	vectors.emplace_back( num_dimensions, fcount );
+    }
+
+    // Inverse document frequencies
+    std::vector<value_type> idf( num_dimensions );
+    if( num_docs == 0 )
+	num_docs = num_points;
+    cilk_for( size_t j=0; j < num_dimensions; ++j )
+	idf[j] = log10( value_type(num_docs + 1) / value_type(df[j] + 1) );
+
+    cilk_for( size_t i=0; i < num_points; ++i ) {
+	auto PI = std::next( I, i );
+	value_type *v = &vectors.get_alloc_v()[vec_start[i]];
+	index_type *c = &vectors.get_alloc_i()[vec_start[i]];
+	size_t f = 0;
+	for( auto MI=PI->cbegin(), ME=PI->cend(); MI != ME; ++MI, ++f ) {
+	    c[f] = MI->first;
+	    v[f] = weighting.tf<value_type>( MI->second ) * idf[MI->first];
+	}
+	internal::tfidf_finish( vectors[i], v, c, f, weighting );
+    }
+    vectors.shrink_to_fit();
+
+    const char * name = "tfidf";
+    return data_set_type( name, dict_ptr, vec_names_ptr, vectors_ptr, false );
+}
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_TERM_DICT_H
@@ -0,0 +1,173 @@
+/* -*-C++-*-
+ */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+
+#ifndef INCLUDED_ASAP_TOKENIZER_H
+#define INCLUDED_ASAP_TOKENIZER_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Word tokenizer for text::word_catalog and text::ngram_catalog.
+// A word is a letter followed by any number of letters and quotes; the
+// input is upper-cased along the way. The input is classified 64 bytes at
+// a time into bit masks of letters and quotes, using AVX2 or SSE2 where
+// available. Word boundaries then follow from bit arithmetic on the masks.
+
+namespace asap {
+
+namespace internal {
+
+// Upper-case the 64 bytes at p in place and return the masks of letters
+// and of quotes, with bit i describing p[i].
+inline void classify64( char * p, uint64_t & letter, uint64_t & quote ) {
+#if defined(__AVX2__)
+    const __m256i lbias = _mm256_set1_epi8( (char)(0x80 - 'a') );
+    const __m256i ubias = _mm256_set1_epi8( (char)(0x80 - 'A') );
+    const __m256i limit = _mm256_set1_epi8( (char)(0x80 + 26) );
+    const __m256i caseb = _mm256_set1_epi8( 0x20 );
+    const __m256i q = _mm256_set1_epi8( '\'' );
+    letter = quote = 0;
+    for( int i=0; i < 2; ++i ) {
+	__m256i c = _mm256_loadu_si256( (const __m256i *)&p[32*i] );
+	// Range tests: biased values below limit as signed bytes
+	__m256i lower = _mm256_cmpgt_epi8(
+	    limit, _mm256_add_epi8( c, lbias ) );
+	c = _mm256_sub_epi8( c, _mm256_and_si256( lower, caseb ) );
+	_mm256_storeu_si256( (__m256i *)&p[32*i], c );
+	__m256i l = _mm256_cmpgt_epi8( limit, _mm256_add_epi8( c, ubias ) );
+	__m256i e = _mm256_cmpeq_epi8( c, q );
+	letter |= uint64_t(uint32_t(_mm256_movemask_epi8( l ))) << (32*i);
+	quote |= uint64_t(uint32_t(_mm256_movemask_epi8( e ))) << (32*i);
+    }
+#elif defined(__SSE2__)
+    const __m128i lbias = _mm_set1_epi8( (char)(0x80 - 'a') );
+    const __m128i ubias = _mm_set1_epi8( (char)(0x80 - 'A') );
+    const __m128i limit = _mm_set1_epi8( (char)(0x80 + 26) );
+    const __m128i caseb = _mm_set1_epi8( 0x20 );
+    const __m128i q = _mm_set1_epi8( '\'' );
+    letter = quote = 0;
+    for( int i=0; i < 4; ++i ) {
+	__m128i c = _mm_loadu_si128( (const __m128i *)&p[16*i] );
+	__m128i lower = _mm_cmplt_epi8( _mm_add_epi8( c, lbias ), limit );
+	c = _mm_sub_epi8( c, _mm_and_si128( lower, caseb ) );
+	_mm_storeu_si128( (__m128i *)&p[16*i], c );
+	__m128i l = _mm_cmplt_epi8( _mm_add_epi8( c, ubias ), limit );
+	__m128i e = _mm_cmpeq_epi8( c, q );
+	letter |= uint64_t(_mm_movemask_epi8( l )) << (16*i);
+	quote |= uint64_t(_mm_movemask_epi8( e )) << (16*i);
+    }
+#else
+    letter = quote = 0;
+    for( int i=0; i < 64; ++i ) {
+	if( p[i] >= 'a' && p[i] <= 'z' )
+	    p[i] = ( p[i] - 'a' ) + 'A';
+	letter |= uint64_t( p[i] >= 'A' && p[i] <= 'Z' ) << i;
+	quote |= uint64_t( p[i] == '\'' ) << i;
+    }
+#endif
+}
+
+} // namespace internal
+
+namespace text {
+
+// Upper-case [p,end) and call fn( w, len ) for each word, in order. Words
+// are NUL-terminated in place, overwriting the character following them,
+// which may be *end.
+template<typename Fn>
+void tokenize( char * p, char * end, Fn fn ) {
+    uint64_t carry = 0;	// last byte of previous block is in a word
+    char * w = 0;	// start of pending word
+    char tail[64];
+
+    for( char * b = p; b < end; b += 64 ) {
+	size_t n = std::min( size_t(end - b), size_t(64) );
+	uint64_t letter, quote;
+	if( n == 64 )
+	    internal::classify64( b, letter, quote );
+	else {
+	    // Pad the final block with non-word characters
+	    memcpy( tail, b, n );
+	    memset( &tail[n], ' ', 64-n );
+	    internal::classify64( tail, letter, quote );
+	    memcpy( b, tail, n );
+	}
+
+	// Quotes belong to a word only when a run of quotes follows a
+	// letter (or continues a word from the previous block). Adding the
+	// first bit of such runs carries through the run.
+	uint64_t qstart = quote & ~( quote << 1 ) & ( ( letter << 1 ) | carry );
+	uint64_t inword = letter | ( ( ( quote + qstart ) ^ quote ) & quote );
+	uint64_t prev = ( inword << 1 ) | carry;
+	uint64_t starts = inword & ~prev;
+	uint64_t ends = ~inword & prev;
+	carry = inword >> 63;
+
+	// Starts and ends alternate
+	while( true ) {
+	    if( w ) {
+		if( !ends )
+		    break;
+		char * e = b + __builtin_ctzll( ends );
+		ends &= ends - 1;
+		*e = '\0';
+		fn( w, size_t(e - w) );
+		w = 0;
+	    }
+	    if( !starts )
+		break;
+	    w = b + __builtin_ctzll( starts );
+	    starts &= starts - 1;
+	}
+    }
+
+    if( w ) {
+	*end = '\0';
+	fn( w, size_t(end - w) );
+    }
+}
+
+// FNV-1a hash of the word [w,w+len), as charp_hash
+inline uint64_t word_fnv( const char * w, size_t len ) {
+    uint64_t v = 14695981039346656037ULL;
+    for( size_t i=0; i < len; ++i )
+	v = ( v ^ uint64_t(w[i]) ) * 1099511628211ULL;
+    return v;
+}
+
+// 64-bit hash of the word [w,w+len): FNV-1a with a final mix, such that all
+// bits of the hash vary, e.g. where the top bits select a shard or feature
+inline uint64_t word_hash( const char * w, size_t len ) {
+    uint64_t v = word_fnv( w, len );
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    return v;
+}
+
+} // namespace text
+
+} // namespace asap
+
+#endif // INCLUDED_ASAP_TOKENIZER_H
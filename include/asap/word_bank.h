@@ -27,12 +27,20 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <iterator>
 #include <utility>
 #include <memory>
+#include <mutex>
 
 #include "asap/traits.h"
 #include "asap/hashtable.h"
 #include "asap/hashindex.h"
+#include "asap/swisstable.h"
+#include "asap/perfect_hash.h"
+#include "asap/short_word.h"
+#include "asap/compressed_io.h"
 
 namespace asap {
 
@@ -40,13 +48,15 @@ template<typename Container>
 typename std::enable_if<
     !is_specialization_of<hash_table, Container>::value
 && !is_specialization_of<hash_index, Container>::value
+&& !is_specialization_of<swiss_table, Container>::value
 && !is_specialization_of<std::vector, Container>::value>::type
 reserve_space( Container & c, size_t s ) { }
 
 template<typename Container,
 	 typename = typename std::enable_if<
 	     is_specialization_of<hash_table, Container>::value
-	     || is_specialization_of<hash_index, Container>::value>::type>
+	     || is_specialization_of<hash_index, Container>::value
+	     || is_specialization_of<swiss_table, Container>::value>::type>
 void reserve_space( Container & c, size_t s ) {
     size_t s2 = s;
     size_t m = 1;
@@ -65,6 +75,112 @@ void reserve_space( Container & c, size_t s ) {
     c.reserve( s );
 }
 
+// Release spare capacity once a container will no longer grow
+template<typename Container>
+typename std::enable_if<
+    !is_specialization_of<hash_index, Container>::value
+&& !is_specialization_of<std::vector, Container>::value>::type
+shrink_space( Container & c ) { }
+
+template<typename Container>
+typename std::enable_if<
+    is_specialization_of<hash_index, Container>::value>::type
+shrink_space( Container & c ) {
+    c.freeze();
+}
+
+template<typename Container>
+typename std::enable_if<
+    is_specialization_of<std::vector, Container>::value>::type
+shrink_space( Container & c ) {
+    c.shrink_to_fit();
+}
+
+namespace internal {
+
+// Keys that may hold a word inline instead of pointing into a word bank.
+// Inline words need not be memorized, and must not be released.
+template<typename KeyTy>
+struct inline_key : std::false_type {
+    static bool fits( size_t len ) { return false; }
+    static bool holds( const KeyTy & k ) { return false; }
+};
+
+template<>
+struct inline_key<text::short_word> : std::true_type {
+    static bool fits( size_t len ) {
+	return len <= text::short_word::max_inline;
+    }
+    static bool holds( const text::short_word & k ) {
+	return k.is_inline();
+    }
+};
+
+// Hash tables store the hash of every key. An element taken from one hash
+// table may be looked up in, or inserted into, another one without hashing
+// its key again, provided that both use the same hash function.
+template<typename IndexTy, typename Iterator, typename = void>
+struct has_stored_hash : std::false_type { };
+
+template<typename IndexTy, typename Iterator>
+struct has_stored_hash<
+    IndexTy, Iterator,
+    typename std::enable_if<
+	( is_specialization_of<hash_table, IndexTy>::value
+	  || is_specialization_of<hash_index, IndexTy>::value
+	  || is_specialization_of<swiss_table, IndexTy>::value
+	  || is_specialization_of<perfect_hash_map, IndexTy>::value )
+	&& std::is_same<typename IndexTy::hasher,
+			typename Iterator::hasher>::value>::type>
+    : std::true_type { };
+
+// Look up the key of the element at I
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<has_stored_hash<IndexTy,Iterator>::value,
+			typename IndexTy::const_iterator>::type
+find_entry( const IndexTy & idx, const Iterator & I ) {
+    return idx.find( I->first, I.hash() );
+}
+
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<!has_stored_hash<IndexTy,Iterator>::value,
+			typename IndexTy::const_iterator>::type
+find_entry( const IndexTy & idx, const Iterator & I ) {
+    return idx.find( I->first );
+}
+
+// The hash of the key of the element at I under the hash function of idx
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<has_stored_hash<IndexTy,Iterator>::value, size_t>::type
+entry_hash( const IndexTy & idx, const Iterator & I ) {
+    return I.hash();
+}
+
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<!has_stored_hash<IndexTy,Iterator>::value, size_t>::type
+entry_hash( const IndexTy & idx, const Iterator & I ) {
+    return idx.hash_function()( I->first );
+}
+
+// Insert kv, where kv.first is a copy of the key of the element at I
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<has_stored_hash<IndexTy,Iterator>::value,
+			std::pair<typename IndexTy::iterator,bool>>::type
+insert_entry( IndexTy & idx, const typename IndexTy::value_type & kv,
+	      const Iterator & I ) {
+    return idx.insert( kv, I.hash() );
+}
+
+template<typename IndexTy, typename Iterator>
+typename std::enable_if<!has_stored_hash<IndexTy,Iterator>::value,
+			std::pair<typename IndexTy::iterator,bool>>::type
+insert_entry( IndexTy & idx, const typename IndexTy::value_type & kv,
+	      const Iterator & I ) {
+    return idx.insert( kv );
+}
+
+} // namespace internal
+
 class word_bank_base {
     // list of all chunks of text
     std::list<std::shared_ptr<char>> m_store;
@@ -128,7 +244,11 @@ protected:
 	return push_chunk( new char[size] );
     }
     char * push_chunk( char * chunk ) {
-	std::shared_ptr<char> sp( chunk, std::default_delete<char[]>() );
+	return push_chunk( chunk, std::default_delete<char[]>() );
+    }
+    template<typename Deleter>
+    char * push_chunk( char * chunk, Deleter d ) {
+	std::shared_ptr<char> sp( chunk, d );
 	m_store.push_back( sp );
 
 	return chunk;
@@ -274,6 +394,203 @@ public:
     }
 };
 
+namespace internal {
+
+// Per-thread cache of free slabs for word_bank_arena. Slab sizes are powers
+// of two, from min_slab up to max_slab. Slabs released by a word bank are
+// kept for reuse by the next word bank filled on the same thread, up to
+// max_cached bytes, which saves page faults on fresh memory as well as
+// calls to the allocator. Slabs may be released on a different thread than
+// the one that acquired them.
+class slab_cache {
+public:
+    static const size_t min_slab = size_t(1) << 16;
+    static const unsigned num_classes = 8;
+    static const size_t max_slab = min_slab << (num_classes-1);
+    static const size_t max_cached = size_t(64) << 20;
+
+private:
+    std::vector<char *>	m_free[num_classes];
+    size_t		m_cached;
+
+    slab_cache() : m_cached( 0 ) { }
+
+public:
+    ~slab_cache() {
+	for( unsigned c=0; c < num_classes; ++c )
+	    for( char * p : m_free[c] )
+		delete[] p;
+    }
+
+    static char * acquire( size_t size ) {
+	slab_cache * sc = local();
+	unsigned c = size_class( size );
+	if( sc && c < num_classes && !sc->m_free[c].empty() ) {
+	    char * p = sc->m_free[c].back();
+	    sc->m_free[c].pop_back();
+	    sc->m_cached -= size;
+	    return p;
+	}
+	return new char[size];
+    }
+
+    static void release( char * p, size_t size ) {
+	slab_cache * sc = local();
+	unsigned c = size_class( size );
+	if( sc && c < num_classes && sc->m_cached + size <= max_cached ) {
+	    sc->m_free[c].push_back( p );
+	    sc->m_cached += size;
+	} else
+	    delete[] p;
+    }
+
+private:
+    // Class of a slab of size bytes, or num_classes if size is not one
+    // of the cached sizes
+    static unsigned size_class( size_t size ) {
+	unsigned c = 0;
+	for( size_t s=min_slab; s < size && c < num_classes; s <<= 1 )
+	    ++c;
+	return c < num_classes && ( min_slab << c ) == size ? c : num_classes;
+    }
+
+    // The cache of the calling thread; null while the thread exits
+    static slab_cache * local() {
+	static thread_local slab_cache * cache = nullptr;
+	static thread_local bool exited = false;
+	struct reaper {
+	    ~reaper() { delete cache; cache = nullptr; exited = true; }
+	};
+	if( !cache && !exited ) {
+	    // Destroyed, and frees the cache, when the thread exits
+	    static thread_local reaper r;
+	    (void)r;
+	    cache = new slab_cache();
+	}
+	return cache;
+    }
+};
+
+struct slab_deleter {
+    size_t size;
+    void operator () ( char * p ) const { slab_cache::release( p, size ); }
+};
+
+} // namespace internal
+
+// A word bank that copies words into slabs of memory, bump-allocating
+// within the current slab. Slabs grow geometrically, such that a word bank
+// holds few of them, and there is no bookkeeping per word. Clearing the
+// word bank releases its slabs in bulk to the slab cache of the releasing
+// thread, from where they are reused by the next word bank filled on
+// that thread, e.g., for the next file processed by the same worker.
+class word_bank_arena : public word_bank_base {
+public:
+    static const bool is_managed = true;
+    static const bool is_allocated = false;
+
+private:
+    size_t		  m_slab;	// size of next slab
+    size_t		  m_avail;
+    char		* m_next;
+
+public:
+    word_bank_arena()
+	: m_slab( internal::slab_cache::min_slab ), m_avail( 0 ),
+	  m_next( nullptr ) { }
+    word_bank_arena( const word_bank_arena & wb )
+	: word_bank_base( wb ), m_slab( internal::slab_cache::min_slab ),
+	  m_avail( 0 ), m_next( nullptr ) { }
+    word_bank_arena( word_bank_arena && wb )
+	: word_bank_base( std::move((word_bank_base&&)wb) ),
+	  m_slab( wb.m_slab ), m_avail( wb.m_avail ), m_next( wb.m_next ) {
+	wb.m_slab = internal::slab_cache::min_slab;
+	wb.m_avail = 0;
+	wb.m_next = nullptr;
+    }
+    word_bank_arena & operator = ( const word_bank_arena & wb ) {
+	word_bank_base::operator = ( wb );
+	m_slab = internal::slab_cache::min_slab;
+	m_avail = 0;
+	m_next = nullptr;
+	return *this;
+    }
+    word_bank_arena & operator = ( word_bank_arena && wb ) {
+	word_bank_base::operator = ( std::move(wb) );
+	m_slab = wb.m_slab;
+	m_avail = wb.m_avail;
+	m_next = wb.m_next;
+	wb.m_slab = internal::slab_cache::min_slab;
+	wb.m_avail = 0;
+	wb.m_next = nullptr;
+	return *this;
+    }
+    ~word_bank_arena() { clear(); }
+
+    void clear( const char * ) { }
+    void clear() {
+	word_bank_base::clear();
+	m_slab = internal::slab_cache::min_slab;
+	m_avail = 0;
+	m_next = nullptr;
+    }
+
+    // Push len characters starting at p and '\0' delimit it
+    const char * store( const char * p, size_t len ) {
+	if( m_avail < len+1 )
+	    push_slab( len+1 );
+	char * where = m_next;
+	memcpy( where, p, len );
+	where[len] = '\0';
+	m_avail -= len + 1;
+	m_next += len + 1;
+	return where;
+    }
+
+    // Build up a string
+    const char * append( const char * start, const char * str, size_t len ) {
+	// Erase prior string terminator
+	if( start ) {
+	    --m_next;
+	    ++m_avail;
+	}
+
+	// Move the partial string to a new slab if it does not fit
+	if( m_avail < len+1 ) {
+	    char * was_next = m_next;
+	    push_slab( start ? was_next-start+len+1 : len+1 );
+	    if( start ) {
+		start = store( start, was_next - start );
+		--m_next;
+		++m_avail;
+	    }
+	}
+
+	const char * where = store( str, len );
+	return start ? start : where;
+    }
+
+    // Undo the most recent store
+    void erase( const char * w ) {
+	char * ww = const_cast<char *>( w );
+	m_avail += m_next - ww;
+	m_next = ww;
+    }
+
+private:
+    void push_slab( size_t len ) {
+	size_t size = m_slab;
+	while( size < len )
+	    size <<= 1;
+	m_next = word_bank_base::push_chunk(
+	    internal::slab_cache::acquire( size ),
+	    internal::slab_deleter{ size } );
+	m_avail = size;
+	if( m_slab < internal::slab_cache::max_slab )
+	    m_slab <<= 1;
+    }
+};
+
 // A word bank with all words taken from a pre-defined block of text.
 // The block of text is modified with '\0' to indicate end of string.
 class word_bank_pre_alloc : public word_bank_base {
@@ -320,6 +637,9 @@ public:
 template<typename IndexTy, typename WordBankTy>
 class word_map;
 
+template<typename WordContainerTy, unsigned ShardBits>
+class word_container_concurrent;
+
 template<typename IndexTy, typename WordBankTy>
 class word_container {
 public:
@@ -349,6 +669,8 @@ public:
     size_t size() const		{ return m_words.size(); }
     bool empty() const		{ return m_words.empty(); }
     void clear()		{ m_storage.clear(); m_words.clear(); } 
+    // Shrink the index after aggregation
+    void freeze()		{ shrink_space( m_words ); }
     void swap( word_container & wb ) {
 	m_words.swap( wb.m_words );
 	m_storage.swap( wb.m_storage );
@@ -660,7 +982,8 @@ public:
 	    for( typename index_type::const_iterator
 		     I=this->m_words.cbegin(), E=this->m_words.cend();
 		 I != E; ++I ) {
-		this->m_storage.clear( I->first );
+		if( !internal::inline_key<key_type>::holds( I->first ) )
+		    this->m_storage.clear( I->first );
 	    }
 	}
 	word_container<index_type, word_bank_type>::clear();
@@ -788,31 +1111,109 @@ public:
     // Assumes both *this and rhs are sorted by key (whatever sorting function
     // is used ...)
     void reduce( kv_list & rhs ) {
-	// TODO: consider parallel merge (std::experimental::parallel_merge)
 	// TODO: Better with move iterators?
+	// As we take over the storage of rhs, its words need not be copied,
+	// unless if they are individually allocated.
 	core_reduce( rhs.begin(), rhs.end(), rhs.size(),
 		     pair_cmp<value_type,value_type>(),
-		     pair_add_reducer<value_type,value_type>() );
+		     pair_add_reducer<value_type,value_type>(),
+		     !is_allocated );
 	this->m_storage.move( rhs.storage() );
 	rhs.clear();
     }
 
 private:
+    static const size_t merge_grain = 16384;
+
     template<class InputIt, class Compare, class Reduce>
     void core_reduce(InputIt first2, InputIt last2, size_t size2,
-		     Compare cmp, Reduce reduce) {
+		     Compare cmp, Reduce reduce, bool keep_words = false) {
 	index_type joint;
+	// The parallel merge does not copy words into our word bank
+	if( ( keep_words || !is_managed )
+	    && this->size() + size2 >= 2 * merge_grain
+	    && parallel_merge( first2, last2, size2, joint,
+			       typename std::iterator_traits<InputIt>
+			       ::iterator_category() ) ) {
+	    this->m_words.swap( joint );
+	    return;
+	}
 	joint.reserve( this->size() + size2 ); // worst case
 	core_merge( this->begin(), this->end(), 
 		    first2, last2, std::back_inserter(joint),
 		    pair_cmp<value_type,value_type>(),
-		    pair_add_reducer<value_type,value_type>() );
+		    pair_add_reducer<value_type,value_type>(), keep_words );
 	this->m_words.swap( joint );
     }
+
+    // Merge path: split the merged sequence into segments of equal length
+    // by binary search along the cross diagonals, then merge the segments
+    // in parallel. The split points are adjusted such that equal keys are
+    // never separated. Segments are merged into a scratch area at the
+    // position they would take without duplicates and are then compacted.
+    template<class InputIt>
+    bool parallel_merge(InputIt first2, InputIt last2, size_t size2,
+			index_type & joint, std::random_access_iterator_tag) {
+	pair_cmp<value_type,value_type> cmp;
+	iterator first1 = this->begin();
+	size_t size1 = this->size();
+	size_t nseg = ( size1 + size2 + merge_grain - 1 ) / merge_grain;
+	std::vector<size_t> s1( nseg+1 ), s2( nseg+1 );
+	s1[0] = s2[0] = 0;
+	s1[nseg] = size1;
+	s2[nseg] = size2;
+	cilk_for( size_t k=1; k < nseg; ++k ) {
+	    size_t d = k * ( size1 + size2 ) / nseg;
+	    size_t lo = d > size2 ? d - size2 : 0;
+	    size_t hi = std::min( d, size1 );
+	    while( lo < hi ) {
+		size_t i = ( lo + hi ) / 2;
+		if( cmp( first1[i], first2[d-i-1] ) )
+		    lo = i + 1;
+		else
+		    hi = i;
+	    }
+	    size_t i = lo, j = d - lo;
+	    if( i < size1 && j > 0 && !cmp( first2[j-1], first1[i] ) )
+		++i;
+	    s1[k] = i;
+	    s2[k] = j;
+	}
+
+	index_type scratch( size1 + size2 );
+	std::vector<size_t> len( nseg+1 );
+	len[0] = 0;
+	cilk_for( size_t k=0; k < nseg; ++k ) {
+	    typename index_type::iterator out
+		= scratch.begin() + s1[k] + s2[k];
+	    len[k+1] = core_merge( first1 + s1[k], first1 + s1[k+1],
+				   first2 + s2[k], first2 + s2[k+1], out,
+				   cmp, pair_add_reducer<value_type,value_type>(),
+				   true ) - out;
+	}
+	for( size_t k=0; k < nseg; ++k )
+	    len[k+1] += len[k];
+
+	joint.resize( len[nseg] );
+	cilk_for( size_t k=0; k < nseg; ++k ) {
+	    typename index_type::iterator from
+		= scratch.begin() + s1[k] + s2[k];
+	    std::copy( from, from + ( len[k+1] - len[k] ),
+		       joint.begin() + len[k] );
+	}
+	return true;
+    }
+    template<class InputIt, class Tag>
+    bool parallel_merge(InputIt first2, InputIt last2, size_t size2,
+			index_type & joint, Tag) {
+	return false;
+    }
+
     template<class InputIt, class OutputIt, class Compare, class Reduce>
     OutputIt core_merge(iterator first1, iterator last1,
 			 InputIt first2, InputIt last2,
-			 OutputIt d_first, Compare cmp, Reduce reduce) {
+			 OutputIt d_first, Compare cmp, Reduce reduce,
+			 bool keep_words) {
 	for (; first1 != last1; ++d_first) {
 	    if (first2 == last2) {
 		return std::copy(first1, last1, d_first);
@@ -824,9 +1225,12 @@ private:
 		    *d_first = val;
 		    ++first1;
 		} else { // take element from first2, need to duplicate string
-		    if( word_bank_type::is_managed ) { // record new copy
-			size_t len = strlen( first2->first );
-			key_type w = memorize( (char*)first2->first, len );
+		    // record new copy
+		    if( word_bank_type::is_managed && !keep_words
+			&& !internal::inline_key<key_type>::holds(
+			    first2->first ) ) {
+			const char * src = first2->first;
+			key_type w = memorize( (char*)src, strlen( src ) );
 			*d_first = value_type( w, first2->second );
 		    } else {
 			*d_first = *first2;
@@ -840,9 +1244,11 @@ private:
 	}
 	// take elements from first2, need to duplicate strings
 	for( ; first2 != last2; ++first2, ++d_first ) {
-	    if( word_bank_type::is_managed ) { // record new copy
-		size_t len = strlen( first2->first );
-		key_type w = memorize( (char*)first2->first, len );
+	    // record new copy
+	    if( word_bank_type::is_managed && !keep_words
+		&& !internal::inline_key<key_type>::holds( first2->first ) ) {
+		const char * src = first2->first;
+		key_type w = memorize( (char*)src, strlen( src ) );
 		*d_first = value_type( w, first2->second );
 	    } else {
 		*d_first = *first2;
@@ -915,6 +1321,8 @@ public:
 
     template<typename OtherIndexTy, typename OtherWordBankTy>
     friend class word_map;
+    template<typename WordContainerTy, unsigned ShardBits>
+    friend class word_container_concurrent;
 
 private:
     template<typename OtherIndexTy>
@@ -950,7 +1358,8 @@ public:
 	    for( typename index_type::const_iterator
 		     I=this->m_words.cbegin(), E=this->m_words.cend();
 		 I != E; ++I ) {
-		this->m_storage.clear( I->first );
+		if( !internal::inline_key<key_type>::holds( I->first ) )
+		    this->m_storage.clear( I->first );
 	    }
 	}
 	word_container<index_type,word_bank_type>::clear();
@@ -967,15 +1376,7 @@ public:
 
     // Memorize the word and store it in the word list as well
     const char * index( char * p, size_t len ) {
-	const char * w = this->m_storage.store( p, len );
-	iterator found = this->m_words.find( w );
-	if( found != this->m_words.end() ) {
-	    ++found->second;
-	    this->m_storage.erase( w );
-	} else {
-	    ++ (this->m_words[w]);
-	}
-	return w;
+	return index( p, len, internal::inline_key<key_type>() );
     }
 
     // Build up a string
@@ -1004,6 +1405,12 @@ public:
     const_iterator find( const key_type & w ) const {
 	return this->m_words.find( w );
     }
+    // Look up the key of the element at I, which may belong to another
+    // container. Avoids hashing the key again where possible.
+    template<typename Iterator>
+    const_iterator find_entry( const Iterator & I ) const {
+	return internal::find_entry( this->m_words, I );
+    }
     // For reference and ease of substituting types in templates
     iterator binary_search( const key_type & w ) {
 	return find( w );
@@ -1078,11 +1485,53 @@ public:
 	// Assumes Reducer is commutative -- results in errors. Why?
 	// if( this->size() < rhs.size() )
 	    // this->swap( rhs );
+	if( !is_allocated && rhs.size() >= parallel_reduce_size
+	    && parallel_reduce( rhs, is_specialization_of<hash_table,
+				index_type>() ) )
+	    return;
 	core_reduce( rhs.cbegin(), rhs.cend(), rhs.storage(),
 		     mapped_add_reducer<mapped_type,mapped_type>() );
 	rhs.mark_clear();
     }
 private:
+    static const size_t parallel_reduce_size = 4096;
+
+    // Short words are held in the key and bypass the word bank. Returns p
+    // for these words.
+    const char * index( char * p, size_t len, std::true_type ) {
+	if( !internal::inline_key<key_type>::fits( len ) )
+	    return index( p, len, std::false_type() );
+	std::pair<iterator,bool> ret
+	    = this->m_words.insert( value_type( key_type( p, len ),
+						mapped_type(0) ) );
+	++ret.first->second;
+	return p;
+    }
+    const char * index( char * p, size_t len, std::false_type ) {
+	const char * w = this->m_storage.store( p, len );
+	// A single lookup, such that the word is hashed only once
+	std::pair<iterator,bool> ret
+	    = this->m_words.insert( value_type( w, mapped_type(0) ) );
+	++ret.first->second;
+	if( !ret.second )
+	    this->m_storage.erase( w );
+	return w;
+    }
+
+    // Merge the hash tables in parallel. Rather than copying new words into
+    // our own word bank, which is not thread-safe, take over the storage
+    // of rhs.
+    bool parallel_reduce( word_map & rhs, std::true_type ) {
+	this->m_words.merge( rhs.m_words,
+			     mapped_add_reducer<mapped_type,mapped_type>() );
+	this->m_storage.move( rhs.m_storage );
+	rhs.clear();
+	return true;
+    }
+    bool parallel_reduce( word_map & rhs, std::false_type ) {
+	return false;
+    }
+
     // Copy in all contents from rhs into *this.
     // Retains rhs. Shares word storage.
     template<typename InputIterator, typename Reducer>
@@ -1100,9 +1549,11 @@ private:
 	    // once the element has been inserted. Unless if we force it
 	    // with a const_cast...
 	    key_type w = I->first;
-	    if( word_bank_type::is_managed ) { // record new copy of word
-		size_t len = strlen( I->first );
-		w = memorize( (char*)I->first, len );
+	    bool stored = word_bank_type::is_managed
+		&& !internal::inline_key<key_type>::holds( w );
+	    if( stored ) { // record new copy of word
+		const char * src = I->first;
+		w = memorize( (char*)src, strlen( src ) );
 	    }
 
 	    // Note: reconstruct value_type from key and mapped_type as
@@ -1111,7 +1562,8 @@ private:
 	    reducer_fn( keyval.second, I->second );
 
 	    // Lookup translated word and 
-	    std::pair<iterator,bool> ret = this->m_words.insert( keyval );
+	    std::pair<iterator,bool> ret
+		= internal::insert_entry( this->m_words, keyval, I );
 	    if( ret.second ) {
 		// Value was freshly inserted. Now remap the string.
 		// Unseen words need to be stored into container of LHS
@@ -1125,7 +1577,7 @@ private:
 	    } else {
 		// Not inserted - key already occurred
 		reducer_fn( ret.first->second, I->second );
-		if( word_bank_type::is_managed ) // erase redundant copy of word
+		if( stored ) // erase redundant copy of word
 		    this->erase( w );
 
 		// TODO: consider dropping the old word and setting I->first
@@ -1238,6 +1690,168 @@ public:
     type & get_value() { return imp_.view(); }
 };
 
+// An alternative to word_container_reducer that avoids the merge phase of
+// the reducer. The map is split in shards, each a word map of its own
+// protected by a lock. A document's words are first partitioned by shard,
+// after which each shard is updated under its lock, such that a lock is
+// taken once per shard per document rather than once per word.
+// Every word is hashed once, with the hash function of the word map, or
+// not at all if the document's map stores hashes. The hash selects the
+// shard and is reused for the insertion into the shard and for the join.
+// The shards are joined into a single word map by get_value(), which may
+// be called only after all updates have completed.
+template<typename WordContainerTy, unsigned ShardBits = 6>
+class word_container_concurrent {
+    typedef WordContainerTy type;
+    typedef typename type::index_type index_type;
+    typedef typename type::key_type key_type;
+    typedef typename type::mapped_type mapped_type;
+    typedef typename type::value_type value_type;
+
+    static_assert( std::is_same<key_type, const char *>::value,
+		   "word_container_concurrent requires C-string keys" );
+
+    static const size_t num_shards = size_t(1) << ShardBits;
+
+    struct shard {
+	std::mutex	mux;
+	type		words;
+    };
+
+private:
+    std::unique_ptr<shard[]>	m_shards;
+    type			m_joined;
+    bool			m_is_joined;
+
+public:
+    word_container_concurrent()
+	: m_shards( new shard[num_shards] ), m_is_joined( false ) { }
+
+    word_container_concurrent( const word_container_concurrent & ) = delete;
+    word_container_concurrent &
+    operator = ( const word_container_concurrent & ) = delete;
+
+    void swap( type & c ) {
+	get_value().swap( c );
+    }
+
+    // Thread-safe
+    template<typename OtherIndexTy, typename OtherWordBankTy>
+    void count_presence( const word_map<OtherIndexTy,OtherWordBankTy> & rhs ) {
+	core_count( rhs.cbegin(), rhs.cend(), rhs.size(), rhs.storage() );
+    }
+    template<typename OtherIndexTy, typename OtherWordBankTy>
+    void count_presence( const kv_list<OtherIndexTy,OtherWordBankTy> & rhs ) {
+	core_count( rhs.cbegin(), rhs.cend(), rhs.size(), rhs.storage() );
+    }
+
+    // Not thread-safe
+    type & get_value() {
+	if( !m_is_joined )
+	    join();
+	return m_joined;
+    }
+
+private:
+    template<typename InputIterator>
+    void core_count( InputIterator I, InputIterator E, size_t n,
+		     const word_bank_base & storage ) {
+	typedef typename std::decay<decltype(I->second)>::type
+	    other_mapped_type;
+	struct entry_type {
+	    key_type		key;
+	    other_mapped_type	value;
+	    size_t		hash;
+	};
+
+	assert( !m_is_joined );
+
+	// All shards have the same hash function
+	const index_type & idx = m_shards[0].words.m_words;
+
+	// Partition by shard (counting sort)
+	std::vector<entry_type> part( n );
+	std::vector<size_t> hashes( n );
+	size_t start[num_shards+1];
+	std::fill( &start[0], &start[num_shards+1], size_t(0) );
+	size_t k = 0;
+	for( InputIterator J=I; J != E; ++J, ++k ) {
+	    hashes[k] = internal::entry_hash( idx, J );
+	    ++start[shard_of( hashes[k] )+1];
+	}
+	for( size_t s=0; s < num_shards; ++s )
+	    start[s+1] += start[s];
+
+	size_t pos[num_shards];
+	std::copy( &start[0], &start[num_shards], &pos[0] );
+	k = 0;
+	for( InputIterator J=I; J != E; ++J, ++k )
+	    part[pos[shard_of( hashes[k] )]++]
+		= entry_type{ J->first, J->second, hashes[k] };
+
+	mapped_nonzero_reducer<mapped_type,other_mapped_type> reducer;
+	for( size_t s=0; s < num_shards; ++s ) {
+	    if( start[s] == start[s+1] )
+		continue;
+	    type & words = m_shards[s].words;
+	    bool any_word_new = false;
+	    std::lock_guard<std::mutex> lock( m_shards[s].mux );
+	    for( size_t k=start[s]; k < start[s+1]; ++k ) {
+		const entry_type & e = part[k];
+		typename index_type::iterator L
+		    = words.m_words.find( e.key, e.hash );
+		if( L == words.m_words.end() ) {
+		    key_type w = e.key;
+		    if( type::is_managed )
+			w = words.memorize( (char*)w, strlen( w ) );
+		    L = words.m_words.insert( value_type( w, mapped_type(0) ),
+					      e.hash ).first;
+		    any_word_new = true;
+		}
+		reducer( L->second, e.value );
+	    }
+	    if( !type::is_managed && any_word_new )
+		words.m_storage.copy( storage );
+	}
+    }
+
+    // The shards hold disjoint sets of words. Their hashes are retained,
+    // such that the shards are merged into one map without hashing any
+    // word again, and in parallel where the map supports it.
+    void join() {
+	size_t n = 0;
+	for( size_t s=0; s < num_shards; ++s )
+	    n += m_shards[s].words.size();
+	reserve_space( m_joined.m_words, n );
+	for( size_t s=0; s < num_shards; ++s ) {
+	    type & words = m_shards[s].words;
+	    join_shard( words, is_specialization_of<hash_table, index_type>() );
+	    m_joined.m_storage.move( words.m_storage );
+	    words.mark_clear();
+	}
+	m_is_joined = true;
+    }
+
+    void join_shard( type & words, std::true_type ) {
+	m_joined.m_words.merge( words.m_words,
+				mapped_add_reducer<mapped_type,mapped_type>() );
+    }
+    void join_shard( type & words, std::false_type ) {
+	for( auto I=words.m_words.cbegin(), E=words.m_words.cend();
+	     I != E; ++I )
+	    internal::insert_entry( m_joined.m_words, *I, I );
+    }
+
+    // The top bits of the hash select the shard. They are mixed first, as
+    // they are not affected by the final characters of a word otherwise.
+    static size_t shard_of( size_t h ) {
+	uint64_t v = h;
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	return v >> ( 64 - ShardBits );
+    }
+};
+
 
 template<typename WordContainerTy>
 class word_container_file_builder {
@@ -1290,25 +1904,89 @@ private:
 	if( fstat( fd, &finfo ) < 0 )
 	    fatale( "fstat", fname );
 
+	compression_format fmt = detect_compression( fd );
+	if( fmt != cf_none ) {
+	    open_compressed( fd, fname, finfo.st_size, fmt );
+	    close( fd );
+	    return;
+	}
+
 #if 0
 	char * buf = (char*)mmap(0, finfo.st_size + 1, 
 				 PROT_READ | PROT_WRITE,
 				 MAP_PRIVATE | MAP_POPULATE, fd, 0);
 #else
 	char * buf = new char[finfo.st_size+1];
-	uint64_t r = 0;
-	while( r < (uint64_t)finfo.st_size ) {
-	    uint64_t rr = pread( fd, buf + r, finfo.st_size - r, r );
-	    if( rr == (uint64_t)-1 )
-		fatale( "pread", fname );
-	    r += rr;
+	size_t fsize = finfo.st_size;
+	if( fsize < parallel_read_size )
+	    read_range( fd, fname, buf, 0, fsize );
+	else {
+	    // Large files are read in ranges in parallel
+	    size_t nranges = ( fsize + parallel_read_size - 1 )
+		/ parallel_read_size;
+	    cilk_for( size_t i=0; i < nranges; ++i ) {
+		size_t off = i * parallel_read_size;
+		read_range( fd, fname, buf + off, off,
+			    std::min( size_t(parallel_read_size), fsize - off ) );
+	    }
 	}
 #endif
 	buf[finfo.st_size] = '\0';
 
 	close( fd );
 
-	m_size = finfo.st_size;
+	set_buffer( buf, finfo.st_size );
+    }
+
+    static const size_t parallel_read_size = size_t(16)<<20;
+
+    static void read_range( int fd, const char * fname, char * buf,
+			    size_t off, size_t len ) {
+	size_t r = 0;
+	while( r < len ) {
+	    ssize_t rr = pread( fd, buf + r, len - r, off + r );
+	    if( rr < 0 )
+		fatale( "pread", fname );
+	    if( rr == 0 )
+		fatal( "unexpected end of file: ", fname );
+	    r += rr;
+	}
+    }
+
+    // Decompress the file into memory, straight into the buffer
+    void open_compressed( int fd, const char * fname, size_t file_size,
+			  compression_format fmt ) {
+	size_t cap = uncompressed_size_hint( fd, file_size, fmt ) + 1;
+	char * buf = new char[cap];
+	size_t len = 0;
+
+	decompress_stream ds( fd, fname, fmt );
+	while( true ) {
+	    size_t avail = cap - len - 1;
+	    size_t n = ds.read( &buf[len], avail );
+	    len += n;
+	    if( n < avail || ds.done() )
+		break;
+	    // The buffer is full, which is the case when the hint is exact.
+	    // Probe for more data in the slot of the terminating NUL before
+	    // growing the buffer.
+	    if( ds.read( &buf[len], 1 ) == 0 )
+		break;
+	    ++len;
+	    // Hint was wrong; grow geometrically
+	    cap = std::max( 2*cap, len + ds.segment_size() + 1 );
+	    char * nbuf = new char[cap];
+	    memcpy( nbuf, buf, len );
+	    delete[] buf;
+	    buf = nbuf;
+	}
+	buf[len] = '\0';
+
+	set_buffer( buf, len );
+    }
+
+    void set_buffer( char * buf, size_t size ) {
+	m_size = size;
 
 	std::shared_ptr<char> sp( buf, std::default_delete<char[]>() );
 	m_buf = sp;
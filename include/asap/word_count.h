@@ -24,6 +24,11 @@
 #include <algorithm>
 #include <cctype>
 #include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_set>
 #include <cmath>
 #include <type_traits>
 #include <iterator>
@@ -31,6 +36,7 @@
 #include <cilk/reducer_opadd.h>
 
 #include "asap/word_bank.h"
+#include "asap/tokenizer.h"
 
 namespace asap {
 
@@ -354,6 +360,21 @@ public:
 };
 
 
+// Split [split,data_end) after chunk_size bytes, moving the split forward
+// to the next word boundary. The boundary is overwritten with a NUL, unless
+// it is data_end. Returns the end of the chunk.
+inline char * split_chunk( char * split, char * data_end, size_t chunk_size ) {
+    char * end = std::min( split + chunk_size, data_end );
+    // end = std::find_if( end, data_end, IsSpace() );
+    while( end != data_end &&
+	   *end != ' ' && *end != '\t' &&
+	   *end != '\r' && *end != '\n' )
+	++end;
+    if( end != data_end )
+	*end = '\0';
+    return end;
+}
+
 template<typename MapTy>
 size_t word_catalog( char * data, size_t data_size,
 		   MapTy & catalog, size_t chunk_size ) {
@@ -366,52 +387,16 @@ size_t word_catalog( char * data, size_t data_size,
     char * split = data;
 
     while( split != data_end ) {
-	// Split the data at the chunk_size.
-        char * end = std::min(split + chunk_size, data_end);
-	// Adjust the split to word boundaries.
-	// end = std::find_if( end, data_end, IsSpace() );
-	while( end != data_end && 
-	       *end != ' ' && *end != '\t' &&
-	       *end != '\r' && *end != '\n' )
-	    ++end;
-	if( end != data_end )
-	    *end = '\0';
+	// Split the data at the chunk_size, adjusted to word boundaries.
+	char * end = split_chunk( split, data_end, chunk_size );
 
 	// Process the chunk from split to end
 	cilk_spawn [&] ( char * split, char * end ) {
-	    // TODO: is it better for locality to move toupper() into the
-	    //       inner loop, transforming while checking?
-	    // Or better: use a word_bank with self-allocated storage and
-	    // replace_copy_if words (need to pay attention to allocation of
-	    // word_bank).
-	    // std::for_each( split, end, ToUpper() );
-	    for( char *I=split; I != end; ++I ) {
-		// TODO: check performance with std::for_each and std::find
-		// but with optimized codes in functors.
-		// *I = std::toupper( *I );
-		// TODO: vectorize this expression
-		if( *I >= 'a' && *I <= 'z' )
-		    *I = ( *I - 'a' ) + 'A';
-	    }
-
-	    while( split != end ) {
-		// Skip non-upper characters
-		// split = std::find_if( split, end, IsUpper() );
-		while( split != end && !(*split >= 'A' && *split <= 'Z') )
-		    ++split;
-		// Pass over word
-		char * w = split;
-		// split = std::find_if_not( split, end, IsUpperOrQuote() );
-		while( split != end
-		       && ((*split >= 'A' && *split <= 'Z') || *split == '\'') )
-		    ++split;
-		*split = '\0'; // terminate
-
-		if( split != w ) {
-		    reduce_catalog.index( w, split-w );
+	    // Upper-case and split into words in one vectorized pass
+	    tokenize( split, end, [&]( char * w, size_t len ) {
+		    reduce_catalog.index( w, len );
 		    *reduce_num_words += 1;
-		}
-	    }
+		} );
         }( split, end );
         
         split = end;
@@ -434,56 +419,20 @@ size_t ngram_catalog( char * data, size_t data_size,
     char * split = data;
 
     while( split != data_end ) {
-	// Split the data at the chunk_size.
-        char * end = std::min(split + chunk_size, data_end);
-	// Adjust the split to word boundaries.
-	// end = std::find_if( end, data_end, IsSpace() );
-	while( end != data_end && 
-	       *end != ' ' && *end != '\t' &&
-	       *end != '\r' && *end != '\n' )
-	    ++end;
-	if( end != data_end )
-	    *end = '\0';
+	// Split the data at the chunk_size, adjusted to word boundaries.
+	char * end = split_chunk( split, data_end, chunk_size );
 
 	// Process the chunk from split to end
 	cilk_spawn [&] ( char * split, char * end ) {
 	    ngram<MapTy::N> ng;
 
-	    // TODO: is it better for locality to move toupper() into the
-	    //       inner loop, transforming while checking?
-	    // Or better: use a word_bank with self-allocated storage and
-	    // replace_copy_if words (need to pay attention to allocation of
-	    // word_bank).
-	    // std::for_each( split, end, ToUpper() );
-	    for( char *I=split; I != end; ++I ) {
-		// TODO: check performance with std::for_each and std::find
-		// but with optimized codes in functors.
-		// *I = std::toupper( *I );
-		// TODO: vectorize this expression
-		if( *I >= 'a' && *I <= 'z' )
-		    *I = ( *I - 'a' ) + 'A';
-	    }
-
-	    while( split != end ) {
-		// Skip non-upper characters
-		// split = std::find_if( split, end, IsUpper() );
-		while( split != end && !(*split >= 'A' && *split <= 'Z') )
-		    ++split;
-		// Pass over word
-		char * w = split;
-		// split = std::find_if_not( split, end, IsUpperOrQuote() );
-		while( split != end
-		       && ((*split >= 'A' && *split <= 'Z') || *split == '\'') )
-		    ++split;
-		*split = '\0'; // terminate
-
-		if( split != w ) {
-		    if( ng.push_back( reduce_catalog.store( w, split-w ) ) ) {
+	    // Upper-case and split into words in one vectorized pass
+	    tokenize( split, end, [&]( char * w, size_t len ) {
+		    if( ng.push_back( reduce_catalog.store( w, len ) ) ) {
 			reduce_catalog.index( ng );
 			*reduce_num_ngrams += 1;
 		    }
-		}
-	    }
+		} );
         }( split, end );
         
         split = end;
@@ -518,6 +467,108 @@ void move_word_container( To & to, From && from ) {
 
 } // namespace internal
 
+namespace internal {
+
+// Tokenise a compressed file one decompressed block at a time. The next
+// block is decompressed while the current one is catalogued. Words
+// straddling a block boundary are carried over into the next block. Blocks
+// are retained by the container when its word_bank is not self-managed.
+template<typename WordContainerTy, typename CatalogFn>
+size_t catalog_compressed( const char * fname, compression_format fmt,
+			   WordContainerTy & container, size_t chunk_size,
+			   CatalogFn catalog ) {
+    int fd;
+    if( (fd = open( fname, O_RDONLY )) < 0 )
+	fatale( "open", fname );
+
+    size_t nwords = 0;
+    {
+	decompress_stream ds( fd, fname, fmt );
+	const size_t seg_size = ds.segment_size();
+	char * block = new char[seg_size+1];
+	size_t len = ds.read( block, seg_size );
+	bool more = len == seg_size;
+	while( true ) {
+	    std::shared_ptr<char> sp( block, std::default_delete<char[]>() );
+
+	    // Hold back the trailing partial word unless at end of input
+	    size_t end = len;
+	    if( more ) {
+		while( end > 0 && block[end-1] != ' ' && block[end-1] != '\t'
+		       && block[end-1] != '\r' && block[end-1] != '\n' )
+		    --end;
+	    }
+	    size_t carry = len - end;
+	    char * next = nullptr;
+	    if( more ) {
+		next = new char[carry+seg_size+1];
+		memcpy( next, &block[end], carry );
+	    }
+
+	    size_t nw = 0;
+	    if( end > 0 ) {
+		// Boundary character is white space, safe to overwrite
+		block[end] = '\0';
+		nw = cilk_spawn catalog( block, end, container, chunk_size );
+	    }
+	    size_t next_len = 0;
+	    bool next_more = false;
+	    if( more ) {
+		size_t n = ds.read( &next[carry], seg_size );
+		next_len = carry + n;
+		next_more = n == seg_size;
+	    }
+	    cilk_sync;
+
+	    nwords += nw;
+	    if( end > 0 && !WordContainerTy::is_managed )
+		container.enregister( sp );
+	    if( !more )
+		break;
+	    block = next;
+	    len = next_len;
+	    more = next_more;
+	}
+    }
+
+    close( fd );
+    return nwords;
+}
+
+// Catalog a file, decompressing on the fly if it is gzip/zstd compressed.
+template<typename WordContainerTy, typename CatalogFn>
+size_t catalog_file( const std::string & filename,
+		     WordContainerTy & container, size_t chunk_size,
+		     CatalogFn catalog ) {
+    compression_format fmt = detect_compression( filename.c_str() );
+    if( fmt != cf_none )
+	return catalog_compressed( filename.c_str(), fmt, container,
+				   chunk_size, catalog );
+
+    word_container_file_builder<WordContainerTy> builder( filename, container );
+    return catalog( builder.get_buffer(),
+		    builder.get_buffer_end()-builder.get_buffer(),
+		    builder.get_word_list(), chunk_size );
+}
+
+template<typename MapTy>
+struct word_catalog_fn {
+    size_t operator () ( char * data, size_t data_size,
+			 MapTy & catalog, size_t chunk_size ) const {
+	return text::word_catalog( data, data_size, catalog, chunk_size );
+    }
+};
+
+template<typename MapTy>
+struct ngram_catalog_fn {
+    size_t operator () ( char * data, size_t data_size,
+			 MapTy & catalog, size_t chunk_size ) const {
+	return text::ngram_catalog( data, data_size, catalog, chunk_size );
+    }
+};
+
+} // namespace internal
+
 template<typename InternalContainerTy,
 	 typename WordContainerTy = InternalContainerTy>
 typename std::enable_if<!std::is_same<InternalContainerTy,WordContainerTy>::value, size_t>::type
@@ -526,12 +577,9 @@ word_catalog( const std::string & filename,
 	      size_t chunk_size = size_t(1)<<20 ) {
     typedef InternalContainerTy word_container_type;
     word_container_type intl_container;
-    word_container_file_builder<word_container_type>
-	builder( filename, intl_container );
     size_t nwords =
-	text::word_catalog( builder.get_buffer(),
-			    builder.get_buffer_end()-builder.get_buffer(),
-			    builder.get_word_list(), chunk_size );
+	internal::catalog_file( filename, intl_container, chunk_size,
+				internal::word_catalog_fn<word_container_type>() );
 
     internal::move_word_container( word_container, std::move(intl_container) );
     intl_container.mark_clear();
@@ -546,11 +594,8 @@ word_catalog( const std::string & filename,
 	      WordContainerTy & word_container,
 	      size_t chunk_size = size_t(1)<<20 ) {
     typedef WordContainerTy word_container_type;
-    word_container_file_builder<word_container_type>
-	builder( filename, word_container );
-    return text::word_catalog( builder.get_buffer(),
-			       builder.get_buffer_end()-builder.get_buffer(),
-			       builder.get_word_list(), chunk_size );
+    return internal::catalog_file( filename, word_container, chunk_size,
+				   internal::word_catalog_fn<word_container_type>() );
 }
 
 template<typename InternalContainerTy,
@@ -561,12 +606,9 @@ ngram_catalog( const std::string & filename,
 	       size_t chunk_size = size_t(1)<<20 ) {
     typedef InternalContainerTy word_container_type;
     word_container_type intl_container;
-    word_container_file_builder<word_container_type>
-	builder( filename, intl_container );
     size_t ngrams =
-	text::ngram_catalog( builder.get_buffer(),
-			    builder.get_buffer_end()-builder.get_buffer(),
-			    builder.get_word_list(), chunk_size );
+	internal::catalog_file( filename, intl_container, chunk_size,
+				internal::ngram_catalog_fn<word_container_type>() );
 
     internal::move_word_container( word_container, intl_container );
 
@@ -580,11 +622,8 @@ ngram_catalog( const std::string & filename,
 	       WordContainerTy & word_container,
 	       size_t chunk_size = size_t(1)<<20 ) {
     typedef WordContainerTy word_container_type;
-    word_container_file_builder<word_container_type>
-	builder( filename, word_container );
-    return text::ngram_catalog( builder.get_buffer(),
-				builder.get_buffer_end()-builder.get_buffer(),
-				builder.get_word_list(), chunk_size );
+    return internal::catalog_file( filename, word_container, chunk_size,
+				   internal::ngram_catalog_fn<word_container_type>() );
 }
 
 
@@ -686,12 +725,44 @@ void clear_ids( Iterator I, Iterator E ) {
 	JI->second.second = 0;
 }
 
+// Assign consecutive ids to the words for which F( word, count ) holds.
+// Other words are marked as having no id, see has_id().
 template<typename Iterator, typename Functor>
-void assign_ids_if( Iterator I, Iterator E, Functor F ) {
-    decltype(I->second.second) uniq_id = 0;
+size_t assign_ids_if( Iterator I, Iterator E, Functor F ) {
+    typedef decltype(I->second.second) id_type;
+    id_type uniq_id = 0;
+    for( Iterator JI=I; JI != E; ++JI )
+	JI->second.second = F( JI->first, JI->second.first )
+	    ? uniq_id++ : ~id_type(0);
+    return uniq_id;
+}
+
+template<typename IdTy>
+bool has_id( IdTy id ) {
+    return id != ~IdTy(0);
+}
+
+// The number of words in [I,E) that have an id
+template<typename Iterator>
+size_t count_ids( Iterator I, Iterator E ) {
+    size_t n = 0;
     for( Iterator JI=I; JI != E; ++JI )
-	if( F( JI->first, JI->second.first ) )
-	    JI->second.second = uniq_id++;
+	n += has_id( JI->second.second );
+    return n;
+}
+
+// Look up the key of the catalog entry at I in the joint word map. Word
+// containers over hash tables reuse the hash stored with the entry.
+template<typename LookupTy, typename Iterator>
+auto lookup_entry( const LookupTy & m, const Iterator & I, int )
+    -> decltype( m.find_entry( I ) ) {
+    return m.find_entry( I );
+}
+
+template<typename LookupTy, typename Iterator>
+typename LookupTy::const_iterator
+lookup_entry( const LookupTy & m, const Iterator & I, long ) {
+    return find_entry( m, I );
 }
 
 template<typename Iterator>
@@ -712,6 +783,228 @@ void assign_ids( Iterator I, Iterator E ) {
 
 } // internal
 
+// Selection of the vocabulary of a TF/IDF data set by document frequency.
+// Words are dropped when they appear in fewer than min_df documents, in
+// more than a fraction max_df of the documents, or when they are stop
+// words. Of the remaining words, the max_features words with the highest
+// document frequency are retained, if max_features is non-zero.
+//
+// The filter is a predicate on a word and its document frequency, as
+// internal::assign_ids_if expects. select() must be called first with the
+// document frequencies of all words, after which the filter must be
+// applied exactly once per word, sequentially, as ties at the frequency
+// cut-off are admitted on a first-come basis.
+class vocabulary_filter {
+    size_t	m_min_df;
+    float	m_max_df;
+    size_t	m_max_features;
+    std::deque<std::string> m_stop_words;
+    std::unordered_set<const char *, text::charp_hash, text::charp_eql>
+		m_stop_set;
+
+    size_t	m_max_count;	// set by select()
+    size_t	m_cutoff;
+    size_t	m_ties;
+
+public:
+    vocabulary_filter( size_t min_df = 1, float max_df = 1.0f,
+		       size_t max_features = 0 )
+	: m_min_df( min_df ), m_max_df( max_df ),
+	  m_max_features( max_features ), m_max_count( ~size_t(0) ),
+	  m_cutoff( 0 ), m_ties( 0 ) { }
+
+    vocabulary_filter( const vocabulary_filter & ) = delete;
+    vocabulary_filter & operator = ( const vocabulary_filter & ) = delete;
+
+    void set_min_df( size_t min_df ) { m_min_df = min_df; }
+    void set_max_df( float max_df ) { m_max_df = max_df; }
+    void set_max_features( size_t n ) { m_max_features = n; }
+
+    // True if no word is dropped
+    bool empty() const {
+	return m_min_df <= 1 && m_max_df >= 1.0f && m_max_features == 0
+	    && m_stop_set.empty();
+    }
+
+    // Words are upper-cased, as by the tokenizer
+    void add_stop_word( const char * w ) {
+	std::string u( w );
+	for( char & c : u )
+	    c = std::toupper( c );
+	m_stop_words.push_back( u );
+	m_stop_set.insert( m_stop_words.back().c_str() );
+    }
+
+    // Read white space separated stop words from a file
+    void read_stop_words( const std::string & filename ) {
+	std::ifstream is( filename );
+	if( !is )
+	    fatale( "open", filename );
+	std::string w;
+	while( is >> w )
+	    add_stop_word( w.c_str() );
+    }
+
+    bool is_stop_word( const char * w ) const {
+	return m_stop_set.find( w ) != m_stop_set.end();
+    }
+    bool has_stop_words() const { return !m_stop_set.empty(); }
+
+    // Determine the document frequency cut-off for max_features, given
+    // the words in [I,E) with their document frequencies as in
+    // appear_count, from a collection of num_docs documents.
+    template<typename Iterator>
+    void select( Iterator I, Iterator E, size_t num_docs ) {
+	m_max_count = m_max_df >= 1.0f ? num_docs
+	    : size_t( m_max_df * float(num_docs) );
+	m_cutoff = 0;
+	m_ties = ~size_t(0);
+	if( m_max_features == 0 )
+	    return;
+
+	std::vector<size_t> df;
+	for( Iterator JI=I; JI != E; ++JI )
+	    if( admit( JI->first, JI->second.first ) )
+		df.push_back( JI->second.first );
+	if( df.size() <= m_max_features )
+	    return;
+
+	// Bisect on the frequency for the largest cut-off t such that at
+	// least max_features words have frequency t or more. Each step is a
+	// parallel count, which avoids sorting the frequencies.
+	size_t lo = m_min_df, hi = m_max_count;
+	while( lo < hi ) {
+	    size_t t = lo + ( hi - lo + 1 ) / 2;
+	    if( count_at_least( df, t ) >= m_max_features )
+		lo = t;
+	    else
+		hi = t - 1;
+	}
+	m_cutoff = lo;
+	m_ties = m_max_features - count_at_least( df, lo + 1 );
+    }
+
+    bool operator () ( const char * w, size_t df ) {
+	if( !admit( w, df ) || df < m_cutoff )
+	    return false;
+	if( df > m_cutoff )
+	    return true;
+	if( m_ties == 0 )
+	    return false;
+	--m_ties;
+	return true;
+    }
+
+private:
+    bool admit( const char * w, size_t df ) const {
+	return df >= m_min_df && df <= m_max_count && !is_stop_word( w );
+    }
+
+    static size_t count_at_least( const std::vector<size_t> & df, size_t t ) {
+	cilk::reducer< cilk::op_add<size_t> > count(0);
+	cilk_for( size_t i=0; i < df.size(); ++i )
+	    if( df[i] >= t )
+		*count += 1;
+	return count.get_value();
+    }
+};
+
+// Assign ids to the words in [I,E) that pass the filter, given their
+// document frequency, counted over num_docs documents, as in appear_count.
+// The other words get no id: they are skipped by tfidf_map_catalog and are
+// not written as columns. Returns the number of words pruned.
+template<typename Iterator>
+size_t prune_vocabulary( Iterator I, Iterator E, vocabulary_filter & filter,
+			 size_t num_docs ) {
+    if( filter.empty() ) {
+	internal::assign_ids( I, E );
+	return 0;
+    }
+    filter.select( I, E, num_docs );
+    size_t n = internal::assign_ids_if( I, E, [&]( const char * w, size_t df ) {
+	    return filter( w, df );
+	} );
+    return std::distance( I, E ) - n;
+}
+
+// Weighting of TF/IDF vectors. Sublinear scaling replaces a term frequency
+// tf by 1+log(tf). The other settings apply to each vector once its scores
+// are known: only the top_n terms with the largest absolute score are
+// retained, if top_n is non-zero, and the vector is scaled to unit
+// Euclidean length. The default weighting is plain tf*idf.
+struct tfidf_weighting {
+    size_t	top_n;
+    bool	sublinear_tf;
+    bool	l2_normalize;
+
+    tfidf_weighting() : top_n( 0 ), sublinear_tf( false ),
+			l2_normalize( false ) { }
+
+    bool empty() const { return !top_n && !sublinear_tf && !l2_normalize; }
+
+    template<typename ValueTy, typename CountTy>
+    ValueTy tf( CountTy count ) const {
+	return sublinear_tf && count > 0 ? ValueTy(1) + log( ValueTy(count) )
+	    : ValueTy(count);
+    }
+};
+
+namespace internal {
+
+// Apply the per-vector settings of the weighting to the n scores v with
+// coordinates c, in place. The retained scores keep their relative order.
+// Returns their number.
+template<typename ValueTy, typename IndexTy>
+size_t tfidf_weigh( ValueTy *v, IndexTy *c, size_t n,
+		    const tfidf_weighting & weighting ) {
+    if( weighting.top_n && n > weighting.top_n ) {
+	// Select the top_n positions by partial sorting. Ties are broken by
+	// position, such that the selection is deterministic.
+	std::vector<size_t> pos( n );
+	for( size_t f=0; f < n; ++f )
+	    pos[f] = f;
+	auto top = pos.begin() + weighting.top_n;
+	std::nth_element( pos.begin(), top, pos.end(),
+			  [&]( size_t a, size_t b ) {
+			      ValueTy va = std::abs( v[a] ), vb = std::abs( v[b] );
+			      return va > vb || ( va == vb && a < b );
+			  } );
+	std::sort( pos.begin(), top );
+	// pos[f] >= f, hence compaction can proceed in place
+	for( size_t f=0; f < weighting.top_n; ++f ) {
+	    v[f] = v[pos[f]];
+	    c[f] = c[pos[f]];
+	}
+	n = weighting.top_n;
+    }
+
+    if( weighting.l2_normalize ) {
+	ValueTy sqnorm = 0;
+	for( size_t f=0; f < n; ++f )
+	    sqnorm += v[f] * v[f];
+	if( sqnorm > 0 ) {
+	    ValueTy scale = ValueTy(1) / sqrt( sqnorm );
+	    for( size_t f=0; f < n; ++f )
+		v[f] *= scale;
+	}
+    }
+    return n;
+}
+
+// Finish a vector of a TF/IDF data set holding nscores of its nonzeros
+// after weighting. Trimmed storage is released by the caller through
+// sparse_vector_set::shrink_to_fit().
+template<typename VectorTy, typename ValueTy, typename IndexTy>
+void tfidf_finish( VectorTy & vec, ValueTy *v, IndexTy *c, size_t nscores,
+		   const tfidf_weighting & weighting ) {
+    size_t n = tfidf_weigh( v, c, nscores, weighting );
+    // Words may have been pruned from the vocabulary
+    if( n < vec.nonzeros() )
+	vec.trim_nonzeros( n );
+}
+
+} // namespace internal
+
 template<bool enable_bin_search, typename lookup_type>
 typename std::enable_if<enable_bin_search, typename lookup_type::const_iterator>::type
 tfidf_lookup( lookup_type & joint_word_map, const char * key, bool is_sorted ) {
@@ -741,44 +1034,73 @@ tfidf_lookup( lookup_type & joint_word_map, const text::ngram<lookup_type::N> &
 }
 
 
+// As tfidf_lookup, but taking the catalog entry rather than its key
+template<bool enable_bin_search, typename lookup_type, typename Iterator>
+typename std::enable_if<enable_bin_search, typename lookup_type::const_iterator>::type
+tfidf_lookup_entry( lookup_type & joint_word_map, const Iterator & MI,
+		    bool is_sorted ) {
+    return is_sorted
+	? joint_word_map.binary_search( MI->first )
+	: internal::lookup_entry( joint_word_map, MI, 0 );
+}
+
+template<bool enable_bin_search, typename lookup_type, typename Iterator>
+typename std::enable_if<!enable_bin_search, typename lookup_type::const_iterator>::type
+tfidf_lookup_entry( lookup_type & joint_word_map, const Iterator & MI,
+		    bool is_sorted ) {
+    return internal::lookup_entry( joint_word_map, MI, 0 );
+}
+
+// Calculate the TF/IDF score of the word at MI. Returns false if the word
+// has been pruned from the vocabulary.
 template<bool WordContSameAsLookup, typename ValueTy, typename IndexTy,
 	 typename InputIterator, typename WordLookupTy>
-void
+bool
 tfidf_map_word( ValueTy *v, IndexTy *c, InputIterator MI,
 		WordLookupTy & joint_word_map,
-		size_t num_points, bool is_sorted ) {
+		size_t num_points, bool is_sorted,
+		const tfidf_weighting & weighting ) {
     typedef ValueTy value_type;
 
     // Should always find the word!
     typename WordLookupTy::const_iterator F
-	= tfidf_lookup<
+	= tfidf_lookup_entry<
 	    /*std::is_same<WordContainerTy,WordLookupTy>::value*/
-	    WordContSameAsLookup>( joint_word_map, MI->first, is_sorted );
+	    WordContSameAsLookup>( joint_word_map, MI, is_sorted );
     assert( F != joint_word_map.cend() );
+    if( !internal::has_id( F->second.second ) )
+	return false;
 
     size_t tcount = F->second.first;
     size_t id = F->second.second;
 
-    size_t tf = MI->second;
+    value_type tf = weighting.tf<value_type>( MI->second );
     value_type norm
 	= log10(value_type(num_points + 1) / value_type(tcount + 1)); 
     *c = id;
-    *v = value_type(tf) * norm; // tfidf
+    *v = tf * norm; // tfidf
+    return true;
 }
 
+// Calculate the TF/IDF scores of a catalog. Words pruned from the
+// vocabulary are skipped. Returns the number of scores.
 template<bool WordContSameAsLookup, typename ValueTy, typename IndexTy,
 	 typename InputIterator, typename WordLookupTy>
-void
+size_t
 tfidf_map_catalog( ValueTy *v, IndexTy *c,
 		   InputIterator I, InputIterator E,
 		   WordLookupTy & joint_word_map,
-		   size_t num_points, bool is_sorted ) {
+		   size_t num_points, bool is_sorted,
+		   const tfidf_weighting & weighting = tfidf_weighting() ) {
     size_t f = 0;
     for( InputIterator MI=I, ME=E; MI != ME; ++MI ) {
-	tfidf_map_word<WordContSameAsLookup>( &v[f], &c[f], MI, joint_word_map,
-					      num_points, is_sorted );
-	++f;
+	if( tfidf_map_word<WordContSameAsLookup>( &v[f], &c[f], MI,
+						  joint_word_map,
+						  num_points, is_sorted,
+						  weighting ) )
+	    ++f;
     }
+    return f;
 }
 
 template<bool WordContSameAsLookup, typename ValueTy, typename IndexTy,
@@ -786,26 +1108,43 @@ template<bool WordContSameAsLookup, typename ValueTy, typename IndexTy,
 	 typename = typename std::enable_if<
 	     std::is_same<typename std::iterator_traits<InputIterator>::iterator_tag,
 			  std::random_access_iterator_tag>::value>::type>
-void
+size_t
 tfidf_map_catalog( ValueTy *v, IndexTy *c,
 		   InputIterator I, InputIterator E,
 		   WordLookupTy & joint_word_map,
-		   size_t num_points, bool is_sorted ) {
+		   size_t num_points, bool is_sorted,
+		   const tfidf_weighting & weighting = tfidf_weighting() ) {
     typedef ValueTy value_type;
 
-    if( std::distance( I, E ) > 1000 ) {
+    size_t n = std::distance( I, E );
+    if( n > 1000 ) {
+	// Mark pruned words, then close the gaps
+	std::vector<bool> kept( n );
 	cilk_for( InputIterator MI=I; MI != E; ++MI ) {
 	    size_t f = std::distance( I, MI ); // O(1) for random access iterator
-	    tfidf_map_word<WordContSameAsLookup>( &v[f], &c[f], MI, joint_word_map,
-						  num_points, is_sorted );
+	    kept[f] = tfidf_map_word<WordContSameAsLookup>(
+		&v[f], &c[f], MI, joint_word_map, num_points, is_sorted,
+		weighting );
 	}
+	size_t g = 0;
+	for( size_t f=0; f < n; ++f ) {
+	    if( kept[f] ) {
+		v[g] = v[f];
+		c[g] = c[f];
+		++g;
+	    }
+	}
+	return g;
     } else {
 	size_t f = 0;
 	for( InputIterator MI=I; MI != E; ++MI ) {
-	    tfidf_map_word<WordContSameAsLookup>( &v[f], &c[f], MI, joint_word_map,
-						  num_points, is_sorted );
-	    ++f;
+	    if( tfidf_map_word<WordContSameAsLookup>( &v[f], &c[f], MI,
+						      joint_word_map,
+						      num_points, is_sorted,
+						      weighting ) )
+		++f;
 	}
+	return f;
     }
 }
 
@@ -816,7 +1155,8 @@ tfidf( InputIterator I, InputIterator E,
        std::shared_ptr<WordContainerTy> & joint_word_map_ptr,
        WordLookupTy & joint_word_lookup,
        std::shared_ptr<VectorNameTy> & vec_names_ptr,
-       bool is_sorted, bool iterate_ascending ) {
+       bool is_sorted, bool iterate_ascending,
+       const tfidf_weighting & weighting = tfidf_weighting() ) {
     typedef data_set<VectorTy, WordContainerTy, VectorNameTy> data_set_type;
     typedef typename data_set_type::vector_list_type vector_list_type;
     typedef typename data_set_type::index_list_type index_list_type;
@@ -827,9 +1167,12 @@ tfidf( InputIterator I, InputIterator E,
     // Reference to work with
     lookup_type & joint_word_map = joint_word_lookup; // *joint_word_map_ptr;
 
-    // Get statistics on input word maps
+    // Get statistics on input word maps. Words pruned from the vocabulary
+    // have no id and are not counted as dimensions.
     size_t num_points = std::distance( I, E );
-    size_t num_dimensions = joint_word_map.size();
+    size_t num_dimensions
+	= internal::count_ids( joint_word_map_ptr->cbegin(),
+			       joint_word_map_ptr->cend() );
     size_t nonzeros = std::for_each( I, E, SizeCounter<decltype(*I)>() ).size;
 
     // Construct set of vectors, either dense or sparse
@@ -884,21 +1227,23 @@ tfidf( InputIterator I, InputIterator E,
     // Calculate TF/IDF scores
     cilk_for( size_t i=0; i < num_points; ++i ) {
 	auto PI = std::next( I, i ); // Get word map to operate on
-	size_t fcount = PI->size();
 
 	value_type *v = &vectors.get_alloc_v()[vec_start[i]];
 	index_type *c = &vectors.get_alloc_i()[vec_start[i]];
 
-	tfidf_map_catalog<
+	size_t nscores = tfidf_map_catalog<
 	    std::is_same<WordContainerTy,WordLookupTy>::value>(
 		v, c, PI->cbegin(), PI->cend(), joint_word_map,
-		num_points, is_sorted );
+		num_points, is_sorted, weighting );
+	internal::tfidf_finish( vectors[i], v, c, nscores, weighting );
 
 	// In case of collections where IDs have not been assigned in the
 	// natural iteration order, we need to now sort the sparse vectors.
 	if( !iterate_ascending )
 	    vectors[i].sort_by_index();
     }
+    // Release the storage of scores dropped by the weighting or pruning
+    vectors.shrink_to_fit();
 
     delete[] vec_start;
 
@@ -913,10 +1258,12 @@ data_set<VectorTy, WordContainerTy, VectorNameTy>
 tfidf( InputIterator I, InputIterator E,
        std::shared_ptr<WordContainerTy> & joint_word_map_ptr,
        std::shared_ptr<VectorNameTy> & vec_names_ptr,
-       bool is_sorted, bool iterate_ascending ) {
+       bool is_sorted, bool iterate_ascending,
+       const tfidf_weighting & weighting = tfidf_weighting() ) {
     return tfidf<VectorTy, InputIterator, WordContainerTy, WordContainerTy,
 		 VectorNameTy>( I, E, joint_word_map_ptr, *joint_word_map_ptr,
-				vec_names_ptr, is_sorted, iterate_ascending );
+				vec_names_ptr, is_sorted, iterate_ascending,
+				weighting );
 }
 
 /*
@@ -992,7 +1339,7 @@ tfidf_by_words( InputIterator I, InputIterator E,
 	    // Should always find the word!
 	    typename index_list_type::const_iterator F = is_sorted
 		? joint_word_map.binary_search( MI->first )
-		: joint_word_map.find( MI->first );
+		: internal::lookup_entry( joint_word_map, MI, 0 );
 	    assert( F != joint_word_map.cend() );
 
 	    size_t fcount = F->second.first; // Number of files involved in.
@@ -1076,7 +1423,7 @@ tfidf_inplace( InputIterator I, InputIterator E,
 		 MI=PI->begin(), ME=PI->end(); MI != ME; ++MI ) {
 	    // Should always find the word!
 	    typename index_list_type::const_iterator F
-		= joint_word_map.find( MI->first );
+		= internal::lookup_entry( joint_word_map, MI, 0 );
 	    assert( F != joint_word_map.cend() );
 
 	    size_t tcount = F->second.first; // second.second not needed
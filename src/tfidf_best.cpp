@@ -20,13 +20,13 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <deque>
 #include <unordered_map>
 
 #include <cilk/cilk.h>
 #include <cilk/reducer.h>
 #include <cilk/cilk_api.h>
-//#include "cilkpub/sort.h"
 
 #include "asap/utils.h"
 #include "asap/arff.h"
@@ -35,8 +35,15 @@
 #include "asap/word_count.h"
 #include "asap/normalize.h"
 #include "asap/io.h"
+#include "asap/parallel_sort.h"
+#include "asap/sketch.h"
+#include "asap/file_schedule.h"
 #include "asap/hashtable.h"
 #include "asap/hashindex.h"
+#include "asap/perfect_hash.h"
+#include "asap/term_dict.h"
+#include "asap/df_store.h"
+#include "asap/feature_hash.h"
 #include "asap/traits.h"
 
 #include <stddefines.h>
@@ -46,16 +53,28 @@
 enum algorithm_t {
     a_baseline,
     a_unsorted_fast,
-    a_sorted_fast
+    a_sorted_fast,
+    a_interned,
+    a_swiss,
+    a_hashed,
+    a_streaming
 };
 
 char const * indir = nullptr;
 char const * outfile = nullptr;
 bool do_sort = false;
 algorithm_t algo = a_baseline;
+unsigned hash_bits = 16;
+char const * samplefile = nullptr;
+char const * dfstore = nullptr;
+size_t approx_terms = 0;	// approximate document frequencies if non-zero
+size_t approx_memory = size_t(16)<<20;
+asap::vocabulary_filter vocab_filter;
+asap::tfidf_weighting weighting;
+asap::file_schedule schedule;
 
 static void help(char *progname) {
-    std::cout << "Usage: " << progname << " -i <indir> -o <outfile> [-a {hus}] [-w] [-s]\n";
+    std::cout << "Usage: " << progname << " -i <indir> -o <outfile> [-a {husiwft}] [-b <bits>] [-m <samplefile>] [-d <min_df>] [-D <max_df>] [-n <max_features>] [-x <stopwords>] [-I <dfstore>] [-S <terms> [-C <MB>]] [-t <top_n>] [-l] [-u] [-w] [-s]\n";
 }
 
 algorithm_t decode_char( char c ) {
@@ -63,7 +82,11 @@ algorithm_t decode_char( char c ) {
     case 'h': return a_baseline;
     case 'u': return a_unsorted_fast;
     case 's': return a_sorted_fast;
-    default: fatal( "configuration string can only be h, u or s" );
+    case 'i': return a_interned;
+    case 'w': return a_swiss;
+    case 'f': return a_hashed;
+    case 't': return a_streaming;
+    default: fatal( "configuration string can only be h, u, s, i, w, f or t" );
     }
 }
 
@@ -71,7 +94,7 @@ static void parse_args(int argc, char **argv) {
     int c;
     extern char *optarg;
     
-    while ((c = getopt(argc, argv, "i:o:wsa:")) != EOF) {
+    while ((c = getopt(argc, argv, "i:o:wsa:b:m:d:D:n:x:I:S:C:t:lu")) != EOF) {
         switch (c) {
 	case 'i':
 	    indir = optarg;
@@ -85,6 +108,42 @@ static void parse_args(int argc, char **argv) {
 	case 'a':
 	    algo = decode_char(*optarg);
 	    break;
+	case 'b':
+	    hash_bits = atoi(optarg);
+	    break;
+	case 'm':
+	    samplefile = optarg;
+	    break;
+	case 'd':
+	    vocab_filter.set_min_df( atol(optarg) );
+	    break;
+	case 'D':
+	    vocab_filter.set_max_df( atof(optarg) );
+	    break;
+	case 'n':
+	    vocab_filter.set_max_features( atol(optarg) );
+	    break;
+	case 'x':
+	    vocab_filter.read_stop_words( optarg );
+	    break;
+	case 'I':
+	    dfstore = optarg;
+	    break;
+	case 'S':
+	    approx_terms = atol(optarg);
+	    break;
+	case 'C':
+	    approx_memory = size_t(atol(optarg)) << 20;
+	    break;
+	case 't':
+	    weighting.top_n = atol(optarg);
+	    break;
+	case 'l':
+	    weighting.sublinear_tf = true;
+	    break;
+	case 'u':
+	    weighting.l2_normalize = true;
+	    break;
 	case '?':
 	    help(argv[0]);
 	    exit(1);
@@ -94,8 +153,16 @@ static void parse_args(int argc, char **argv) {
     if( !indir )
 	fatal( "Input directory must be supplied." );
 
+    // The interned and streaming algorithms always number new terms in
+    // sorted order
     if( do_sort && algo != a_sorted_fast )
 	fatal( "Only the sorted-fast algorithm supports sorting" );
+    if( samplefile && algo != a_hashed )
+	fatal( "Only the hashed algorithm samples words" );
+    if( dfstore && algo != a_interned && algo != a_streaming )
+	fatal( "Only the interned and streaming algorithms update a document frequency store" );
+    if( approx_terms && ( algo != a_streaming || dfstore ) )
+	fatal( "Only the streaming algorithm approximates document frequencies, without a document frequency store" );
 
     std::cerr << "Input directory = " << indir << '\n';
     if( !outfile )
@@ -105,22 +172,40 @@ static void parse_args(int argc, char **argv) {
     else
 	std::cerr << "Output file = " << outfile << '\n';
     std::cerr << "TF/IDF list sorted = " << ( do_sort ? "true\n" : "false\n" );
+    if( dfstore )
+	std::cerr << "Document frequency store = " << dfstore << '\n';
+    if( algo == a_hashed )
+	std::cerr << "Hashed features = 2^" << hash_bits << '\n';
+    if( approx_terms ) {
+	std::cerr << "Approximate document frequency terms = " << approx_terms
+		  << '\n';
+	std::cerr << "Approximate document frequency sketch MB = "
+		  << ( approx_memory >> 20 ) << '\n';
+    }
+    if( weighting.top_n )
+	std::cerr << "Terms per vector = " << weighting.top_n << '\n';
+    if( weighting.sublinear_tf )
+	std::cerr << "Sublinear TF = true\n";
+    if( weighting.l2_normalize )
+	std::cerr << "L2-normalised = true\n";
 }
 
 
 
 
+// HashTableTy is asap::hash_table or asap::swiss_table
 template<typename directory_listing_type, typename vector_type,
-	 typename word_bank_type>
+	 typename word_bank_type,
+	 template<typename...> class HashTableTy = asap::hash_table>
 void tfidf_all_hash( directory_listing_type & dir_list, const char * outfile,
 		     size_t total_size, timespec veryStart ) {
-    typedef asap::hash_table<const char*, size_t, asap::text::charp_hash,
-			     asap::text::charp_eql> wc_map_type;
+    typedef HashTableTy<const char*, size_t, asap::text::charp_hash,
+			asap::text::charp_eql> wc_map_type;
     typedef asap::word_map<wc_map_type, word_bank_type> internal_map_type;
 
-    typedef asap::hash_table<const char *,
-			     asap::appear_count<size_t, size_t>,
-			     asap::text::charp_hash, asap::text::charp_eql>
+    typedef HashTableTy<const char *,
+			asap::appear_count<size_t, size_t>,
+			asap::text::charp_hash, asap::text::charp_eql>
     dc_map_type;
     typedef asap::word_map<dc_map_type, word_bank_type> aggregate_map_type;
 
@@ -139,19 +224,19 @@ void tfidf_all_hash( directory_listing_type & dir_list, const char * outfile,
     // Sorting the intermediate lists achieves this goal only if the aggregate
     // map type is not automatically sorted.
 
-    asap::word_container_reducer<aggregate_map_type> allwords;
+    asap::word_container_concurrent<aggregate_map_type> allwords;
     cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
 
-    cilk_for( size_t i=0; i < num_files; ++i ) {
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
 	// File to read
 	std::string filename = *std::next(dir_list.cbegin(),i);
 	// Internally use the type internal_map_type, then merge into the catalog[i]
 	size_t num_words =
 	    asap::word_catalog<internal_map_type>( std::string(filename),
-						   catalog[i] );
+						   catalog[i], chunk_size );
 	*total_num_words += num_words;
 	allwords.count_presence( catalog[i] );
-    }
+    } );
     get_time( wc_end );
 
     // Aggregate map has 4 phases:
@@ -160,8 +245,11 @@ void tfidf_all_hash( directory_listing_type & dir_list, const char * outfile,
     // 3. assign_ids
     // 4. random lookup
     // Phases 2 and 3 are similar; a single data structure suffices.
-    asap::internal::assign_ids( allwords.get_value().begin(),
-				allwords.get_value().end() );
+    // Words pruned from the vocabulary are assigned no id
+    size_t num_pruned
+	= asap::prune_vocabulary( allwords.get_value().begin(),
+				  allwords.get_value().end(), vocab_filter,
+				  num_files );
     get_time( sort_end );
 
     std::shared_ptr<aggregate_map_type> allwords_ptr
@@ -177,7 +265,8 @@ void tfidf_all_hash( directory_listing_type & dir_list, const char * outfile,
 	    catalog.cbegin(), catalog.cend(), allwords_ptr, *allwords_ptr,
 	    dir_list_ptr,
 	    false, // whether joint_word_map is sorted
-	    false );  // whether catalogs are sorted
+	    false,  // whether catalogs are sorted
+	    weighting );
     get_time(tfidf_end);
 
     print_time("word count", tfidf_begin, wc_end);
@@ -188,6 +277,7 @@ void tfidf_all_hash( directory_listing_type & dir_list, const char * outfile,
     std::cerr << "Total words: " << total_num_words.get_value() << '\n';
     std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
     std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
     std::cerr << "TF/IDF indices sorted by word: " << false << '\n';
     std::cerr << "TF/IDF iterate catalog in ascending order: "
 	      << false << '\n';
@@ -241,20 +331,20 @@ void tfidf_switch_hash_list( directory_listing_type & dir_list,
     // The final result must be sorted by key (words).
     // Sorting the intermediate lists achieves this goal only if the aggregate
     // map type is not automatically sorted.
-    asap::word_container_reducer<aggregate_map_type> allwords;
+    asap::word_container_concurrent<aggregate_map_type> allwords;
     cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
 
-    cilk_for( size_t i=0; i < num_files; ++i ) {
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
 	// File to read
 	std::string filename = *std::next(dir_list.cbegin(),i);
 	// Internally use the type internal_map_type, then merge
 	// into the catalog[i]
 	size_t num_words =
 	    asap::word_catalog<internal_map_type>( std::string(filename),
-						   catalog[i] );
+						   catalog[i], chunk_size );
 	*total_num_words += num_words;
 	allwords.count_presence( catalog[i] );
-    }
+    } );
     get_time( wc_end );
 
     // Aggregate map has 4 phases:
@@ -264,8 +354,11 @@ void tfidf_switch_hash_list( directory_listing_type & dir_list,
     // 4. random lookup
     // Phases 2 and 3 are similar; a single data structure suffices.
     assert( !do_sort );
-    asap::internal::assign_ids( allwords.get_value().begin(),
-				allwords.get_value().end() );
+    // Words pruned from the vocabulary are assigned no id
+    size_t num_pruned
+	= asap::prune_vocabulary( allwords.get_value().begin(),
+				  allwords.get_value().end(), vocab_filter,
+				  num_files );
     get_time( sort_end );
 
     std::shared_ptr<directory_listing_type> dir_list_ptr
@@ -280,7 +373,8 @@ void tfidf_switch_hash_list( directory_listing_type & dir_list,
 	tfidf = asap::tfidf<typename data_set_type::vector_type>(
 	    catalog.cbegin(), catalog.cend(), allwords_ptr, dir_list_ptr,
 	    false, // whether joint_word_map is sorted
-	    true );  // whether catalogs iterated in ascending order
+	    true,  // whether catalogs iterated in ascending order
+	    weighting );
     get_time(tfidf_end);
 
     print_time("word count", tfidf_begin, wc_end);
@@ -291,6 +385,7 @@ void tfidf_switch_hash_list( directory_listing_type & dir_list,
     std::cerr << "Total words: " << total_num_words.get_value() << '\n';
     std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
     std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
     std::cerr << "TF/IDF indices sorted by word: " << false << '\n';
     std::cerr << "TF/IDF iterate catalog in ascending order: " << true << '\n';
     print_time("library", tfidf_begin, tfidf_end);
@@ -328,8 +423,11 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
 				  asap::appear_count<size_t,size_t>>> agg2_map_type;
     typedef asap::kv_list<agg2_map_type, word_bank_type> aggregate2_map_type;
 
-    // Just a hash table, no word bank associated
-    typedef agg1_map_type aggregate3_map_type;
+    // Read-only index for lookup, no word bank associated
+    typedef asap::perfect_hash_map<const char *,
+				   asap::appear_count<size_t, size_t>,
+				   asap::text::charp_hash,
+				   asap::text::charp_eql> aggregate3_map_type;
 
     typedef asap::data_set<vector_type, aggregate2_map_type,
 			   directory_listing_type> data_set_type;
@@ -342,10 +440,10 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
     std::vector<intermediate_map_type> catalog;
     catalog.resize( num_files );
 
-    asap::word_container_reducer<aggregate1_map_type> allwords;
+    asap::word_container_concurrent<aggregate1_map_type> allwords;
     cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
 
-    cilk_for( size_t i=0; i < num_files; ++i ) {
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
 	// File to read
 	std::string filename = *std::next(dir_list.cbegin(),i);
 	// Internally use the type internal_map_type, then merge
@@ -353,12 +451,12 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
 	// to calculate term frequency, then converts to a list (intermediate).
 	size_t num_words =
 	    asap::word_catalog<internal_map_type>( std::string(filename),
-						   catalog[i] );
+						   catalog[i], chunk_size );
 	// Reductions. Merge catalog[i] (list, intermediate_map_type)
 	// into the document frequency (hash table, aggregate1_map_type).
 	*total_num_words += num_words;
 	allwords.count_presence( catalog[i] );
-    }
+    } );
     get_time( wc_end );
 
     // Aggregate map has 4 phases:
@@ -372,23 +470,18 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
     allwords2.insert( std::move(allwords.get_value()) );
     allwords.get_value().clear();
 
-    if( do_sort ) {
-	/*
-	cilkpub::cilk_sort( allwords2.begin(), allwords2.end(),
-			    asap::pair_cmp<typename aggregate2_map_type::value_type,
-			    typename aggregate2_map_type::value_type>() );
-	 */
-	std::sort( allwords2.begin(), allwords2.end(),
-		   asap::pair_cmp<typename aggregate2_map_type::value_type,
-		   typename aggregate2_map_type::value_type>() );
-    }
+    if( do_sort )
+	asap::parallel_sort( allwords2.begin(), allwords2.end(),
+			     asap::pair_cmp<typename aggregate2_map_type::value_type,
+			     typename aggregate2_map_type::value_type>() );
 
-    asap::internal::assign_ids( allwords2.begin(), allwords2.end() );
+    // Words pruned from the vocabulary are assigned no id
+    size_t num_pruned
+	= asap::prune_vocabulary( allwords2.begin(), allwords2.end(),
+				  vocab_filter, num_files );
 
-    // Construct an index (hash table) for fast lookup
-    aggregate3_map_type allwords3;
-    asap::reserve_space( allwords3, allwords2.size() );
-    allwords3.insert( allwords2.begin(), allwords2.end() );
+    // Construct an index (perfect hash) for fast lookup
+    aggregate3_map_type allwords3( allwords2.begin(), allwords2.end() );
     get_time( sort_end );
 
     std::shared_ptr<directory_listing_type> dir_list_ptr
@@ -404,7 +497,8 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
 	    catalog.cbegin(), catalog.cend(), allwords_ptr,
 	    allwords3, dir_list_ptr,
 	    do_sort, // whether joint_word_map is sorted
-	    do_sort );  // whether catalogs are sorted
+	    do_sort,  // whether catalogs are sorted
+	    weighting );
     get_time(tfidf_end);
 
     print_time("word count", tfidf_begin, wc_end);
@@ -415,6 +509,7 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
     std::cerr << "Total words: " << total_num_words.get_value() << '\n';
     std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
     std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
     std::cerr << "TF/IDF indices sorted by word: " << do_sort << '\n';
     std::cerr << "TF/IDF iterate catalog in ascending order: "
 	      << do_sort << '\n';
@@ -433,6 +528,421 @@ void tfidf_switch_sortable( directory_listing_type & dir_list, const char * outf
 	      << " MB/s\n";
 }
 
+// Mark the documents in the listing that the document frequency store has
+// counted before. Returns the names of the inputs to record in the updated
+// store: those of the store followed by the new documents.
+template<typename directory_listing_type>
+std::vector<std::string> counted_inputs( const asap::df_store & store,
+					 const directory_listing_type & dir_list,
+					 std::vector<char> & counted ) {
+    std::vector<std::string> inputs = store.inputs();
+    size_t i = 0;
+    for( auto I=dir_list.cbegin(), E=dir_list.cend(); I != E; ++I, ++i ) {
+	std::string name = asap::df_store::input_name( *I );
+	if( store.counted( name ) )
+	    counted[i] = true;
+	else
+	    inputs.push_back( name );
+    }
+    return inputs;
+}
+
+template<typename directory_listing_type, typename vector_type,
+	 typename word_bank_type>
+void tfidf_interned( directory_listing_type & dir_list, const char * outfile,
+		     size_t total_size, timespec veryStart ) {
+    typedef asap::hash_table<const char*, size_t, asap::text::charp_hash,
+			     asap::text::charp_eql> wc_map_type;
+    typedef asap::word_map<wc_map_type, word_bank_type> internal_map_type;
+
+    // Per-document catalogs hold (term id, count) pairs ordered by id
+    typedef std::vector<std::pair<asap::term_dictionary::id_type, size_t>>
+	id_catalog_type;
+
+    typedef asap::data_set<vector_type, asap::term_dictionary,
+			   directory_listing_type> data_set_type;
+
+    struct timespec wc_end, sort_end, tfidf_begin, tfidf_end;
+
+    // word count
+    get_time( tfidf_begin );
+    size_t num_files = dir_list.size();
+    std::vector<id_catalog_type> catalog;
+    catalog.resize( num_files );
+
+    std::shared_ptr<asap::term_dictionary> dict
+	= std::make_shared<asap::term_dictionary>();
+    cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
+
+    // Incremental mode: terms seen previously retain their ids, and
+    // documents counted previously do not add to the document frequencies
+    asap::df_store store;
+    if( dfstore && store.open( dfstore ) )
+	asap::load_dictionary( *dict, store );
+    std::vector<char> counted( num_files, false );
+    std::vector<std::string> inputs;
+    if( dfstore )
+	inputs = counted_inputs( store, dir_list, counted );
+    size_t num_counted = std::count( counted.begin(), counted.end(), true );
+
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
+	// File to read
+	std::string filename = *std::next(dir_list.cbegin(),i);
+	// Count words per document, then replace the words by their ids.
+	// Interning every occurrence instead would take a shard lock per
+	// word rather than per distinct word of the document.
+	// The document's text is released at the end of the iteration.
+	internal_map_type wc;
+	size_t num_words =
+	    asap::word_catalog<internal_map_type>( std::string(filename), wc,
+						   chunk_size );
+	*total_num_words += num_words;
+	dict->intern( wc, catalog[i] );
+    } );
+    get_time( wc_end );
+
+    // Aggregate over integer ids only. Terms not in the store are numbered
+    // in lexicographic order, independently of the order of processing.
+    // Without a store, all indices are thus sorted by word.
+    size_t num_stored = store.size();
+    asap::remap_ids( catalog.begin(), catalog.end(),
+		     dict->sort_ids( num_stored ) );
+    std::vector<asap::term_dictionary::df_type> df
+	= asap::document_frequency( catalog.cbegin(), catalog.cend(),
+				    dict->size(),
+				    [&]( size_t i ) { return !counted[i]; } );
+    asap::merge_document_frequency( df, store );
+    size_t num_docs = num_files - num_counted + store.num_docs();
+    dict->freeze( df );
+    if( dfstore ) {
+	store.close();
+	asap::df_store::write( dfstore, num_docs, dict->cbegin(),
+			       dict->cend(), inputs );
+    }
+    // The store retains all terms; pruned terms are removed from the catalogs
+    size_t num_pruned = 0;
+    if( !vocab_filter.empty() ) {
+	std::vector<asap::term_dictionary::id_type> remap
+	    = dict->prune( df, vocab_filter, num_docs );
+	asap::remap_ids( catalog.begin(), catalog.end(), remap );
+	num_pruned = remap.size() - df.size();
+    }
+    get_time( sort_end );
+
+    std::shared_ptr<directory_listing_type> dir_list_ptr
+	= std::make_shared<directory_listing_type>();
+    dir_list_ptr->swap( dir_list );
+
+    data_set_type
+	tfidf = asap::tfidf<typename data_set_type::vector_type>(
+	    catalog.cbegin(), catalog.cend(), dict, df, dir_list_ptr,
+	    num_docs, weighting );
+    get_time(tfidf_end);
+
+    print_time("word count", tfidf_begin, wc_end);
+    std::cerr << "word count sort intm: " << false << '\n';
+    std::cerr << "word count is sorted: " << false << '\n';
+    print_time("word sort", wc_end, sort_end);
+    print_time("TF/IDF", sort_end, tfidf_end);
+    std::cerr << "Total words: " << total_num_words.get_value() << '\n';
+    std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
+    std::cerr << "TF/IDF documents in corpus: " << num_docs << '\n';
+    std::cerr << "TF/IDF documents counted before: " << num_counted << '\n';
+    std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
+    std::cerr << "TF/IDF indices sorted by word: " << ( num_stored == 0 )
+	      << '\n';
+    std::cerr << "TF/IDF iterate catalog in ascending order: " << true << '\n';
+    print_time("library", tfidf_begin, tfidf_end);
+
+    struct timespec begin, end;
+    get_time( begin );
+    if( outfile )
+	asap::arff_write( outfile, tfidf );
+    get_time (end);
+    print_time("output", begin, end);
+    print_time("complete time", veryStart, begin); // no output
+    std::cerr << "Rate: "
+	      << double(total_size)/double(time_diff(begin,veryStart))
+	/double(1024*2014)
+	      << " MB/s\n";
+}
+
+// Streaming TF/IDF in two passes over the input. The first pass interns
+// words and counts document frequencies; per-document word counts are
+// discarded immediately. The second pass re-tokenises the documents and
+// writes each TF/IDF vector to the output as soon as it is computed. The
+// files are processed in windows of tasks of the schedule, such that at
+// most one window's text and vectors are held in memory. Memory use thus
+// depends on the vocabulary rather than on the corpus.
+template<typename directory_listing_type, typename vector_type,
+	 typename word_bank_type>
+void tfidf_streaming( directory_listing_type & dir_list, const char * outfile,
+		      size_t total_size, timespec veryStart ) {
+    typedef asap::hash_table<const char*, size_t, asap::text::charp_hash,
+			     asap::text::charp_eql> wc_map_type;
+    typedef asap::word_map<wc_map_type, word_bank_type> internal_map_type;
+
+    typedef std::vector<std::pair<asap::term_dictionary::id_type, size_t>>
+	id_catalog_type;
+
+    typedef typename vector_type::value_type value_type;
+    typedef typename vector_type::index_type index_type;
+
+    struct timespec wc_end, sort_end, tfidf_begin, tfidf_end;
+
+    // Pass 1: document frequencies
+    get_time( tfidf_begin );
+    size_t num_files = dir_list.size();
+
+    asap::term_dictionary dict;
+    cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
+
+    asap::df_store store;
+    if( dfstore && store.open( dfstore ) )
+	asap::load_dictionary( dict, store );
+    std::vector<char> counted( num_files, false );
+    std::vector<std::string> inputs;
+    if( dfstore )
+	inputs = counted_inputs( store, dir_list, counted );
+    size_t num_counted = std::count( counted.begin(), counted.end(), true );
+
+    // Approximate document frequencies are counted in fixed memory. Only
+    // the terms with the highest estimates become columns.
+    std::unique_ptr<asap::approximate_counter> approx;
+    if( approx_terms )
+	approx.reset( new asap::approximate_counter( approx_memory,
+						     2 * approx_terms ) );
+
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
+	if( counted[i] )
+	    return;
+	std::string filename = *std::next(dir_list.cbegin(),i);
+	internal_map_type wc;
+	size_t num_words =
+	    asap::word_catalog<internal_map_type>( std::string(filename), wc,
+						   chunk_size );
+	*total_num_words += num_words;
+	if( approx )
+	    approx->count_presence( wc );
+	else
+	    dict.count_presence( wc );
+    } );
+    get_time( wc_end );
+
+    std::vector<asap::term_dictionary::df_type> df;
+    if( approx ) {
+	const asap::approximate_counter::view & v = approx->combine();
+	std::vector<asap::approximate_counter::estimate> top
+	    = approx->heavy_hitters( approx_terms );
+	df.resize( top.size() );
+	for( const auto & e : top )
+	    df[dict.intern( e.word.c_str() )]
+		= std::min( e.upper, uint64_t(num_files) );
+	std::cerr << "Approximate document frequencies exceed true ones by at most "
+		  << v.sketch.error_bound() << " with probability "
+		  << 1.0 - v.sketch.delta() << '\n';
+	std::cerr << "Terms not retained occur in at most "
+		  << v.top.min_count() << " documents\n";
+    } else
+	df = dict.document_frequency();
+    // Terms not in the store are numbered in lexicographic order, as in
+    // tfidf_interned
+    size_t num_stored = store.size();
+    std::vector<asap::term_dictionary::id_type> remap
+	= dict.sort_ids( num_stored );
+    {
+	std::vector<asap::term_dictionary::df_type> sdf( df.size() );
+	cilk_for( size_t j=0; j < df.size(); ++j )
+	    sdf[remap[j]] = df[j];
+	df.swap( sdf );
+    }
+    asap::merge_document_frequency( df, store );
+    size_t num_docs = num_files - num_counted + store.num_docs();
+    dict.freeze( df );
+    if( dfstore ) {
+	store.close();
+	asap::df_store::write( dfstore, num_docs, dict.cbegin(), dict.cend(),
+			       inputs );
+    }
+    // The store retains all terms. Pruned terms are mapped to npos.
+    size_t num_pruned = 0;
+    if( !vocab_filter.empty() ) {
+	std::vector<asap::term_dictionary::id_type> kept
+	    = dict.prune( df, vocab_filter, num_docs );
+	num_pruned = kept.size() - df.size();
+	cilk_for( size_t j=0; j < remap.size(); ++j )
+	    remap[j] = kept[remap[j]];
+    }
+
+    size_t num_dimensions = df.size();
+    std::vector<value_type> idf( num_dimensions );
+    cilk_for( size_t j=0; j < num_dimensions; ++j )
+	idf[j] = log10( value_type(num_docs + 1) / value_type(df[j] + 1) );
+    get_time( sort_end );
+
+    // Pass 2: TF/IDF vectors, written out in order of the directory listing
+    std::ofstream of;
+    std::ostream * os = nullptr;
+    if( outfile && !strcmp( outfile, "-" ) )
+	os = &std::cout;
+    else if( outfile ) {
+	of.open( outfile, std::ios_base::out );
+	if( !of )
+	    fatale( "open", outfile );
+	os = &of;
+    }
+    if( os )
+	asap::arff::arff_write_header( *os, "tfidf", dict.cbegin(), dict.cend() );
+
+    const size_t window = 4 * __cilkrts_get_nworkers();
+    cilk::reducer< cilk::op_add<size_t> > nonzeros(0);
+    for( size_t t=0; t < schedule.size(); t += window ) {
+	size_t tl = std::min( t + window, schedule.size() );
+	size_t first = schedule[t].first;
+	std::vector<std::string> lines( schedule[tl-1].last - first );
+
+	asap::for_each_file( schedule, t, tl, [&]( size_t i, size_t chunk_size ) {
+	    std::string filename = *std::next(dir_list.cbegin(),i);
+	    internal_map_type wc;
+	    asap::word_catalog<internal_map_type>( std::string(filename), wc,
+						   chunk_size );
+
+	    id_catalog_type catalog;
+	    catalog.reserve( wc.size() );
+	    for( auto I=wc.cbegin(), E=wc.cend(); I != E; ++I ) {
+		asap::term_dictionary::id_type id = dict.find( I->first );
+		if( id != asap::term_dictionary::npos )
+		    id = remap[id];
+		// Pruned, or file modified since pass 1
+		if( id == asap::term_dictionary::npos )
+		    continue;
+		catalog.emplace_back( id, I->second );
+	    }
+	    std::sort( catalog.begin(), catalog.end() );
+
+	    size_t n = catalog.size();
+	    std::vector<value_type> v( n );
+	    std::vector<index_type> c( n );
+	    for( size_t f=0; f < n; ++f ) {
+		c[f] = catalog[f].first;
+		v[f] = weighting.tf<value_type>( catalog[f].second ) * idf[c[f]];
+	    }
+	    n = asap::internal::tfidf_weigh( v.data(), c.data(), n, weighting );
+	    *nonzeros += n;
+
+	    if( os ) {
+		vector_type vec( v.data(), c.data(), num_dimensions, n );
+		std::ostringstream line;
+		line << "\n\t" << vec << " % " << filename;
+		lines[i-first] = line.str();
+	    }
+	} );
+
+	if( os )
+	    for( const std::string & line : lines )
+		*os << line;
+    }
+    if( os )
+	*os << std::endl;
+    if( of.is_open() )
+	of.close();
+    get_time(tfidf_end);
+
+    print_time("word count", tfidf_begin, wc_end);
+    print_time("word sort", wc_end, sort_end);
+    print_time("TF/IDF and output", sort_end, tfidf_end);
+    std::cerr << "Total words: " << total_num_words.get_value() << '\n';
+    std::cerr << "TF/IDF vectors: " << num_files << '\n';
+    std::cerr << "TF/IDF documents in corpus: " << num_docs << '\n';
+    std::cerr << "TF/IDF documents counted before: " << num_counted << '\n';
+    std::cerr << "TF/IDF dimensions: " << num_dimensions << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
+    std::cerr << "TF/IDF nonzeros: " << nonzeros.get_value() << '\n';
+    std::cerr << "TF/IDF indices sorted by word: " << ( num_stored == 0 )
+	      << '\n';
+    print_time("complete time", veryStart, tfidf_end);
+    std::cerr << "Rate: "
+	      << double(total_size)/double(time_diff(tfidf_end,veryStart))
+	/double(1024*2014)
+	      << " MB/s\n";
+}
+
+// TF/IDF with feature hashing: no vocabulary is built. Words are hashed to
+// columns while tokenising and document frequencies are counted per column.
+template<typename directory_listing_type, typename vector_type>
+void tfidf_hashed( directory_listing_type & dir_list, const char * outfile,
+		   size_t total_size, timespec veryStart ) {
+    typedef asap::data_set<vector_type, asap::feature_hasher,
+			   directory_listing_type> data_set_type;
+
+    struct timespec wc_end, df_end, tfidf_begin, tfidf_end;
+
+    // word count
+    get_time( tfidf_begin );
+    size_t num_files = dir_list.size();
+    std::vector<asap::hashed_catalog> catalog;
+    catalog.resize( num_files );
+
+    std::shared_ptr<asap::feature_hasher> hasher
+	= std::make_shared<asap::feature_hasher>( hash_bits,
+						  samplefile != nullptr );
+    cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
+    hasher->set_stop_words( vocab_filter );
+
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
+	// File to read
+	std::string filename = *std::next(dir_list.cbegin(),i);
+	size_t num_words = hasher->catalog( filename, catalog[i], chunk_size );
+	*total_num_words += num_words;
+	hasher->count_presence( catalog[i] );
+    } );
+    get_time( wc_end );
+
+    hasher->freeze();
+    size_t num_pruned = 0;
+    if( !vocab_filter.empty() )
+	num_pruned = hasher->prune( vocab_filter, num_files );
+    get_time( df_end );
+
+    std::shared_ptr<directory_listing_type> dir_list_ptr
+	= std::make_shared<directory_listing_type>();
+    dir_list_ptr->swap( dir_list );
+
+    data_set_type
+	tfidf = asap::tfidf<typename data_set_type::vector_type>(
+	    catalog.cbegin(), catalog.cend(), hasher, dir_list_ptr,
+	    weighting );
+    get_time(tfidf_end);
+
+    print_time("word count", tfidf_begin, wc_end);
+    print_time("word sort", wc_end, df_end);
+    print_time("TF/IDF", df_end, tfidf_end);
+    std::cerr << "Total words: " << total_num_words.get_value() << '\n';
+    std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
+    std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "Pruned words: " << num_pruned << '\n';
+    print_time("library", tfidf_begin, tfidf_end);
+
+    struct timespec begin, end;
+    get_time( begin );
+    if( outfile )
+	asap::arff_write( outfile, tfidf );
+    if( samplefile ) {
+	std::ofstream of( samplefile, std::ios_base::out );
+	if( !of )
+	    fatale( "open", samplefile );
+	hasher->write_samples( of );
+    }
+    get_time (end);
+    print_time("output", begin, end);
+    print_time("complete time", veryStart, begin); // no output
+    std::cerr << "Rate: "
+	      << double(total_size)/double(time_diff(begin,veryStart))
+	/double(1024*2014)
+	      << " MB/s\n";
+}
+
 /*
  * TODO:
  *  + sort files by descending size prior to processing.
@@ -462,10 +972,17 @@ int main(int argc, char **argv) {
     typedef asap::word_list<std::deque<const char*>, asap::word_bank_managed>
 	directory_listing_type;
     directory_listing_type dir_list;
-    size_t total_size = asap::get_directory_listing( indir, dir_list );
+    std::vector<size_t> file_sizes;
+    size_t total_size = asap::get_directory_listing( indir, dir_list,
+						     &file_sizes );
+    schedule.build( file_sizes, __cilkrts_get_nworkers(),
+		    asap::file_schedule::cache_size() );
     get_time (end);
     print_time("directory listing", begin, end);
     std::cerr << "total bytes: " << total_size << '\n';
+    std::cerr << "file tasks: " << schedule.size()
+	      << " chunk size: " << schedule.chunk_size()
+	      << " batch size: " << schedule.batch_size() << '\n';
 
     typedef size_t index_type;
 #if MEM == 0 // default
@@ -495,6 +1012,22 @@ int main(int argc, char **argv) {
     case a_sorted_fast:
 	tfidf_switch_sortable<directory_listing_type, vector_type, word_bank_type>( dir_list, outfile, total_size, veryStart );
 	break;
+    case a_interned:
+	tfidf_interned<directory_listing_type, vector_type, word_bank_type>( dir_list, outfile, total_size, veryStart );
+	break;
+    case a_swiss:
+	tfidf_all_hash<directory_listing_type, vector_type, word_bank_type,
+		       asap::swiss_table>(
+	    dir_list, outfile, total_size, veryStart );
+	break;
+    case a_hashed:
+	tfidf_hashed<directory_listing_type, vector_type>(
+	    dir_list, outfile, total_size, veryStart );
+	break;
+    case a_streaming:
+	tfidf_streaming<directory_listing_type, vector_type, word_bank_type>(
+	    dir_list, outfile, total_size, veryStart );
+	break;
     default:
 	fatal( "unsupported configuration." );
     }
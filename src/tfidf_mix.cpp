@@ -26,7 +26,6 @@
 #include <cilk/cilk.h>
 #include <cilk/reducer.h>
 #include <cilk/cilk_api.h>
-//#include "cilkpub/sort.h"
 
 #include "asap/utils.h"
 #include "asap/arff.h"
@@ -35,6 +34,8 @@
 #include "asap/word_count.h"
 #include "asap/normalize.h"
 #include "asap/io.h"
+#include "asap/file_schedule.h"
+#include "asap/parallel_sort.h"
 #include "asap/hashtable.h"
 #include "asap/hashindex.h"
 #include "asap/traits.h"
@@ -48,6 +49,7 @@ char const * outfile = nullptr;
 bool by_words = false;
 bool do_sort = false;
 int config = 0;
+asap::file_schedule schedule;
 
 static void help(char *progname) {
     std::cout << "Usage: " << progname << " -i <indir> -o <outfile> -c \"[HLM][HLM][HLM][HLM][HLM]\" [-w] [-s]\n";
@@ -124,14 +126,9 @@ static void parse_args(int argc, char **argv) {
 template<typename map_type>
 typename std::enable_if<map_type::can_sort>::type
 kv_sort( map_type & m ) {
-/*
-    cilkpub::cilk_sort( m.begin(), m.end(),
-			asap::pair_cmp<typename map_type::value_type,
-			typename map_type::value_type>() );
-*/
-    std::sort( m.begin(), m.end(),
-	       asap::pair_cmp<typename map_type::value_type,
-	       typename map_type::value_type>() );
+    asap::parallel_sort( m.begin(), m.end(),
+			 asap::pair_cmp<typename map_type::value_type,
+			 typename map_type::value_type>() );
 }
 
 template<typename map_type>
@@ -270,13 +267,13 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
     asap::word_container_reducer<agg1_map_type> allwords;
     cilk::reducer< cilk::op_add<size_t> > total_num_words(0);
 
-    cilk_for( size_t i=0; i < num_files; ++i ) {
+    asap::for_each_file( schedule, [&]( size_t i, size_t chunk_size ) {
 	// File to read
 	std::string filename = *std::next(dir_list.cbegin(),i);
 	// Internally use the type intl_map_type, then merge into the catalog[i]
 	size_t num_words =
 	    asap::word_catalog<intl_map_type>( std::string(filename),
-					       catalog[i] );
+					       catalog[i], chunk_size );
 	*total_num_words += num_words;
 
 	// The list of pairs is sorted if intl_map_type is based on std::map
@@ -299,7 +296,7 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
 
 	// TODO: replace by post-processing parallel multi-way merge?
 	allwords.count_presence( catalog[i] );
-    }
+    } );
     get_time( wc_end );
 
     // Aggregate map has 4 phases:
@@ -319,6 +316,7 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
     bool iterate_ascending = is_sorted
 	|| std::is_same<agg2_map_type,agg3_map_type>::value;
     asap::internal::assign_ids( allwords2.begin(), allwords2.end() );
+    allwords2.freeze();
 
     agg3_map_type allwords3;
     init_agg3<agg3_lookup_only>( allwords3, std::move(allwords2) );
@@ -538,10 +536,17 @@ int main(int argc, char **argv) {
     typedef asap::word_list<std::deque<const char*>, asap::word_bank_managed>
 	directory_listing_type;
     directory_listing_type dir_list;
-    size_t total_size = asap::get_directory_listing( indir, dir_list );
+    std::vector<size_t> file_sizes;
+    size_t total_size = asap::get_directory_listing( indir, dir_list,
+						     &file_sizes );
+    schedule.build( file_sizes, __cilkrts_get_nworkers(),
+		    asap::file_schedule::cache_size() );
     get_time (end);
     print_time("directory listing", begin, end);
     std::cerr << "total bytes: " << total_size << '\n';
+    std::cerr << "file tasks: " << schedule.size()
+	      << " chunk size: " << schedule.chunk_size()
+	      << " batch size: " << schedule.batch_size() << '\n';
 
     typedef size_t index_type;
 #if MEM == 0 // default
@@ -550,6 +555,8 @@ int main(int argc, char **argv) {
     typedef asap::word_bank_malloc word_bank_type;
 #elif MEM == 2
     typedef asap::word_bank_managed word_bank_type;
+#elif MEM == 3
+    typedef asap::word_bank_arena word_bank_type;
 #endif
 
     typedef asap::sparse_vector<index_type, float, false,
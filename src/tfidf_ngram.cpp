@@ -31,8 +31,10 @@
 #include "asap/sparse_vector.h"
 #include "asap/word_count.h"
 #include "asap/ngram_bank.h"
+#include "asap/ngram_hash.h"
 #include "asap/normalize.h"
 #include "asap/io.h"
+#include "asap/file_schedule.h"
 #include "asap/hashtable.h"
 
 #include <stddefines.h>
@@ -50,16 +52,18 @@ char const * outfile = nullptr;
 bool by_words = false;
 bool do_sort = false;
 bool intm_map = false;
+bool rolling_hash = false;
+asap::file_schedule schedule;
 
 static void help(char *progname) {
-    std::cout << "Usage: " << progname << " -i <indir> -o <outfile> [-w] [-s] [-m]\n";
+    std::cout << "Usage: " << progname << " -i <indir> -o <outfile> [-w] [-s] [-m] [-r]\n";
 }
 
 static void parse_args(int argc, char **argv) {
     int c;
     extern char *optarg;
     
-    while ((c = getopt(argc, argv, "i:o:wsm")) != EOF) {
+    while ((c = getopt(argc, argv, "i:o:wsmr")) != EOF) {
         switch (c) {
 	case 'i':
 	    indir = optarg;
@@ -76,6 +80,9 @@ static void parse_args(int argc, char **argv) {
 	case 'm':
 	    intm_map = true;
 	    break;
+	case 'r':
+	    rolling_hash = true;
+	    break;
 	case '?':
 	    help(argv[0]);
 	    exit(1);
@@ -84,6 +91,8 @@ static void parse_args(int argc, char **argv) {
     
     if( !indir )
 	fatal( "Input directory must be supplied." );
+    if( rolling_hash && ( by_words || do_sort || intm_map ) )
+	fatal( "Rolling hash n-grams do not support -w, -s or -m" );
     
     std::cerr << "Input directory = " << indir << '\n';
     if( !outfile )
@@ -95,6 +104,8 @@ static void parse_args(int argc, char **argv) {
     std::cerr << "TF/IDF by words = " << ( by_words ? "true\n" : "false\n" );
     std::cerr << "TF/IDF list sorted = " << ( do_sort ? "true\n" : "false\n" );
     std::cerr << "N-grams, N = " << N << '\n';
+    std::cerr << "N-grams by rolling hash = "
+	      << ( rolling_hash ? "true\n" : "false\n" );
 }
 
 template<typename map_type, bool can_sort = true>
@@ -123,7 +134,10 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
     asap::ngram_container_reducer<agg_map_type> allwords;
     allwords.get_value().set_growth( 1, 2 );
 
-    cilk_for( size_t i=0; i < num_files; ++i ) {
+    // N-grams do not span chunks, so the default chunk size is retained
+    // rather than the one of the schedule, which depends on the number of
+    // workers
+    asap::for_each_file( schedule, [&]( size_t i, size_t ) {
 	// File to read
 	std::string filename = *std::next(dir_list.cbegin(),i);
 	catalog[i].set_growth( 1, 2 );
@@ -136,7 +150,7 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
 
 	// std::cerr << filename << ": " << ngrams << " ngrams\n";
 	allwords.count_presence( catalog[i] );
-    }
+    } );
     get_time( wc_end );
 
     std::shared_ptr<agg_map_type> allwords_ptr
@@ -170,6 +184,61 @@ data_set_type tfidf_driver( directory_listing_type & dir_list ) {
     return tfidf;
 }
 
+// N-grams are keyed by a rolling hash over word hashes; the words of an
+// n-gram are looked at only to check collisions and for output.
+template<typename directory_listing_type, typename vector_type,
+	 typename word_bank_type>
+asap::data_set<vector_type, asap::hashed_ngram_dictionary<N>,
+	       directory_listing_type>
+tfidf_rolling_driver( directory_listing_type & dir_list ) {
+    typedef asap::hashed_ngram_map<N, word_bank_type> intl_map_type;
+    typedef asap::hashed_ngram_dictionary<N> agg_map_type;
+
+    struct timespec wc_end, tfidf_begin, tfidf_end;
+
+    // word count
+    get_time( tfidf_begin );
+    size_t num_files = dir_list.size();
+    std::vector<intl_map_type> catalog;
+    catalog.resize( num_files );
+
+    asap::hashed_ngram_dictionary_reducer<N> allwords;
+    allwords.get_value().set_growth( 1, 2 );
+
+    // The default chunk size is retained, as in tfidf_driver
+    asap::for_each_file( schedule, [&]( size_t i, size_t ) {
+	// File to read
+	std::string filename = *std::next(dir_list.cbegin(),i);
+	catalog[i].set_growth( 1, 2 );
+	asap::hashed_ngram_catalog( filename, catalog[i] );
+	allwords.count_presence( catalog[i] );
+    } );
+    get_time( wc_end );
+
+    std::shared_ptr<agg_map_type> allwords_ptr
+	= std::make_shared<agg_map_type>();
+    allwords_ptr->swap( allwords.get_value() );
+    allwords_ptr->freeze();
+
+    std::shared_ptr<directory_listing_type> dir_list_ptr
+	= std::make_shared<directory_listing_type>();
+    dir_list_ptr->swap( dir_list );
+
+    auto tfidf = asap::tfidf<vector_type>(
+	catalog.cbegin(), catalog.cend(), allwords_ptr, dir_list_ptr );
+    get_time(tfidf_end);
+
+    print_time("ngram count", tfidf_begin, wc_end);
+    print_time("TF/IDF", wc_end, tfidf_end);
+    std::cerr << "TF/IDF vectors: " << tfidf.get_num_points() << '\n';
+    std::cerr << "TF/IDF dimensions: " << tfidf.get_dimensions() << '\n';
+    std::cerr << "N-gram hash collisions: " << allwords_ptr->collisions()
+	      << '\n';
+    print_time("library", tfidf_begin, tfidf_end);
+
+    return tfidf;
+}
+
 #if 0
 // a single null-terminated word
 struct wc_word {
@@ -228,9 +297,14 @@ int main(int argc, char **argv) {
     typedef asap::word_list<std::deque<const char*>, asap::word_bank_managed>
 	directory_listing_type;
     directory_listing_type dir_list;
-    asap::get_directory_listing( indir, dir_list );
+    std::vector<size_t> file_sizes;
+    asap::get_directory_listing( indir, dir_list, &file_sizes );
+    schedule.build( file_sizes, __cilkrts_get_nworkers(),
+		    asap::file_schedule::cache_size() );
     get_time (end);
     print_time("directory listing", begin, end);
+    std::cerr << "file tasks: " << schedule.size()
+	      << " batch size: " << schedule.batch_size() << '\n';
 
     typedef size_t index_type;
     typedef asap::word_bank_pre_alloc word_bank_type;
@@ -272,6 +346,19 @@ int main(int argc, char **argv) {
     typedef asap::data_set<vector_type, aggregate_map_type,
 			   directory_listing_type> data_set_type;
 
+    if( rolling_hash ) {
+	auto tfidf = tfidf_rolling_driver<directory_listing_type, vector_type,
+					  word_bank_type>( dir_list );
+	get_time( begin );
+	if( outfile )
+	    asap::arff_write( outfile, tfidf );
+	get_time (end);
+	print_time("output", begin, end);
+	print_time("complete time", veryStart, end);
+	return 0;
+    }
+
+
     data_set_type tfidf(
 	intm_map
 	? tfidf_driver<directory_listing_type, internal_map_type,
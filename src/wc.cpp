@@ -33,6 +33,9 @@
 #include "asap/word_count.h"
 #include "asap/normalize.h"
 #include "asap/io.h"
+#include "asap/parallel_sort.h"
+#include "asap/sketch.h"
+#include "asap/external_count.h"
 
 #include <stddefines.h>
 #include <container.h>
@@ -43,16 +46,20 @@ char const * infile = nullptr;
 char const * outfile = nullptr;
 bool do_sort = false;
 size_t disp_num = 10;
+size_t approx_memory = 0;	// approximate counting if non-zero
+size_t approx_words = 0;
+size_t spill_memory = 0;	// spill to scratch_dir if non-zero
+char const * scratch_dir = nullptr;
 
 static void help(char *progname) {
-    std::cout << "Usage: " << progname << " -i <infile> -o <outfile> [-s] [-d <displaynum>]\n";
+    std::cout << "Usage: " << progname << " -i <infile> -o <outfile> [-s] [-d <displaynum>] [-a <MB> [-k <words>]] [-m <MB> [-T <dir>]]\n";
 }
 
 static void parse_args(int argc, char **argv) {
     int c;
     extern char *optarg;
     
-    while ((c = getopt(argc, argv, "i:o:sd:")) != EOF) {
+    while ((c = getopt(argc, argv, "i:o:sd:a:k:m:T:")) != EOF) {
         switch (c) {
 	case 'i':
 	    infile = optarg;
@@ -68,6 +75,18 @@ static void parse_args(int argc, char **argv) {
 	case 's':
 	    do_sort = true;
 	    break;
+	case 'a':
+	    approx_memory = size_t(atol(optarg)) << 20;
+	    break;
+	case 'k':
+	    approx_words = atol(optarg);
+	    break;
+	case 'm':
+	    spill_memory = size_t(atol(optarg)) << 20;
+	    break;
+	case 'T':
+	    scratch_dir = optarg;
+	    break;
 	case '?':
 	    help(argv[0]);
 	    exit(1);
@@ -76,11 +95,75 @@ static void parse_args(int argc, char **argv) {
     
     if( !infile )
 	fatal( "Input file must be supplied." );
+    if( approx_words && !approx_memory )
+	fatal( "Monitored words (-k) apply to approximate counting (-a) only" );
+    if( approx_memory && !approx_words )
+	approx_words = std::max( 16 * disp_num, size_t(1024) );
+    if( scratch_dir && !spill_memory )
+	fatal( "Scratch directory (-T) applies to spilling (-m) only" );
+    if( spill_memory && approx_memory )
+	fatal( "Spilling (-m) and approximate counting (-a) are exclusive" );
+    if( spill_memory && !scratch_dir ) {
+	scratch_dir = getenv( "TMPDIR" );
+	if( !scratch_dir )
+	    scratch_dir = "/tmp";
+    }
     
     std::cerr << "Input file = " << infile << '\n';
     std::cerr << "Output file = " << ( outfile ? outfile : "standard output" ) << '\n';
     std::cerr << "Word count list sorted = " << ( do_sort ? "true\n" : "false\n" );
     std::cerr << "Word count display number = " << disp_num << "\n";
+    if( approx_memory ) {
+	std::cerr << "Approximate count sketch MB = " << ( approx_memory >> 20 )
+		  << "\n";
+	std::cerr << "Approximate count monitored words = " << approx_words
+		  << "\n";
+    }
+    if( spill_memory ) {
+	std::cerr << "Spill memory MB = " << ( spill_memory >> 20 ) << "\n";
+	std::cerr << "Scratch directory = " << scratch_dir << "\n";
+    }
+}
+
+// Approximate word count in fixed memory: the most frequent words with
+// bounds on their count
+static void approximate_word_count( struct timespec veryStart ) {
+    struct timespec begin, end;
+
+    get_time( begin );
+    asap::approximate_counter counter( approx_memory, approx_words );
+    size_t nwords = asap::approximate_catalog( std::string(infile), counter );
+    const asap::approximate_counter::view & v = counter.combine();
+    get_time( end );
+    print_time("word count", begin, end);
+
+    get_time( begin );
+    FILE *fp = stdout;
+    if( outfile ) {
+	if( !(fp = fopen( outfile, "w" )) )
+	    fatale( "fopen", outfile );
+    }
+
+    std::vector<asap::approximate_counter::estimate> top
+	= counter.heavy_hitters( disp_num );
+    fprintf( fp, "\nWordcount: Approximate results (TOP %lu):\n", top.size() );
+    for( const auto & e : top )
+	fprintf( fp, "%15s - %lu (at least %lu)\n", e.word.c_str(), e.upper,
+		 e.lower );
+    fprintf( fp, "Total: %lu\n", nwords );
+    fprintf( fp, "Error: counts exceed true counts by at most %lu"
+	     " with probability %.6f\n",
+	     v.sketch.error_bound(), 1.0 - v.sketch.delta() );
+    if( outfile )
+	fclose( fp );
+    get_time (end);
+    print_time("output", begin, end);
+
+    std::cerr << "Sketch: " << v.sketch.depth() << " x " << v.sketch.width()
+	      << " counters per worker\n";
+    std::cerr << "Unmonitored words occur at most " << v.top.min_count()
+	      << " times\n";
+    print_time("complete time", veryStart, end);
 }
 
 struct hash_word {
@@ -171,27 +254,46 @@ int main(int argc, char **argv) {
     get_time (end);
     print_time("init", begin, end);
 
+    if( approx_memory ) {
+	approximate_word_count( veryStart );
+	return 0;
+    }
+
     // word count
     get_time( begin );
     // typedef asap::word_map<std::unordered_map<hash_word, size_t, hash_word_hash, hash_word_eql>, asap::word_bank_pre_alloc> word_map_type;
     // typedef asap::kv_list<std::vector<std::pair<hash_word, size_t>>, asap::word_bank_pre_alloc> word_list_type;
     // typedef asap::word_map<std::unordered_map<const char *, size_t, asap::text::charp_hash, asap::text::charp_eql>, asap::word_bank_pre_alloc> word_map_type;
     // typedef asap::kv_list<std::vector<std::pair<const char *, size_t>>, asap::word_bank_pre_alloc> word_list_type;
-    typedef hash_table<wc_word, size_t, wc_word_hash> wc_unordered_map;
+    // typedef hash_table<wc_word, size_t, wc_word_hash> wc_unordered_map;
+    // typedef asap::word_map<wc_unordered_map, asap::word_bank_pre_alloc> word_map_type;
+    // typedef asap::kv_list<std::vector<std::pair<wc_word, size_t>>, asap::word_bank_pre_alloc> word_list_type;
+    // Short words are compared inline, without touching the input buffer
+    typedef asap::hash_table<asap::text::short_word, size_t,
+			     asap::text::short_word_hash,
+			     asap::text::short_word_eql> wc_unordered_map;
     typedef asap::word_map<wc_unordered_map, asap::word_bank_pre_alloc> word_map_type;
-    typedef asap::kv_list<std::vector<std::pair<wc_word, size_t>>, asap::word_bank_pre_alloc> word_list_type;
+    typedef asap::kv_list<std::vector<std::pair<asap::text::short_word, size_t>>, asap::word_bank_pre_alloc> word_list_type;
 
     word_list_type catalog;
-    asap::word_catalog<word_map_type>( std::string(infile), catalog );
+    if( spill_memory ) {
+	// Exact counts in bounded memory; tables beyond the budget are
+	// written to scratch space and merged at the end
+	asap::external_counter counter( spill_memory, scratch_dir );
+	asap::external_catalog( std::string(infile), counter );
+	counter.finish( catalog );
+	std::cerr << "Spilled " << counter.num_runs() << " runs, "
+		  << ( counter.spilled_bytes() >> 20 ) << " MB\n";
+    } else
+	asap::word_catalog<word_map_type>( std::string(infile), catalog );
     get_time( end );
     print_time("word count", begin, end);
 
     get_time( begin );
-    // The list of pairs is sorted if word_map_type is based on std::map
-    // but it is not sorted if based on std::unordered_map
+    // Only the displayed words need to be in order
     if( do_sort )
-	std::sort( catalog.begin(), catalog.end(),
-		   cmp_2nd_rev<typename word_list_type::value_type>() );
+	asap::parallel_top_k( catalog.begin(), catalog.end(), disp_num,
+			      cmp_2nd_rev<typename word_list_type::value_type>() );
     get_time( end );
     print_time("sort", begin, end);
 
@@ -208,7 +310,7 @@ int main(int argc, char **argv) {
     auto I = catalog.cbegin();
     auto E = catalog.cend();
     for( size_t i=0; I != E && i < dn; ++i, ++I ) {
-        fprintf( fp, "%15s - %lu\n", (char *)I->first, I->second );
+        fprintf( fp, "%15s - %lu\n", (const char *)I->first, I->second );
 	total += I->second;
     }
     for( ; I != E; ++I )
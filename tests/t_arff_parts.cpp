@@ -0,0 +1,234 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <cstdlib>
+#include <cmath>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+
+#include "asap/utils.h"
+#include "asap/arff.h"
+#include "asap/dense_vector.h"
+#include "asap/sparse_vector.h"
+
+// Values are written with the default stream precision
+template<typename ValueTy>
+bool close( ValueTy a, ValueTy b ) {
+    return std::abs( a - b ) <= 1e-5 * std::max( std::abs( a ), std::abs( b ) );
+}
+
+template<typename VectorTy, typename VectorTy2>
+typename std::enable_if<asap::is_dense_vector<VectorTy>::value, bool>::type
+same( const VectorTy & a, const VectorTy2 & b ) {
+    if( a.length() != b.length() )
+	return false;
+    for( size_t i=0, e=a.length(); i != e; ++i )
+	if( !close( a[i], b[i] ) )
+	    return false;
+    return true;
+}
+
+template<typename VectorTy, typename VectorTy2>
+typename std::enable_if<asap::is_sparse_vector<VectorTy>::value, bool>::type
+same( const VectorTy & a, const VectorTy2 & b ) {
+    if( a.nonzeros() != b.nonzeros() )
+	return false;
+    for( size_t i=0, e=a.nonzeros(); i != e; ++i ) {
+	typename VectorTy::value_type va, vb;
+	typename VectorTy::index_type ca, cb;
+	a.get( i, va, ca );
+	b.get( i, vb, cb );
+	if( !close( va, vb ) || ca != cb )
+	    return false;
+    }
+    return true;
+}
+
+template<typename DataSetTy, typename DataSetTy2>
+void compare( const DataSetTy & data, const DataSetTy2 & parts ) {
+    if( strcmp( parts.get_relation(), data.get_relation() ) )
+	fatal( "relation mismatch: ", parts.get_relation() );
+    if( parts.get_index().size() != data.get_index().size() )
+	fatal( "dimensions mismatch: ", parts.get_index().size() );
+    if( parts.get_num_points() != data.get_num_points() )
+	fatal( "number of vectors mismatch: ", parts.get_num_points() );
+
+    size_t n = 0;
+    auto J = parts.vector_cbegin();
+    for( auto I = data.vector_cbegin(); I != data.vector_cend(); ++I, ++J ) {
+	if( !same( *I, *J ) )
+	    fatal( "vector ", n, " differs" );
+	++n;
+    }
+}
+
+void write_file( const std::string & filename, const char * p, size_t len ) {
+    std::ofstream of( filename, std::ios_base::out );
+    of.write( p, len );
+    of.close();
+}
+
+// Split the file by hand into a directory of parts, the first of which
+// holds the header, and compare the data sets read from the file and from
+// the directory.
+template<typename vector_type>
+void test_read( const char * filename, const char * dirname, size_t nparts ) {
+    typedef asap::word_list<std::vector<const char *>,
+			    asap::word_bank_pre_alloc> word_list;
+    typedef asap::data_set<vector_type,word_list> data_set_type;
+
+    bool is_stored_sparse, is_parts_sparse;
+    data_set_type data
+	= asap::arff_read<data_set_type>( std::string(filename), is_stored_sparse );
+
+    // Dense records do not map onto sparse vectors one-to-one
+    if( asap::is_sparse_vector<vector_type>::value && !is_stored_sparse ) {
+	std::cout << "skipped: file is not stored sparsely" << std::endl;
+	return;
+    }
+
+    std::ifstream in( filename );
+    std::string text( (std::istreambuf_iterator<char>( in )),
+		      std::istreambuf_iterator<char>() );
+    const char * d = strcasestr( text.c_str(), "\n@data" );
+    if( !d )
+	fatal( "no data section in ", filename );
+    size_t start = text.find( '\n', d + 1 - text.c_str() );
+    if( start == std::string::npos )
+	start = text.size();
+
+    std::string dir = std::string( dirname ) + "/read";
+    if( mkdir( dir.c_str(), 0777 ) < 0 && errno != EEXIST )
+	fatale( "mkdir", dir );
+    size_t len = text.size() - start;
+    size_t from = 0;
+    for( size_t i=0; i < nparts; ++i ) {
+	size_t to = i == nparts-1 ? text.size()
+	    : text.find( '\n', start + ( i + 1 ) * len / nparts );
+	to = to == std::string::npos ? text.size() : to + 1;
+	char name[32];
+	sprintf( name, "/part-%05lu", (unsigned long)i );
+	write_file( dir + name, &text[from], to - from );
+	from = to;
+    }
+    write_file( dir + "/.part-00000.crc", "crc", 3 );
+    write_file( dir + "/_SUCCESS", "", 0 );
+
+    data_set_type parts
+	= asap::arff_read<data_set_type>( dir, is_parts_sparse );
+    compare( data, parts );
+    if( is_parts_sparse != is_stored_sparse )
+	fatal( "sparseness mismatch" );
+
+    std::cout << "read parts=" << nparts << ": " << data.get_num_points()
+	      << " vectors OK" << std::endl;
+}
+
+// Write the file as a directory of parts and compare the data set read
+// back from the directory against the original. The writer emits vectors
+// in sparse format.
+void test_write( const char * filename, const char * dirname, size_t nparts ) {
+    typedef asap::sparse_vector<size_t, float, false,
+				asap::mm_no_ownership_policy> vector_type;
+    typedef asap::word_list<std::vector<const char *>,
+			    asap::word_bank_pre_alloc> word_list;
+    typedef asap::word_list<std::vector<const char *>,
+			    asap::word_bank_managed> name_list;
+    typedef asap::data_set<vector_type,word_list> data_set_type;
+    typedef asap::data_set<vector_type,word_list,name_list> named_set_type;
+    typedef named_set_type::vector_list_type vector_set_type;
+
+    bool is_stored_sparse, is_parts_sparse;
+    data_set_type data
+	= asap::arff_read<data_set_type>( std::string(filename), is_stored_sparse );
+
+    if( !is_stored_sparse ) {
+	std::cout << "skipped: file is not stored sparsely" << std::endl;
+	return;
+    }
+
+    // The writer requires row names
+    size_t npoints = data.get_num_points();
+    size_t ndim = data.get_index().size();
+    size_t nnz = 0;
+    for( auto I = data.vector_cbegin(); I != data.vector_cend(); ++I )
+	nnz += I->nonzeros();
+
+    std::shared_ptr<name_list> rows = std::make_shared<name_list>();
+    std::shared_ptr<vector_set_type> vecs
+	= std::make_shared<vector_set_type>( npoints, ndim, nnz );
+    size_t n = 0;
+    for( auto I = data.vector_cbegin(); I != data.vector_cend(); ++I, ++n ) {
+	char name[32];
+	rows->index( name, sprintf( name, "row%lu", (unsigned long)n ) );
+	vecs->emplace_back( ndim, I->nonzeros() );
+	vector_type & v = *std::prev( vecs->end() );
+	for( size_t k=0; k < I->nonzeros(); ++k ) {
+	    vector_type::value_type val;
+	    vector_type::index_type c;
+	    I->get( k, val, c );
+	    v.set( k, val, c );
+	}
+    }
+    named_set_type named( data.get_relation(), data.get_index_ptr(), rows,
+			  vecs );
+
+    std::string dir = std::string( dirname ) + "/write";
+    asap::arff_write_parts( dir, named, nparts );
+
+    data_set_type parts
+	= asap::arff_read<data_set_type>( dir, is_parts_sparse );
+    compare( data, parts );
+
+    std::cout << "write parts=" << nparts << ": " << npoints
+	      << " vectors OK" << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+    if( argc < 3 )
+	fatal( "usage: t_arff_parts input-filename output-dirname" );
+
+    const char * filename = argv[1];
+    const char * dirname = argv[2];
+    if( mkdir( dirname, 0777 ) < 0 && errno != EEXIST )
+	fatale( "mkdir", dirname );
+    if( mkdir( dirname, 0777 ) < 0 && errno != EEXIST )
+	fatale( "mkdir", dirname );
+
+    std::cout << "==== ARFF parts: dense vectors\n";
+    test_read<asap::dense_vector<size_t, float, false,
+				 asap::mm_ownership_policy>>(
+				     filename, dirname, 3 );
+    test_read<asap::dense_vector<size_t, float, false,
+				 asap::mm_no_ownership_policy>>(
+				     filename, dirname, 3 );
+
+    std::cout << "==== ARFF parts: sparse vectors\n";
+    test_read<asap::sparse_vector<size_t, float, false,
+				  asap::mm_ownership_policy>>(
+				      filename, dirname, 3 );
+    test_read<asap::sparse_vector<size_t, float, false,
+				  asap::mm_no_ownership_policy>>(
+				      filename, dirname, 3 );
+    test_write( filename, dirname, 4 );
+    // Rewriting with fewer parts must not leave stale parts behind
+    test_write( filename, dirname, 2 );
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <cstdlib>
+
+#include "asap/utils.h"
+#include "asap/arff.h"
+#include "asap/arff_stream.h"
+#include "asap/dense_vector.h"
+#include "asap/sparse_vector.h"
+
+template<typename VectorTy>
+typename std::enable_if<asap::is_dense_vector<VectorTy>::value, bool>::type
+same( const VectorTy & a, const VectorTy & b ) {
+    if( a.length() != b.length() )
+	return false;
+    for( size_t i=0, e=a.length(); i != e; ++i )
+	if( a[i] != b[i] )
+	    return false;
+    return true;
+}
+
+template<typename VectorTy>
+typename std::enable_if<asap::is_sparse_vector<VectorTy>::value, bool>::type
+same( const VectorTy & a, const VectorTy & b ) {
+    if( a.nonzeros() != b.nonzeros() )
+	return false;
+    for( size_t i=0, e=a.nonzeros(); i != e; ++i ) {
+	typename VectorTy::value_type va, vb;
+	typename VectorTy::index_type ca, cb;
+	a.get( i, va, ca );
+	b.get( i, vb, cb );
+	if( va != vb || ca != cb )
+	    return false;
+    }
+    return true;
+}
+
+// Compare streamed batches against a complete read of the same file.
+// Small batches and windows force records to straddle window boundaries.
+template<typename vector_type>
+void test( const char * filename, size_t batch, size_t window ) {
+    typedef asap::word_list<std::vector<const char *>,
+			    asap::word_bank_pre_alloc> word_list;
+    typedef asap::data_set<vector_type,word_list> data_set_type;
+
+    bool is_stored_sparse;
+    data_set_type data
+	= asap::arff_read<data_set_type>( std::string(filename), is_stored_sparse );
+
+    // Dense records do not map onto sparse vectors one-to-one
+    if( asap::is_sparse_vector<vector_type>::value && !is_stored_sparse ) {
+	std::cout << "skipped: file is not stored sparsely" << std::endl;
+	return;
+    }
+
+    asap::arff_cursor<vector_type> cursor( filename, batch, window );
+    typename asap::arff_cursor<vector_type>::batch_type vecs;
+
+    if( strcmp( cursor.get_relation(), data.get_relation() ) )
+	fatal( "relation mismatch: ", cursor.get_relation() );
+    if( cursor.get_dimensions() != data.get_dimensions() )
+	fatal( "dimensions mismatch: ", cursor.get_dimensions() );
+
+    size_t n = 0;
+    auto I = data.vector_cbegin();
+    while( cursor.next( vecs ) ) {
+	for( const vector_type & v : vecs ) {
+	    if( I == data.vector_cend() )
+		fatal( "too many vectors" );
+	    if( !same( v, *I ) )
+		fatal( "vector ", n, " differs" );
+	    ++I;
+	    ++n;
+	}
+    }
+    if( I != data.vector_cend() )
+	fatal( "too few vectors: ", n );
+    if( cursor.is_stored_sparse() != is_stored_sparse )
+	fatal( "sparseness mismatch" );
+
+    std::cout << "batch=" << batch << " window=" << window
+	      << ": " << n << " vectors OK" << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+    if( argc < 2 )
+	fatal( "usage: t_arff_stream input-filename" );
+
+    const char * filename = argv[1];
+
+    std::cout << "==== Streaming ARFF file: dense vectors\n";
+    test<asap::dense_vector<size_t, float, false, asap::mm_ownership_policy>>(
+	filename, 4096, size_t(1)<<22 );
+    test<asap::dense_vector<size_t, float, false, asap::mm_ownership_policy>>(
+	filename, 3, 64 );
+
+    std::cout << "==== Streaming ARFF file: sparse vectors\n";
+    test<asap::sparse_vector<size_t, float, false, asap::mm_ownership_policy>>(
+	filename, 4096, size_t(1)<<22 );
+    test<asap::sparse_vector<size_t, float, false, asap::mm_ownership_policy>>(
+	filename, 1, 16 );
+
+    return 0;
+}
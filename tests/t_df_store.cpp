@@ -0,0 +1,114 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+
+#include "asap/utils.h"
+#include "asap/data_set.h"
+#include "asap/df_store.h"
+
+void check( const asap::df_store & store, size_t num_docs,
+	    const std::vector<std::string> & terms,
+	    const std::vector<asap::df_store::df_type> & df ) {
+    if( store.num_docs() != num_docs || store.size() != terms.size() )
+	fatal( "store has ", store.size(), " terms in ", store.num_docs(),
+	       " documents, expected ", terms.size(), " in ", num_docs );
+    for( size_t i=0; i < terms.size(); ++i ) {
+	if( strcmp( store.term( i ), terms[i].c_str() ) )
+	    fatal( "term ", i, " is ", store.term( i ), " expected ", terms[i] );
+	if( store.df( i ) != df[i] )
+	    fatal( "df of ", terms[i], " is ", store.df( i ) );
+	if( store.find( terms[i].c_str() ) != i )
+	    fatal( "term not found: ", terms[i] );
+    }
+    if( store.find( "ABSENT" ) != asap::df_store::npos )
+	fatal( "absent term found" );
+}
+
+int main( int argc, char *argv[] ) {
+    std::string filename = "t_df_store.tmp";
+    unlink( filename.c_str() );
+
+    asap::df_store store;
+    if( store.open( filename ) )
+	fatal( "opened a store that does not exist" );
+
+    // First batch
+    std::vector<std::string> terms;
+    std::vector<asap::df_store::df_type> df;
+    {
+	asap::term_dictionary dict;
+	for( size_t i=0; i < 1000; ++i ) {
+	    terms.push_back( "TERM" + std::to_string( i ) );
+	    dict.intern( terms.back().c_str() );
+	    df.push_back( i % 7 + 1 );
+	}
+	dict.freeze( df );
+	asap::df_store::write( filename, 10, dict.cbegin(), dict.cend() );
+    }
+    if( !store.open( filename ) )
+	fatal( "cannot open store" );
+    check( store, 10, terms, df );
+    if( store.num_inputs() != 0 )
+	fatal( "store records inputs" );
+
+    // Second batch: previous terms retain their id
+    {
+	asap::term_dictionary dict;
+	asap::load_dictionary( dict, store );
+	std::vector<asap::df_store::df_type> df2( 1500, 1 );
+	for( size_t i=1000; i < 1500; ++i ) {
+	    terms.push_back( "NEW" + std::to_string( i ) );
+	    if( dict.intern( terms.back().c_str() ) != i )
+		fatal( "unexpected id for new term" );
+	}
+	asap::merge_document_frequency( df2, store );
+	for( size_t i=0; i < 1000; ++i )
+	    df[i] += 1;
+	df.resize( 1500, 1 );
+	dict.freeze( df2 );
+	store.close();
+	std::vector<std::string> inputs;
+	inputs.push_back( asap::df_store::input_name( filename ) );
+	inputs.push_back( "/no/such/input" );
+	asap::df_store::write( filename, 15, dict.cbegin(), dict.cend(),
+			       inputs );
+    }
+    if( !store.open( filename ) )
+	fatal( "cannot open store" );
+    check( store, 15, terms, df );
+
+    // Inputs are recorded by canonical name
+    if( store.num_inputs() != 2
+	|| store.inputs()[1] != "/no/such/input" )
+	fatal( "inputs not recorded" );
+    if( !store.counted( asap::df_store::input_name( "./" + filename ) )
+	|| store.counted( "/no/such" ) )
+	fatal( "input lookup failed" );
+
+    store.close();
+    unlink( filename.c_str() );
+    std::cout << "df_store: " << terms.size() << " terms ok\n";
+    return 0;
+}
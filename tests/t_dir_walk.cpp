@@ -0,0 +1,147 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+
+#include "asap/utils.h"
+#include "asap/data_set.h"
+#include "asap/io.h"
+
+void make_file( const std::string & name, size_t size ) {
+    std::ofstream os( name.c_str() );
+    os << std::string( size, 'x' );
+    if( !os )
+	fatal( "cannot write ", name );
+}
+
+void make_dir( const std::string & name ) {
+    if( mkdir( name.c_str(), 0755 ) < 0 )
+	fatale( "mkdir", name );
+}
+
+void make_link( const std::string & target, const std::string & name ) {
+    if( symlink( target.c_str(), name.c_str() ) < 0 )
+	fatale( "symlink", name );
+}
+
+// The listing of a sequential depth-first walk with readdir and lstat
+size_t reference( const std::string & dirname,
+		  std::vector<std::string> & files,
+		  std::vector<size_t> & sizes ) {
+    DIR * dp = opendir( dirname.c_str() );
+    if( !dp )
+	fatale( "opendir", dirname );
+    size_t total = 0;
+    while( struct dirent * d = readdir( dp ) ) {
+	std::string n = d->d_name;
+	if( n == "." || n == ".." )
+	    continue;
+	std::string path = dirname + "/" + n;
+	struct stat buf;
+	if( lstat( path.c_str(), &buf ) < 0 )
+	    fatale( "lstat", path );
+	bool link = S_ISLNK( buf.st_mode );
+	if( link ) {
+	    char target[1024];
+	    ssize_t nb = readlink( path.c_str(), target, sizeof(target) );
+	    if( nb < 0 )
+		fatale( "readlink", path );
+	    std::string t( target, nb );
+	    path = t[0] == '/' ? t : dirname + "/" + t;
+	    if( lstat( path.c_str(), &buf ) < 0 )
+		fatale( "lstat", path );
+	}
+	if( S_ISREG( buf.st_mode ) ) {
+	    files.push_back( path );
+	    sizes.push_back( buf.st_size );
+	    total += buf.st_size;
+	} else if( S_ISDIR( buf.st_mode ) && !link )
+	    total += reference( path, files, sizes );
+    }
+    closedir( dp );
+    return total;
+}
+
+int main( int argc, char *argv[] ) {
+    char tmpl[] = "/tmp/t_dir_walk.XXXXXX";
+    if( !mkdtemp( tmpl ) )
+	fatale( "mkdtemp", tmpl );
+    std::string root = tmpl;
+
+    // Nested directories, one large enough to take several getdents
+    // batches, and entries that are not listed
+    make_file( root + "/a", 10 );
+    make_dir( root + "/sub1" );
+    make_file( root + "/sub1/b", 20 );
+    make_dir( root + "/sub1/deep" );
+    make_file( root + "/sub1/deep/c", 30 );
+    make_dir( root + "/sub1/empty" );
+    make_dir( root + "/sub2" );
+    for( size_t i=0; i < 2000; ++i )
+	make_file( root + "/sub2/file-with-a-rather-long-name-"
+		   + std::to_string( i ), i % 7 );
+    if( mkfifo( ( root + "/fifo" ).c_str(), 0644 ) < 0 )
+	fatale( "mkfifo", root + "/fifo" );
+    make_link( "sub1/b", root + "/rel" );
+    make_link( root + "/a", root + "/sub1/abs" );
+    make_link( "sub2", root + "/dirlink" );
+
+    std::vector<std::string> ref_files;
+    std::vector<size_t> ref_sizes;
+    size_t ref_total = reference( root, ref_files, ref_sizes );
+
+    typedef asap::word_list<std::deque<const char*>, asap::word_bank_managed>
+	directory_listing_type;
+    directory_listing_type dir_list;
+    std::vector<size_t> sizes;
+    size_t total = asap::get_directory_listing( root, dir_list, &sizes );
+
+    // The FIFO and the link to a directory are skipped; the links to
+    // regular files are listed by their targets
+    if( ref_files.size() != 2005 )
+	fatal( "reference lists ", ref_files.size(), " files" );
+    if( dir_list.size() != ref_files.size() || sizes.size() != ref_sizes.size() )
+	fatal( "listed ", dir_list.size(), " files, expected ",
+	       ref_files.size() );
+    size_t i = 0;
+    for( auto I=dir_list.cbegin(), E=dir_list.cend(); I != E; ++I, ++i ) {
+	if( ref_files[i] != *I )
+	    fatal( "file ", i, " is ", *I, " expected ", ref_files[i] );
+	if( sizes[i] != ref_sizes[i] )
+	    fatal( "size of ", *I, " is ", sizes[i], " expected ",
+		   ref_sizes[i] );
+    }
+    if( total != ref_total )
+	fatal( "total size ", total, " expected ", ref_total );
+
+    std::string cmd = "rm -rf " + root;
+    if( system( cmd.c_str() ) != 0 )
+	fatal( "cannot remove ", root );
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+#include <cilk/reducer_opadd.h>
+#include <cilk/cilk_api.h>
+
+#include "asap/utils.h"
+#include "asap/data_set.h"
+#include "asap/external_count.h"
+
+// Word i, spelled in upper-case letters as the tokenizer keeps only those.
+// Every third word is too long to be held inline by short_word.
+std::string word( size_t i ) {
+    std::string w( i % 3 == 0 ? "LONGWORDPREFIXW" : "W" );
+    do {
+	w += char( 'A' + i % 26 );
+	i /= 26;
+    } while( i != 0 );
+    return w;
+}
+
+template<typename ListTy>
+void check( ListTy & list, const std::map<std::string, size_t> & exact,
+	    bool sorted ) {
+    if( list.size() != exact.size() )
+	fatal( "counted ", list.size(), " distinct words, expected ",
+	       exact.size() );
+    std::map<std::string, size_t> got;
+    const char * prev = nullptr;
+    for( auto I=list.cbegin(), E=list.cend(); I != E; ++I ) {
+	const char * w = I->first;
+	if( sorted && prev && strcmp( prev, w ) >= 0 )
+	    fatal( "words out of order: ", prev, " ", w );
+	prev = w;
+	got[w] = I->second;
+    }
+    if( got != exact )
+	fatal( "counts differ" );
+}
+
+int main( int argc, char *argv[] ) {
+    std::mt19937 gen( 1 );
+    std::uniform_int_distribution<size_t> dist( 0, 199999 );
+    std::string text;
+    std::map<std::string, size_t> exact;
+    for( size_t i=0; i < 1000000; ++i ) {
+	std::string w = word( dist( gen ) );
+	text += w + ( i % 10 == 9 ? '\n' : ' ' );
+	++exact[w];
+    }
+
+    typedef asap::kv_list<std::vector<std::pair<asap::text::short_word, size_t>>,
+			  asap::word_bank_pre_alloc> short_list_type;
+    typedef asap::kv_list<std::vector<std::pair<const char *, size_t>>,
+			  asap::word_bank_pre_alloc> charp_list_type;
+
+    // The tables exceed the budget: counts are spilled and merged
+    {
+	std::vector<char> buf( text.begin(), text.end() );
+	buf.push_back( '\0' );
+	asap::external_counter counter( 0, "/tmp" );
+	size_t nwords = asap::text::external_catalog( buf.data(), text.size(),
+						      counter, 65536 );
+	if( nwords != 1000000 )
+	    fatal( "counted ", nwords, " words" );
+	if( counter.num_runs() < 2 )
+	    fatal( "expected runs, got ", counter.num_runs() );
+	short_list_type list;
+	counter.finish( list );
+	check( list, exact, true );
+    }
+
+    // As above, with words held in the word bank of the list
+    {
+	std::vector<char> buf( text.begin(), text.end() );
+	buf.push_back( '\0' );
+	asap::external_counter counter( 0, "/tmp" );
+	asap::text::external_catalog( buf.data(), text.size(), counter, 65536 );
+	charp_list_type list;
+	counter.finish( list );
+	check( list, exact, true );
+    }
+
+    // The tables fit in the budget: counts are merged in memory. The budget
+    // is split over the workers, so give each worker room for the whole text.
+    {
+	std::vector<char> buf( text.begin(), text.end() );
+	buf.push_back( '\0' );
+	asap::external_counter counter(
+	    ( size_t(1)<<30 ) * __cilkrts_get_nworkers(), "/tmp" );
+	asap::text::external_catalog( buf.data(), text.size(), counter, 65536 );
+	if( counter.num_runs() != 0 )
+	    fatal( "expected no runs, got ", counter.num_runs() );
+	short_list_type list;
+	counter.finish( list );
+	check( list, exact, false );
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <random>
+
+#include "asap/utils.h"
+#include "asap/hashindex.h"
+
+// Few distinct home slots, to create long clusters that wrap around
+struct clustered_hash {
+    size_t operator() ( const std::string & s ) const {
+	size_t h = std::hash<std::string>()( s );
+	return ( h & ~size_t(0xff) ) | ( ( h & 3 ) * 61 );
+    }
+};
+
+template<typename Index>
+void check( const Index & t, const std::vector<std::string> & order,
+	    const std::unordered_map<std::string,size_t> & ref ) {
+    if( t.size() != ref.size() )
+	fatal( "size mismatch: ", t.size(), " vs ", ref.size() );
+    // Iteration follows insertion order
+    size_t n = 0;
+    for( auto I=t.cbegin(), E=t.cend(); I != E; ++I, ++n ) {
+	if( I->first != order[n] || I->second != ref.find( I->first )->second )
+	    fatal( "unexpected element: ", I->first );
+	if( I.hash() != t.hash_function()( I->first ) )
+	    fatal( "wrong stored hash for ", I->first );
+    }
+    for( auto & kv : ref ) {
+	auto F = t.find( kv.first );
+	if( F == t.cend() || F->second != kv.second )
+	    fatal( "element not found: ", kv.first );
+    }
+    if( t.find( std::string( "absent" ) ) != t.cend() )
+	fatal( "found absent element" );
+}
+
+template<typename Hash>
+void test( const char * msg, float max_load, size_t nops, size_t nkeys ) {
+    typedef asap::hash_index<std::string, size_t, Hash> index_type;
+    index_type t( 16, max_load );
+    std::unordered_map<std::string,size_t> ref;
+    std::vector<std::string> order;
+    std::mt19937 rng( 42 );
+
+    for( size_t i=0; i < nops; ++i ) {
+	std::string k = "key" + std::to_string( rng() % nkeys );
+	if( ref.find( k ) == ref.end() )
+	    order.push_back( k );
+	if( rng() % 2 ) {
+	    t[k] += i;
+	    ref[k] += i;
+	} else {
+	    t.insert( std::make_pair( k, i ) );
+	    ref.insert( std::make_pair( k, i ) );
+	}
+	if( float(t.size()) > float(t.capacity()) * max_load )
+	    fatal( "load exceeds ", max_load );
+	if( i % 1000 == 0 )
+	    check( t, order, ref );
+    }
+    check( t, order, ref );
+
+    t.freeze();
+    if( t.capacity() > 8 && float(t.size()) <= float(t.capacity()/2) * max_load )
+	fatal( "freeze did not shrink the index: capacity ", t.capacity() );
+    check( t, order, ref );
+
+    index_type t2;
+    t2.swap( t );
+    check( t2, order, ref );
+    t2.max_load_factor( 0.5f );
+    check( t2, order, ref );
+    t2.reserve( 2*nkeys );
+    check( t2, order, ref );
+
+    std::cout << msg << ": " << t2.size() << " elements, capacity "
+	      << t2.capacity() << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+    std::cout << "==== hash_index: std::hash\n";
+    test<std::hash<std::string>>( "std::hash 0.875", 0.875f, 200000, 5000 );
+    test<std::hash<std::string>>( "std::hash 0.95", 0.95f, 200000, 5000 );
+    std::cout << "==== hash_index: clustered hash\n";
+    test<clustered_hash>( "clustered", 0.875f, 20000, 1000 );
+    return 0;
+}
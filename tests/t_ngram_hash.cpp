@@ -0,0 +1,148 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+
+#include "asap/utils.h"
+#include "asap/data_set.h"
+#include "asap/ngram_hash.h"
+
+static const size_t N = 2;
+typedef asap::hashed_ngram_map<N> map_type;
+
+// The key of words [first,first+N) computed from scratch
+uint64_t direct_key( const std::vector<std::string> & words, size_t first ) {
+    asap::text::rolling_ngram_key<N> key;
+    for( size_t i=first; i < first+N; ++i )
+	key.push( words[i].c_str(), words[i].size() );
+    return key.key();
+}
+
+std::string join( const asap::text::ngram<N> & ng ) {
+    std::string s;
+    for( auto I=ng.cbegin(), E=ng.cend(); I != E; ++I )
+	s += std::string( I == ng.cbegin() ? "" : "#" ) + *I;
+    return s;
+}
+
+void count( const char * text, map_type & catalog, size_t chunk_size ) {
+    std::string t( text );
+    std::shared_ptr<char> buf( new char[t.size()+1],
+			       std::default_delete<char[]>() );
+    memcpy( buf.get(), t.c_str(), t.size()+1 );
+    catalog.enregister( buf );
+    asap::text::hashed_ngram_catalog( buf.get(), t.size(), catalog,
+				      chunk_size );
+}
+
+int main( int argc, char *argv[] ) {
+    // Sliding the window yields the key of the window
+    std::vector<std::string> words
+	= { "a", "quick", "brown", "fox", "jumps", "over", "a", "quick", "dog" };
+    asap::text::rolling_ngram_key<N> key;
+    for( size_t i=0; i < words.size(); ++i ) {
+	bool full = key.push( words[i].c_str(), words[i].size() );
+	if( full != ( i+1 >= N ) )
+	    fatal( "window full after ", i+1, " words" );
+	if( full && key.key() != direct_key( words, i+1-N ) )
+	    fatal( "rolling key differs at word ", i );
+    }
+    if( direct_key( words, 0 ) != direct_key( words, 6 ) )
+	fatal( "equal n-grams have different keys" );
+    if( direct_key( words, 0 ) == direct_key( words, 1 ) )
+	fatal( "distinct n-grams have equal keys" );
+
+    // Counting; chunks of a few bytes exercise the merge of chunk catalogs
+    std::vector<map_type> catalog( 2 );
+    count( "a b c a b c a b", catalog[0], 1<<20 );
+    count( "b c d", catalog[1], 1<<20 );
+    map_type chunked;
+    count( "a b c a b c a b", chunked, 4 );
+
+    std::map<std::string, size_t> expect = { { "A#B", 3 }, { "B#C", 2 },
+					     { "C#A", 2 } };
+    if( catalog[0].size() != expect.size() )
+	fatal( "catalog has ", catalog[0].size(), " n-grams" );
+    for( auto I=catalog[0].cbegin(), E=catalog[0].cend(); I != E; ++I ) {
+	std::string ng = join( I->second.words );
+	if( expect[ng] != I->second.count )
+	    fatal( "count of ", ng, " is ", I->second.count );
+    }
+    if( catalog[0].collisions() != 0 )
+	fatal( "repeated n-grams counted as collisions" );
+
+    // Distinct n-grams forced onto the same key are detected on a hit
+    {
+	map_type forced;
+	asap::text::ngram<N> ab, cd;
+	ab.push_back( "A" );
+	ab.push_back( "B" );
+	cd.push_back( "C" );
+	cd.push_back( "D" );
+	forced.index( 1, ab );
+	forced.index( 1, ab );
+	forced.index( 1, cd );
+	if( forced.size() != 1 || forced.collisions() != 1 )
+	    fatal( "forced collision: ", forced.size(), " n-grams and ",
+		   forced.collisions(), " collisions" );
+    }
+
+    // N-grams do not span chunks, which loses some
+    size_t total = 0;
+    for( auto I=chunked.cbegin(), E=chunked.cend(); I != E; ++I ) {
+	std::string ng = join( I->second.words );
+	if( !expect.count( ng ) || I->second.count > expect[ng] )
+	    fatal( "chunked count of ", ng, " is ", I->second.count );
+	total += I->second.count;
+    }
+    if( total == 0 || total >= 7 || chunked.collisions() != 0 )
+	fatal( "chunked catalog holds ", total, " n-grams" );
+
+    // Document frequencies
+    std::shared_ptr<asap::hashed_ngram_dictionary<N>> dict
+	= std::make_shared<asap::hashed_ngram_dictionary<N>>();
+    {
+	asap::hashed_ngram_dictionary_reducer<N> allngrams;
+	cilk_for( size_t i=0; i < catalog.size(); ++i )
+	    allngrams.count_presence( catalog[i] );
+	dict->swap( allngrams.get_value() );
+    }
+    dict->freeze();
+    // The dictionary holds on to the text after the catalogs are released
+    catalog.clear();
+
+    std::map<std::string, size_t> df = { { "A#B", 1 }, { "B#C", 2 },
+					 { "C#A", 1 }, { "C#D", 1 } };
+    if( dict->size() != df.size() || dict->collisions() != 0 )
+	fatal( "dictionary has ", dict->size(), " n-grams and ",
+	       dict->collisions(), " collisions" );
+    size_t id = 0;
+    for( auto I=dict->cbegin(), E=dict->cend(); I != E; ++I, ++id ) {
+	std::string ng = join( I->first );
+	if( df[ng] != I->second.first || I->second.second != id )
+	    fatal( "n-gram ", ng, " has df ", I->second.first,
+		   " id ", I->second.second );
+    }
+
+    return 0;
+}
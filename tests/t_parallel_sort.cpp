@@ -0,0 +1,94 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+
+#include <cilk/cilk.h>
+
+#include "asap/utils.h"
+#include "asap/parallel_sort.h"
+
+typedef std::pair<std::string, size_t> value_type;
+
+struct cmp_2nd_rev {
+    bool operator() ( const value_type & p1, const value_type & p2 ) const {
+	return p1.second > p2.second;
+    }
+};
+
+std::vector<value_type> make( size_t n, size_t range, unsigned seed ) {
+    std::mt19937 gen( seed );
+    std::uniform_int_distribution<size_t> dist( 0, range-1 );
+    std::vector<value_type> v( n );
+    for( size_t i=0; i < n; ++i ) {
+	size_t c = dist( gen );
+	v[i] = value_type( std::to_string( i ), c );
+    }
+    return v;
+}
+
+void check_sort( size_t n, size_t range ) {
+    std::vector<value_type> v = make( n, range, n );
+    std::vector<value_type> ref = v;
+    asap::parallel_sort( v.begin(), v.end(), cmp_2nd_rev() );
+    std::stable_sort( ref.begin(), ref.end(), cmp_2nd_rev() );
+    for( size_t i=0; i < n; ++i )
+	if( v[i].second != ref[i].second )
+	    fatal( "sort of ", n, " elements differs at ", i );
+    // A permutation of the input
+    std::sort( v.begin(), v.end() );
+    std::sort( ref.begin(), ref.end() );
+    if( v != ref )
+	fatal( "sort of ", n, " elements lost elements" );
+}
+
+void check_top_k( size_t n, size_t k, size_t range ) {
+    std::vector<value_type> v = make( n, range, n+k );
+    std::vector<value_type> ref = v;
+    auto E = asap::parallel_top_k( v.begin(), v.end(), k, cmp_2nd_rev() );
+    std::stable_sort( ref.begin(), ref.end(), cmp_2nd_rev() );
+    if( size_t(E - v.begin()) != std::min( n, k ) )
+	fatal( "top ", k, " of ", n, " returned ", E - v.begin() );
+    for( size_t i=0; i < std::min( n, k ); ++i )
+	if( v[i].second != ref[i].second )
+	    fatal( "top ", k, " of ", n, " differs at ", i );
+    std::sort( v.begin(), v.end() );
+    std::sort( ref.begin(), ref.end() );
+    if( v != ref )
+	fatal( "top ", k, " of ", n, " lost elements" );
+}
+
+int main( int argc, char *argv[] ) {
+    // Sequential and sample sort, with and without many equal keys
+    for( size_t n : { 0, 1, 1000, 100000, 150001 } ) {
+	check_sort( n, 1000000 );
+	check_sort( n, 3 );
+    }
+    check_sort( 100000, 1 );
+
+    for( size_t k : { 0, 1, 10, 1000 } ) {
+	check_top_k( 100, k, 1000 );
+	check_top_k( 200000, k, 1000000 );
+	check_top_k( 200000, k, 5 );
+    }
+    check_top_k( 200000, 200000, 1000 );
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "asap/utils.h"
+#include "asap/perfect_hash.h"
+
+// Only a few distinct hash values, such that some keys collide in every
+// level of the perfect hash function
+struct colliding_hash {
+    size_t operator() ( const std::string & s ) const {
+	return std::hash<std::string>()( s ) % 64;
+    }
+};
+
+template<typename Hash>
+void test( const char * msg, size_t n ) {
+    typedef asap::perfect_hash_map<std::string, size_t, Hash> map_type;
+    std::vector<std::pair<std::string, size_t>> kv;
+    for( size_t i=0; i < n; ++i )
+	kv.push_back( std::make_pair( "key" + std::to_string( i ), i ) );
+
+    map_type m( kv.begin(), kv.end() );
+    if( m.size() != n )
+	fatal( "size mismatch: ", m.size(), " vs ", n );
+
+    std::vector<bool> seen( n, false );
+    for( auto I=m.cbegin(), E=m.cend(); I != E; ++I ) {
+	if( I->first != "key" + std::to_string( I->second ) )
+	    fatal( "key and value mismatch: ", I->first );
+	if( seen[I->second] )
+	    fatal( "duplicate element: ", I->first );
+	seen[I->second] = true;
+    }
+
+    for( auto & p : kv ) {
+	auto F = m.find( p.first );
+	if( F == m.cend() || F->second != p.second )
+	    fatal( "element not found: ", p.first );
+	if( m.find( p.first, m.hash_function()( p.first ) ) != F )
+	    fatal( "lookup with known hash differs: ", p.first );
+    }
+    for( size_t i=0; i < n; ++i )
+	if( m.find( "absent" + std::to_string( i ) ) != m.cend() )
+	    fatal( "found absent key ", i );
+
+    map_type m2;
+    m2.swap( m );
+    if( !m.empty() || m2.size() != n
+	|| ( n > 0 && m2.find( kv[n/2].first ) == m2.cend() ) )
+	fatal( "swap failed" );
+
+    std::cout << msg << ": " << n << " keys ok" << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+    std::cout << "==== perfect_hash_map: std::hash\n";
+    test<std::hash<std::string>>( "std::hash", 100000 );
+    test<std::hash<std::string>>( "std::hash", 1 );
+    test<std::hash<std::string>>( "std::hash", 0 );
+    std::cout << "==== perfect_hash_map: colliding hash\n";
+    test<colliding_hash>( "colliding", 1000 );
+    return 0;
+}
@@ -0,0 +1,148 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+
+#include <cilk/cilk.h>
+#include <cilk/reducer.h>
+#include <cilk/reducer_opadd.h>
+
+#include "asap/utils.h"
+#include "asap/data_set.h"
+#include "asap/sketch.h"
+
+// Word i, spelled in upper-case letters as the tokenizer keeps only those
+std::string word( size_t i ) {
+    std::string w( "W" );
+    do {
+	w += char( 'A' + i % 26 );
+	i /= 26;
+    } while( i != 0 );
+    return w;
+}
+
+// A stream of words, where word i occurs with probability ~ 1/(i+1)
+std::vector<std::string> zipf( size_t n, size_t vocab, unsigned seed ) {
+    std::vector<double> w( vocab );
+    for( size_t i=0; i < vocab; ++i )
+	w[i] = 1.0 / double(i+1);
+    std::mt19937 gen( seed );
+    std::discrete_distribution<size_t> dist( w.begin(), w.end() );
+    std::vector<std::string> s( n );
+    for( size_t i=0; i < n; ++i )
+	s[i] = word( dist( gen ) );
+    return s;
+}
+
+void check_summary( const asap::space_saving & ss,
+		    std::map<std::string, uint64_t> & exact ) {
+    for( const auto & e : ss.top() ) {
+	if( ss.find( e.hash ) == nullptr )
+	    fatal( "monitored word not found: ", e.word );
+	uint64_t c = exact[e.word];
+	if( c > e.count || c < e.count - e.error )
+	    fatal( "count of ", e.word, " is ", c, " not in [",
+		   e.count - e.error, ",", e.count, "]" );
+    }
+    for( const auto & x : exact ) {
+	uint64_t h = asap::text::word_hash( x.first.c_str(), x.first.size() );
+	if( !ss.find( h ) && x.second > ss.min_count() )
+	    fatal( "unmonitored word ", x.first, " occurs ", x.second,
+		   " times, more than ", ss.min_count() );
+    }
+}
+
+int main( int argc, char *argv[] ) {
+    std::vector<std::string> a = zipf( 50000, 5000, 1 );
+    std::vector<std::string> b = zipf( 50000, 5000, 2 );
+    std::map<std::string, uint64_t> exact_a, exact;
+    for( const std::string & w : a )
+	++exact_a[w];
+    exact = exact_a;
+    for( const std::string & w : b )
+	++exact[w];
+
+    // Count-min sketch: no underestimates, overestimates within the bound
+    asap::count_min_sketch sa( 1024, 4 ), sb( 1024, 4 );
+    for( const std::string & w : a )
+	sa.add( asap::text::word_hash( w.c_str(), w.size() ) );
+    for( const std::string & w : b )
+	sb.add( asap::text::word_hash( w.c_str(), w.size() ) );
+    sa.merge( sb );
+    if( sa.total() != a.size() + b.size() )
+	fatal( "sketch total ", sa.total() );
+    size_t over = 0;
+    for( const auto & x : exact ) {
+	uint64_t e = sa.estimate(
+	    asap::text::word_hash( x.first.c_str(), x.first.size() ) );
+	if( e < x.second )
+	    fatal( "sketch underestimates ", x.first );
+	if( e > x.second + sa.error_bound() )
+	    ++over;
+    }
+    if( over > exact.size() * 0.1 )
+	fatal( over, " estimates exceed the error bound" );
+
+    // Space-saving: exact when all words fit, bounded otherwise
+    asap::space_saving all( 10000 ), ssa( 200 ), ssb( 200 );
+    for( const std::string & w : a ) {
+	uint64_t h = asap::text::word_hash( w.c_str(), w.size() );
+	all.offer( h, w.c_str(), w.size() );
+	ssa.offer( h, w.c_str(), w.size() );
+    }
+    for( const auto & e : all.top() )
+	if( e.error != 0 || e.count != exact_a[e.word] )
+	    fatal( "count of ", e.word, " is ", e.count );
+    check_summary( ssa, exact_a );
+    for( const std::string & w : b )
+	ssb.offer( asap::text::word_hash( w.c_str(), w.size() ),
+		   w.c_str(), w.size() );
+    ssa.merge( ssb );
+    if( ssa.size() != 200 )
+	fatal( "merged summary holds ", ssa.size(), " words" );
+    check_summary( ssa, exact );
+
+    // Approximate counter over text; the most frequent words are found
+    std::string text;
+    for( const std::string & w : a )
+	text += w + ' ';
+    std::vector<char> buf( text.begin(), text.end() );
+    buf.push_back( '\0' );
+    asap::approximate_counter counter( 1<<16, 100 );
+    size_t nwords = asap::text::approximate_catalog( buf.data(), text.size(),
+						     counter, 4096 );
+    if( nwords != a.size() )
+	fatal( "counted ", nwords, " words" );
+    counter.combine();
+    std::vector<asap::approximate_counter::estimate> hh
+	= counter.heavy_hitters( 5 );
+    if( hh.size() != 5 )
+	fatal( "found ", hh.size(), " heavy hitters" );
+    for( size_t i=0; i < hh.size(); ++i ) {
+	uint64_t c = exact_a[word( i )];
+	if( hh[i].word != word( i )
+	    || c > hh[i].upper || c < hh[i].lower )
+	    fatal( "heavy hitter ", i, " is ", hh[i].word, " with ",
+		   hh[i].upper, " expected ", c );
+    }
+
+    return 0;
+}
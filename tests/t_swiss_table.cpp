@@ -0,0 +1,103 @@
+/* -*-C++-*- */
+/*
+ * Copyright 2016 EU Project ASAP 619706.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <random>
+
+#include "asap/utils.h"
+#include "asap/swisstable.h"
+
+// Few distinct home slots, to create long clusters that wrap around
+struct clustered_hash {
+    size_t operator() ( const std::string & s ) const {
+	size_t h = std::hash<std::string>()( s );
+	return ( h & ~size_t(0xff) ) | ( ( h & 3 ) * 61 );
+    }
+};
+
+template<typename Table>
+void check( const Table & t,
+	    const std::unordered_map<std::string,std::string> & ref ) {
+    if( t.size() != ref.size() )
+	fatal( "size mismatch: ", t.size(), " vs ", ref.size() );
+    size_t n = 0;
+    for( auto I=t.cbegin(), E=t.cend(); I != E; ++I, ++n ) {
+	auto F = ref.find( I->first );
+	if( F == ref.end() || F->second != I->second )
+	    fatal( "unexpected element: ", I->first );
+    }
+    if( n != ref.size() )
+	fatal( "iteration visits ", n, " elements, expected ", ref.size() );
+    for( auto & kv : ref ) {
+	auto F = t.find( kv.first );
+	if( F == t.cend() || F->second != kv.second )
+	    fatal( "element not found: ", kv.first );
+    }
+}
+
+template<typename Hash>
+void test( const char * msg, size_t nops, size_t nkeys ) {
+    typedef asap::swiss_table<std::string, std::string, Hash> table_type;
+    table_type t( 16 );
+    std::unordered_map<std::string,std::string> ref;
+    std::mt19937 rng( 42 );
+
+    for( size_t i=0; i < nops; ++i ) {
+	std::string k = "key" + std::to_string( rng() % nkeys );
+	switch( rng() % 4 ) {
+	case 0:
+	case 1:
+	    t[k] += "x";
+	    ref[k] += "x";
+	    break;
+	case 2:
+	    t.insert( std::make_pair( k, std::string( "i" ) ) );
+	    ref.insert( std::make_pair( k, std::string( "i" ) ) );
+	    break;
+	case 3:
+	    if( t.erase( k ) != ref.erase( k ) )
+		fatal( "erase mismatch on ", k );
+	    break;
+	}
+	if( i % 1000 == 0 )
+	    check( t, ref );
+    }
+    check( t, ref );
+
+    table_type t2( t );
+    check( t2, ref );
+    t.clear();
+    if( t.size() != 0 || t.cbegin() != t.cend() )
+	fatal( "table not empty after clear" );
+    t = std::move( t2 );
+    check( t, ref );
+    t.rehash( 16 );
+    check( t, ref );
+
+    std::cout << msg << ": " << t.size() << " elements, capacity "
+	      << t.capacity() << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+    std::cout << "==== swiss_table: std::hash\n";
+    test<std::hash<std::string>>( "std::hash", 200000, 5000 );
+    std::cout << "==== swiss_table: clustered hash\n";
+    test<clustered_hash>( "clustered", 50000, 1000 );
+    return 0;
+}